@@ -0,0 +1,265 @@
+/** apic.c
+ * driver for the local APIC (one per cpu) and the I/O APIC
+*/
+
+#include "apic.h"
+#include "lib.h"
+#include "pit.h"
+#include "scheduler.h"
+
+#define CALIBRATE_US        10000       // how long to count the timer against the pit for
+
+static volatile uint32_t* lapic;        // this cpu's local APIC, same address on every cpu
+static volatile uint32_t* ioapic;
+static uint32_t lapic_per_us;           // timer counts per microsecond, divided by 16
+
+int lapic_timer_on;
+int lapic_tsc_deadline;
+
+#define LAPIC_REG(off)      lapic[(off) / 4]
+
+
+/** apic_set_base
+ * DESCRIPTION: set where the local APIC and I/O APIC registers are
+ * INPUTS: lapic_base, ioapic_base - addresses from the MP table, mapped uncached
+ * OUTPUTS: none
+*/
+void apic_set_base(uint32_t lapic_base, uint32_t ioapic_base)
+{
+    lapic  = (volatile uint32_t*)lapic_base;
+    ioapic = (volatile uint32_t*)ioapic_base;
+}
+
+
+/** lapic_init
+ * DESCRIPTION: enable this cpu's local APIC
+ * INPUTS: bsp - 1 on the boot processor
+ * OUTPUTS: none
+ * SIDE EFFECTS: the boot processor's LINT0 takes the PIC's interrupts (ExtINT) and LINT1 NMIs.
+ *               APs mask both, they only get IPIs. the timer and error LVTs are masked
+*/
+void lapic_init(int bsp)
+{
+    LAPIC_REG(LAPIC_SVR) = LAPIC_ENABLE | APIC_SPURIOUS_VECTOR;
+    LAPIC_REG(LAPIC_LVT_TIMER) = LVT_MASKED;
+    LAPIC_REG(LAPIC_LVT_ERROR) = LVT_MASKED;
+    if (bsp)
+    {
+        LAPIC_REG(LAPIC_LVT_LINT0) = LVT_EXTINT;
+        LAPIC_REG(LAPIC_LVT_LINT1) = LVT_NMI;
+    }
+    else
+    {
+        LAPIC_REG(LAPIC_LVT_LINT0) = LVT_MASKED;
+        LAPIC_REG(LAPIC_LVT_LINT1) = LVT_MASKED;
+    }
+
+    // the ESR latches errors, clear it with back to back writes
+    LAPIC_REG(LAPIC_ESR) = 0;
+    LAPIC_REG(LAPIC_ESR) = 0;
+    LAPIC_REG(LAPIC_EOI) = 0;
+    LAPIC_REG(LAPIC_TPR) = 0;
+}
+
+
+/** lapic_id
+ * DESCRIPTION: this cpu's APIC id
+ * INPUTS: none
+ * OUTPUTS: the id, 0 if there's no local APIC
+*/
+uint32_t lapic_id(void)
+{
+    if (lapic == NULL)
+    {
+        return 0;
+    }
+    return LAPIC_REG(LAPIC_ID) >> ICR_DEST_SHIFT;
+}
+
+
+/** lapic_eoi
+ * DESCRIPTION: acknowledge an interrupt the local APIC delivered (IPIs, not PIC interrupts)
+ * INPUTS: none
+ * OUTPUTS: none
+*/
+void lapic_eoi(void)
+{
+    LAPIC_REG(LAPIC_EOI) = 0;
+}
+
+
+/** lapic_send_ipi
+ * DESCRIPTION: interrupt another cpu
+ * INPUTS: apic_id - destination cpu
+ *         low - ICR low word: ICR_FIXED | vector, ICR_INIT, or ICR_STARTUP | page
+ * OUTPUTS: none
+ * SIDE EFFECTS: waits for the previous IPI to have gone out first
+*/
+void lapic_send_ipi(uint32_t apic_id, uint32_t low)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    while (LAPIC_REG(LAPIC_ICR_LO) & ICR_PENDING);
+    LAPIC_REG(LAPIC_ICR_HI) = apic_id << ICR_DEST_SHIFT;
+    LAPIC_REG(LAPIC_ICR_LO) = low;      // writing the low word sends it
+    restore_flags(flags);
+}
+
+
+/** ioapic_init
+ * DESCRIPTION: mask every I/O APIC redirection entry
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: none if there's no I/O APIC
+*/
+void ioapic_init(void)
+{
+    uint32_t max, i;
+
+    if (ioapic == NULL)
+    {
+        return;
+    }
+    ioapic[IOAPIC_REGSEL / 4] = IOAPIC_REG_VER;
+    max = (ioapic[IOAPIC_WIN / 4] >> 16) & 0xFF;
+    for (i = 0; i <= max; i++)
+    {
+        ioapic[IOAPIC_REGSEL / 4] = IOAPIC_REDTBL(i);
+        ioapic[IOAPIC_WIN / 4] = LVT_MASKED;
+    }
+}
+
+
+/** apic_spurious
+ * DESCRIPTION: spurious local APIC interrupt, nothing to acknowledge
+ * INPUTS: none
+ * OUTPUTS: none
+*/
+void apic_spurious(void)
+{
+    return;
+}
+
+
+/** lapic_detect
+ * DESCRIPTION: checks for a local APIC and finds its registers, for when there's no MP table
+ * INPUTS: none
+ * OUTPUTS: physical base of the registers, 0 if the cpu has no local APIC
+*/
+uint32_t lapic_detect(void)
+{
+    uint32_t a, b, c, d;
+
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & CPUID_EDX_APIC))
+    {
+        return 0;
+    }
+    return (uint32_t)rdmsr(MSR_APIC_BASE) & APIC_BASE_MASK;
+}
+
+
+/** lapic_timer_init
+ * DESCRIPTION: set up this cpu's local APIC timer as its scheduler clock: TSC-deadline mode if
+ *              the cpu has it, one shot counting otherwise. The boot processor measures the one
+ *              shot rate against the pit, the APs share its bus clock
+ * INPUTS: bsp - 1 on the boot processor
+ * OUTPUTS: none
+ * SIDE EFFECTS: the timer is left stopped. turns lapic_timer_on on, from the boot processor
+*/
+void lapic_timer_init(int bsp)
+{
+    uint32_t a, b, c, d;
+
+    if (lapic == NULL || (!bsp && !lapic_timer_on))
+    {
+        return;
+    }
+    if (bsp)
+    {
+        cpuid(1, &a, &b, &c, &d);
+        lapic_tsc_deadline = (c & CPUID_ECX_DEADLINE) != 0;
+
+        LAPIC_REG(LAPIC_TIMER_DCR) = TIMER_DIV_16;
+        LAPIC_REG(LAPIC_LVT_TIMER) = LVT_MASKED | LVT_TIMER_ONESHOT;
+        LAPIC_REG(LAPIC_TIMER_ICR) = 0xFFFFFFFF;
+        pit_delay_us(CALIBRATE_US);
+        lapic_per_us = (0xFFFFFFFF - LAPIC_REG(LAPIC_TIMER_CCR)) / CALIBRATE_US;
+        LAPIC_REG(LAPIC_TIMER_ICR) = 0;
+        if (lapic_per_us == 0 && !lapic_tsc_deadline)
+        {
+            return;             // not counting, stay on the pit
+        }
+    }
+
+    if (lapic_tsc_deadline)
+    {
+        LAPIC_REG(LAPIC_LVT_TIMER) = LVT_TIMER_DEADLINE | APIC_TIMER_VECTOR;
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    }
+    else
+    {
+        LAPIC_REG(LAPIC_TIMER_DCR) = TIMER_DIV_16;
+        LAPIC_REG(LAPIC_LVT_TIMER) = LVT_TIMER_ONESHOT | APIC_TIMER_VECTOR;
+        LAPIC_REG(LAPIC_TIMER_ICR) = 0;
+    }
+    if (bsp)
+    {
+        lapic_timer_on = 1;
+    }
+}
+
+
+/** lapic_timer_arm
+ * DESCRIPTION: have this cpu's timer interrupt once, us microseconds from now
+ * INPUTS: us - microseconds, at least 1
+ * OUTPUTS: none
+ * SIDE EFFECTS: replaces the pending interrupt, if there is one
+*/
+void lapic_timer_arm(uint32_t us)
+{
+    if (us == 0)
+    {
+        us = 1;
+    }
+    if (lapic_tsc_deadline)
+    {
+        wrmsr(MSR_TSC_DEADLINE, rdtsc() + (uint64_t)us * tsc_per_us);
+    }
+    else
+    {
+        LAPIC_REG(LAPIC_TIMER_ICR) = us * lapic_per_us;
+    }
+}
+
+
+/** lapic_timer_stop
+ * DESCRIPTION: cancel this cpu's pending timer interrupt
+ * INPUTS: none
+ * OUTPUTS: none
+*/
+void lapic_timer_stop(void)
+{
+    if (lapic_tsc_deadline)
+    {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    }
+    else
+    {
+        LAPIC_REG(LAPIC_TIMER_ICR) = 0;
+    }
+}
+
+
+/** lapic_timer_handler
+ * DESCRIPTION: this cpu's timer ran out, it's a scheduler tick
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: may switch processes
+*/
+void lapic_timer_handler(void)
+{
+    lapic_eoi();
+    sched_tick();
+}
@@ -0,0 +1,121 @@
+/** apic.h
+ * driver for the local APIC (one per cpu) and the I/O APIC
+*/
+
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "types.h"
+
+/** BACKGROUND:
+ *  - Every cpu has a local APIC, memory mapped at the same physical address on all of them (each
+ *    cpu sees its own). It takes interrupts for its cpu and is how cpus interrupt each other:
+ *    writing the interrupt command register (ICR) sends an inter-processor interrupt (IPI).
+ *  - Application processors (every cpu but the one the BIOS booted) sit halted after reset until
+ *    the boot processor sends them INIT, then a STARTUP IPI twice. STARTUP carries a page number
+ *    below 1MB, the AP starts in real mode at that page.
+ *  - Device interrupts still come from the 8259 PIC: the boot processor's LINT0 is put in ExtINT
+ *    mode (virtual wire), so the PIC's INTR line reaches it just like without an APIC, and EOIs
+ *    still go to the PIC. Every I/O APIC entry is masked, nothing is routed through it.
+ *  - Interrupts a local APIC delivers itself (IPIs, its timer) need a write to its EOI register
+ *    instead.
+ *  - Each local APIC has a timer of its own, which is the scheduler's clock on every cpu. It
+ *    counts down at the bus clock (over a divider), which isn't known, so the boot processor
+ *    counts it against the pit once at boot. Where the cpu supports it the timer runs in
+ *    TSC-deadline mode instead: it fires when the tsc reaches the value written to an MSR, so
+ *    arming it is one wrmsr of an absolute time and needs no calibration of its own. Either way
+ *    arming takes no port I/O.
+ */
+#define LAPIC_DEFAULT_BASE  0xFEE00000
+#define IOAPIC_DEFAULT_BASE 0xFEC00000
+
+/* local APIC registers, byte offsets from the base */
+#define LAPIC_ID            0x020
+#define LAPIC_VER           0x030
+#define LAPIC_TPR           0x080       // task priority, 0 takes everything
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0       // spurious vector, bit 8 enables the APIC
+#define LAPIC_ESR           0x280       // error status
+#define LAPIC_ICR_LO        0x300
+#define LAPIC_ICR_HI        0x310       // destination APIC id in bits 24-31
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_ICR     0x380       // initial count, writing it starts the timer
+#define LAPIC_TIMER_CCR     0x390       // current count
+#define LAPIC_TIMER_DCR     0x3E0       // divide configuration
+
+#define LAPIC_ENABLE        0x100
+#define LVT_MASKED          0x10000
+#define LVT_EXTINT          0x700
+#define LVT_NMI             0x400
+#define LVT_TIMER_ONESHOT   0x00000
+#define LVT_TIMER_DEADLINE  0x40000
+
+#define TIMER_DIV_16        0x3
+#define MSR_APIC_BASE       0x1B
+#define MSR_TSC_DEADLINE    0x6E0
+#define APIC_BASE_MASK      0xFFFFF000
+#define CPUID_EDX_APIC      (1 << 9)    // leaf 1
+#define CPUID_ECX_DEADLINE  (1 << 24)   // leaf 1
+
+/* ICR low word: delivery mode, level, trigger. bit 12 is set while the last IPI is still going out */
+#define ICR_FIXED           0x4000      // fixed, assert
+#define ICR_INIT            0x4500      // INIT, assert
+#define ICR_STARTUP         0x4600      // STARTUP, vector field = start page
+#define ICR_PENDING         0x1000
+#define ICR_DEST_SHIFT      24
+
+/* I/O APIC: index register, data window, and the registers behind them */
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WIN          0x10
+#define IOAPIC_REG_VER      0x01        // max redirection entry in bits 16-23
+#define IOAPIC_REDTBL(n)    (0x10 + 2 * (n))
+
+#define APIC_SPURIOUS_VECTOR    0xFF
+#define APIC_TIMER_VECTOR       0xEF
+
+#ifndef ASM
+
+/* point the drivers at the APICs, the addresses must already be mapped */
+void apic_set_base(uint32_t lapic, uint32_t ioapic);
+
+/* enable this cpu's local APIC. the boot processor keeps taking PIC interrupts through LINT0 */
+void lapic_init(int bsp);
+
+/* this cpu's APIC id */
+uint32_t lapic_id(void);
+
+/* acknowledge an interrupt the local APIC delivered */
+void lapic_eoi(void);
+
+/* send an IPI. low is one of the ICR_ modes or'd with the vector */
+void lapic_send_ipi(uint32_t apic_id, uint32_t low);
+
+/* mask every I/O APIC entry, legacy IRQs stay on the PIC */
+void ioapic_init(void);
+
+/* spurious local APIC interrupts, no EOI */
+void apic_spurious(void);
+
+/* 1 once the timer has been set up, the scheduler uses it from then on instead of the pit */
+extern int lapic_timer_on;
+extern int lapic_tsc_deadline;          /* 1 if it runs in TSC-deadline mode */
+
+/* this cpu's local APIC base from its MSR, 0 if the cpu has none */
+uint32_t lapic_detect(void);
+
+/* set up this cpu's timer. the boot processor measures its rate first */
+void lapic_timer_init(int bsp);
+
+/* one interrupt us microseconds from now, replacing any pending one / cancel it */
+void lapic_timer_arm(uint32_t us);
+void lapic_timer_stop(void);
+
+/* timer interrupt */
+void lapic_timer_handler(void);
+
+#endif /* ASM */
+
+#endif /* _APIC_H */
@@ -4,6 +4,8 @@
 #include "speaker.h"
 #include "pit.h"
 
+spinlock_t gfx_lock = SPINLOCK_INIT("gfx");
+
 int xres = 640;
 int yres = 480;
 int cur_bank = 0;
@@ -2259,7 +2261,10 @@ void runTerminal()
     register uint32_t term_esp asm("esp");
     cur_term_esp;
     cur_term_ebp;
-    while(term_flag){;}
+    while(term_flag)
+    {
+        idle_wait();    // the mouse handler clears term_flag, no point spinning until then
+    }
     // term_flag = 0;
     renderDesktop();
     desktopflag = 1;
@@ -2859,6 +2864,8 @@ void runGUI()
             
         }
 
+        // clicks only change on a mouse interrupt, sleep until the next one
+        idle_wait();
     }
 }
 
@@ -1,4 +1,5 @@
 #include "lib.h"
+#include "spinlock.h"
 
 #define VBE_DISPI_IOPORT_INDEX  0x01CE
 #define VBE_DISPI_IOPORT_DATA   0x01CF
@@ -53,6 +54,9 @@ int lockscreen_flag;
 
 int stop_pressed;
 
+/* the screen and the console cursor positions */
+extern spinlock_t gfx_lock;
+
 uint16_t isBGAAvailable();
 void BgaWriteRegister(unsigned short IndexValue, unsigned short DataValue);
 unsigned short BgaReadRegister(unsigned short IndexValue);
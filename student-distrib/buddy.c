@@ -0,0 +1,355 @@
+/** buddy.c
+ *  Buddy allocator for physical page frames, fed from the multiboot memory map
+*/
+
+#include "buddy.h"
+#include "lib.h"
+#include "spinlock.h"
+
+#define BITS_PER_WORD       32
+#define WORD_SHIFT          5
+#define WORD_MASK           (BITS_PER_WORD - 1)
+
+/* one bitmap per order, order k has MAX_FRAMES >> k bits. Summed over all orders this is < 2 * MAX_FRAMES bits */
+#define BITMAP_WORDS        (2 * (MAX_FRAMES / BITS_PER_WORD))
+
+#define BLOCKS(order)       (MAX_FRAMES >> (order))
+#define WORDS(order)        ((BLOCKS(order) + WORD_MASK) >> WORD_SHIFT)
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+static uint32_t free_map[BITMAP_WORDS];                 // the bitmaps for all orders, back to back
+static uint32_t map_offset[MAX_ORDER + 1];              // start of each order's bitmap in free_map
+static uint32_t free_count[MAX_ORDER + 1];              // free blocks per order
+static uint32_t scan_hint[MAX_ORDER + 1];               // word to resume scanning from, per order
+static uint32_t total_frames;
+static uint32_t free_frames;
+
+static uint32_t reserved_base[MAX_RESERVED];
+static uint32_t reserved_end[MAX_RESERVED];
+static uint32_t num_reserved;
+
+static spinlock_t buddy_lock = SPINLOCK_INIT("buddy");      // the bitmaps and counts
+/*************************************************************************/
+
+
+/** test_block / set_block / clear_block
+ * DESCRIPTION: bitmap helpers. idx is the block index within the order (pfn >> order)
+*/
+static inline int test_block(uint32_t order, uint32_t idx)
+{
+    return (free_map[map_offset[order] + (idx >> WORD_SHIFT)] >> (idx & WORD_MASK)) & 1;
+}
+
+static inline void set_block(uint32_t order, uint32_t idx)
+{
+    free_map[map_offset[order] + (idx >> WORD_SHIFT)] |= (1 << (idx & WORD_MASK));
+    free_count[order]++;
+}
+
+static inline void clear_block(uint32_t order, uint32_t idx)
+{
+    free_map[map_offset[order] + (idx >> WORD_SHIFT)] &= ~(1 << (idx & WORD_MASK));
+    free_count[order]--;
+}
+
+
+/** find_free_block
+ * DESCRIPTION: find a free block of exactly the given order. Starts at the
+ *              order's scan hint so repeated allocations don't rescan full words.
+ * INPUTS: order - the order to search, must have free_count[order] > 0
+ * OUTPUTS: the block index within the order
+ * SIDE EFFECTS: updates the scan hint
+*/
+static uint32_t find_free_block(uint32_t order)
+{
+    uint32_t  words = WORDS(order);
+    uint32_t* map   = &free_map[map_offset[order]];
+    uint32_t  w     = scan_hint[order];
+    uint32_t  i;
+
+    for (i = 0; i < words; i++)
+    {
+        if (map[w] != 0)
+        {
+            scan_hint[order] = w;
+            return (w << WORD_SHIFT) + find_first_set(map[w]);
+        }
+        w++;
+        if (w == words)
+        {
+            w = 0;
+        }
+    }
+
+    /* free_count said there was a block, so this is never reached */
+    return 0;
+}
+
+
+/** free_block
+ * DESCRIPTION: return a block to the allocator, merging it with its buddy for as long as possible
+ * INPUTS: pfn - first frame of the block
+ *         order - order of the block
+ * OUTPUTS: none
+ * SIDE EFFECTS: modifies the bitmaps. caller must hold buddy_lock.
+*/
+static void free_block(uint32_t pfn, uint32_t order)
+{
+    uint32_t idx = pfn >> order;
+
+    while (order < MAX_ORDER && test_block(order, idx ^ 1))
+    {
+        clear_block(order, idx ^ 1);
+        idx >>= 1;
+        order++;
+    }
+    set_block(order, idx);
+}
+
+
+/** buddy_init
+ * DESCRIPTION: set up an empty allocator. Regions are added with buddy_add_region.
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: clears all bitmaps and reserved ranges
+*/
+void buddy_init(void)
+{
+    uint32_t order;
+    uint32_t offset = 0;
+
+    for (order = 0; order <= MAX_ORDER; order++)
+    {
+        map_offset[order] = offset;
+        offset += WORDS(order);
+        free_count[order] = 0;
+        scan_hint[order] = 0;
+    }
+    memset(free_map, 0, sizeof(free_map));
+
+    total_frames = 0;
+    free_frames  = 0;
+    num_reserved = 0;
+}
+
+
+/** buddy_reserve_region
+ * DESCRIPTION: keep a range of physical memory out of the allocator. Must be called before the
+ *              region that contains it is added (multiboot modules are parsed before the mmap).
+ * INPUTS: base - start of the range
+ *         length - length of the range in bytes
+ * OUTPUTS: none
+ * SIDE EFFECTS: records the range
+*/
+void buddy_reserve_region(uint32_t base, uint32_t length)
+{
+    if (num_reserved == MAX_RESERVED || length == 0)
+    {
+        return;
+    }
+
+    /* round outwards to whole frames */
+    reserved_base[num_reserved] = base & ~(FRAME_SIZE - 1);
+    reserved_end[num_reserved]  = (base + length + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+    num_reserved++;
+}
+
+
+/** add_frames
+ * DESCRIPTION: free every frame in [start, end) as the largest aligned blocks that fit
+ * INPUTS: start, end - frame numbers
+*/
+static void add_frames(uint32_t start, uint32_t end)
+{
+    uint32_t order;
+
+    while (start < end)
+    {
+        order = MAX_ORDER;
+        while ((start & ((1 << order) - 1)) || (start + (1 << order) > end))
+        {
+            order--;
+        }
+        free_block(start, order);
+        total_frames += (1 << order);
+        free_frames  += (1 << order);
+        start += (1 << order);
+    }
+}
+
+
+/** buddy_add_region
+ * DESCRIPTION: hand a range of usable RAM to the allocator. The range is clipped to
+ *              [BUDDY_BASE, MAX_PHYS_MEM) and any reserved ranges are cut out of it.
+ * INPUTS: base - physical start address
+ *         length - length in bytes
+ * OUTPUTS: none
+ * SIDE EFFECTS: frames in the region become allocatable
+*/
+void buddy_add_region(uint32_t base, uint32_t length)
+{
+    uint32_t start, end, i;
+    uint32_t flags;
+
+    /* clip, careful about wrapping past 4GB */
+    end = (base + length < base || base + length > MAX_PHYS_MEM) ? MAX_PHYS_MEM : base + length;
+    start = (base < BUDDY_BASE) ? BUDDY_BASE : base;
+    if (start >= end)
+    {
+        return;
+    }
+
+    /* only whole frames */
+    start = (start + FRAME_SIZE - 1) >> FRAME_SHIFT;
+    end   = end >> FRAME_SHIFT;
+
+    spin_lock_irqsave(&buddy_lock, flags);
+    while (start < end)
+    {
+        /* find the closest reserved range that overlaps what's left */
+        uint32_t cut_start = end;
+        uint32_t cut_end   = end;
+        for (i = 0; i < num_reserved; i++)
+        {
+            uint32_t r_start = reserved_base[i] >> FRAME_SHIFT;
+            uint32_t r_end   = reserved_end[i] >> FRAME_SHIFT;
+            if (r_end > start && r_start < cut_start)
+            {
+                cut_start = (r_start < start) ? start : r_start;
+                cut_end   = r_end;
+            }
+        }
+
+        add_frames(start, cut_start);
+        start = (cut_end > cut_start) ? cut_end : cut_start;
+    }
+    spin_unlock_irqrestore(&buddy_lock, flags);
+}
+
+
+/** frame_alloc
+ * DESCRIPTION: allocate 2^order physically contiguous, naturally aligned frames
+ * INPUTS: order - 0 for a 4KB page up to MAX_ORDER for a 4MB page
+ * OUTPUTS: physical address of the block, 0 if out of memory
+ * SIDE EFFECTS: larger blocks are split and their unused halves stay free
+*/
+uint32_t frame_alloc(uint32_t order)
+{
+    uint32_t k, idx;
+    uint32_t flags;
+
+    if (order > MAX_ORDER)
+    {
+        return 0;
+    }
+
+    spin_lock_irqsave(&buddy_lock, flags);
+
+    /* smallest order that has something free */
+    for (k = order; k <= MAX_ORDER && free_count[k] == 0; k++);
+    if (k > MAX_ORDER)
+    {
+        spin_unlock_irqrestore(&buddy_lock, flags);
+        return 0;
+    }
+
+    idx = find_free_block(k);
+    clear_block(k, idx);
+
+    /* split down, keeping the lower half and freeing the upper half at each step */
+    while (k > order)
+    {
+        k--;
+        idx <<= 1;
+        set_block(k, idx | 1);
+    }
+
+    free_frames -= (1 << order);
+    spin_unlock_irqrestore(&buddy_lock, flags);
+
+    return (idx << order) << FRAME_SHIFT;
+}
+
+
+/** frame_free
+ * DESCRIPTION: return a block from frame_alloc
+ * INPUTS: addr - physical address returned by frame_alloc
+ *         order - the order it was allocated with
+ * OUTPUTS: none
+ * SIDE EFFECTS: the block is merged with free buddies
+*/
+void frame_free(uint32_t addr, uint32_t order)
+{
+    uint32_t flags;
+
+    if (addr == 0 || order > MAX_ORDER)
+    {
+        return;
+    }
+
+    spin_lock_irqsave(&buddy_lock, flags);
+    free_block(addr >> FRAME_SHIFT, order);
+    free_frames += (1 << order);
+    spin_unlock_irqrestore(&buddy_lock, flags);
+}
+
+
+/** page_alloc
+ * DESCRIPTION: allocate a single 4KB frame. Checks the order 0 bitmap word under the scan
+ *              hint first, so back to back single page allocations are one load + bsf.
+ * INPUTS: none
+ * OUTPUTS: physical address of the page, 0 if out of memory
+ * SIDE EFFECTS: none
+*/
+uint32_t page_alloc(void)
+{
+    uint32_t  flags;
+    uint32_t* word;
+    uint32_t  bit;
+
+    spin_lock_irqsave(&buddy_lock, flags);
+    word = &free_map[map_offset[0] + scan_hint[0]];
+    if (*word != 0)
+    {
+        bit = find_first_set(*word);
+        *word &= ~(1 << bit);
+        free_count[0]--;
+        free_frames--;
+        spin_unlock_irqrestore(&buddy_lock, flags);
+        return ((scan_hint[0] << WORD_SHIFT) + bit) << FRAME_SHIFT;
+    }
+    spin_unlock_irqrestore(&buddy_lock, flags);
+
+    return frame_alloc(0);
+}
+
+
+/** page_free
+ * DESCRIPTION: free a single 4KB frame
+ * INPUTS: addr - physical address from page_alloc
+ * OUTPUTS: none
+ * SIDE EFFECTS: none
+*/
+void page_free(uint32_t addr)
+{
+    frame_free(addr, 0);
+}
+
+
+/** buddy_free_frames
+ * DESCRIPTION: number of free 4KB frames
+*/
+uint32_t buddy_free_frames(void)
+{
+    return free_frames;
+}
+
+
+/** buddy_total_frames
+ * DESCRIPTION: number of 4KB frames managed by the allocator
+*/
+uint32_t buddy_total_frames(void)
+{
+    return total_frames;
+}
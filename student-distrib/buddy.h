@@ -0,0 +1,48 @@
+/* buddy.h - physical page frame allocator
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include "types.h"
+
+/** BACKGROUND:
+ *  - Physical memory is handed out in naturally aligned blocks of 2^order frames (4KB each).
+ *  - Order 0 is a single 4KB page, order 10 (MAX_ORDER) is one 4MB page, which is what the
+ *    page directory maps for programs and the graphics backing stores.
+ *  - Every order keeps a bitmap with one bit per block. A set bit means the block is free
+ *    at exactly that order, so a lookup is a word scan + bsf and freeing only has to check
+ *    the buddy's bit to know if the two halves can be merged.
+ */
+#define FRAME_SIZE          4096
+#define FRAME_SHIFT         12
+#define MAX_ORDER           10                              // 2^10 frames = 4MB
+#define FOUR_MB_ORDER       MAX_ORDER
+#define BUDDY_BASE          0x800000                        // everything below 8MB belongs to the kernel
+#define MAX_PHYS_MEM        0x40000000                      // only the first 1GB of RAM is managed
+#define MAX_FRAMES          (MAX_PHYS_MEM >> FRAME_SHIFT)
+#define MAX_RESERVED        8                               // max number of reserved ranges (boot modules)
+
+/* set up an empty allocator */
+void buddy_init(void);
+
+/* hand a range of usable RAM (from the multiboot memory map) to the allocator */
+void buddy_add_region(uint32_t base, uint32_t length);
+
+/* keep a range (e.g. a boot module) out of any region added afterwards */
+void buddy_reserve_region(uint32_t base, uint32_t length);
+
+/* allocate/free 2^order physically contiguous frames. returns 0 on failure */
+uint32_t frame_alloc(uint32_t order);
+void frame_free(uint32_t addr, uint32_t order);
+
+/* single 4KB page fast path */
+uint32_t page_alloc(void);
+void page_free(uint32_t addr);
+
+/* stats */
+uint32_t buddy_free_frames(void);
+uint32_t buddy_total_frames(void);
+
+#endif /* _BUDDY_H */
@@ -0,0 +1,87 @@
+/** clock.c
+ *  Monotonic nanosecond clock off the tsc
+*/
+
+#include "clock.h"
+#include "lib.h"
+#include "paging.h"
+#include "pit.h"
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+/* a whole page of its own, user programs see all of it */
+static union {
+    clock_page_t page;
+    uint8_t      frame[PAGESIZE];
+} clock_frame __attribute__((aligned(PAGESIZE)));
+/*************************************************************************/
+
+
+/** clock_init
+ * DESCRIPTION: start the clock at 0 and work out the cycles to nanoseconds scale
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: fills in the clock page. tsc_khz must be measured already
+*/
+void clock_init(void)
+{
+    clock_page_t* p  = &clock_frame.page;
+    uint64_t      n  = (uint64_t)NS_PER_MS << CLOCK_SHIFT;
+    uint32_t      hi = (uint32_t)(n >> 32);
+    uint32_t      lo = (uint32_t)n;
+    uint32_t      mult;
+
+    // mult = NS_PER_MS << shift / tsc_khz, fits in 32 bits for any tsc over 1MHz
+    if (tsc_khz <= hi)
+    {
+        mult = 0xFFFFFFFF;
+    }
+    else
+    {
+        asm ("divl %2" : "=a"(mult), "+d"(hi) : "rm"(tsc_khz), "a"(lo));
+    }
+
+    p->version  = CLOCK_VERSION;
+    p->mult     = mult;
+    p->shift    = CLOCK_SHIFT;
+    p->tsc_khz  = tsc_khz;
+    p->tsc_base = rdtsc();
+}
+
+
+/** clock_page_phys
+ * DESCRIPTION: where the clock page is, the kernel is identity mapped
+ * INPUTS: none
+ * OUTPUTS: its physical address
+*/
+uint32_t clock_page_phys(void)
+{
+    return (uint32_t)&clock_frame;
+}
+
+
+/** clock_cycles_to_ns
+ * DESCRIPTION: scale a cycle count to nanoseconds. the top and bottom halves are multiplied
+ *              separately, 32 x 32 bits each, so nothing overflows for centuries of cycles
+ * INPUTS: cycles - tsc cycles
+ * OUTPUTS: nanoseconds
+*/
+uint64_t clock_cycles_to_ns(uint64_t cycles)
+{
+    uint32_t hi   = (uint32_t)(cycles >> 32);
+    uint32_t lo   = (uint32_t)cycles;
+    uint32_t mult = clock_frame.page.mult;
+
+    return (((uint64_t)hi * mult) << (32 - CLOCK_SHIFT)) + (((uint64_t)lo * mult) >> CLOCK_SHIFT);
+}
+
+
+/** clock_ns
+ * DESCRIPTION: read the clock
+ * INPUTS: none
+ * OUTPUTS: nanoseconds since clock_init
+*/
+uint64_t clock_ns(void)
+{
+    return clock_cycles_to_ns(rdtsc() - clock_frame.page.tsc_base);
+}
@@ -0,0 +1,50 @@
+/** clock.h
+ *  Monotonic nanosecond clock off the tsc
+*/
+
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include "types.h"
+
+/** BACKGROUND:
+ *  - The tsc counts at a fixed rate, measured against the pit at boot (pit.c), so the time since
+ *    boot is the cycles since then scaled to nanoseconds. The scale is fixed point,
+ *    ns = cycles * mult >> shift, so reading the clock is an rdtsc and two multiplies, no
+ *    division and no port I/O.
+ *  - Everything a reader needs is in the clock page, which every process also has mapped read
+ *    only at CLOCKPAGE (paging.h). rdtsc works in user mode, so a program can read the clock
+ *    itself without a system call (syscalls/ece391clock.c). clock_gettime does the same thing
+ *    in the kernel, for programs that don't.
+ *  - The page is only written by clock_init, before any process runs, so readers need no
+ *    locking. version is for user code to check the layout it was built against.
+ *  - This assumes the cpus' tscs run at one constant rate and agree with each other, which is
+ *    what QEMU and any recent cpu give.
+ */
+#define CLOCK_SHIFT         22
+#define CLOCK_VERSION       1
+#define CLOCK_MONOTONIC     0
+#define NS_PER_MS           1000000
+
+/* layout of the clock page, shared with user programs */
+typedef struct {
+    uint32_t version;
+    uint32_t mult;                  /* nanoseconds per cycle << shift */
+    uint32_t shift;
+    uint32_t tsc_khz;
+    uint64_t tsc_base;              /* rdtsc at time 0 */
+} clock_page_t;
+
+/* fill in the clock page, after pit_init has measured the tsc */
+void clock_init(void);
+
+/* physical address of the clock page, for paging_init to map */
+uint32_t clock_page_phys(void);
+
+/* nanoseconds since boot */
+uint64_t clock_ns(void);
+
+/* a cycle count in nanoseconds */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+#endif /* _CLOCK_H */
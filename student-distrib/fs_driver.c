@@ -1,9 +1,6 @@
 #include "fs_driver.h"
 #include "syscall.h"
 
-extern int cur_pid;
-extern pcb_t *  cur_pcb;
-
 /* void fs_init(uint32_t fs_ptr)
  * initializes the File system
  * Inputs: fs_ptr - Pointer to the base of the file system
@@ -10,4 +10,5 @@ extern void generic_fault_code();
 extern void generic_fault_code_linkage();
 extern void double_fault();
 extern void double_fault_linkage();
+extern void page_fault_linkage();
 #endif /* ASM */
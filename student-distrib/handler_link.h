@@ -20,6 +20,16 @@ extern void mouse_handler();
 extern void mouse_handler_linkage();
 extern void pit_handler();
 extern void pit_handler_linkage();
+extern void smp_resched_ipi();
+extern void resched_ipi_linkage();
+extern void lapic_timer_handler();
+extern void apic_timer_linkage();
+extern void smp_tlb_ipi();
+extern void tlb_ipi_linkage();
+extern void apic_spurious();
+extern void spurious_linkage();
+extern void prof_ipi();
+extern void prof_ipi_linkage();
 // extern void generic_fault_code();
 // extern void generic_fault_code_linkage();
 #endif /* ASM */
@@ -0,0 +1,200 @@
+/** heap.c
+ *  Per process user heap, grown and shrunk with the brk/sbrk system calls
+*/
+
+#include "heap.h"
+#include "buddy.h"
+#include "lib.h"
+
+#define PAGE_UP(x)      (((x) + PAGESIZE - 1) & ~(PAGESIZE - 1))
+#define PTE_IDX(va)     (((va) >> ADDRSHIFT) & (TABLESIZE - 1))
+#define TABLE_IDX(va)   (((va) - USER_HEAP) / FOUR_MB_BYTES)
+
+
+/** load_pdes
+ * DESCRIPTION: point the heap PDEs at a heap's page tables
+ * INPUTS: heap - the heap
+ * OUTPUTS: none
+ * SIDE EFFECTS: changes PD[USER_HEAPIDX ...] of the heap's directory, nothing is invalidated
+*/
+static void load_pdes(uheap_t* heap)
+{
+    int i;
+
+    for (i = 0; i < USER_HEAP_TABLES; i++)
+    {
+        pde_t* pde = &heap->pd[USER_HEAPIDX + i];
+        if (heap->tables[i] != NULL)
+        {
+            pde->page_size = 0;
+            pde->address_31_12 = kheap_virt_to_phys(heap->tables[i]) >> ADDRSHIFT;
+            pde->user_supervisor = 1;
+            pde->read_write = 1;
+            pde->present = 1;
+        }
+        else
+        {
+            pde->present = 0;
+        }
+    }
+}
+
+
+/** heap_init
+ * DESCRIPTION: set up an empty heap for a new process
+ * INPUTS: heap - heap in the new pcb
+ *         pd - the process's page directory
+ * OUTPUTS: none
+ * SIDE EFFECTS: clears the heap PDEs, nothing is allocated until the first brk
+*/
+void heap_init(uheap_t* heap, pde_t* pd)
+{
+    int i;
+
+    heap->brk = USER_HEAP;
+    heap->pd = pd;
+    for (i = 0; i < USER_HEAP_TABLES; i++)
+    {
+        heap->tables[i] = NULL;
+    }
+    load_pdes(heap);
+}
+
+
+/** map_page
+ * DESCRIPTION: back one heap page with a fresh zeroed frame, allocating its page table if needed
+ * INPUTS: heap - the current process's heap
+ *         va - page aligned user address inside the heap
+ * OUTPUTS: 0 on success, -1 if out of memory
+*/
+static int32_t map_page(uheap_t* heap, uint32_t va)
+{
+    uint32_t t = TABLE_IDX(va);
+    uint32_t frame;
+    pte_t*   pte;
+
+    if (heap->tables[t] == NULL)
+    {
+        heap->tables[t] = (pte_t*)kpage_alloc(1);
+        if (heap->tables[t] == NULL)
+        {
+            return -1;
+        }
+        memset(heap->tables[t], 0, PAGESIZE);
+        load_pdes(heap);        // not present -> present, no flush needed
+    }
+
+    frame = page_alloc();
+    if (frame == 0)
+    {
+        return -1;
+    }
+
+    pte = &heap->tables[t][PTE_IDX(va)];
+    pte->address_31_12 = frame >> ADDRSHIFT;
+    pte->user_supervisor = 1;
+    pte->read_write = 1;
+    pte->present = 1;
+
+    // don't hand the process another process's old data
+    memset((void*)va, 0, PAGESIZE);
+    return 0;
+}
+
+
+/** unmap_range
+ * DESCRIPTION: free the frames behind [start, end) and any page table that ends up unused
+ * INPUTS: heap - the heap
+ *         start, end - page aligned user addresses inside the heap
+ * OUTPUTS: none
+ * SIDE EFFECTS: the caller has to reload the PDEs and invalidate the range
+*/
+static void unmap_range(uheap_t* heap, uint32_t start, uint32_t end)
+{
+    uint32_t va;
+    uint32_t t;
+    pte_t*   pte;
+
+    for (va = start; va < end; va += PAGESIZE)
+    {
+        t = TABLE_IDX(va);
+        if (heap->tables[t] == NULL)
+        {
+            continue;
+        }
+        pte = &heap->tables[t][PTE_IDX(va)];
+        if (pte->present)
+        {
+            page_free(pte->address_31_12 << ADDRSHIFT);
+            pte->present = 0;
+        }
+    }
+
+    // tables that start at or above the new break are empty now
+    for (t = 0; t < USER_HEAP_TABLES; t++)
+    {
+        if (heap->tables[t] != NULL && USER_HEAP + t * FOUR_MB_BYTES >= start)
+        {
+            kpage_free(heap->tables[t], 1);
+            heap->tables[t] = NULL;
+        }
+    }
+}
+
+
+/** heap_set_brk
+ * DESCRIPTION: move the break. Growing maps zeroed pages, shrinking gives them back.
+ * INPUTS: heap - heap of the running process (its directory must be in cr3)
+ *         new_brk - the new end of the heap
+ * OUTPUTS: 0 on success, -1 if the break is out of range or memory ran out
+ * SIDE EFFECTS: on failure the break is unchanged
+*/
+int32_t heap_set_brk(uheap_t* heap, uint32_t new_brk)
+{
+    uint32_t old_end, new_end, va;
+
+    if (new_brk < USER_HEAP || new_brk > USER_HEAP_END)
+    {
+        return -1;
+    }
+
+    old_end = PAGE_UP(heap->brk);
+    new_end = PAGE_UP(new_brk);
+
+    if (new_end > old_end)
+    {
+        for (va = old_end; va < new_end; va += PAGESIZE)
+        {
+            if (map_page(heap, va) == -1)
+            {
+                unmap_range(heap, old_end, va);
+                load_pdes(heap);
+                tlb_flush_range(old_end, va);
+                return -1;
+            }
+        }
+    }
+    else if (new_end < old_end)
+    {
+        unmap_range(heap, new_end, old_end);
+        load_pdes(heap);
+        tlb_flush_range(new_end, old_end);
+    }
+
+    heap->brk = new_brk;
+    return 0;
+}
+
+
+/** heap_release
+ * DESCRIPTION: free the whole heap when a process halts
+ * INPUTS: heap - the heap, its directory doesn't have to be in cr3
+ * OUTPUTS: none
+ * SIDE EFFECTS: the heap is empty afterwards. stale TLB entries go with the next cr3 load
+*/
+void heap_release(uheap_t* heap)
+{
+    unmap_range(heap, USER_HEAP, PAGE_UP(heap->brk));
+    load_pdes(heap);
+    heap->brk = USER_HEAP;
+}
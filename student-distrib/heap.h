@@ -0,0 +1,41 @@
+/* heap.h - per process user heap grown with brk/sbrk
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _HEAP_H
+#define _HEAP_H
+
+#include "types.h"
+#include "paging.h"
+
+/** BACKGROUND:
+ *  - Every process gets a heap region right after the terminal backing stores, starting at
+ *    USER_HEAP (152MB) and running for at most USER_HEAP_TABLES * 4MB.
+ *  - The region is mapped with 4KB pages. Page tables and frames are only allocated when brk
+ *    grows over them, and given back when it shrinks or the process halts.
+ *  - The heap PDEs live in the process's own page directory, so switching processes (a cr3
+ *    load) switches heaps too. Shrinking the heap only invlpg's the pages it gave back.
+ */
+#define USER_HEAP           0x9800000
+#define USER_HEAPIDX        38
+#define USER_HEAP_TABLES    4                               // 16MB of heap at most
+#define USER_HEAP_END       (USER_HEAP + USER_HEAP_TABLES * FOUR_MB_BYTES)
+#define FOUR_MB_BYTES       0x400000
+
+/* heap state kept in the pcb */
+typedef struct {
+    uint32_t brk;                               /* current break, USER_HEAP when empty */
+    pde_t*   pd;                                /* page directory the heap is mapped in */
+    pte_t*   tables[USER_HEAP_TABLES];          /* kernel heap address of each page table, NULL if not allocated */
+} uheap_t;
+
+/* empty heap for a new process, mapped in the process's page directory */
+void heap_init(uheap_t* heap, pde_t* pd);
+
+/* move the break, mapping or unmapping pages as needed. the heap's directory must be in cr3 */
+int32_t heap_set_brk(uheap_t* heap, uint32_t new_brk);
+
+/* free every page and page table */
+void heap_release(uheap_t* heap);
+
+#endif /* _HEAP_H */
@@ -4,6 +4,7 @@
 
 #include "idt.h"
 #include "x86_desc.h"
+#include "prof.h"
 /* void idt_init()
  * initializes the IDT
  * Inputs: None
@@ -94,7 +95,7 @@
     SET_IDT_ENTRY(idt[11], &segment_not_present);
     SET_IDT_ENTRY(idt[12], &stack_segment_fault);
     SET_IDT_ENTRY(idt[13], &general_protection);
-    SET_IDT_ENTRY(idt[14], &page_fault);        // page-fault - must be handled differently later!
+    SET_IDT_ENTRY(idt[14], &page_fault_linkage);    // page-fault, linkage passes the frame for user copy fixups
     /* no entry for 15, since this is intel-reserved. */ 
     SET_IDT_ENTRY(idt[16], &fpu_fault);         // x87 FPU faults
     SET_IDT_ENTRY(idt[17], &alignment_check);   // alignment check fault - error code
@@ -109,6 +110,18 @@
     idt[0x28] = rtc_handler_desc;   // RTC      -> IRQ8 -> port 0x28
     idt[0x2C] = mouse_handler_desc;  // 
 
+    /* IPIs from other cpus, the local APIC's timer and spurious interrupt. same gate as the pit's */
+    idt[SMP_RESCHED_VECTOR] = pit_handler_desc;
+    SET_IDT_ENTRY(idt[SMP_RESCHED_VECTOR], &resched_ipi_linkage);
+    idt[APIC_TIMER_VECTOR] = pit_handler_desc;
+    SET_IDT_ENTRY(idt[APIC_TIMER_VECTOR], &apic_timer_linkage);
+    idt[SMP_TLB_VECTOR] = pit_handler_desc;
+    SET_IDT_ENTRY(idt[SMP_TLB_VECTOR], &tlb_ipi_linkage);
+    idt[PROF_VECTOR] = pit_handler_desc;
+    SET_IDT_ENTRY(idt[PROF_VECTOR], &prof_ipi_linkage);
+    idt[APIC_SPURIOUS_VECTOR] = pit_handler_desc;
+    SET_IDT_ENTRY(idt[APIC_SPURIOUS_VECTOR], &spurious_linkage);
+
     /* initialize System Call IDT entry. sys calls are 0x80 in idt */
     idt[0x80].seg_selector = ((uint16_t) KERNEL_CS);    // set segment to KERNEL CS
     idt[0x80].reserved4 = 0;
@@ -12,6 +12,8 @@
 #include "syscall_handler.h"
 #include "handler_link.h"
 #include "handler_code_link.h"
+#include "smp.h"
+#include "apic.h"
 
 
 // Fills in IDT and loads it using lidt
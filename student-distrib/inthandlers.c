@@ -93,8 +93,19 @@ void general_protection(){
 }
 
 // page fault handler 0x0E
-void page_fault(){
-    printf("0x0E (14) page fault\n");
+// a fault inside a user copy resumes at the copy's fixup, anything else kills the process
+void page_fault(fault_frame_t* frame){
+    uint32_t fixup;
+    uint32_t addr;
+
+    if ((frame->cs & 0x3) == 0 && (fixup = search_exception_table(frame->eip)) != 0)
+    {
+        frame->eip = fixup;
+        return;
+    }
+
+    asm volatile ("movl %%cr2, %0" : "=r"(addr));
+    printf("0x0E (14) page fault at 0x%x\n", addr);
     halt(HALT_EXC);
 }
 
@@ -9,6 +9,7 @@
 #include "handler_link.h"
 #include "handler_code_link.h"
 #include "lib.h"
+#include "uaccess.h"
 
 extern int32_t halt (uint8_t status);
 // Declare all of the interrupt handlers
@@ -26,7 +27,7 @@ void invalid_tss();
 void segment_not_present();
 void stack_segment_fault();
 void general_protection();
-void page_fault();
+void page_fault(fault_frame_t* frame);
 void fpu_fault();
 void alignment_check();
 void machine_check();
@@ -0,0 +1,195 @@
+/** irqstat.c
+ *  How often each interrupt vector fires and how long its handler takes
+*/
+
+#include "irqstat.h"
+#include "lib.h"
+#include "smp.h"
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+static irqstat_t irq_stats[SMP_MAX_CPUS][IRQSTAT_VECTORS];
+static uint64_t  irq_entry[SMP_MAX_CPUS];                   // rdtsc at entry, 0 once used
+static uint32_t  irq_vec[SMP_MAX_CPUS];                     // and which vector it was
+static irq_regs_t* irq_frame[SMP_MAX_CPUS];                 // and what it interrupted
+static spinlock_t irqstat_lock = SPINLOCK_INIT("irqstat");  // a reset against a read
+/*************************************************************************/
+
+
+/** irq_enter_stamp
+ * DESCRIPTION: an interrupt came in, count it and note when
+ * INPUTS: vec - its vector, IRQSTAT_OTHER for the shared linkages
+ *         regs - the registers the linkage saved
+ * OUTPUTS: none
+ * SIDE EFFECTS: called with interrupts off, before the kernel lock is taken
+*/
+void irq_enter_stamp(uint32_t vec, irq_regs_t* regs)
+{
+    int32_t cpu = cpu_id();
+
+    irq_stats[cpu][vec].count++;
+    irq_vec[cpu]   = vec;
+    irq_frame[cpu] = regs;
+    irq_entry[cpu] = rdtsc();
+}
+
+
+/** irq_lock_stamp
+ * DESCRIPTION: the linkage has the kernel lock. the time since entry was the wait for it, it's
+ *              counted as such and the handler is timed from now
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: called with interrupts off
+*/
+void irq_lock_stamp(void)
+{
+    int32_t    cpu = cpu_id();
+    uint64_t   now = rdtsc();
+    uint32_t   cycles;
+    irqstat_t* s;
+
+    // an interrupt taken while we waited used the entry up
+    if (irq_entry[cpu] == 0)
+    {
+        return;
+    }
+    cycles = (uint32_t)(now - irq_entry[cpu]);
+    irq_entry[cpu] = now;
+
+    s = &irq_stats[cpu][irq_vec[cpu]];
+    s->waits++;
+    s->wait_cycles += cycles;
+    if (cycles > s->wait_max)
+    {
+        s->wait_max = cycles;
+    }
+}
+
+
+/** irq_exit_stamp
+ * DESCRIPTION: a handler returned, time it against this cpu's last entry
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: called with interrupts off. uses the entry up
+*/
+void irq_exit_stamp(void)
+{
+    int32_t    cpu = cpu_id();
+    uint64_t   now = rdtsc();
+    uint32_t   cycles;
+    irqstat_t* s;
+
+    if (irq_entry[cpu] == 0)
+    {
+        return;
+    }
+    cycles = (uint32_t)(now - irq_entry[cpu]);
+    irq_entry[cpu] = 0;
+
+    s = &irq_stats[cpu][irq_vec[cpu]];
+    if (s->timed++ == 0 || cycles < s->min)
+    {
+        s->min = cycles;
+    }
+    if (cycles > s->max)
+    {
+        s->max = cycles;
+    }
+    s->cycles += cycles;
+    s->hist[(cycles == 0) ? 0 : find_last_set(cycles)]++;
+}
+
+
+/** irq_regs
+ * DESCRIPTION: the registers saved by this cpu's latest interrupt linkage
+ * INPUTS: none
+ * OUTPUTS: them, only good inside that interrupt's handler
+*/
+irq_regs_t* irq_regs(void)
+{
+    return irq_frame[cpu_id()];
+}
+
+
+/** irqstat_get
+ * DESCRIPTION: add up a vector's stats over every cpu
+ * INPUTS: vec - the vector, or IRQSTAT_OTHER
+ *         e - filled in
+ * OUTPUTS: 1, 0 if it never fired
+ * SIDE EFFECTS: other cpus keep counting meanwhile, so it's a snapshot give or take one. a
+ *               reset can't land halfway through it
+*/
+int32_t irqstat_get(uint32_t vec, irqstat_entry_t* e)
+{
+    irqstat_t* s;
+    uint32_t   hi, lo, flags;
+    int32_t    i, b;
+
+    memset(e, 0, sizeof(*e));
+    spin_lock_irqsave(&irqstat_lock, flags);
+    e->vector = (vec == IRQSTAT_OTHER) ? -1 : (int32_t)vec;
+    for (i = 0; i < ncpus; i++)
+    {
+        s = &irq_stats[i][vec];
+        if (s->timed != 0)
+        {
+            if (e->timed == 0 || s->min < e->min)
+            {
+                e->min = s->min;
+            }
+            if (s->max > e->max)
+            {
+                e->max = s->max;
+            }
+        }
+        if (s->wait_max > e->wait_max)
+        {
+            e->wait_max = s->wait_max;
+        }
+        e->waits       += s->waits;
+        e->wait_cycles += s->wait_cycles;
+        e->count  += s->count;
+        e->timed  += s->timed;
+        e->cycles += s->cycles;
+        for (b = 0; b < IRQSTAT_BUCKETS; b++)
+        {
+            e->hist[b] += s->hist[b];
+        }
+    }
+    spin_unlock_irqrestore(&irqstat_lock, flags);
+    if (e->count == 0)
+    {
+        return 0;
+    }
+
+    // avg = cycles / timed, the quotient fits in 32 bits since no single run is longer
+    if (e->timed != 0)
+    {
+        hi = (uint32_t)(e->cycles >> 32);
+        lo = (uint32_t)e->cycles;
+        asm ("divl %2" : "=a"(e->avg), "+d"(hi) : "rm"(e->timed), "a"(lo));
+    }
+    if (e->waits != 0)
+    {
+        hi = (uint32_t)(e->wait_cycles >> 32);
+        lo = (uint32_t)e->wait_cycles;
+        asm ("divl %2" : "=a"(e->wait_avg), "+d"(hi) : "rm"(e->waits), "a"(lo));
+    }
+    return 1;
+}
+
+
+/** irqstat_reset
+ * DESCRIPTION: zero every cpu's stats. the stamps themselves take no lock, an interrupt
+ *              running on another cpu meanwhile may keep part of its count
+ * INPUTS: none
+ * OUTPUTS: none
+*/
+void irqstat_reset(void)
+{
+    uint32_t flags;
+
+    spin_lock_irqsave(&irqstat_lock, flags);
+    memset(irq_stats, 0, sizeof(irq_stats));
+    spin_unlock_irqrestore(&irqstat_lock, flags);
+}
@@ -0,0 +1,94 @@
+/** irqstat.h
+ *  How often each interrupt vector fires and how long its handler takes
+*/
+
+#ifndef _IRQSTAT_H
+#define _IRQSTAT_H
+
+/** BACKGROUND:
+ *  - The interrupt linkages (handler_link.S) call irq_enter_stamp first thing, before even
+ *    waiting for the kernel lock, irq_lock_stamp once they have it and irq_exit_stamp as soon
+ *    as the handler returns. Each takes an rdtsc. The time to the lock stamp is kept apart as
+ *    the vector's lock wait (time another cpu held the lock, which is latency too), the time
+ *    from it to the exit is the handler's own. Neither includes the deferred work run after it
+ *    (softirq.h). The linkages without the lock have no wait, their entry stamp starts the
+ *    handler's time.
+ *  - The entry stamp is kept per cpu and used up by the next exit on that cpu. A handler that
+ *    switches processes (a timer tick, a wake up) returns in another context, the time until
+ *    that one's interrupt returns is still what the cpu spent in interrupts, so it's charged to
+ *    the vector that switched. An entry with no matching exit (the new context left by a system
+ *    call instead) is counted but not timed.
+ *  - Each cpu keeps its own counts, so no locking, and the irqstat system call adds them up.
+ *    Per vector: how many times it fired, and for the timed ones the shortest, longest and total
+ *    cycles and a histogram with a bucket per power of two: bucket b counts handlers that took
+ *    2^b to 2^(b+1) - 1 cycles.
+ *  - Linkages shared by many vectors (generic_fault, do_nothing) can't tell which one they're
+ *    handling, they're counted together under IRQSTAT_OTHER.
+ *  - Times are in tsc cycles, a user program scales them with tsc_khz off the clock page.
+ *  - The entry stamp also notes where the linkage saved the interrupted registers, so a handler
+ *    can look at what it interrupted with irq_regs (the profiler does).
+ */
+#define IRQSTAT_VECTORS     257             // every IDT vector, and the shared linkages
+#define IRQSTAT_OTHER       256
+#define IRQSTAT_BUCKETS     32
+
+#ifndef ASM
+
+#include "types.h"
+
+/* what a linkage has pushed by the time it calls irq_enter_stamp, lowest address first */
+typedef struct {
+    uint32_t flags;                         /* pushfl */
+    uint32_t edi, esi, ebp, esp;            /* pushal. esp is the kernel esp after the cpu's push */
+    uint32_t ebx, edx, ecx, eax;
+    uint32_t eip;                           /* pushed by the cpu */
+    uint32_t cs;
+    uint32_t eflags;
+} irq_regs_t;
+
+/* one vector on one cpu */
+typedef struct {
+    uint32_t count;                         /* times it fired */
+    uint32_t timed;                         /* of those, the ones with a duration */
+    uint32_t min;                           /* cycles */
+    uint32_t max;
+    uint64_t cycles;                        /* total */
+    uint32_t hist[IRQSTAT_BUCKETS];
+    uint32_t waits;                         /* times it waited for the kernel lock */
+    uint32_t wait_max;                      /* cycles */
+    uint64_t wait_cycles;                   /* total */
+} irqstat_t;
+
+/* what the irqstat system call hands out, one per vector that fired, every cpu added up */
+typedef struct {
+    int32_t  vector;                        /* -1 for IRQSTAT_OTHER */
+    uint32_t count;
+    uint32_t timed;
+    uint32_t min;
+    uint32_t avg;
+    uint32_t max;
+    uint64_t cycles;
+    uint32_t hist[IRQSTAT_BUCKETS];
+    uint32_t waits;                         /* kernel lock waits, not part of the times above */
+    uint32_t wait_avg;
+    uint32_t wait_max;
+    uint64_t wait_cycles;
+} irqstat_entry_t;
+
+/* interrupt linkages: a handler for vec is starting / has the kernel lock / has returned */
+void irq_enter_stamp(uint32_t vec, irq_regs_t* regs);
+void irq_lock_stamp(void);
+void irq_exit_stamp(void);
+
+/* registers of whatever this cpu's current interrupt interrupted */
+irq_regs_t* irq_regs(void);
+
+/* every cpu's stats for a vector added up: 0 if it never fired */
+int32_t irqstat_get(uint32_t vec, irqstat_entry_t* e);
+
+/* start counting again from zero */
+void irqstat_reset(void);
+
+#endif /* ASM */
+
+#endif /* _IRQSTAT_H */
@@ -17,10 +17,23 @@
 #include "pit.h"
 #include "bga.h"
 #include "speaker.h"
+#include "buddy.h"
+#include "slab.h"
+#include "proc.h"
+#include "shm.h"
+#include "pipe.h"
+#include "smp.h"
+#include "clock.h"
+#include "timer.h"
+#include "serial.h"
 
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags, bit)   ((flags) & (1 << (bit)))
 
+#define MMAP_TYPE_RAM   1
+#define ONE_MB          0x100000
+#define ONE_KB          1024
+
 
 
 /* Check if MAGIC is valid and print the Multiboot information structure
@@ -42,6 +55,9 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Set MBI to the address of the Multiboot information structure. */
     mbi = (multiboot_info_t *) addr;
 
+    /* physical frames get added as the memory map is parsed below */
+    buddy_init();
+
     /* Print out the flags. */
     //printf("flags = 0x%#x\n", (unsigned)mbi->flags);
 
@@ -63,6 +79,8 @@ void entry(unsigned long magic, unsigned long addr) {
         module_t* mod = (module_t*)mbi->mods_addr;
         boot_block_ptr = mod->mod_start;
         while (mod_count < mbi->mods_count) {
+            /* keep the module (filesystem image) out of the frame allocator */
+            buddy_reserve_region(mod->mod_start, mod->mod_end - mod->mod_start);
             //printf("Module %d loaded at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_start);
             //printf("Module %d ends at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_end);
             //printf("First few bytes of module:\n");
@@ -96,6 +114,7 @@ void entry(unsigned long magic, unsigned long addr) {
         for (mmap = (memory_map_t *)mbi->mmap_addr;
                 (unsigned long)mmap < mbi->mmap_addr + mbi->mmap_length;
                 mmap = (memory_map_t *)((unsigned long)mmap + mmap->size + sizeof (mmap->size)))
+        {
             // printf("    size = 0x%x, base_addr = 0x%#x%#x\n    type = 0x%x,  length    = 0x%#x%#x\n",
             //         (unsigned)mmap->size,
             //         (unsigned)mmap->base_addr_high,
@@ -103,7 +122,17 @@ void entry(unsigned long magic, unsigned long addr) {
             //         (unsigned)mmap->type,
             //         (unsigned)mmap->length_high,
             //         (unsigned)mmap->length_low);
-            ;
+
+            /* type 1 is usable RAM. we can't address anything above 4GB */
+            if (mmap->type == MMAP_TYPE_RAM && mmap->base_addr_high == 0)
+            {
+                buddy_add_region(mmap->base_addr_low, mmap->length_high ? MAX_PHYS_MEM : mmap->length_low);
+            }
+        }
+    }
+    /* no memory map, fall back to mem_upper (KB of RAM above 1MB) */
+    else if (CHECK_FLAG(mbi->flags, 0)) {
+        buddy_add_region(ONE_MB, mbi->mem_upper * ONE_KB);
     }
 
     /* Construct an LDT entry in the GDT */
@@ -147,20 +176,34 @@ void entry(unsigned long magic, unsigned long addr) {
         ltr(KERNEL_TSS);
     }
 
-    /* Init the PIC and paging*/
+    /* the boot processor holds the kernel lock from here on, except while halted */
+    kernel_enter();
+
+    /* Init the PIC and paging. The MP table is read before paging hides low memory */
     i8259_init();
+    smp_detect();
     paging_init();
+    slab_init();
+    proc_init();
+    shm_init();
+    pipe_init();
 
     /* Initialize devices, memory, filesystem, enable device interrupts on the
      * PIC, any other initialization stuff... */
     clear();
+    serial_init();
     fs_init(boot_block_ptr);
 
     idt_init();
     kb_init();
     mouse_init();
+    timer_init();
     rtc_init();
     pit_init();
+    clock_init();
+
+    /* start the other cpus, they wait in their idle tasks for terminals to launch */
+    smp_init();
 
     syscall_init();
     terminal_init();
@@ -180,8 +223,10 @@ void entry(unsigned long magic, unsigned long addr) {
 
 #if RUN_TESTS
     /* Run tests */
-    // clear();
-    // launch_tests();
+#if LAUNCH_TESTS
+    clear();
+    launch_tests();
+#endif
 
 		
 #else
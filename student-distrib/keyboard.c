@@ -386,30 +386,24 @@ int get_kbdbufsize(){
     return TERM_BUF_SIZE;
 }
 
-/** kb_handler
- * DESCRIPTION: Handles KB interrupts, according to PC/XT Scan Code Set 1
+/** kb_key
+ * DESCRIPTION: Handles one key, according to PC/XT Scan Code Set 1
  * INPUTS:
- *      NONE
+ *      keychar: the key, translated from its scancode
  * OUTPUTS:
  *      NONE
- * SIDE EFFECTS: Reads scancode from keyboard and prints char to screen
+ * SIDE EFFECTS: Prints char to screen
  * - Also copies printed chars to kernel's kb buffer, until buffer is full. 
  * - Handles special keys and cases: ctrl-l blanks screen and clears buffer
  * - Handles shift and capslock and combinations, and capitalization of numbers
+ * - Caller holds term_lock, with interrupts off
 */
-void kb_handler(){
+static void kb_key(unsigned char keychar){
     int space_idx;
     int search_length;
     int takes_args;
     int num_hits;
     int hit_idx;
-    // printf("kb_handler run ");
-    cli();
-    send_eoi(KB_IRQ);
-    volatile unsigned char keycode;
-    keycode = inb(PORT_8042_DATA);
-    unsigned char keychar = PS2Set1[(int)keycode];
-    // printf("Keyboard did a thing! status: [%x]\n", keycode);
 
 
     // if youre reading this, pretend you dont see this goto statement...
@@ -422,61 +416,50 @@ void kb_handler(){
     switch(keychar)
     {
         case 0x00   :   // null or we don't care - exit early and do nothing
-            sti();  // we're done here, get out
             return;
         case 0x1B   :   // 0x1B corresponds to ESC
             // don't do anything for escape... YET
-            sti();  // we're done here, get out
             return;
         case LCTRL_DN   :   // 0x11 is "device control 1" used as LCTRL
             Lctrl = 1;      // Lctrl active
             ctrl = 1;   // update overall ctrl state
-            sti();  // we're done here, get out
             return;
         case LCTRL_UP   :   // 0x91 is 0x80 + device control 1, indicating release
             Lctrl = 0;
             ctrl = Lctrl | Rctrl;   // update overall ctrl state
-            sti();  // we're done here, get out
             return;
         case RCTRL_DN   :
             Rctrl = 1;
             ctrl = 1;
-            sti();  // we're done here, get out
             return;
         case RCTRL_UP   :
             Rctrl = 0;
             ctrl = Lctrl | Rctrl;
-            sti();  // we're done here, get out
             return;
         case LALT_DN    :
             Lalt = 1;
             alt = 1;
-            sti();  // we're done here, get out
             return;
         case LALT_UP    :
             Lalt = 0;
             alt = Lalt | Ralt;
-            sti();  // we're done here, get out
             return;
         case LSH_DN     :   // handle both shifts identically
         case RSH_DN     :
             shift = 1;
             capitalize = 1 - capslock;  // set capitalization to not-capslock
             // printf("LSH_DN, cap is: %d", capitalize);
-            sti();  // we're done here, get out
             return;
         case LSH_UP     :   // The two shifts behave in unison, very confusing
         case RSH_UP     :   // when holding both, no release is sent until 2nd is released...
             shift = 0;
             capitalize = capslock;
             // printf("LSH_UP, cap is: %d", capitalize);
-            sti();  // we're done here, get out
             return;
         case CL_DN      :
             capslock ^= 1;   // toggle capslock
             capitalize = shift^capslock;  // xor selective inversion
             // printf("capslock is: %d", capslock);
-            sti();  // we're done here, get out
             return;
 
         case 0x08   :   // backspace
@@ -509,7 +492,6 @@ void kb_handler(){
                 update_cursor();
             }
             // kb_putc(0x08);
-            sti();  // we're done here, get out
             return;
         case '\n'   :   // enter - if anything's waiting for keyboard, it's time!
             // but terminal is responsible for figuring out what's in the buffer and clearing it!
@@ -519,13 +501,13 @@ void kb_handler(){
             }
             if((kb_buf_idx) < (TERM_BUF_SIZE) && term_flag){     // if writing a char won't OVERfill the buffer
                 terminalState[vis_term].enter_pressed = 1;
+                terminal_wake_reader(vis_term);
                 // moved putc to terminal write, not sure if itll cause dependency issues
                 // kb_putc(keychar);  // print the new char
                 
                 // kb_buf[(kb_buf_idx)++] = *(char*)(&keychar);   // write as char and increment idx
             }
             //*bufready = 1;  // signal to any waiting terminal drivers that the kb_buf is ready
-            sti();  // we're done here, get out
             return;
         case 0x09   :   // Tab, hardcoded autocomplete
             if (lockscreenflag)
@@ -540,18 +522,15 @@ void kb_handler(){
                     mode = 1;
                     printLockCursor(1);
                 }
-                sti();
                 return;
             }
             if(kb_buf_idx == 0){    // If there's nothin in the buffer
-                sti();      // nothing to autocomplete so just sti->return
                 return; 
             }
             for(space_idx = 0; space_idx < kb_buf_idx; space_idx ++){
                 if(kb_buf[space_idx] == ' '){  // If we found a space
                     if (space_idx == kb_buf_idx -1)   // If we're at the end
                     {   // do nothing if the space is at the end.
-                        sti();
                         return;
                     }
                     space_idx ++;   // iterate to the next character 
@@ -575,7 +554,6 @@ void kb_handler(){
                     takes_args = 1;
                 }
                 else{   // Nothing to be done
-                    sti();
                     return;
                 }
             }
@@ -594,7 +572,6 @@ void kb_handler(){
                     if(num_hits > 0){
                         kb_printf("\ncat counter \n391OS> %s", kb_buf);
                         update_cursor();
-                        sti();
                         return;
                     }
                     else {
@@ -611,7 +588,6 @@ void kb_handler(){
                         if(num_hits > 0){
                             kb_printf("\nfish frame0.txt frame1.txt \n391OS> %s", kb_buf);
                             update_cursor();
-                            sti();
                             return;
                         }
                         else {
@@ -625,7 +601,6 @@ void kb_handler(){
                         if(num_hits > 0){   // If fish was an option, we'dve already printed it
                             kb_printf("\nframe0.txt frame1.txt \n391OS> %s", kb_buf);
                             update_cursor();
-                            sti();
                             return;
                         }
                         else {
@@ -642,7 +617,6 @@ void kb_handler(){
                     if(num_hits > 0){   // If fish was an option, we'dve already printed it
                         kb_printf("\nshell sigtest syserr \n391OS> %s", kb_buf);
                         update_cursor();
-                        sti();
                         return;
                     }
                     else {
@@ -674,7 +648,6 @@ void kb_handler(){
                     kb_printf((int8_t*)kb_buf + space_idx);
                     kb_buf_idx += 4; // length of "grep"
                     update_cursor();
-                    sti();
                     return;
                 }
                 else if(strncmp("hello", (int8_t*)(kb_buf + space_idx), search_length) == 0){  // check if we're a subset of "hello"
@@ -738,7 +711,6 @@ void kb_handler(){
                         kb_printf((int8_t*)kb_buf + space_idx);
                         kb_buf_idx += 4; // length of "exit"
                         update_cursor();
-                        sti();
                         return;
                     }
                 }
@@ -800,7 +772,6 @@ void kb_handler(){
                     update_cursor();
                 }
             }
-            sti();
             return;
         default :
             break;
@@ -818,7 +789,6 @@ void kb_handler(){
             //     kb_buf[i] = 0x00;   // clear the kbd buf
             // }
             kb_buf_idx = 0; // reset index;
-            sti();  // we're done here, get out
             return;
         }
     }
@@ -827,17 +797,14 @@ void kb_handler(){
         switch(keychar) {
             case 0x8D: // F1
                 switch_terminal(0);
-                sti();
                 return;
 
             case 0x81: //F2
                 switch_terminal(1);
-                sti();
                 return;
 
             case 0x90: //F3
                 switch_terminal(2);
-                sti();
                 return;
         }
     }
@@ -943,8 +910,6 @@ void kb_handler(){
         PIANO:
         if (pianomode)
         {
-            sti();
-
             switch(keychar)
             {
                 case 'a':
@@ -1033,7 +998,28 @@ void kb_handler(){
             }
         }
     }
-    sti();
-    
     return;
 }
+
+
+/** kb_handler
+ * DESCRIPTION: Handles KB interrupts: reads the scancode and handles the key under term_lock
+ * INPUTS:
+ *      NONE
+ * OUTPUTS:
+ *      NONE
+ * SIDE EFFECTS: see kb_key. Switches to a reader woken by enter, it was boosted so it can echo now
+*/
+void kb_handler(){
+    uint32_t flags;
+    unsigned char keycode;
+
+    send_eoi(KB_IRQ);
+    keycode = inb(PORT_8042_DATA);
+
+    spin_lock_irqsave(&term_lock, flags);
+    kb_key(PS2Set1[(int)keycode]);
+    spin_unlock_irqrestore(&term_lock, flags);
+
+    sched_preempt();
+}
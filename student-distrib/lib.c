@@ -328,8 +328,11 @@ int32_t kb_puts(int8_t* s) {
  * Return value: VOID
  * Function: visually applies a backspace, going back one character and overwriting it.*/
 void kb_putc_bksp(){
+    uint32_t flags;
+
     if (term_flag)
     {
+        spin_lock_irqsave(&gfx_lock, flags);
         if(screen_x <= 0){  // backspace at x=0? 
             screen_y = (screen_y - 1) % NUM_ROWS;   // back up a row
             screen_x = NUM_COLS;
@@ -337,6 +340,7 @@ void kb_putc_bksp(){
         screen_x--; // backspace won't handle if you hit newline early!
         screen_x %= NUM_COLS;
         printchar(screen_x, screen_y, 0, BLACK);
+        spin_unlock_irqrestore(&gfx_lock, flags);
     }
 }
 
@@ -360,7 +364,9 @@ void kb_putc_reset(){
  * Return Value: void
  *  Function: Output a character to the console, or backspace if char is backspace. */
 void putc(uint8_t c) {
-    cli();
+    uint32_t flags;
+
+    spin_lock_irqsave(&gfx_lock, flags);
     if (cur_term == vis_term)
     {
         if(c == '\n' || c == '\r') {
@@ -407,7 +413,7 @@ void putc(uint8_t c) {
         terminalState[cur_term].screen_x = screen_x_;
         terminalState[cur_term].screen_y = screen_y_;
     }
-    sti();
+    spin_unlock_irqrestore(&gfx_lock, flags);
 }
 
 /* void kb_putc(uint8_t c);
@@ -415,8 +421,11 @@ void putc(uint8_t c) {
  * Return Value: void
  *  Function: Output a character to the console, or backspace if char is backspace. */
 void kb_putc(uint8_t c) {
+    uint32_t flags;
+
     if (term_flag)
     {
+        spin_lock_irqsave(&gfx_lock, flags);
         if(c == '\n' || c == '\r') {
             screen_y++;
             screen_x = 0;
@@ -435,6 +444,7 @@ void kb_putc(uint8_t c) {
             }
             screen_x %= NUM_COLS;
         }
+        spin_unlock_irqrestore(&gfx_lock, flags);
     }
 }
 /* int8_t* itoa(uint32_t value, int8_t* buf, int32_t radix);
@@ -127,6 +127,72 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Bit scan forward - returns the index of the lowest set bit in "word".
+ * The result is undefined when word is 0, so callers must check first */
+static inline uint32_t find_first_set(uint32_t word) {
+    uint32_t idx;
+    asm volatile ("bsfl %1, %0"
+            : "=r"(idx)
+            : "rm"(word)
+            : "cc"
+    );
+    return idx;
+}
+
+/* Bit scan reverse - returns the index of the highest set bit in "word".
+ * The result is undefined when word is 0, so callers must check first */
+static inline uint32_t find_last_set(uint32_t word) {
+    uint32_t idx;
+    asm volatile ("bsrl %1, %0"
+            : "=r"(idx)
+            : "rm"(word)
+            : "cc"
+    );
+    return idx;
+}
+
+/* Returns the index of the lowest clear bit in "word".
+ * The result is undefined when word is 0xFFFFFFFF */
+static inline uint32_t find_first_zero(uint32_t word) {
+    return find_first_set(~word);
+}
+
+/* Reads the time stamp counter, for cycle accurate benchmarks */
+static inline uint64_t rdtsc(void) {
+    uint64_t val;
+    asm volatile ("rdtsc"
+            : "=A"(val)
+    );
+    return val;
+}
+
+/* Runs cpuid for a leaf, filling in the four result registers */
+static inline void cpuid(uint32_t leaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    asm volatile ("cpuid"
+            : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+            : "a"(leaf), "c"(0)
+    );
+}
+
+/* Reads a model specific register */
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint64_t val;
+    asm volatile ("rdmsr"
+            : "=A"(val)
+            : "c"(msr)
+    );
+    return val;
+}
+
+/* Writes a model specific register */
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    asm volatile ("wrmsr"
+            :
+            : "c"(msr), "A"(val)
+            : "memory"
+    );
+}
+
 /* Clear interrupt flag - disables interrupts on this processor */
 #define cli()                           \
 do {                                    \
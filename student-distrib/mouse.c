@@ -27,7 +27,9 @@ int cursorInBounds(int xmin, int xmax, int ymin, int ymax)
 //Mouse functions
 void mouse_handler()
 {
-  cli();
+  uint32_t flags;
+
+  // the packet state is only the handler's, interrupts are already off in it
   if (intr_done)
   {
     intr_done = 0;
@@ -86,9 +88,12 @@ void mouse_handler()
       {
         mouse_y_coord = 459;
       }
+      spin_lock_irqsave(&gfx_lock, flags);
       printcursor(mouse_x_coord, mouse_y_coord, BLACK, WHITE, firstintrflag);
+      spin_unlock_irqrestore(&gfx_lock, flags);
       if (!firstintrflag) firstintrflag = 1;
       intr_done = 1;
+      spin_lock_irqsave(&term_lock, flags);
       if (lclick && term_flag && cursorInBounds(95, 185, 440, 480))
       {
         switch_terminal(0);
@@ -101,6 +106,7 @@ void mouse_handler()
       {
         switch_terminal(2);
       }
+      spin_unlock_irqrestore(&term_lock, flags);
       if (lclick && musicmode && cursorInBounds(588, 630, 40, 82))
       {
         stop_pressed = 1;
@@ -116,7 +122,6 @@ void mouse_handler()
 
   // printf("%x %x %x \n", mouse_data[0], mouse_data[1], mouse_data[2]);
   send_eoi(12);
-  sti();
 }
 
 void mouse_wait(uint8_t a_type) //unsigned char
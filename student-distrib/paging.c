@@ -1,8 +1,48 @@
 #include "paging.h"
+#include "buddy.h"
+#include "lib.h"
+#include "terminal.h"
+#include "smp.h"
+#include "clock.h"
+
+/* what a terminal's vidmap page points at: video memory when visible, its backup page otherwise */
+#define VIDMEM_PAGE(term, vis)  ((term) == (vis) ? VIDMEM : VIDMEM + PAGESIZE * ((term) + 1))
 
 
 // int32_t buf[100000] __attribute__((aligned (PAGESIZE)));
 
+/* page tables for the kernel heap window. PD[KHEAPIDX + i] -> kheap_tables[i] */
+static pte_t kheap_tables[KHEAP_TABLES][TABLESIZE] __attribute__((aligned (PAGESIZE)));
+static uint32_t kheap_hint;     // page index to start the next search from
+static spinlock_t kheap_lock = SPINLOCK_INIT("kheap");     // kheap_tables and kheap_hint
+
+/* vidmap page tables, one per terminal. PD[VIRVIDMEMIDX] of a process points at its terminal's */
+static pte_t vidmem_tables[MAX_TERMINALS][TABLESIZE] __attribute__((aligned (PAGESIZE)));
+
+/* PD[CLOCKPAGEIDX]: just the clock page, read only for user code */
+static pte_t clock_table[TABLESIZE] __attribute__((aligned (PAGESIZE)));
+
+/* the directory in cr3 is per cpu, this_cpu()->pd */
+
+/** backing_page
+*   gets a 4MB frame for one of the graphics backing stores. there is no fixed address to fall
+*   back on, anything not from the allocator may be past the end of RAM or owned by it, so
+*   without one the kernel can't boot
+*   args: none
+*   ret: physical address of the page, doesn't return if there is none
+*/
+static uint32_t backing_page(void)
+{
+    uint32_t addr = frame_alloc(FOUR_MB_ORDER);
+
+    if (addr == 0)
+    {
+        printf("paging_init: no free 4MB frame for the graphics backing stores\n");
+        asm volatile ("cli; 1: hlt; jmp 1b");
+    }
+    return addr;
+}
+
 /*
 *   void paging_init(void)
 *   initializes paging 
@@ -11,7 +51,13 @@
 */
 void paging_init(void) {
 
-    int i;
+    int i, t;
+
+    /* VGA mirror and terminal backing stores. virtual addresses stay fixed, physical pages come from the allocator */
+    uint32_t vga_page   = backing_page();
+    uint32_t term1_page = backing_page();
+    uint32_t term2_page = backing_page();
+    uint32_t term3_page = backing_page();
 
     /*sets up page table for PD[0]
       Present set to 1 for VIDMEM idx and 0 otherwise */
@@ -31,11 +77,17 @@ void paging_init(void) {
         if (i >= 0xb8 && i<= 0xbb) // index b8 - bb are vidmem, and terminal back up pages
         {
             page_table[i].user_supervisor = 1;
+            page_table[i].global = 1;   // same in every process, keep across cr3 reloads
+            page_table[i].present = 1;
+        }
+        else if (i == (AP_BOOT_ADDR >> ADDRSHIFT))  // AP start-up trampoline, smp_init copies it in
+        {
             page_table[i].present = 1;
         }
         else if (i >= 0xA0 && i<(0xA0 + 75))
         {
             page_table[i].user_supervisor = 1;
+            page_table[i].global = 1;
             page_table[i].present = 1;
         }
         else
@@ -44,33 +96,49 @@ void paging_init(void) {
         }
     }
 
-    for (i = 0; i < TABLESIZE; i++)
+    /* one vidmap table per terminal. terminal 0 starts out visible, the rest point at their backup pages */
+    for (t = 0; t < MAX_TERMINALS; t++)
     {
-        vidmem_table[i].read_write = 1;
-        vidmem_table[i].user_supervisor = 0; 
-        vidmem_table[i].write_through = 0;
-        vidmem_table[i].cache_disable = 0;
-        vidmem_table[i].accessed = 0;
-        vidmem_table[i].dirty = 0;
-        vidmem_table[i].page_attribute_table = 0;
-        vidmem_table[i].global = 0;
-        vidmem_table[i].available_3 = 0;
-        vidmem_table[i].address_31_12 = i;
-        
-        if (i ==(VIDMEM >> ADDRSHIFT))
+        for (i = 0; i < TABLESIZE; i++)
         {
-            vidmem_table[i].user_supervisor = 1;
-            vidmem_table[i].address_31_12 = VIDMEM >> ADDRSHIFT;
-            vidmem_table[i].present = 1;
-        }
-        else
-        {
-            vidmem_table[i].present = 0;
+            vidmem_tables[t][i].read_write = 1;
+            vidmem_tables[t][i].user_supervisor = 0; 
+            vidmem_tables[t][i].write_through = 0;
+            vidmem_tables[t][i].cache_disable = 0;
+            vidmem_tables[t][i].accessed = 0;
+            vidmem_tables[t][i].dirty = 0;
+            vidmem_tables[t][i].page_attribute_table = 0;
+            vidmem_tables[t][i].global = 0;
+            vidmem_tables[t][i].available_3 = 0;
+            vidmem_tables[t][i].address_31_12 = i;
+            
+            if (i == VIDMEMIDX)
+            {
+                vidmem_tables[t][i].user_supervisor = 1;
+                vidmem_tables[t][i].address_31_12 = VIDMEM_PAGE(t, 0) >> ADDRSHIFT;
+                vidmem_tables[t][i].present = 1;
+            }
+            else
+            {
+                vidmem_tables[t][i].present = 0;
+            }
         }
     }
     
 
 
+    /* the clock page at CLOCKPAGE, nothing else in its 4MB */
+    memset(clock_table, 0, sizeof(clock_table));
+    clock_table[0].address_31_12 = clock_page_phys() >> ADDRSHIFT;
+    clock_table[0].user_supervisor = 1;
+    clock_table[0].read_write = 0;
+    clock_table[0].global = 1;
+    clock_table[0].present = 1;
+
+    /* kernel heap window starts out empty, kpage_alloc fills it in */
+    memset(kheap_tables, 0, sizeof(kheap_tables));
+    kheap_hint = 0;
+
     /*sets up page directory for PD[0] */
     for (i = 0; i < DIRSIZE; i++)
     {
@@ -97,6 +165,7 @@ void paging_init(void) {
             page_directory[i].page_size = 1;
             page_directory[i].address_31_12 = KERNEL >> ADDRSHIFT;
             page_directory[i].user_supervisor = 0;
+            page_directory[i].global = 1;
             page_directory[i].present = 1; 
         }
 
@@ -110,36 +179,57 @@ void paging_init(void) {
         else if (i == VGAIDX)
         {
             page_directory[i].page_size = 1;
-            page_directory[i].address_31_12 = VGAADDR >> ADDRSHIFT;
+            page_directory[i].address_31_12 = vga_page >> ADDRSHIFT;
             page_directory[i].user_supervisor = 1;
+            page_directory[i].global = 1;
             page_directory[i].present = 1; 
         }
         else if (i == TERM1)
         {
             page_directory[i].page_size = 1;
-            page_directory[i].address_31_12 = TERM1ADDR >> ADDRSHIFT;
+            page_directory[i].address_31_12 = term1_page >> ADDRSHIFT;
             page_directory[i].user_supervisor = 1;
+            page_directory[i].global = 1;
             page_directory[i].present = 1; 
         }
         else if (i == TERM2)
         {
             page_directory[i].page_size = 1;
-            page_directory[i].address_31_12 = TERM2ADDR >> ADDRSHIFT;
+            page_directory[i].address_31_12 = term2_page >> ADDRSHIFT;
             page_directory[i].user_supervisor = 1;
+            page_directory[i].global = 1;
             page_directory[i].present = 1; 
         }
         else if (i == TERM3)
         {
             page_directory[i].page_size = 1;
-            page_directory[i].address_31_12 = TERM3ADDR >> ADDRSHIFT;
+            page_directory[i].address_31_12 = term3_page >> ADDRSHIFT;
             page_directory[i].user_supervisor = 1;
+            page_directory[i].global = 1;
             page_directory[i].present = 1; 
         }
 
+        /* index 2-5: kernel heap window */
+        else if (i >= KHEAPIDX && i < KHEAPIDX + KHEAP_TABLES)
+        {
+            page_directory[i].page_size = 0;
+            page_directory[i].address_31_12 = (uint32_t)(kheap_tables[i - KHEAPIDX]) >> ADDRSHIFT;
+            page_directory[i].user_supervisor = 0;
+            page_directory[i].present = 1;
+        }
+
+        else if (i == CLOCKPAGEIDX)
+        {
+            page_directory[i].page_size = 0;
+            page_directory[i].address_31_12 = (uint32_t)(clock_table) >> ADDRSHIFT;
+            page_directory[i].user_supervisor = 1;
+            page_directory[i].present = 1;
+        }
+
         else if (i == VIRVIDMEMIDX)
         {
             page_directory[i].page_size = 0;
-            page_directory[i].address_31_12 = (uint32_t)(vidmem_table) >> ADDRSHIFT;
+            page_directory[i].address_31_12 = (uint32_t)(vidmem_tables[0]) >> ADDRSHIFT;
             page_directory[i].user_supervisor = 1;
             page_directory[i].present = 1; 
         }
@@ -158,3 +248,287 @@ void paging_init(void) {
     loadPageDirectory(page_directory);
     enablePaging();
 }
+
+
+/*
+*   void* kpage_alloc(uint32_t npages)
+*   maps npages virtually contiguous 4KB pages into the kernel heap window.
+*   the frames behind them come from page_alloc and don't have to be contiguous
+*   args: npages - number of pages
+*   ret: kernel virtual address of the first page, NULL if out of memory or window space
+*/
+void* kpage_alloc(uint32_t npages)
+{
+    pte_t*   pte = &kheap_tables[0][0];
+    uint32_t start, run, i, phys;
+    uint32_t flags;
+
+    if (npages == 0 || npages > KHEAP_PAGES)
+    {
+        return NULL;
+    }
+
+    spin_lock_irqsave(&kheap_lock, flags);
+
+    /* first fit from the hint, wrapping around once */
+    start = kheap_hint;
+    run = 0;
+    for (i = 0; i < KHEAP_PAGES + npages && run < npages; i++)
+    {
+        uint32_t idx = (kheap_hint + i) % KHEAP_PAGES;
+        if (idx == 0)
+        {
+            run = 0;            // runs can't wrap past the end of the window
+        }
+        if (pte[idx].present)
+        {
+            run = 0;
+            continue;
+        }
+        if (run == 0)
+        {
+            start = idx;
+        }
+        run++;
+    }
+    if (run < npages)
+    {
+        spin_unlock_irqrestore(&kheap_lock, flags);
+        return NULL;
+    }
+
+    for (i = 0; i < npages; i++)
+    {
+        phys = page_alloc();
+        if (phys == 0)
+        {
+            /* undo what we mapped so far */
+            while (i-- > 0)
+            {
+                page_free(pte[start + i].address_31_12 << ADDRSHIFT);
+                pte[start + i].present = 0;
+                invlpg(KHEAP + ((start + i) << ADDRSHIFT));
+            }
+            spin_unlock_irqrestore(&kheap_lock, flags);
+            return NULL;
+        }
+        pte[start + i].address_31_12 = phys >> ADDRSHIFT;
+        pte[start + i].read_write = 1;
+        pte[start + i].user_supervisor = 0;
+        pte[start + i].global = 1;
+        pte[start + i].present = 1;
+    }
+    kheap_hint = (start + npages) % KHEAP_PAGES;
+
+    spin_unlock_irqrestore(&kheap_lock, flags);
+
+    /* entries went from not present to present, nothing stale in the TLB */
+    return (void*)(KHEAP + (start << ADDRSHIFT));
+}
+
+/*
+*   void kpage_free(void* addr, uint32_t npages)
+*   unmaps pages from kpage_alloc and returns their frames to the buddy allocator
+*   args: addr - address returned by kpage_alloc
+*         npages - number of pages it was allocated with
+*   ret: void
+*/
+void kpage_free(void* addr, uint32_t npages)
+{
+    pte_t*   pte = &kheap_tables[0][0];
+    uint32_t start, i;
+    uint32_t flags;
+
+    if ((uint32_t)addr < KHEAP || (uint32_t)addr >= KHEAP + (KHEAP_PAGES << ADDRSHIFT))
+    {
+        return;
+    }
+    start = ((uint32_t)addr - KHEAP) >> ADDRSHIFT;
+    if (start + npages > KHEAP_PAGES)
+    {
+        return;
+    }
+
+    spin_lock_irqsave(&kheap_lock, flags);
+    for (i = 0; i < npages; i++)
+    {
+        if (pte[start + i].present)
+        {
+            page_free(pte[start + i].address_31_12 << ADDRSHIFT);
+            pte[start + i].present = 0;
+            // global, a cr3 reload wouldn't drop it
+            invlpg((uint32_t)addr + (i << ADDRSHIFT));
+        }
+    }
+    // the other cpus share the heap tables
+    smp_tlb_shootdown();
+    spin_unlock_irqrestore(&kheap_lock, flags);
+}
+
+/*
+*   uint32_t kheap_virt_to_phys(void* addr)
+*   looks up the physical address behind a kernel heap address
+*   args: addr - address inside the kernel heap window
+*   ret: physical address, 0 if not mapped
+*/
+uint32_t kheap_virt_to_phys(void* addr)
+{
+    pte_t*   pte = &kheap_tables[0][0];
+    uint32_t idx;
+
+    if ((uint32_t)addr < KHEAP || (uint32_t)addr >= KHEAP + (KHEAP_PAGES << ADDRSHIFT))
+    {
+        return 0;
+    }
+    idx = ((uint32_t)addr - KHEAP) >> ADDRSHIFT;
+    if (!pte[idx].present)
+    {
+        return 0;
+    }
+    return (pte[idx].address_31_12 << ADDRSHIFT) | ((uint32_t)addr & (PAGESIZE - 1));
+}
+
+/*
+*   void tlb_flush_range(uint32_t start, uint32_t end)
+*   invalidates the TLB entries for [start, end). Only meant for per process
+*   (non global) mappings, big ranges fall back to a cr3 reload.
+*   every invlpg also drops the cached page directory entries, so this is
+*   also what to call after swapping page table PDEs
+*   args: start, end - page aligned virtual addresses
+*   ret: void
+*/
+void tlb_flush_range(uint32_t start, uint32_t end)
+{
+    uint32_t va;
+
+    if (((end - start) >> ADDRSHIFT) > INVLPG_CEILING)
+    {
+        flushTLB();
+        return;
+    }
+
+    invlpg(start);
+    for (va = start + PAGESIZE; va < end; va += PAGESIZE)
+    {
+        invlpg(va);
+    }
+}
+
+/*
+*   pde_t* pd_create(uint32_t user_page, int32_t term)
+*   makes a page directory for a new process. Every kernel PDE is copied from
+*   page_directory, so the kernel page tables (PD[0], heap window) are shared
+*   and kernel mappings never have to be synced between directories
+*   args: user_page - physical address of the 4MB program page
+*         term - terminal the process runs on, picks its vidmap table
+*   ret: the directory (kernel heap address), NULL if out of memory
+*/
+pde_t* pd_create(uint32_t user_page, int32_t term)
+{
+    pde_t* pd = (pde_t*)kpage_alloc(1);
+
+    if (pd == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(pd, page_directory, DIRSIZE * sizeof(pde_t));
+    pd[USERIDX].address_31_12 = user_page >> ADDRSHIFT;
+    pd[VIRVIDMEMIDX].address_31_12 = (uint32_t)(vidmem_tables[term]) >> ADDRSHIFT;
+    return pd;
+}
+
+/*
+*   void pd_destroy(pde_t* pd)
+*   frees a process's page directory. It must not be in any cpu's cr3: halt switches to the
+*   parent's first, and a cpu with nothing to run goes back to page_directory, so another cpu
+*   only has it loaded while running the process, which isn't exiting. Freeing it anyway
+*   would leave that cpu walking a recycled page, so that's a kernel bug and stops here
+*   args: pd - directory from pd_create
+*   ret: void
+*/
+void pd_destroy(pde_t* pd)
+{
+    int32_t i;
+
+    if (pd == NULL || pd == page_directory)
+    {
+        return;
+    }
+    for (i = 0; i < ncpus; i++)
+    {
+        if (cpus[i].pd == pd)
+        {
+            printf("pd_destroy: directory %x still loaded on cpu %d\n", (uint32_t)pd, i);
+            asm volatile ("cli; 1: hlt; jmp 1b");
+        }
+    }
+    kpage_free(pd, 1);
+}
+
+/*
+*   void pd_switch(pde_t* pd)
+*   switches address space, a single cr3 load. Global kernel entries survive it
+*   args: pd - directory from pd_create, or page_directory
+*   ret: void
+*/
+void pd_switch(pde_t* pd)
+{
+    cpu_t* c = this_cpu();
+
+    if (pd == c->pd)
+    {
+        return;
+    }
+    c->pd = pd;
+    if (pd == page_directory)
+    {
+        loadPageDirectory(page_directory);
+    }
+    else
+    {
+        loadPageDirectory((pde_t*)kheap_virt_to_phys(pd));
+    }
+}
+
+/*
+*   void vidmap_update(int32_t visible)
+*   repoints every terminal's vidmap page when the visible terminal changes
+*   args: visible - the terminal now on screen
+*   ret: void
+*/
+void vidmap_update(int32_t visible)
+{
+    int t;
+
+    for (t = 0; t < MAX_TERMINALS; t++)
+    {
+        vidmem_tables[t][VIDMEMIDX].address_31_12 = VIDMEM_PAGE(t, visible) >> ADDRSHIFT;
+    }
+    invlpg(VIRVIDMEM + (VIDMEMIDX << ADDRSHIFT));
+    smp_tlb_shootdown();
+}
+
+
+/*
+*   void paging_map_mmio(uint32_t phys)
+*   identity maps the 4MB page around a device's registers (the APICs), kernel
+*   only, uncached and global. Every process directory is copied from
+*   page_directory, so this has to happen before the first one is made
+*   args: phys - physical address of the registers
+*   ret: void
+*/
+void paging_map_mmio(uint32_t phys)
+{
+    pde_t* pde = &page_directory[phys >> 22];
+
+    pde->page_size = 1;
+    pde->address_31_12 = (phys & ~(FOUR_MB_PAGE - 1)) >> ADDRSHIFT;
+    pde->user_supervisor = 0;
+    pde->read_write = 1;
+    pde->write_through = 1;
+    pde->cache_disable = 1;
+    pde->global = 1;
+    pde->present = 1;
+    invlpg(phys);
+}
@@ -1,3 +1,6 @@
+#ifndef _PAGING_H
+#define _PAGING_H
+
 #include "types.h"
 #include "x86_desc.h"
 
@@ -13,13 +16,21 @@
 #define USERIDX     32 
 #define VIRVIDMEMIDX    33
 #define VGAIDX  34
-#define VGAADDR     0x8800000
+#define VGAADDR     0x8800000           // virtual, the frames behind these come from frame_alloc
 #define TERM1  35
 #define TERM1ADDR     0x8C00000
 #define TERM2  36
 #define TERM2ADDR     0x9000000
 #define TERM3  37
 #define TERM3ADDR     0x9400000
+#define KHEAP       0x800000            // kernel heap window, backed by 4KB pages from the buddy allocator
+#define KHEAPIDX    2
+#define KHEAP_TABLES    4               // 4 page tables -> 16MB window, PD[2] - PD[5]
+#define KHEAP_PAGES     (KHEAP_TABLES * TABLESIZE)
+#define FOUR_MB_PAGE    0x400000
+#define CLOCKPAGE       0xB800000       // clock.h's page, read only in every process
+#define CLOCKPAGEIDX    46
+#define INVLPG_CEILING  32              // past this many pages a cr3 reload is cheaper than invlpg
 
 /*struct for page directory entry*/
 typedef struct __attribute__((packed)) pde_t {
@@ -53,17 +64,61 @@ typedef struct __attribute__((packed)) pte_t {
 
 // pde_t page_directory[DIRSIZE] __attribute__((aligned (PAGESIZE)));
 // pte_t page_table[TABLESIZE] __attribute__((aligned (PAGESIZE)));
-pte_t vidmem_table[TABLESIZE] __attribute__((aligned (PAGESIZE)));
+/* boot/kernel directory, also the template every process directory is copied from */
 pde_t page_directory[DIRSIZE] __attribute__((aligned (PAGESIZE)));
 pte_t page_table[TABLESIZE] __attribute__((aligned (PAGESIZE)));
-pte_t vidmem_table[TABLESIZE] __attribute__((aligned (PAGESIZE)));
 
 
 /*initializes paging*/
 extern void paging_init(void);
 
+/*maps npages fresh 4KB pages into the kernel heap window, returns NULL if out of memory*/
+extern void* kpage_alloc(uint32_t npages);
+
+/*unmaps pages from kpage_alloc and gives the frames back*/
+extern void kpage_free(void* addr, uint32_t npages);
+
+/*physical address behind a kernel heap address*/
+extern uint32_t kheap_virt_to_phys(void* addr);
+
 /*declaration for enablePaging function in enablepaging.S*/
 extern void enablePaging(void);
 
 /*declaration for loadPageDirectory function in enablepaging.S*/
 extern void loadPageDirectory(pde_t * page_directory); 
+
+/*declaration for flushTLB function in enablepaging.S*/
+extern void flushTLB(void);
+
+/*declaration for flushTLBGlobal function in enablepaging.S*/
+extern void flushTLBGlobal(void);
+
+/*invalidates the TLB entry for one page, global or not*/
+static inline void invlpg(uint32_t addr)
+{
+    asm volatile ("invlpg (%0)"
+            :
+            : "r"(addr)
+            : "memory"
+    );
+}
+
+/*invalidates the (non global) pages in [start, end), at least one invlpg is always done*/
+extern void tlb_flush_range(uint32_t start, uint32_t end);
+
+/*page directory for a new process, sharing the kernel page tables*/
+extern pde_t* pd_create(uint32_t user_page, int32_t term);
+
+/*frees a process's page directory*/
+extern void pd_destroy(pde_t* pd);
+
+/*loads a page directory into cr3*/
+extern void pd_switch(pde_t* pd);
+
+/*points each terminal's vidmap page at video memory or its backup page*/
+extern void vidmap_update(int32_t visible);
+
+/*identity maps device registers (4MB at a time), uncached*/
+extern void paging_map_mmio(uint32_t phys);
+
+#endif /* _PAGING_H */
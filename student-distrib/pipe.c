@@ -0,0 +1,264 @@
+/** pipe.c
+ *  Pipe driver: single producer / single consumer ring buffer behind a pair of fds
+*/
+
+#include "pipe.h"
+#include "uaccess.h"
+#include "lib.h"
+#include "spinlock.h"
+
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+static kmem_cache_t* pipe_cache;
+static fot_t pipe_read_fot;
+static fot_t pipe_write_fot;
+static spinlock_t pipe_lock = SPINLOCK_INIT("pipe");   // every pipe's reader and writer counts
+/*************************************************************************/
+
+
+/** pipe_init
+ * DESCRIPTION: create the pipe cache and fill in the pipe file operations
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: must run after slab_init
+*/
+void pipe_init(void)
+{
+    pipe_cache = kmem_cache_create("pipe", sizeof(pipe_t), CACHE_LINE_SIZE, NULL);
+
+    pipe_read_fot.read   = &pipe_read;
+    pipe_read_fot.write  = &pipe_write;
+    pipe_read_fot.open   = &pipe_open;
+    pipe_read_fot.close  = &pipe_close;
+    pipe_read_fot.dup    = &pipe_dup;
+
+    pipe_write_fot.read  = &pipe_read;
+    pipe_write_fot.write = &pipe_write;
+    pipe_write_fot.open  = &pipe_open;
+    pipe_write_fot.close = &pipe_close;
+    pipe_write_fot.dup   = &pipe_dup;
+    // nolock stays 0: each end wakes the other's sleepers, and wake_up needs the kernel lock
+}
+
+
+/** pipe_create
+ * DESCRIPTION: make an empty pipe and set up its read and write ends
+ * INPUTS: rd, wr - unused entries of the caller's fd table
+ * OUTPUTS: 0 on success, -1 if out of memory
+ * SIDE EFFECTS: marks both entries in use
+*/
+int32_t pipe_create(fde_t* rd, fde_t* wr)
+{
+    pipe_t* p = kmem_cache_alloc(pipe_cache);
+
+    if (p == NULL)
+    {
+        return -1;
+    }
+    p->buf = kpage_alloc(PIPE_PAGES);
+    if (p->buf == NULL)
+    {
+        kmem_cache_free(pipe_cache, p);
+        return -1;
+    }
+    p->head    = 0;
+    p->tail    = 0;
+    p->readers = 1;
+    p->writers = 1;
+    wq_init(&p->readq);
+    wq_init(&p->writeq);
+
+    rd->fot_ptr  = &pipe_read_fot;
+    rd->inode    = 0;
+    rd->file_pos = 0;
+    rd->data     = p;
+    rd->cloexec  = 1;
+    rd->flag     = 1;
+
+    wr->fot_ptr  = &pipe_write_fot;
+    wr->inode    = 0;
+    wr->file_pos = 0;
+    wr->data     = p;
+    wr->cloexec  = 1;
+    wr->flag     = 1;
+    return 0;
+}
+
+
+/** pipe_read
+ * DESCRIPTION: read whatever is in the pipe, up to nbytes. waits if it's empty
+ * INPUTS: fd - a read end
+ *         buf - user buffer
+ *         nbytes - most bytes to read
+ * OUTPUTS: bytes read, 0 at end of file (empty and no writers), -1 on a write end or bad buffer
+ * SIDE EFFECTS: may sleep on the pipe
+*/
+int32_t pipe_read(int32_t fd, int8_t* buf, int32_t nbytes)
+{
+    fde_t*   f = &cur_pcb->fdt[fd];
+    pipe_t*  p = f->data;
+    uint32_t avail, n, off, first;
+
+    if (f->fot_ptr != &pipe_read_fot || nbytes < 0)
+    {
+        return -1;
+    }
+    if (nbytes == 0)
+    {
+        return 0;
+    }
+
+    wait_event(&p->readq, p->head != p->tail || p->writers == 0);
+    if ((avail = p->head - p->tail) == 0)
+    {
+        return 0;
+    }
+
+    n     = MIN(avail, (uint32_t)nbytes);
+    off   = p->tail & PIPE_MASK;
+    first = MIN(n, PIPE_SIZE - off);
+    if (copy_to_user(buf, p->buf + off, first) != 0 ||
+        copy_to_user(buf + first, p->buf, n - first) != 0)
+    {
+        return -1;
+    }
+
+    // the bytes are out before the writer is allowed to reuse them
+    asm volatile ("" : : : "memory");
+    p->tail += n;
+    wake_up(&p->writeq);
+    return n;
+}
+
+
+/** pipe_write
+ * DESCRIPTION: write all of buf into the pipe, waiting for room as needed
+ * INPUTS: fd - a write end
+ *         buf - user buffer
+ *         nbytes - bytes to write
+ * OUTPUTS: nbytes, fewer if the last reader went away part way, -1 if there are no readers
+ * SIDE EFFECTS: may sleep on the pipe
+*/
+int32_t pipe_write(int32_t fd, const int8_t* buf, int32_t nbytes)
+{
+    fde_t*   f = &cur_pcb->fdt[fd];
+    pipe_t*  p = f->data;
+    uint32_t space, n, off, first;
+    int32_t  done = 0;
+
+    if (f->fot_ptr != &pipe_write_fot || nbytes < 0)
+    {
+        return -1;
+    }
+
+    while (done < nbytes)
+    {
+        wait_event(&p->writeq, p->head - p->tail < PIPE_SIZE || p->readers == 0);
+        if (p->readers == 0)
+        {
+            return (done > 0) ? done : -1;
+        }
+        space = PIPE_SIZE - (p->head - p->tail);
+
+        n     = MIN(space, (uint32_t)(nbytes - done));
+        off   = p->head & PIPE_MASK;
+        first = MIN(n, PIPE_SIZE - off);
+        if (copy_from_user(p->buf + off, buf + done, first) != 0 ||
+            copy_from_user(p->buf, buf + done + first, n - first) != 0)
+        {
+            return (done > 0) ? done : -1;
+        }
+
+        // publish the bytes only once they're in the buffer
+        asm volatile ("" : : : "memory");
+        p->head += n;
+        done += n;
+        wake_up(&p->readq);
+    }
+    return done;
+}
+
+
+/** pipe_open
+ * DESCRIPTION: pipes are made with the pipe system call, not opened by name
+ * OUTPUTS: -1
+*/
+int32_t pipe_open(const int8_t* filename)
+{
+    return -1;
+}
+
+
+/** pipe_close
+ * DESCRIPTION: close one end. The pipe is freed with its last end
+ * INPUTS: fd - a pipe end
+ * OUTPUTS: 0, -1 if the fd has no pipe
+ * SIDE EFFECTS: a reader waiting on the last writer sees end of file, a writer waiting on the
+ *               last reader gets an error
+*/
+int32_t pipe_close(int32_t fd)
+{
+    fde_t*   f = &cur_pcb->fdt[fd];
+    pipe_t*  p = f->data;
+    uint32_t flags;
+    int32_t  last;
+
+    if (p == NULL)
+    {
+        return -1;
+    }
+
+    spin_lock_irqsave(&pipe_lock, flags);
+    if (f->fot_ptr == &pipe_read_fot)
+    {
+        p->readers--;
+    }
+    else
+    {
+        p->writers--;
+    }
+    last = (p->readers == 0 && p->writers == 0);
+    spin_unlock_irqrestore(&pipe_lock, flags);
+
+    // nobody else has the pipe once both counts are 0, it's freed without the lock
+    if (last)
+    {
+        kpage_free(p->buf, PIPE_PAGES);
+        kmem_cache_free(pipe_cache, p);
+    }
+    else
+    {
+        // the other side may be waiting on us, it sees EOF / no readers now
+        wake_up(&p->readq);
+        wake_up(&p->writeq);
+    }
+
+    f->data = NULL;
+    return 0;
+}
+
+
+/** pipe_dup
+ * DESCRIPTION: count another copy of a pipe end
+ * INPUTS: f - the new fd entry, already a copy of the old one
+ * OUTPUTS: none
+ * SIDE EFFECTS: the pipe stays open until this copy is closed too
+*/
+void pipe_dup(fde_t* f)
+{
+    pipe_t*  p = f->data;
+    uint32_t flags;
+
+    spin_lock_irqsave(&pipe_lock, flags);
+    if (f->fot_ptr == &pipe_read_fot)
+    {
+        p->readers++;
+    }
+    else
+    {
+        p->writers++;
+    }
+    spin_unlock_irqrestore(&pipe_lock, flags);
+}
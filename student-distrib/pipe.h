@@ -0,0 +1,56 @@
+/* pipe.h - anonymous pipes between processes
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PIPE_H
+#define _PIPE_H
+
+#include "types.h"
+#include "syscall.h"
+#include "paging.h"
+#include "slab.h"
+#include "waitq.h"
+
+/** BACKGROUND:
+ *  - A pipe is a PIPE_SIZE byte ring buffer with a read end and a write end, each an fd with its
+ *    own fot_t. PIPE_SIZE is a power of two and head/tail are free running counters, so the fill
+ *    level is head - tail and the buffer offset is a mask, no modulo and no wrap flag.
+ *  - Only the writer moves head and only the reader moves tail, so the ring itself needs no
+ *    lock: the data is copied before the counter that publishes it is stored. head and tail sit
+ *    on separate cache lines so the two sides don't bounce one line back and forth.
+ *  - A reader with nothing to read (or a writer with no room) sleeps on the pipe's wait queue
+ *    until the other side moves its counter. Reads return what is there, writes block until
+ *    everything is in.
+ *  - Reading an empty pipe with no writers left returns 0 (end of file), writing to a pipe with
+ *    no readers left returns -1.
+ */
+#define PIPE_PAGES          4
+#define PIPE_SIZE           (PIPE_PAGES * PAGESIZE)     // must stay a power of two
+#define PIPE_MASK           (PIPE_SIZE - 1)
+
+typedef struct {
+    volatile uint32_t head;                     /* bytes ever written, moved by the writer */
+    uint8_t  pad0[CACHE_LINE_SIZE - sizeof(uint32_t)];
+    volatile uint32_t tail;                     /* bytes ever read, moved by the reader */
+    uint8_t  pad1[CACHE_LINE_SIZE - sizeof(uint32_t)];
+    uint8_t* buf;                               /* PIPE_SIZE bytes from kpage_alloc */
+    int32_t  readers;                           /* open read ends */
+    int32_t  writers;                           /* open write ends */
+    wait_queue_t readq;                         /* readers waiting for data */
+    wait_queue_t writeq;                        /* writers waiting for room */
+} pipe_t;
+
+/* create the pipe object cache and the pipe file operations */
+void pipe_init(void);
+
+/* make a new pipe and install its two ends in the given (free) fd entries */
+int32_t pipe_create(fde_t* rd, fde_t* wr);
+
+/* file operations, used through pipe_read_fot / pipe_write_fot */
+int32_t pipe_read(int32_t fd, int8_t* buf, int32_t nbytes);
+int32_t pipe_write(int32_t fd, const int8_t* buf, int32_t nbytes);
+int32_t pipe_open(const int8_t* filename);
+int32_t pipe_close(int32_t fd);
+void pipe_dup(fde_t* f);
+
+#endif /* _PIPE_H */
@@ -8,10 +8,16 @@
 #include "tests.h"
 #include "scheduler.h"
 #include "rtc.h"
+#include "apic.h"
+#include "prof.h"
 
 static uint16_t frequency_divider;   // 16-bit value from 0 to 65535. Divides base frequency to get lower frequency.
 
-#define IRQ0_MS             25      // number of milliseconds between IRQ0 ints
+#define IRQ0_HZ             (1000000 / PIT_TICK_US)    // IRQ0 ints a second
+#define CALIBRATE_US        50000   // how long to count the tsc against the pit for
+
+uint32_t tsc_khz;                   // tsc cycles per millisecond, measured at boot
+uint32_t tsc_per_us;                // the same rounded down to cycles per microsecond
 
 /** pit_init
  * DESCRIPTION: initialize the PIT
@@ -24,8 +30,9 @@ void pit_init()
 {
     uint8_t write_byte;
 
-    /* set the frequency divider to correspond to 25ms interrupts (47727) */
-    frequency_divider = IRQ0_BASE_FREQUENCY / IRQ0_MS;
+    /* set the frequency divider to correspond to 25ms interrupts (29829). pit_arm only reloads
+       the high byte, so a tick really counts 0x7400, about 24.9ms */
+    frequency_divider = IRQ0_BASE_FREQUENCY / IRQ0_HZ;
 
     /* configure Channel 0 and write to CMD port */
     write_byte = SELECT_CHANNEL_0 | ACCESS_MODE_LOBYTE_HBYTE | OPERATING_MODE_0 | BINARY_MODE;
@@ -37,35 +44,133 @@ void pit_init()
 
     /* configure PIT to acknowledge interrupts in only one command */
     outb(SELECT_CHANNEL_0 | ACCESS_MODE_HIBYTE | OPERATING_MODE_0 | BINARY_MODE, MODE_CMD_PORT);
+    pit_arm();
 
     enable_irq(PIT_IRQ);
 
+    pit_calibrate_tsc();
+}
+
+
+/** pit_delay_us
+ * DESCRIPTION: busy wait on channel 2, the only pit channel whose output can be polled. for
+ *              calibrating the other clocks at boot, not for general use
+ * INPUTS: us - microseconds, at most 54000 (one 16 bit count)
+ * OUTPUTS: none
+ * SIDE EFFECTS: takes channel 2 from the speaker, which is left muted
+*/
+void pit_delay_us(uint32_t us)
+{
+    uint32_t count = us * (IRQ0_BASE_FREQUENCY / 1000) / 1000;
+    uint8_t  gate;
+
+    // gate on so the count runs, speaker data off so it isn't heard
+    gate = inb(CHAN_2_RW_PORT);
+    outb((gate & ~CHAN_2_SPEAKER) | CHAN_2_GATE, CHAN_2_RW_PORT);
+
+    // mode 0: the output goes high when the count runs out
+    outb(SELECT_CHANNEL_2 | ACCESS_MODE_LOBYTE_HBYTE | OPERATING_MODE_0 | BINARY_MODE, MODE_CMD_PORT);
+    outb((uint8_t)low_byte(count), CHAN_2_DATA_PORT);
+    outb((uint8_t)high_byte(count), CHAN_2_DATA_PORT);
+    while (!(inb(CHAN_2_RW_PORT) & CHAN_2_OUT));
+
+    outb(gate & ~(CHAN_2_SPEAKER | CHAN_2_GATE), CHAN_2_RW_PORT);
+}
+
+
+/** pit_calibrate_tsc
+ * DESCRIPTION: measure the tsc's rate against the pit
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: sets tsc_khz and tsc_per_us
+*/
+void pit_calibrate_tsc(void)
+{
+    uint64_t start = rdtsc();
+
+    pit_delay_us(CALIBRATE_US);
+    tsc_khz = (uint32_t)(rdtsc() - start) / (CALIBRATE_US / 1000);
+    tsc_per_us = tsc_khz / 1000;
+    if (tsc_per_us == 0)
+    {
+        tsc_per_us = 1;
+    }
 }
 
 
 /** pit_handler
- * DESCRIPTION: call scheduler on each interrupt
+ * DESCRIPTION: charge each interrupt to the running process, the scheduler switches when its
+ *              slice is used up
  * INPUTS: none
  * OUTPUTS: none
- * SIDE EFFECTS: none
+ * SIDE EFFECTS: takes a profiling sample while the profiler runs (prof.h)
 */
 void pit_handler()
 {
 
     cli();
 
+    // one shot: the scheduler re-arms the pit only if it wants another tick
+    send_eoi(PIT_IRQ);
+    if (prof_running)
+    {
+        prof_tick();
+    }
+    // with the local APIC timer the pit is only ever the profiler's
+    if (lapic_timer_on)
+    {
+        return;
+    }
+    sti();
+
+    sched_tick();
+
+}
+
+
+
+/** pit_arm
+ * DESCRIPTION: start counting down one tick, IRQ0 fires when it runs out
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: restarts the count if one was already running
+*/
+void pit_arm(void)
+{
     /** PIT is configured to ACCESS_MODE_HIBYTE.
-     *  acknowledge the interrupt by resetting the Channel 0 reload value high byte */
+     *  writing the Channel 0 reload value high byte starts a new count */
     outb(high_byte(frequency_divider), CHAN_0_DATA_PORT);
+}
 
-    send_eoi(PIT_IRQ);
-    sti();
 
-    task_switch();
+/** pit_periodic
+ * DESCRIPTION: interrupt at a fixed rate, reloading by itself, rather than once per pit_arm
+ * INPUTS: hz - interrupts a second, at least 19
+ * OUTPUTS: none
+ * SIDE EFFECTS: pit_stop goes back to one shot, the next pit_arm starts a normal tick
+*/
+void pit_periodic(uint32_t hz)
+{
+    uint32_t divider = IRQ0_BASE_FREQUENCY / hz;
 
+    outb(SELECT_CHANNEL_0 | ACCESS_MODE_LOBYTE_HBYTE | OPERATING_MODE_RATE | BINARY_MODE, MODE_CMD_PORT);
+    outb((uint8_t)low_byte(divider), CHAN_0_DATA_PORT);
+    outb((uint8_t)high_byte(divider), CHAN_0_DATA_PORT);
 }
 
 
+/** pit_stop
+ * DESCRIPTION: cancel the running count, no IRQ0 until the next pit_arm
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: none
+*/
+void pit_stop(void)
+{
+    /* writing the mode stops channel 0 until a new count is written */
+    outb(SELECT_CHANNEL_0 | ACCESS_MODE_HIBYTE | OPERATING_MODE_0 | BINARY_MODE, MODE_CMD_PORT);
+}
+
 
 #if ENABLE_SOUND
 
@@ -21,6 +21,7 @@
  **/
 #define IRQ0_BASE_FREQUENCY 1193180 // the frequency at which pit generates an IRQ0 Int
 #define PIT_IRQ             0
+#define PIT_TICK_US         25000   // time between IRQ0s, the scheduler's tick (SCHED_TICK_US)
 
 /** CHANNELS:
  * CHANNEL 0: 
@@ -50,6 +51,9 @@
  * Output     -> BIT 5: output voltage, high or low
 */
 #define CHAN_2_RW_PORT     0x61     // gate can be enabled / disabled through bit 0
+#define CHAN_2_GATE        0x01
+#define CHAN_2_SPEAKER     0x02     // speaker data enable
+#define CHAN_2_OUT         0x20     // channel 2 output, read only
 
 
 /** CMD:
@@ -84,6 +88,7 @@
 #define ACCESS_MODE_LOBYTE_HBYTE 0x30
 #define OPERATING_MODE_0         0x00 // used for IRQ0
 #define OPERATING_MODE_SQR_WAVE  0x06 // used for speakers
+#define OPERATING_MODE_RATE      0x04 // periodic IRQ0, for the profiler
 #define BINARY_MODE              0x00
 
 
@@ -98,6 +103,21 @@
 void pit_init();
 void pit_handler();
 
+/* one shot ticks: start one / cancel the one running */
+void pit_arm(void);
+void pit_stop(void);
+
+/* periodic IRQ0 at hz until pit_stop, when the local APIC timer has the scheduler */
+void pit_periodic(uint32_t hz);
+
+/* busy wait on channel 2, boot time calibration only */
+void pit_delay_us(uint32_t us);
+
+/* measure tsc_khz and tsc_per_us, pit_init does it */
+void pit_calibrate_tsc(void);
+extern uint32_t tsc_khz;
+extern uint32_t tsc_per_us;
+
 
 void play_sound(uint32_t nFrequency);
 void speaker_beep(uint32_t nFrequency);
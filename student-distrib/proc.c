@@ -0,0 +1,247 @@
+/** proc.c
+ *  Process table: free pid bitmap, pid -> pcb index and kernel stack allocation
+*/
+
+#include "proc.h"
+#include "paging.h"
+#include "lib.h"
+#include "spinlock.h"
+#include "smp.h"
+
+#define BITS_PER_WORD   32
+#define WORD_SHIFT      5
+#define WORD_MASK       (BITS_PER_WORD - 1)
+#define FULL_WORD       0xFFFFFFFF
+#define BASE_PID_MASK   ((1 << MAX_TERMINALS) - 1)
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+static uint32_t pid_map[PID_WORDS];             // set bit = pid in use
+static pcb_t*   pid_table[MAX_PID];             // pid -> pcb
+static uint32_t pid_hint;                       // word to start the next search from
+static uint32_t num_procs;
+
+static void*    stack_cache[KSTACK_CACHE];      // freed pcb + kernel stack blocks
+static uint32_t num_cached;
+static void*    zombie[SMP_MAX_CPUS];           // per cpu, block of a halted process it may still be running on
+
+spinlock_t      proc_lock = SPINLOCK_INIT("proc");
+/*************************************************************************/
+
+
+/** release_block
+ * DESCRIPTION: put a pcb + stack block back, on the cache if there's room
+ * INPUTS: block - the block
+ * OUTPUTS: none
+ * SIDE EFFECTS: caller must hold proc_lock
+*/
+static void release_block(void* block)
+{
+    if (num_cached < KSTACK_CACHE)
+    {
+        stack_cache[num_cached++] = block;
+    }
+    else
+    {
+        kpage_free(block, KSTACK_PAGES);
+    }
+}
+
+
+/** on_block
+ * DESCRIPTION: checks if we're currently running on a pcb + stack block
+*/
+static int on_block(void* block)
+{
+    uint32_t esp;
+    asm volatile ("movl %%esp, %0" : "=r"(esp));
+    return (esp >= (uint32_t)block && esp < (uint32_t)block + KSTACK_SIZE);
+}
+
+
+/** reap
+ * DESCRIPTION: release the block of the last process that halted on this cpu once we're off its
+ *              stack. on_block only sees our own esp, so another cpu's zombie is left to it
+ * SIDE EFFECTS: caller must hold proc_lock
+*/
+static void reap(void)
+{
+    void** z = &zombie[cpu_id()];
+
+    if (*z != NULL && !on_block(*z))
+    {
+        release_block(*z);
+        *z = NULL;
+    }
+}
+
+
+/** proc_init
+ * DESCRIPTION: empty process table
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: must run after slab/paging setup, before the first execute
+*/
+void proc_init(void)
+{
+    memset(pid_map, 0, sizeof(pid_map));
+    memset(pid_table, 0, sizeof(pid_table));
+    pid_hint   = 0;
+    num_procs  = 0;
+    num_cached = 0;
+    memset(zombie, 0, sizeof(zombie));
+}
+
+
+/** proc_alloc
+ * DESCRIPTION: reserve a pid and get a zeroed pcb with a kernel stack above it
+ * INPUTS: want - a specific pid (the base shells use their terminal number),
+ *                or ANY_PID for the lowest free pid from MAX_TERMINALS up
+ * OUTPUTS: the pcb with pid filled in, NULL if no pid or memory is left
+ * SIDE EFFECTS: marks the pid in use
+*/
+pcb_t* proc_alloc(int32_t want)
+{
+    uint32_t flags;
+    uint32_t w, i, used;
+    int32_t  new_pid = -1;
+    pcb_t*   pcb;
+
+    spin_lock_irqsave(&proc_lock, flags);
+    reap();
+
+    if (want != ANY_PID)
+    {
+        if (want < 0 || want >= MAX_PID || proc_in_use(want))
+        {
+            spin_unlock_irqrestore(&proc_lock, flags);
+            return NULL;
+        }
+        new_pid = want;
+    }
+    else
+    {
+        for (i = 0; i < PID_WORDS; i++)
+        {
+            w = (pid_hint + i) % PID_WORDS;
+            // the base shell pids live in word 0 and are never handed out here
+            used = pid_map[w] | (w == 0 ? BASE_PID_MASK : 0);
+            if (used != FULL_WORD)
+            {
+                new_pid = (w << WORD_SHIFT) + find_first_zero(used);
+                pid_hint = w;
+                break;
+            }
+        }
+        if (new_pid == -1)
+        {
+            spin_unlock_irqrestore(&proc_lock, flags);
+            return NULL;
+        }
+    }
+
+    if (num_cached > 0)
+    {
+        pcb = (pcb_t*)stack_cache[--num_cached];
+    }
+    else
+    {
+        pcb = (pcb_t*)kpage_alloc(KSTACK_PAGES);
+        if (pcb == NULL)
+        {
+            spin_unlock_irqrestore(&proc_lock, flags);
+            return NULL;
+        }
+    }
+
+    pid_map[new_pid >> WORD_SHIFT] |= (1 << (new_pid & WORD_MASK));
+    pid_table[new_pid] = pcb;
+    num_procs++;
+    spin_unlock_irqrestore(&proc_lock, flags);
+
+    memset(pcb, 0, sizeof(pcb_t));
+    pcb->pid = new_pid;
+    return pcb;
+}
+
+
+/** proc_free
+ * DESCRIPTION: release a pid along with its pcb and kernel stack
+ * INPUTS: pid - the pid to free
+ * OUTPUTS: none
+ * SIDE EFFECTS: if we're running on its stack (halt), the block is released later
+*/
+void proc_free(int32_t pid)
+{
+    uint32_t flags;
+    pcb_t*   pcb;
+
+    if (pid < 0 || pid >= MAX_PID)
+    {
+        return;
+    }
+
+    spin_lock_irqsave(&proc_lock, flags);
+    pcb = pid_table[pid];
+    if (pcb == NULL)
+    {
+        spin_unlock_irqrestore(&proc_lock, flags);
+        return;
+    }
+
+    pid_map[pid >> WORD_SHIFT] &= ~(1 << (pid & WORD_MASK));
+    pid_table[pid] = NULL;
+    num_procs--;
+    if ((uint32_t)pid >= MAX_TERMINALS && (uint32_t)(pid >> WORD_SHIFT) < pid_hint)
+    {
+        pid_hint = pid >> WORD_SHIFT;
+    }
+
+    reap();
+    if (on_block(pcb))
+    {
+        zombie[cpu_id()] = pcb;
+    }
+    else
+    {
+        release_block(pcb);
+    }
+    spin_unlock_irqrestore(&proc_lock, flags);
+}
+
+
+/** proc_get
+ * DESCRIPTION: pid -> pcb
+ * INPUTS: pid - the pid
+ * OUTPUTS: the pcb, NULL if not in use
+*/
+pcb_t* proc_get(int32_t pid)
+{
+    if (pid < 0 || pid >= MAX_PID)
+    {
+        return NULL;
+    }
+    return pid_table[pid];
+}
+
+
+/** proc_in_use
+ * DESCRIPTION: checks the pid bitmap
+*/
+int32_t proc_in_use(int32_t pid)
+{
+    if (pid < 0 || pid >= MAX_PID)
+    {
+        return 0;
+    }
+    return (pid_map[pid >> WORD_SHIFT] >> (pid & WORD_MASK)) & 1;
+}
+
+
+/** proc_count
+ * DESCRIPTION: number of live processes
+*/
+uint32_t proc_count(void)
+{
+    return num_procs;
+}
@@ -0,0 +1,55 @@
+/* proc.h - process table: pid allocation and pid -> pcb lookup
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _PROC_H
+#define _PROC_H
+
+#include "types.h"
+#include "syscall.h"
+#include "terminal.h"
+#include "spinlock.h"
+
+/** BACKGROUND:
+ *  - Free pids are tracked in a bitmap (set bit = in use) and found with find_first_zero, so
+ *    allocation only looks at MAX_PID / 32 words in the worst case and usually just one.
+ *  - pids below MAX_TERMINALS belong to the base shell of that terminal. Everything else is
+ *    handed out from MAX_TERMINALS up.
+ *  - Each process gets one KSTACK_SIZE block from the kernel heap. The pcb sits at the bottom
+ *    and the kernel stack grows down from the top, same layout as the old fixed blocks below 8MB.
+ *  - Freed blocks are kept on a short list for the next execute. The block of a process that
+ *    halts is still the stack we're running on, so it is only released once we've left it.
+ *    Each cpu keeps its own such block and only that cpu releases it, since only it can tell
+ *    when it's off the stack.
+ */
+#define KSTACK_PAGES        2
+#define KSTACK_SIZE         (KSTACK_PAGES * PAGESIZE)
+#define KSTACK_CACHE        16                      // free blocks kept around for reuse
+#define PID_WORDS           (MAX_PID / 32)
+#define ANY_PID             -1
+
+/* top of a process's kernel stack, what goes in tss.esp0 */
+#define KSTACK_TOP(pcb)     ((uint32_t)(pcb) + KSTACK_SIZE - ESP0_OFFSET)
+
+/* covers the table and the stack cache */
+extern spinlock_t proc_lock;
+
+/* clear the table */
+void proc_init(void);
+
+/* reserve a pid and allocate its pcb + kernel stack. want is a specific pid or ANY_PID */
+pcb_t* proc_alloc(int32_t want);
+
+/* release a pid and its pcb + kernel stack */
+void proc_free(int32_t pid);
+
+/* pcb of a pid, NULL if the pid isn't in use */
+pcb_t* proc_get(int32_t pid);
+
+/* nonzero if the pid is in use */
+int32_t proc_in_use(int32_t pid);
+
+/* number of live processes */
+uint32_t proc_count(void);
+
+#endif /* _PROC_H */
@@ -0,0 +1,284 @@
+/** prof.c
+ *  Sampling profiler: where each cpu is on every profiling tick
+*/
+
+#include "prof.h"
+#include "lib.h"
+#include "smp.h"
+#include "apic.h"
+#include "pit.h"
+#include "paging.h"
+#include "proc.h"
+#include "irqstat.h"
+#include "serial.h"
+
+
+/* one cpu's samples. only that cpu moves head, only prof_read moves tail */
+typedef struct {
+    prof_sample_t*    buf;                  // PROF_SAMPLES, from kpage_alloc on the first start
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t          lost;
+} prof_ring_t;
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+volatile int32_t   prof_running;
+static prof_ring_t prof_rings[SMP_MAX_CPUS];
+/*************************************************************************/
+
+
+/** prof_stack_limit
+ * DESCRIPTION: top of the kernel stack esp is on, so a frame chain walk stays inside it
+ * INPUTS: esp - where the interrupted code's stack was
+ * OUTPUTS: the first address past its stack, 0 if it isn't one we know is mapped
+*/
+static uint32_t prof_stack_limit(uint32_t esp)
+{
+    uint32_t pcb = (uint32_t)cur_pcb;
+
+    // a process's kernel stack is the KSTACK_SIZE block its pcb starts
+    if (pcb != 0 && esp > pcb && esp < pcb + KSTACK_SIZE)
+    {
+        return pcb + KSTACK_SIZE;
+    }
+    // the boot, idle and AP stacks are in the kernel's own 4MB page
+    if (esp >= KERNEL && esp < KHEAP)
+    {
+        return KHEAP;
+    }
+    return 0;
+}
+
+
+/** prof_sample
+ * DESCRIPTION: record what this cpu's current interrupt interrupted
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: called from an interrupt handler, interrupts off
+*/
+static void prof_sample(void)
+{
+    prof_ring_t*   ring = &prof_rings[cpu_id()];
+    irq_regs_t*    r    = irq_regs();
+    prof_sample_t* s;
+    uint32_t       fp, limit;
+
+    if (ring->buf == NULL || r == NULL)
+    {
+        return;
+    }
+    if (ring->head - ring->tail >= PROF_SAMPLES)
+    {
+        ring->lost++;
+        return;
+    }
+
+    s        = &ring->buf[ring->head & PROF_MASK];
+    s->eip   = r->eip;
+    s->pid   = (cur_pcb != NULL) ? cur_pcb->pid : -1;
+    s->cpu   = cpu_id();
+    s->user  = (r->cs & 3) != 0;
+    s->depth = 0;
+
+    // kernel mode: the interrupt didn't switch stacks, the cpu pushed eip, cs and eflags on
+    // top of the interrupted one. each frame is [saved ebp][return address], going up
+    if (!s->user && (limit = prof_stack_limit(r->esp + 3 * sizeof(uint32_t))) != 0)
+    {
+        fp = r->ebp;
+        while (s->depth < PROF_DEPTH && fp > r->esp && fp + 2 * sizeof(uint32_t) <= limit &&
+               (fp & 3) == 0)
+        {
+            s->stack[s->depth++] = ((uint32_t*)fp)[1];
+            if (((uint32_t*)fp)[0] <= fp)
+            {
+                break;
+            }
+            fp = ((uint32_t*)fp)[0];
+        }
+    }
+
+    // the sample is written before the reader can see it
+    asm volatile ("" : : : "memory");
+    ring->head++;
+}
+
+
+/** prof_enable
+ * DESCRIPTION: empty every cpu's ring and start the profiling ticks
+ * INPUTS: none
+ * OUTPUTS: 0, -1 if it's already running or a ring couldn't be allocated
+ * SIDE EFFECTS: with the local APIC timer, takes the pit over at PROF_HZ
+*/
+int32_t prof_enable(void)
+{
+    int32_t i;
+
+    if (prof_running)
+    {
+        return -1;
+    }
+    for (i = 0; i < ncpus; i++)
+    {
+        if (prof_rings[i].buf == NULL &&
+            (prof_rings[i].buf = kpage_alloc(PROF_RING_PAGES)) == NULL)
+        {
+            return -1;
+        }
+        prof_rings[i].head = 0;
+        prof_rings[i].tail = 0;
+        prof_rings[i].lost = 0;
+    }
+
+    prof_running = 1;
+    if (lapic_timer_on)
+    {
+        pit_periodic(PROF_HZ);
+    }
+    return 0;
+}
+
+
+/** prof_disable
+ * DESCRIPTION: stop taking samples
+ * INPUTS: none
+ * OUTPUTS: samples waiting in the rings
+ * SIDE EFFECTS: stops the pit, if it was ours
+*/
+int32_t prof_disable(void)
+{
+    int32_t i, n = 0;
+
+    if (prof_running && lapic_timer_on)
+    {
+        pit_stop();
+    }
+    prof_running = 0;
+    for (i = 0; i < ncpus; i++)
+    {
+        n += prof_rings[i].head - prof_rings[i].tail;
+    }
+    return n;
+}
+
+
+/** prof_read
+ * DESCRIPTION: take samples out of the rings, cpu by cpu
+ * INPUTS: buf - kernel buffer for n samples
+ *         n - room in buf
+ * OUTPUTS: samples copied
+ * SIDE EFFECTS: frees their slots, the sampling cpus can carry on while this runs
+*/
+int32_t prof_read(prof_sample_t* buf, int32_t n)
+{
+    prof_ring_t* ring;
+    int32_t      i, done = 0;
+
+    for (i = 0; i < ncpus && done < n; i++)
+    {
+        ring = &prof_rings[i];
+        while (done < n && ring->tail != ring->head)
+        {
+            buf[done++] = ring->buf[ring->tail & PROF_MASK];
+            // copied out before the slot is handed back
+            asm volatile ("" : : : "memory");
+            ring->tail++;
+        }
+    }
+    return done;
+}
+
+
+/** prof_serial_dump
+ * DESCRIPTION: drain every ring out COM1, one text line per sample (see prof.h)
+ * INPUTS: none
+ * OUTPUTS: samples written
+ * SIDE EFFECTS: slow, about 100 bytes a sample at 115200 baud
+*/
+int32_t prof_serial_dump(void)
+{
+    prof_sample_t s;
+    int8_t        num[12];
+    int32_t       n = 0;
+    uint32_t      i;
+
+    serial_puts("# prof hz ");
+    serial_puts(itoa(PROF_HZ, num, 10));
+    serial_puts(" lost ");
+    serial_puts(itoa(prof_lost(), num, 10));
+    serial_puts("\n");
+    while (prof_read(&s, 1) == 1)
+    {
+        serial_puts("P ");
+        serial_puts(itoa(s.cpu, num, 16));
+        serial_puts(" ");
+        serial_puts(itoa((uint32_t)(s.pid & 0xFFFF), num, 16));
+        serial_puts(s.user ? " u " : " k ");
+        serial_puts(itoa(s.eip, num, 16));
+        for (i = 0; i < s.depth; i++)
+        {
+            serial_puts(" ");
+            serial_puts(itoa(s.stack[i], num, 16));
+        }
+        serial_puts("\n");
+        n++;
+    }
+    serial_puts("# end\n");
+    return n;
+}
+
+
+/** prof_lost
+ * DESCRIPTION: samples dropped on full rings since profiling started
+ * INPUTS: none
+ * OUTPUTS: the count, every cpu
+*/
+uint32_t prof_lost(void)
+{
+    uint32_t lost = 0;
+    int32_t  i;
+
+    for (i = 0; i < ncpus; i++)
+    {
+        lost += prof_rings[i].lost;
+    }
+    return lost;
+}
+
+
+/** prof_tick
+ * DESCRIPTION: a profiling tick on the boot processor: sample it, and have the other cpus
+ *              sample themselves
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: called from pit_handler with interrupts off
+*/
+void prof_tick(void)
+{
+    int32_t i;
+
+    prof_sample();
+    for (i = 0; i < ncpus; i++)
+    {
+        if (i != cpu_id() && cpus[i].online)
+        {
+            lapic_send_ipi(cpus[i].apic_id, ICR_FIXED | PROF_VECTOR);
+        }
+    }
+}
+
+
+/** prof_ipi
+ * DESCRIPTION: the boot processor's profiling tick, sample this cpu
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: runs without the kernel lock, only touches this cpu's ring
+*/
+void prof_ipi(void)
+{
+    if (prof_running)
+    {
+        prof_sample();
+    }
+    lapic_eoi();
+}
@@ -0,0 +1,71 @@
+/** prof.h
+ *  Sampling profiler: where each cpu is on every profiling tick
+*/
+
+#ifndef _PROF_H
+#define _PROF_H
+
+/** BACKGROUND:
+ *  - While profiling, the pit ticks PROF_HZ times a second on the boot processor. Each tick
+ *    records what the interrupt interrupted (irq_regs, irqstat.h) and IPIs every other online
+ *    cpu to do the same, so all the cpus are sampled at once. The scheduler doesn't need the
+ *    pit when the local APIC timer runs it. Without one the pit is the scheduler's, and samples
+ *    are only taken on its ticks.
+ *  - A sample is the interrupted eip, whether it was user or kernel mode, the pid running and
+ *    in kernel mode the callers above it, found by following the saved ebp chain. The chain is
+ *    only followed within the interrupted kernel stack, so a bad ebp (asm, or code built without
+ *    frame pointers) cuts the chain short rather than faulting.
+ *  - Each cpu writes its own ring of PROF_SAMPLES with no locking. prof_read drains them and a
+ *    full ring drops new samples and counts them lost, so a long run has to be read as it goes.
+ *  - The samples are symbolized off the machine: prof_serial_dump writes them out COM1 as text,
+ *    one line per sample, and profsym.py turns that and bootimg's symbol table into a flat
+ *    profile and folded stacks for a flame graph. Line format, all hex:
+ *        P <cpu> <pid> <k|u> <eip> <caller> <caller's caller> ...
+ */
+#define PROF_VECTOR         0xF2                // IPI: sample yourself
+#define PROF_HZ             1000
+#define PROF_DEPTH          8                   // callers kept per sample
+#define PROF_SAMPLES        4096                // per cpu, a power of two
+#define PROF_MASK           (PROF_SAMPLES - 1)
+
+#ifndef ASM
+
+#include "types.h"
+
+typedef struct {
+    uint32_t eip;
+    int16_t  pid;                       /* -1 for none: idle, the gui */
+    uint8_t  cpu;
+    uint8_t  user;                      /* 1 if it was in user mode */
+    uint32_t depth;                     /* callers in stack[] */
+    uint32_t stack[PROF_DEPTH];         /* return addresses, nearest caller first */
+} prof_sample_t;
+
+#define PROF_RING_PAGES     ((PROF_SAMPLES * sizeof(prof_sample_t) + PAGESIZE - 1) / PAGESIZE)
+
+extern volatile int32_t prof_running;
+
+/* start sampling every cpu with empty rings: 0, -1 if already running or out of memory */
+int32_t prof_enable(void);
+
+/* stop sampling: how many samples are waiting to be read */
+int32_t prof_disable(void);
+
+/* move up to n samples out of the rings, oldest first per cpu: how many */
+int32_t prof_read(prof_sample_t* buf, int32_t n);
+
+/* drain every ring out the serial port as text: how many samples */
+int32_t prof_serial_dump(void);
+
+/* samples dropped because a ring was full */
+uint32_t prof_lost(void);
+
+/* pit tick while profiling: sample this cpu, IPI the others */
+void prof_tick(void);
+
+/* the IPI prof_tick sends */
+void prof_ipi(void);
+
+#endif /* ASM */
+
+#endif /* _PROF_H */
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""profsym.py - symbolize the kernel profiler's samples (prof.h)
+
+Run the kernel in QEMU with -serial file:prof.txt, profile with the prof_start, prof_stop and
+prof_dump(NULL, 0) system calls, then
+
+    ./profsym.py bootimg prof.txt                    flat profile on stdout
+    ./profsym.py bootimg prof.txt -f prof.folded     and folded stacks for flamegraph.pl
+
+Each sample line is "P <cpu> <pid> <k|u> <eip> <caller> ...", all hex, nearest caller first.
+Addresses are looked up in bootimg's symbol table (nm -n). A return address points just past
+its call, so callers are looked up one byte back. User mode samples aren't symbolized, they
+all count as [user].
+"""
+
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+
+def load_symbols(image):
+    """sorted start addresses and names of bootimg's functions"""
+    out = subprocess.run(["nm", "-n", image], check=True, capture_output=True, text=True).stdout
+    addrs, names = [], []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in "tTwW":
+            addrs.append(int(fields[0], 16))
+            names.append(fields[2])
+    return addrs, names
+
+
+def lookup(addrs, names, addr):
+    i = bisect.bisect_right(addrs, addr) - 1
+    return names[i] if i >= 0 else "[0x%x]" % addr
+
+
+def read_samples(path):
+    """(cpu, pid, user, eip, callers) per sample line, and the lost count from the header"""
+    samples, lost = [], 0
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.split()
+            if fields[:3] == ["#", "prof", "hz"] and len(fields) >= 6:
+                lost += int(fields[5])
+            if len(fields) < 5 or fields[0] != "P":
+                continue
+            try:
+                nums = [int(x, 16) for x in fields[4:]]
+            except ValueError:
+                continue                        # cut off mid line
+            samples.append((int(fields[1], 16), int(fields[2], 16), fields[3] == "u",
+                            nums[0], nums[1:]))
+    return samples, lost
+
+
+def main():
+    ap = argparse.ArgumentParser(description="symbolize kernel profiler samples")
+    ap.add_argument("image", help="the kernel, bootimg")
+    ap.add_argument("samples", help="serial output with the profiler dump")
+    ap.add_argument("-f", "--folded", help="write folded stacks here")
+    ap.add_argument("-n", "--top", type=int, default=30, help="functions to list")
+    ap.add_argument("--cpu", type=int, help="only this cpu's samples")
+    args = ap.parse_args()
+
+    addrs, names = load_symbols(args.image)
+    samples, lost = read_samples(args.samples)
+    if args.cpu is not None:
+        samples = [s for s in samples if s[0] == args.cpu]
+    if not samples:
+        sys.exit("no samples in %s" % args.samples)
+
+    self_count = collections.Counter()
+    incl_count = collections.Counter()
+    folded = collections.Counter()
+    for cpu, pid, user, eip, callers in samples:
+        if user:
+            stack = ["[user]"]
+        else:
+            stack = [lookup(addrs, names, eip)] + [lookup(addrs, names, a - 1) for a in callers]
+        self_count[stack[0]] += 1
+        for fn in set(stack):                  # recursion counts once
+            incl_count[fn] += 1
+        folded[";".join(reversed(stack))] += 1
+
+    total = len(samples)
+    print("%d samples, %d lost, %d cpus" % (total, lost, len({s[0] for s in samples})))
+    print("%7s %6s %7s %6s  %s" % ("self", "%", "incl", "%", "function"))
+    for fn, n in self_count.most_common(args.top):
+        print("%7d %5.1f%% %7d %5.1f%%  %s" % (n, 100.0 * n / total, incl_count[fn],
+                                               100.0 * incl_count[fn] / total, fn))
+
+    # the first things worth speeding up, whether or not they made the top of the list
+    for fn in ("putpixel", "read_data", "scroll"):
+        print("%-10s self %5.1f%%  incl %5.1f%%" % (fn, 100.0 * self_count[fn] / total,
+                                                   100.0 * incl_count[fn] / total))
+
+    if args.folded:
+        with open(args.folded, "w") as f:
+            for stack, n in sorted(folded.items()):
+                f.write("%s %d\n" % (stack, n))
+
+
+if __name__ == "__main__":
+    main()
@@ -7,6 +7,11 @@
 #include "syscall.h"
 #include "terminal.h"
 #include "bga.h"
+#include "waitq.h"
+#include "timer.h"
+#include "slab.h"
+#include "uaccess.h"
+#include "softirq.h"
 
 
 
@@ -25,18 +30,19 @@
 
 
 /*********************** GLOBAL VARIABLES ********************************/
-static          int32_t  term_freq[MAX_TERMINALS]  = {[0 ... (MAX_TERMINALS - 1)] = MIN_RTC_FREQUENCY};
-static volatile int32_t  term_ticks[MAX_TERMINALS] = {[0 ... (MAX_TERMINALS - 1)] = 0};
 static const    int32_t  real_frequency            = REAL_FREQUENCY;
-static          int32_t  second_delay_ticks        = REAL_FREQUENCY;
-static          int32_t  ms_delay_ticks            = REAL_FREQUENCY;
-static          int32_t  cursor_delay_ticks        = (REAL_FREQUENCY)/2;
-volatile static int8_t   ms_delay_flag             = 0;
-volatile static int8_t   second_delay_flag         = 0;
 static          uint8_t  cur_sec                   = 0;
 static          uint8_t  last_sec                  = 0;
-static struct   time_t   time                      = {0,0,0,0,sunday,1,1,0,20};
-static volatile uint32_t ticks                     = 0;
+static          kmem_cache_t* rtc_cache;                            // rtc_file_t
+static          rtc_file_t*   rtc_heap[RTC_MAX_FILES];              // min-heap on next
+static          int32_t       rtc_nheap;
+static          spinlock_t    rtc_lock = SPINLOCK_INIT("rtc");     // the heap and every rtc_file_t in it
+static          spinlock_t    cmos_lock = SPINLOCK_INIT("cmos");   // the CMOS index, between select and read
+static          ktimer_t cursor_timer;                              // lock screen cursor blink
+static          ktimer_t clock_timer;                               // taskbar clock
+static          work_t   cursor_work;                               // and what they draw, after the interrupt
+static          work_t   clock_work;
+rtc_stats_t     rtc_stats;
 
 int cursorflag = 1;
 
@@ -46,6 +52,222 @@ int cursorflag = 1;
 /*************************************************************************/
 /****************** INITIALIZATION AND HANDLER **************************/
 /*************************************************************************/
+/* deadline a is at or before b, across timer_ticks wrapping */
+#define TICK_BEFORE_EQ(a, b)  ((int32_t)((a) - (b)) <= 0)
+
+
+/** rtc_heap_set
+ * DESCRIPTION: put a file in a heap slot
+ * INPUTS: i - the slot
+ *         r - the file
+ * OUTPUTS: none
+*/
+static inline void rtc_heap_set(int32_t i, rtc_file_t* r)
+{
+    rtc_heap[i] = r;
+    r->slot     = i;
+}
+
+
+/** rtc_heap_fix
+ * DESCRIPTION: move the file in slot i up or down until its deadline is in order
+ * INPUTS: i - a slot in the heap
+ * OUTPUTS: none
+ * SIDE EFFECTS: rtc_lock must be held
+*/
+static void rtc_heap_fix(int32_t i)
+{
+    rtc_file_t* r = rtc_heap[i];
+    int32_t     child;
+
+    while (i > 0 && !TICK_BEFORE_EQ(rtc_heap[(i - 1) / 2]->next, r->next))
+    {
+        rtc_heap_set(i, rtc_heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    while ((child = 2 * i + 1) < rtc_nheap)
+    {
+        if (child + 1 < rtc_nheap && !TICK_BEFORE_EQ(rtc_heap[child]->next, rtc_heap[child + 1]->next))
+        {
+            child++;
+        }
+        if (TICK_BEFORE_EQ(r->next, rtc_heap[child]->next))
+        {
+            break;
+        }
+        rtc_heap_set(i, rtc_heap[child]);
+        i = child;
+    }
+    rtc_heap_set(i, r);
+}
+
+
+/** rtc_heap_remove
+ * DESCRIPTION: take a file off the heap
+ * INPUTS: r - a file in the heap
+ * OUTPUTS: none
+ * SIDE EFFECTS: rtc_lock must be held
+*/
+static void rtc_heap_remove(rtc_file_t* r)
+{
+    int32_t i = r->slot;
+
+    rtc_nheap--;
+    if (i != rtc_nheap)
+    {
+        rtc_heap_set(i, rtc_heap[rtc_nheap]);
+        rtc_heap_fix(i);
+    }
+    r->slot = -1;
+}
+
+
+/** rtc_set_rate
+ * DESCRIPTION: start a file's virtual interrupts at a new rate, the first one period from now
+ * INPUTS: r - the file
+ *         freq - virtual interrupts per virtual second
+ * OUTPUTS: none
+ * SIDE EFFECTS: rtc_lock must be held. the file must be in the heap
+*/
+static void rtc_set_rate(rtc_file_t* r, uint32_t freq)
+{
+    r->freq = freq;
+    r->step = VIRT_SECOND / freq;
+    r->frac = VIRT_SECOND % freq;
+    if (r->step == 0)
+    {
+        r->step = 1;
+        r->frac = 0;
+    }
+    r->err  = 0;
+    r->next = timer_ticks + r->step;
+    rtc_heap_fix(r->slot);
+}
+
+
+/** rtc_file
+ * DESCRIPTION: the virtual rtc behind an fd, made at 2Hz the first time it's used
+ * INPUTS: fd - an rtc fd of the current process
+ * OUTPUTS: the file, NULL if there's no memory or the heap is full
+*/
+static rtc_file_t* rtc_file(int32_t fd)
+{
+    fde_t*      f = &cur_pcb->fdt[fd];
+    rtc_file_t* r = f->data;
+    uint32_t    flags;
+
+    if (r != NULL)
+    {
+        return r;
+    }
+    if ((r = kmem_cache_alloc(rtc_cache)) == NULL)
+    {
+        return NULL;
+    }
+    r->fired = 0;
+    r->refs  = 1;
+    wq_init(&r->wq);
+
+    spin_lock_irqsave(&rtc_lock, flags);
+    if (rtc_nheap == RTC_MAX_FILES)
+    {
+        spin_unlock_irqrestore(&rtc_lock, flags);
+        kmem_cache_free(rtc_cache, r);
+        return NULL;
+    }
+    r->slot = rtc_nheap++;
+    rtc_heap[r->slot] = r;
+    rtc_set_rate(r, MIN_RTC_FREQUENCY);
+    spin_unlock_irqrestore(&rtc_lock, flags);
+
+    f->data = r;
+    return r;
+}
+
+
+/** rtc_virt_tick
+ * DESCRIPTION: run the virtual interrupts that are due on this tick
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: wakes their readers, moves each one period on in the heap
+*/
+static void rtc_virt_tick(void)
+{
+    uint32_t    now = timer_ticks;
+    rtc_file_t* r;
+    uint32_t    flags;
+
+    spin_lock_irqsave(&rtc_lock, flags);
+    while (rtc_nheap > 0 && TICK_BEFORE_EQ((r = rtc_heap[0])->next, now))
+    {
+        r->fired++;
+        wake_up(&r->wq);
+
+        r->next += r->step;
+        r->err  += r->frac;
+        if (r->err >= r->freq)
+        {
+            r->err -= r->freq;
+            r->next++;
+        }
+        // ticks were lost, don't make them all up at once
+        if (TICK_BEFORE_EQ(r->next, now))
+        {
+            r->next = now + r->step;
+        }
+        rtc_heap_fix(0);
+    }
+    spin_unlock_irqrestore(&rtc_lock, flags);
+}
+
+
+/** rtc_cursor_blink
+ * DESCRIPTION: toggle the lock screen cursor, four times a second. deferred work
+ * INPUTS: arg - unused
+ * OUTPUTS: none
+*/
+static void rtc_cursor_blink(void* arg)
+{
+    uint32_t flags;
+
+    spin_lock_irqsave(&gfx_lock, flags);
+    printLockCursor(!cursorflag);
+    cursorflag = !cursorflag;
+    spin_unlock_irqrestore(&gfx_lock, flags);
+}
+
+
+/** rtc_clock_update
+ * DESCRIPTION: 16 times a second, redraw the taskbar clock if the second changed. deferred work
+ * INPUTS: arg - unused
+ * OUTPUTS: none
+*/
+static void rtc_clock_update(void* arg)
+{
+    uint32_t flags;
+
+    cur_sec = rtc_get_time_seconds();
+    if (cur_sec != last_sec)
+    {
+        last_sec = cur_sec;
+        spin_lock_irqsave(&gfx_lock, flags);
+        printTime();
+        spin_unlock_irqrestore(&gfx_lock, flags);
+    }
+}
+
+
+/** rtc_defer
+ * DESCRIPTION: a GUI timer is due, hand its drawing off to run after the interrupt
+ * INPUTS: arg - the work item
+ * OUTPUTS: none
+*/
+static void rtc_defer(void* arg)
+{
+    work_queue((work_t*)arg);
+}
+
+
 /** rtc_init 
  * DESCRIPTION: initialize the RTC, turn on periodic interrupts 
  * INPUTS:
@@ -85,6 +307,16 @@ void rtc_init()
     /* enable NMI and reset register to default register D*/
     outb(REGISTER_D & ENABLE_NMI, INDEX);
 
+    rtc_cache = kmem_cache_create("rtc", sizeof(rtc_file_t), CACHE_LINE_SIZE, NULL);
+    rtc_nheap = 0;
+
+    /* the rest of what the interrupt used to count down itself is on the timer wheel */
+    work_setup(&cursor_work, rtc_cursor_blink, NULL);
+    work_setup(&clock_work, rtc_clock_update, NULL);
+    timer_setup(&cursor_timer, rtc_defer, &cursor_work);
+    timer_add_periodic(&cursor_timer, REAL_FREQUENCY / 4);
+    timer_setup(&clock_timer, rtc_defer, &clock_work);
+    timer_add_periodic(&clock_timer, REAL_FREQUENCY / 16);
 }
 
 
@@ -94,101 +326,34 @@ void rtc_init()
  *      none
  * OUTPUTS:
  *      none
- * SIDE EFFECTS: total ticks will be counted, and per file virtualization will be handled.
- *               Will toggle interrupt_received_flag upon per file virtualized interrupt.
+ * SIDE EFFECTS: one tick of the timer wheel, and the virtual interrupts of every rtc fd that's
+ *               due. the cursor blink and the clock are queued as work, drawn after the handler
 */
 void rtc_handler(void)
 {
-
-    cli();
+    uint64_t start = rdtsc();
+    uint32_t cycles;
 
     /** read data from the RTC register C and discard it.
      *  This is needed so RTC interrupts are not blocked
      **/
+    spin_lock(&cmos_lock);
     outb(REGISTER_C, INDEX);
     inb(DATA);
+    spin_unlock(&cmos_lock);
 
-    static int i;
-    /* decrement ticks for all terminal processes */
-    for(i = 0; i < MAX_TERMINALS; i++)
-    {
-        term_ticks[i]--;
-    }
-
-    /* decrement global ticks and reset them after one second */
-    ticks--;
-    if(ticks == 0)
-    {
-        ticks = real_frequency;
-    }
-
-    /* decrement the counter for one second intervals */
-    if(second_delay_ticks != 0)
-    {
-        second_delay_ticks--;
-    }
-    if(second_delay_ticks == 0)
-    {
-        second_delay_ticks = REAL_FREQUENCY;
-        second_delay_flag = 1;
-    }
-
-    if(ms_delay_ticks != 0)
-    {
-        ms_delay_ticks--;
-    }
-    if(ms_delay_ticks == 0)
-    {
-        ms_delay_ticks = REAL_FREQUENCY;
-        ms_delay_flag = 1;
-    }
-
+    timer_tick();
+    rtc_virt_tick();
 
-    if(cursor_delay_ticks != 0)
-    {
-        cursor_delay_ticks--;
-        
-    }
-    if(cursor_delay_ticks == 0)
-    {
-        cursor_delay_ticks = (REAL_FREQUENCY)/4;
-
-        if (cursorflag)
-        {
-            printLockCursor(0);   
-            cursorflag = 0;
-        }
-        else
-        {
-            printLockCursor(1);
-            cursorflag = 1;
-        }
-    }
+    send_eoi(RTC_IRQ);
 
-    /* every once in a while (16 times per second), make sure the real-time is updated on the system */
-    if(ticks % (REAL_FREQUENCY/16) == 0)
+    cycles = (uint32_t)(rdtsc() - start);
+    rtc_stats.irqs++;
+    rtc_stats.cycles += cycles;
+    if (cycles > rtc_stats.max)
     {
-        cur_sec = rtc_get_time_seconds();
-        if(cur_sec != last_sec)
-        {
-            last_sec = cur_sec;
-            printTime();
-        }
+        rtc_stats.max = cycles;
     }
-
-
-    // cursor_delay_ticks--;
-    // if(cursor_delay_ticks == 0)
-    // {
-    //     cursor_delay_ticks = REAL_FREQUENCY/2;
-        
-    // }
-
-
-
-    send_eoi(RTC_IRQ);
-    sti();
-
 }
 /*************************************************************************/
 
@@ -199,104 +364,140 @@ void rtc_handler(void)
 /** rtc_read
  * DESCRIPTION: wait until the next RTC interrupt.
  * INPUTS:
- *      fd     - the file descriptor. Used to determine the rate of the interrupt per file,
- *               since different files can have different rates of interrupt.
+ *      fd     - the file descriptor. Each one has its own rate of interrupts
  *      buf    - NA
  *      nbytes - NA
- * OUTPUTS: returns 0 after the next (virtualized) RTC interrupt
- * SIDE EFFECTS: blocks program from executing until an interrupt is generated.
+ * OUTPUTS: returns 0 after the fd's next (virtualized) RTC interrupt, -1 if it can't get one
+ * SIDE EFFECTS: sleeps the program until then, doesn't spin
 */
 int rtc_read(int32_t fd, int8_t* buf, int32_t nbytes)
-{    
+{
+    rtc_file_t* r;
+    uint32_t    seen;
 
     if(fd >= MAX_FD || fd < 0) return -1;
+    if((r = rtc_file(fd)) == NULL) return -1;
 
-    // set ticks for current terminal 
-    term_ticks[cur_term] = (real_frequency / 4) / term_freq[cur_term];
+    // sleep until the count moves, rtc_virt_tick wakes us
+    seen = r->fired;
+    wait_event(&r->wq, r->fired != seen);
 
-    // wait until the tick count down to zero
-    while(term_ticks[cur_term] > 0);
-    
     return 0;
 }
 
 
 /** rtc_write
- * DESCRIPTION: write a new frequency to the RTC. Frequency will be virtualized. For multiple processes, pass in a pid.
- * INPUTS: none
- * OUTPUTS: none
- * SIDE EFFECTS: the RTC interrupt rate will be set to that of the RTC buffer, if the buffer is a power of two
+ * DESCRIPTION: set the fd's virtual interrupt rate
+ * INPUTS: fd     - the file descriptor
+ *         buf    - a 4 byte frequency, in Hz
+ *         nbytes - 4
+ * OUTPUTS: 0, -1 for a bad buffer or a frequency out of range
+ * SIDE EFFECTS: the fd's next interrupt is one new period from now. other fds aren't touched
 */
 int rtc_write(int32_t fd, const int8_t* buf, int32_t nbytes)
 {
-    cli();
-    uint32_t buf_ = (uint32_t)*buf;
+    rtc_file_t* r;
+    uint32_t    flags;
+    uint32_t    buf_;
 
     /**
-    *  if the value in the write buffer is not a power of two
-    *  or the write buffer is greater than max frequency
+    *  if the write buffer isn't a 4 byte frequency
+    *  or the frequency is below min or above max frequency
     *  then return
     */
-    if(fd >= MAX_FD) return -1;
-    if(!((buf_ & (buf_ - 1)) == 0 && buf_ >= MIN_RTC_FREQUENCY)) return -1;
-    if (buf_ > HIGHEST_RTC_FREQUENCY) return -1;
-    
-    // set the virtual frequency to the passed in freq
-    term_freq[cur_term] = buf_;
+    if(fd >= MAX_FD || fd < 0) return -1;
+    if(nbytes != sizeof(uint32_t)) return -1;
+    if(copy_from_user(&buf_, buf, sizeof(buf_)) != 0) return -1;
+    if(buf_ < MIN_RTC_FREQUENCY || buf_ > HIGHEST_RTC_FREQUENCY) return -1;
+    if((r = rtc_file(fd)) == NULL) return -1;
+
+    spin_lock_irqsave(&rtc_lock, flags);
+    rtc_set_rate(r, buf_);
+    spin_unlock_irqrestore(&rtc_lock, flags);
 
-    sti();
-    
     return 0;
 }
 
 
 /** rtc_open
- * DESCRIPTION: reset the rate of the RTC to 2Hz
+ * DESCRIPTION: open the rtc. the fd's virtual rtc is made at 2Hz the first time it's used
  * INPUTS: none
- * OUTPUTS: none
- * SIDE EFFECTS: RTC interrupt rate will be reset to 2Hz
+ * OUTPUTS: 0
+ * SIDE EFFECTS: none
 */
 int rtc_open(const int8_t* filename)
 {
-    cli();
-
-    // set the the virtual frequency to 2Hz
-    term_freq[cur_term] = MIN_RTC_FREQUENCY;
-
-    sti();
-
     return 0;
 }
 
 
 /** rtc_close 
- * DESCRIPTION: set the frequency for the associated file to -1
+ * DESCRIPTION: drop the fd's virtual rtc, freed with its last copy
  * INPUTS: fd: file to close
- * OUTPUTS: none
- * SIDE EFFECTS: none
+ * OUTPUTS: 0
+ * SIDE EFFECTS: takes it off the heap
 */
 int rtc_close(int32_t fd)
 {
+    fde_t*      f = &cur_pcb->fdt[fd];
+    rtc_file_t* r = f->data;
+    uint32_t    flags;
+
+    if (r == NULL)
+    {
+        return 0;
+    }
+
+    spin_lock_irqsave(&rtc_lock, flags);
+    if (--r->refs > 0)
+    {
+        r = NULL;
+    }
+    else
+    {
+        rtc_heap_remove(r);
+    }
+    spin_unlock_irqrestore(&rtc_lock, flags);
+
+    if (r != NULL)
+    {
+        kmem_cache_free(rtc_cache, r);
+    }
+    f->data = NULL;
     return 0;
 }
 
 
+/** rtc_dup
+ * DESCRIPTION: count another fd entry sharing a virtual rtc
+ * INPUTS: f - the new fd entry, already a copy of the old one
+ * OUTPUTS: none
+*/
+void rtc_dup(fde_t* f)
+{
+    rtc_file_t* r = f->data;
+    uint32_t    flags;
+
+    if (r == NULL)
+    {
+        return;
+    }
+    spin_lock_irqsave(&rtc_lock, flags);
+    r->refs++;
+    spin_unlock_irqrestore(&rtc_lock, flags);
+}
+
+
 /** rtc_delay
  * DESCRIPTION: delay for a given amount of seconds
  * INPUTS:
  *      seconds: the amount of seconds to delay by
  * OUTPUTS: none
- * SIDE EFFECTS: block execution on the code that calls this function for input amount of second
+ * SIDE EFFECTS: sleeps the caller on a timer, doesn't spin
 */
 void rtc_delay(uint8_t seconds)
 {
-    static int s;
-    for(s = 0; s < seconds; s++)
-    {
-        second_delay_ticks = real_frequency/MIN_RTC_FREQUENCY;
-        while(!second_delay_flag);
-        second_delay_flag = 0;
-    }
+    timer_sleep(seconds * (real_frequency / MIN_RTC_FREQUENCY));
 }
 
 
@@ -305,16 +506,11 @@ void rtc_delay(uint8_t seconds)
  * INPUTS:
  *      delay: how long to delay for. delay is 1/input seconds. must be a power of 2
  * OUTPUTS: none
- * SIDE EFFECTS: block execution on the code that calls this function for 1/input amount of second
+ * SIDE EFFECTS: sleeps the caller on a timer, doesn't spin
 */
 void rtc_delay_inv(uint8_t inv_seconds)
 {
-
-    /* ensure input is a power of two */
-
-    ms_delay_ticks = (real_frequency/inv_seconds) / MIN_RTC_FREQUENCY;
-    while(!ms_delay_flag);
-    ms_delay_flag = 0;
+    timer_sleep((real_frequency / inv_seconds) / MIN_RTC_FREQUENCY);
 }
 
 
@@ -336,7 +532,10 @@ struct time_t* rtc_get_time()
 
     static int delay;
     static int temp;
+    uint32_t   flags;
 
+    // the handler moves the index to register C, keep it out between each select and read
+    spin_lock_irqsave(&cmos_lock, flags);
     outb(REGISTER_SECONDS & ENABLE_NMI, INDEX);
     temp = inb(DATA);
     time.seconds = BCD_TO_DECIMAL(temp);
@@ -380,6 +579,7 @@ struct time_t* rtc_get_time()
     outb(REGISTER_YEAR & ENABLE_NMI, INDEX);
     temp = inb(DATA);
     time.year = BCD_TO_DECIMAL(temp);
+    spin_unlock_irqrestore(&cmos_lock, flags);
 
     /* omit century for now. */
     /** TODO: add logic for century within the next 80 years */ 
@@ -397,9 +597,12 @@ struct time_t* rtc_get_time()
 uint8_t rtc_get_time_seconds()
 {
     static uint8_t temp;
+    uint32_t       flags;
 
+    spin_lock_irqsave(&cmos_lock, flags);
     outb(REGISTER_SECONDS & ENABLE_NMI, INDEX);
     temp = inb(DATA);
+    spin_unlock_irqrestore(&cmos_lock, flags);
     return BCD_TO_DECIMAL(temp);
 }
 /*************************************************************************/
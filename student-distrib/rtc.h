@@ -14,6 +14,7 @@
 #define _RTC_H
 #include "types.h"
 #include "tests.h"
+#include "waitq.h"
 
 
 
@@ -92,6 +93,46 @@ typedef struct time_t {
 } time_t;
 
 
+/** VIRTUAL RTC:
+ *  Every open rtc fd is its own virtual rtc, with its own rate, ticking on the real one's 1024Hz
+ *  interrupt. A virtual second is a quarter of a real one (VIRT_SECOND ticks), the speed
+ *  programs have always been timed against. Any whole rate from 2Hz up is allowed: the
+ *  period is VIRT_SECOND / freq ticks and the remainder is carried from one period to the next,
+ *  so the long run rate is exact even when the period isn't a whole tick. Rates faster than
+ *  a tick run once a tick.
+ *
+ *  The fds with a rate are kept in a min-heap on their next deadline, so each interrupt only
+ *  looks at the top of the heap, and only the fds that are due cost anything (log n each).
+ *  A due fd counts a virtual interrupt, wakes its readers and goes back in the heap one
+ *  period on. rtc_read sleeps until the count moves. dup'd copies of an fd share it.
+*/
+#define VIRT_SECOND     256                 /* ticks of the 1024Hz interrupt in a virtual second */
+#define RTC_MAX_FILES   128                 /* open rtc files in the whole system */
+
+typedef struct rtc_file {
+    uint32_t          freq;                 /* virtual interrupts per virtual second */
+    uint32_t          step;                 /* whole ticks between them */
+    uint32_t          frac;                 /* left over, in 1/freq ticks */
+    uint32_t          err;                  /* fraction carried into the next period */
+    uint32_t          next;                 /* timer_ticks of the next one */
+    volatile uint32_t fired;                /* virtual interrupts so far */
+    int32_t           slot;                 /* index in the heap */
+    int32_t           refs;                 /* fd entries sharing it */
+    wait_queue_t      wq;                   /* rtc_read sleepers */
+} rtc_file_t;
+
+
+/* how long rtc_handler takes, not counting the work it defers */
+typedef struct {
+    uint32_t irqs;
+    uint64_t cycles;
+    uint32_t max;
+} rtc_stats_t;
+
+extern rtc_stats_t rtc_stats;
+
+struct fde;
+
 /* initialize the RTC */
 void rtc_init();
 
@@ -103,6 +144,7 @@ int rtc_read(int32_t fd, int8_t* buf, int32_t nbytes);
 int rtc_write(int32_t fd, const int8_t* buf, int32_t nbytes);
 int rtc_open(const int8_t* filename);
 int rtc_close(int32_t fd);
+void rtc_dup(struct fde* f);
 
 void rtc_delay(uint8_t seconds);
 void rtc_delay_inv(uint8_t inv_seconds);
@@ -1,5 +1,5 @@
 /** scheduler.c
- *  Schedule tasks in a round-robin fashion
+ *  Schedule processes off a multi-level feedback queue
 */
 
 #include "lib.h"
@@ -7,91 +7,1130 @@
 #include "terminal.h"
 #include "scheduler.h"
 #include "paging.h"
+#include "proc.h"
+#include "pit.h"
+#include "apic.h"
+#include "smp.h"
+#include "spinlock.h"
 
 
 int terminals_initialized[3] = {0,0,0}; // 3 terminals
-/** task_switch
- * DESCRIPTION: switch the current task to the next pid's task
- * INPUTS: pid - the pid of the task to switch to
+
+sched_stats_t sched_stats;
+spinlock_t    sched_lock = SPINLOCK_INIT("sched");     // every cpu's run queues
+
+/* one per cpu */
+typedef struct {
+    /* runnable processes waiting for the cpu, one FIFO per level, oldest first. the running one
+     * is never on them. bit i of rq_levels is set while level i isn't empty */
+    pcb_t*   rq_head[SCHED_LEVELS];
+    pcb_t*   rq_tail[SCHED_LEVELS];
+    uint32_t rq_levels;
+    uint32_t nr_queued;                 // processes on the queues, for picking whom to steal from
+
+    int      need_resched;              // a woken process outranks the running one
+    int      tick_pending;              // the boot processor forwarded a pit tick
+
+    /* local APIC timer mode only */
+    int      armed;                     // 1 while this cpu's timer is counting down
+    uint64_t run_start;                 // rdtsc when the running process's slice started being
+                                        // charged, 0 while it isn't
+
+    /* the idle task and where it left off, esp is 0 until it first runs */
+    uint32_t idle_esp;
+    uint32_t idle_ebp;
+    int32_t  idle_depth;                // its kernel lock depth while switched out
+    int      in_idle;                   // 1 while the idle task has the cpu
+    uint64_t idle_start;                // rdtsc when the current halt began, 0 if not halted
+} runq_t;
+
+static runq_t   runqs[SMP_MAX_CPUS];
+
+#define this_rq()       (&runqs[cpu_id()])
+
+/* microseconds each level runs for before being preempted */
+static const int32_t quantum[SCHED_LEVELS] = {SCHED_TICK_US, 2 * SCHED_TICK_US, 4 * SCHED_TICK_US};
+
+static uint64_t boost_at;               // rdtsc of the next boost
+static int      armed;                  // pit mode: 1 while the pit is counting down a tick
+int             sched_tickless = 1;     // 0 for a pit interrupt every tick no matter what
+
+/* the boot processor's idle stack. APs idle on the stack they booted on */
+static uint8_t  idle_stack[IDLE_STACK_SIZE] __attribute__((aligned(16)));
+
+void idle_task(void);
+void kthread_start(void);
+
+
+/** sched_level
+ * DESCRIPTION: the level a process is queued at: its own, but never below SCHED_FG_LEVEL if it
+ *              belongs to the terminal on screen
+ * INPUTS: pcb - the process
+ * OUTPUTS: 0 (first picked) to SCHED_LEVELS - 1
+*/
+static int32_t sched_level(pcb_t* pcb)
+{
+    if (pcb->term == vis_term && pcb->level > SCHED_FG_LEVEL)
+    {
+        return SCHED_FG_LEVEL;
+    }
+    return pcb->level;
+}
+
+
+/** rq_push
+ * DESCRIPTION: put a process at the back of its level's run queue, on its own cpu
+ * INPUTS: pcb - a runnable process that isn't running
  * OUTPUTS: none
- * SIDE EFFECTS: none
+ * SIDE EFFECTS: caller must hold sched_lock, with interrupts off
 */
-void task_switch()
+static void rq_push(pcb_t* pcb)
+{
+    runq_t* rq    = &runqs[pcb->cpu];
+    int32_t level = sched_level(pcb);
+
+    if (pcb->on_rq)
+    {
+        return;
+    }
+    pcb->rq_next = NULL;
+    pcb->on_rq = 1;
+    if (rq->rq_tail[level] != NULL)
+    {
+        rq->rq_tail[level]->rq_next = pcb;
+    }
+    else
+    {
+        rq->rq_head[level] = pcb;
+    }
+    rq->rq_tail[level] = pcb;
+    rq->rq_levels |= (1 << level);
+    rq->nr_queued++;
+    sched_stats.rq_len++;
+}
+
+
+/** rq_pop
+ * DESCRIPTION: take the oldest process off the highest non empty level
+ * INPUTS: rq - the cpu's run queue
+ * OUTPUTS: the process, NULL if every level is empty
+ * SIDE EFFECTS: caller must hold sched_lock, with interrupts off
+*/
+static pcb_t* rq_pop(runq_t* rq)
+{
+    int32_t level;
+    pcb_t*  pcb;
+
+    if (rq->rq_levels == 0)
+    {
+        return NULL;
+    }
+    level = find_first_set(rq->rq_levels);
+    pcb = rq->rq_head[level];
+
+    rq->rq_head[level] = pcb->rq_next;
+    if (rq->rq_head[level] == NULL)
+    {
+        rq->rq_tail[level] = NULL;
+        rq->rq_levels &= ~(1 << level);
+    }
+    pcb->rq_next = NULL;
+    pcb->on_rq = 0;
+    rq->nr_queued--;
+    sched_stats.rq_len--;
+    return pcb;
+}
+
+
+/** rq_unlink
+ * DESCRIPTION: take a process out of the middle of a level's queue
+ * INPUTS: rq - the run queue it's on
+ *         level - the level it's queued at
+ *         pcb - the process
+ *         prev - the one before it, NULL if it's at the head
+ * OUTPUTS: none
+ * SIDE EFFECTS: caller must hold sched_lock, with interrupts off
+*/
+static void rq_unlink(runq_t* rq, int32_t level, pcb_t* pcb, pcb_t* prev)
+{
+    if (prev != NULL)
+    {
+        prev->rq_next = pcb->rq_next;
+    }
+    else
+    {
+        rq->rq_head[level] = pcb->rq_next;
+    }
+    if (rq->rq_tail[level] == pcb)
+    {
+        rq->rq_tail[level] = prev;
+    }
+    if (rq->rq_head[level] == NULL)
+    {
+        rq->rq_levels &= ~(1 << level);
+    }
+    pcb->rq_next = NULL;
+    pcb->on_rq = 0;
+    rq->nr_queued--;
+    sched_stats.rq_len--;
+}
+
+
+/** rq_find
+ * DESCRIPTION: the process a cpu would steal from a run queue: the highest level with one it
+ *              may run, and of those the one that last ran longest ago
+ * INPUTS: rq - the victim's run queue
+ *         cpu - the cpu stealing
+ *         level, prev - set to where the process is queued, for rq_unlink
+ * OUTPUTS: the process, NULL if nothing on rq may run on cpu
+*/
+static pcb_t* rq_find(runq_t* rq, int32_t cpu, int32_t* level, pcb_t** prev)
 {
-    static int idx = -1;
+    pcb_t*  best = NULL;
+    pcb_t*  pcb;
+    pcb_t*  before;
+    int32_t l;
 
-    if (term_flag)
+    for (l = 0; l < SCHED_LEVELS && best == NULL; l++)
     {
-        idx++;
-        if(idx > 2)     // idx should go from 0 to 2
+        for (before = NULL, pcb = rq->rq_head[l]; pcb != NULL; before = pcb, pcb = pcb->rq_next)
         {
-            idx = 0;
+            if ((pcb->affinity & (1 << cpu)) && (best == NULL || pcb->last_ran < best->last_ran))
+            {
+                best   = pcb;
+                *level = l;
+                *prev  = before;
+            }
         }
-        int prev_term = cur_term;
-        cur_term = idx;
+    }
+    return best;
+}
 
-        // get pid and pcb ptrs
-        cur_pid = terminalState[cur_term].cur_pid;
-        int prev_pid = terminalState[prev_term].cur_pid;
-        cur_pcb = (pcb_t *)(EIGHT_MB - ((cur_pid+1) * EIGHT_KB));
-        pcb_t * prev_pcb = (pcb_t *)(EIGHT_MB - ((prev_pid+1) * EIGHT_KB));
 
-        // get current esp and ebp
-        register uint32_t sch_ebp asm("ebp");
-        register uint32_t sch_esp asm("esp");
+/** sched_victim
+ * DESCRIPTION: the cpu an idle cpu should steal from: the one with the most processes waiting,
+ *              among those with something it may run
+ * INPUTS: cpu - the idle cpu
+ * OUTPUTS: the victim, -1 if there's nothing to steal
+ * SIDE EFFECTS: caller must hold sched_lock, with interrupts off
+*/
+static int32_t sched_victim(int32_t cpu)
+{
+    int32_t victim = -1;
+    int32_t level, i;
+    pcb_t*  prev;
 
-        // launch shells at start
-        if (terminals_initialized[idx] == 0)
+    for (i = 0; i < ncpus; i++)
+    {
+        if (i == cpu || runqs[i].nr_queued == 0 ||
+            (victim >= 0 && runqs[i].nr_queued <= runqs[victim].nr_queued))
         {
-            if (idx != 0)
-            {
-                prev_pcb->sch_esp = sch_esp;
-                prev_pcb->sch_ebp = sch_ebp;
+            continue;
+        }
+        if (rq_find(&runqs[i], cpu, &level, &prev) != NULL)
+        {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+
+/** sched_steal
+ * DESCRIPTION: take a waiting process from the busiest other cpu, to run here
+ * INPUTS: cpu - this cpu, which has nothing else to run
+ * OUTPUTS: the process, now ours, NULL if there was nothing to take
+ * SIDE EFFECTS: caller must hold sched_lock, with interrupts off
+*/
+static pcb_t* sched_steal(int32_t cpu)
+{
+    int32_t victim = sched_victim(cpu);
+    int32_t level;
+    pcb_t*  prev;
+    pcb_t*  pcb;
+
+    if (victim < 0)
+    {
+        return NULL;
+    }
+    pcb = rq_find(&runqs[victim], cpu, &level, &prev);
+    rq_unlink(&runqs[victim], level, pcb, prev);
+    pcb->cpu = cpu;
+    sched_stats.steals++;
+    return pcb;
+}
+
+
+/** sched_kick_idle
+ * DESCRIPTION: after queuing work on a busy cpu, interrupt an idle cpu that could steal it
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: caller must hold sched_lock, with interrupts off. one cpu at most, the next
+ *               queuing kicks the next
+*/
+static void sched_kick_idle(void)
+{
+    int32_t i;
+
+    for (i = 0; i < ncpus; i++)
+    {
+        if (i != cpu_id() && runqs[i].in_idle && sched_victim(i) >= 0)
+        {
+            smp_resched(i);
+            return;
+        }
+    }
+}
+
+
+/** sched_launch_pending
+ * DESCRIPTION: finds a terminal this cpu still has to launch a shell for
+ * INPUTS: cpu - the cpu
+ * OUTPUTS: the terminal, MAX_TERMINALS if there is none
+*/
+static int sched_launch_pending(int32_t cpu)
+{
+    int t;
+
+    if (!term_flag)
+    {
+        return MAX_TERMINALS;
+    }
+    for (t = 0; t < MAX_TERMINALS; t++)
+    {
+        if (!terminals_initialized[t] && smp_term_cpu(t) == cpu)
+        {
+            break;
+        }
+    }
+    return t;
+}
+
+
+/** sched_runnable
+ * DESCRIPTION: checks if this cpu has anything to switch to
+ * INPUTS: none
+ * OUTPUTS: 1 if a process is waiting, one can be stolen or a shell is to be launched, 0 if not
+*/
+static int sched_runnable(void)
+{
+    uint32_t flags;
+    int      runnable;
+
+    spin_lock_irqsave(&sched_lock, flags);
+    runnable = this_rq()->rq_levels != 0 || sched_launch_pending(cpu_id()) < MAX_TERMINALS ||
+               sched_victim(cpu_id()) >= 0;
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return runnable;
+}
+
+
+/** sched_arm_local
+ * DESCRIPTION: sched_arm with the local APIC timer: this cpu's timer, for this cpu's run queue.
+ *              The running process's slice is charged from when the timer is armed for it, so
+ *              the interrupt comes exactly when the slice runs out
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: caller must hold interrupts off. leaves a timer that's already counting alone
+*/
+static void sched_arm_local(void)
+{
+    runq_t* rq  = this_rq();
+    pcb_t*  cur = rq->in_idle ? NULL : cur_pcb;
+    int     busy = rq->rq_levels != 0 || sched_launch_pending(cpu_id()) < MAX_TERMINALS;
+    int     off;
+
+    // with the scheduler off only the boot processor ticks, to notice it being turned on
+    off = term_flag ? (sched_tickless && !busy) : (cpu_id() != 0);
+    if (off)
+    {
+        lapic_timer_stop();
+        rq->armed = 0;
+        rq->run_start = 0;
+        return;
+    }
+    if (rq->armed)
+    {
+        return;
+    }
+    if (cur != NULL && term_flag)
+    {
+        rq->run_start = rdtsc();
+        lapic_timer_arm(cur->slice);
+    }
+    else
+    {
+        rq->run_start = 0;
+        lapic_timer_arm(SCHED_TICK_US);
+    }
+    rq->armed = 1;
+}
+
+
+/** sched_arm
+ * DESCRIPTION: set up the next timer interrupt. In tickless mode there's only a next tick if
+ *              something is waiting for a cpu, the running process keeps it for as long as
+ *              nobody else wants it and the idle task halts until some other interrupt. With
+ *              the local APIC timer every cpu arms its own. With the pit only the boot
+ *              processor gets interrupts, and passes ticks on to the APs
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: caller must hold interrupts off, cur_pcb/in_idle must already be what's about
+ *               to run
+*/
+static void sched_arm(void)
+{
+    int busy = term_flag && (!terminals_initialized[0] || !terminals_initialized[1] ||
+                             !terminals_initialized[2]);
+    int i;
+
+    if (lapic_timer_on)
+    {
+        sched_arm_local();
+        return;
+    }
+
+    for (i = 0; i < ncpus; i++)
+    {
+        busy |= term_flag && runqs[i].rq_levels != 0;
+    }
+
+    if (sched_tickless && term_flag && !busy)
+    {
+        if (armed)
+        {
+            pit_stop();
+            armed = 0;
+        }
+        return;
+    }
+    pit_arm();
+    armed = 1;
+}
+
+
+/** sched_arm_cpu
+ * DESCRIPTION: after queuing work for a cpu, make sure its timer comes round to it. A cpu whose
+ *              timer is stopped arms it on the resched IPI
+ * INPUTS: cpu - the cpu
+ * OUTPUTS: none
+ * SIDE EFFECTS: caller must hold interrupts off
+*/
+static void sched_arm_cpu(int32_t cpu)
+{
+    if (!lapic_timer_on)
+    {
+        if (!armed)
+        {
+            sched_arm();
+        }
+        return;
+    }
+    if (runqs[cpu].armed)
+    {
+        return;
+    }
+    if (cpu == cpu_id())
+    {
+        sched_arm();
+    }
+    else
+    {
+        smp_resched(cpu);
+    }
+}
+
+
+/** sched_used
+ * DESCRIPTION: how much of its slice the running process has used since it was last charged
+ * INPUTS: rq - this cpu's run queue
+ * OUTPUTS: microseconds. a whole tick with the pit, which only interrupts once a tick
+ * SIDE EFFECTS: stops charging until the timer is armed again
+*/
+static uint32_t sched_used(runq_t* rq)
+{
+    uint64_t cycles;
+
+    if (!lapic_timer_on)
+    {
+        return SCHED_TICK_US;
+    }
+    if (rq->run_start == 0)
+    {
+        return 0;
+    }
+    cycles = rdtsc() - rq->run_start;
+    rq->run_start = 0;
+    if (cycles >> 32)
+    {
+        return 0xFFFFFFFF / tsc_per_us;
+    }
+    return (uint32_t)cycles / tsc_per_us;
+}
 
+
+/** sched_set_tickless
+ * DESCRIPTION: switch between tickless and periodic pit interrupts
+ * INPUTS: on - 1 for tickless
+ * OUTPUTS: none
+*/
+void sched_set_tickless(int on)
+{
+    uint32_t flags;
+    int32_t  i;
+
+    cli_and_save(flags);
+    sched_tickless = on;
+    sched_arm();
+    if (lapic_timer_on)
+    {
+        // the others look again on the IPI if their timer is stopped, or at their next tick
+        for (i = 0; i < ncpus; i++)
+        {
+            smp_resched(i);
+        }
+    }
+    restore_flags(flags);
+}
+
+
+/** sched_boost
+ * DESCRIPTION: move every process back up to SCHED_START_LEVEL, so cpu bound processes that sank
+ *              to the bottom can't be starved by a steady stream of interactive ones
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: caller must hold interrupts off. covers every cpu
+*/
+static void sched_boost(void)
+{
+    pcb_t*  head;
+    pcb_t*  tail;
+    pcb_t*  pcb;
+    int     i;
+
+    spin_lock(&sched_lock);
+    for (i = 0; i < ncpus; i++)
+    {
+        // drain the queues in pick order, then queue everyone again at their new level
+        head = NULL;
+        tail = NULL;
+        while ((pcb = rq_pop(&runqs[i])) != NULL)
+        {
+            if (tail != NULL)
+            {
+                tail->rq_next = pcb;
             }
-            terminals_initialized[idx] = 1;
-            execute("shell");  
+            else
+            {
+                head = pcb;
+            }
+            tail = pcb;
+        }
+        while (head != NULL)
+        {
+            pcb  = head;
+            head = pcb->rq_next;
+            if (pcb->level > SCHED_START_LEVEL)
+            {
+                pcb->level = SCHED_START_LEVEL;
+                pcb->slice = quantum[SCHED_START_LEVEL];
+            }
+            rq_push(pcb);
+        }
+
+        pcb = cpus[i].pcb;
+        if (!runqs[i].in_idle && pcb != NULL && pcb->level > SCHED_START_LEVEL)
+        {
+            pcb->level = SCHED_START_LEVEL;
+            pcb->slice = quantum[SCHED_START_LEVEL];
+        }
+    }
+    spin_unlock(&sched_lock);
+}
+
+
+/** idle_account
+ * DESCRIPTION: add the time since the last halt started to the idle total
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: none if we weren't halted
+*/
+static void idle_account(void)
+{
+    runq_t*  rq;
+    uint32_t flags;
+
+    cli_and_save(flags);
+    rq = this_rq();
+    if (rq->idle_start != 0)
+    {
+        sched_stats.idle_cycles += rdtsc() - rq->idle_start;
+        rq->idle_start = 0;
+    }
+    restore_flags(flags);
+}
+
+
+/** idle_wait
+ * DESCRIPTION: halt the cpu until the next interrupt, counting the time as idle
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: returns with interrupts on. the kernel lock is let go while halted
+*/
+void idle_wait(void)
+{
+    int32_t depth;
+
+    cli();
+    depth = kernel_release();
+    this_rq()->idle_start = rdtsc();
+    // sti only takes effect after the next instruction, so no interrupt sneaks in before hlt
+    asm volatile ("sti; hlt" : : : "memory");
+    kernel_reacquire(depth);
+    idle_account();
+}
+
+
+/** idle_task
+ * DESCRIPTION: what the cpu runs when no process is runnable. Halts until an interrupt, and
+ *              hands the cpu straight back if that interrupt woke somebody up
+ * INPUTS: none
+ * OUTPUTS: never returns
+ * SIDE EFFECTS: runs on idle_stack (an AP's boot stack), entered from task_switch
+*/
+void idle_task(void)
+{
+    for (;;)
+    {
+        idle_wait();
+        if (sched_runnable())
+        {
+            schedule();
         }
+    }
+}
 
 
-        // save esp and ebp to resume process next time
-        prev_pcb->sch_esp = sch_esp;
-        prev_pcb->sch_ebp = sch_ebp;
+/** sched_ap_idle
+ * DESCRIPTION: where an AP ends up once it's started: its boot stack becomes its idle task
+ * INPUTS: none
+ * OUTPUTS: never returns
+ * SIDE EFFECTS: caller holds the kernel lock
+*/
+void sched_ap_idle(void)
+{
+    cli();
+    this_rq()->in_idle = 1;
+    idle_task();
+}
+
+
+/** sched_new
+ * DESCRIPTION: give a new process its starting level and a full slice
+ * INPUTS: pcb - the process
+ * OUTPUTS: none
+*/
+void sched_new(pcb_t* pcb)
+{
+    pcb->level = SCHED_START_LEVEL;
+    pcb->slice = quantum[SCHED_START_LEVEL];
+    pcb->affinity = SCHED_ALL_CPUS;
+}
 
 
-        // remap paging
-        page_directory[USERIDX].address_31_12 = (EIGHT_MB + (cur_pid * FOUR_MB)) >> ADDRSHIFT;
-        if (cur_term == vis_term)
+/** sched_wake
+ * DESCRIPTION: make a woken process runnable again, with a fresh slice
+ * INPUTS: pcb - the process
+ *         boost - nonzero if it was woken by keyboard or mouse input, which moves it to the top
+ *                 level so the echo doesn't wait behind cpu bound work
+ * OUTPUTS: none
+ * SIDE EFFECTS: queues it on its cpu unless it is the one running there (it was only about to
+ *               sleep) or the scheduler is off. flags a reschedule if it outranks the running
+ *               process, and interrupts its cpu if that isn't us. the caller holds the kernel
+ *               lock, so the process's cpu can't be part way through switching it out
+*/
+void sched_wake(pcb_t* pcb, int boost)
+{
+    runq_t*  rq  = &runqs[pcb->cpu];
+    pcb_t*   cur = cpus[pcb->cpu].pcb;
+    uint32_t flags;
+
+    cli_and_save(flags);
+    pcb->state = PROC_RUNNABLE;
+    if (boost)
+    {
+        pcb->level = 0;
+    }
+    pcb->slice = quantum[pcb->level];
+    if (term_flag && !(pcb == cur && !rq->in_idle))
+    {
+        spin_lock(&sched_lock);
+        rq_push(pcb);
+        if (!rq->in_idle && cur != NULL && sched_level(pcb) < sched_level(cur))
+        {
+            rq->need_resched = 1;
+        }
+        if (rq->need_resched || rq->in_idle)
         {
-            vidmem_table[VIDMEMIDX].address_31_12 = VIDMEM >> ADDRSHIFT;
+            smp_resched(pcb->cpu);
         }
         else
         {
-            vidmem_table[VIDMEMIDX].address_31_12 = (VIDMEM + PAGESIZE*(cur_term+1)) >> ADDRSHIFT;    
+            sched_kick_idle();
+        }
+        spin_unlock(&sched_lock);
+        sched_arm_cpu(pcb->cpu);
+    }
+    restore_flags(flags);
+}
+
+
+/** sched_preempt
+ * DESCRIPTION: switch now if a process that outranks the running one was woken, rather than
+ *              at the next tick. called after waking someone from an interrupt handler
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: may switch processes
+*/
+void sched_preempt(void)
+{
+    runq_t*  rq;
+    uint32_t flags;
+
+    cli_and_save(flags);
+    rq = this_rq();
+    if (rq->need_resched && !this_cpu()->in_softirq)
+    {
+        rq->need_resched = 0;
+        task_switch();
+    }
+    restore_flags(flags);
+}
+
+
+/** sched_charge
+ * DESCRIPTION: charge the time since the last charge to the process running on this cpu. It
+ *              keeps the cpu until its slice runs out (and then drops a level) or something
+ *              that outranks it is woken
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: may switch processes. caller must hold interrupts off
+*/
+static void sched_charge(void)
+{
+    runq_t* rq  = this_rq();
+    pcb_t*  cur = rq->in_idle ? NULL : cur_pcb;
+    uint32_t used = sched_used(rq);
+
+    if (cur != NULL && cur->state == PROC_RUNNABLE)
+    {
+        // the timer may come a hair early, what's left then isn't worth another interrupt
+        cur->slice = ((uint32_t)cur->slice > used) ? cur->slice - (int32_t)used : 0;
+        if (cur->slice <= SCHED_SLACK_US)
+        {
+            if (cur->level < SCHED_LEVELS - 1)
+            {
+                cur->level++;
+            }
+            cur->slice = quantum[cur->level];
+            rq->need_resched = 1;
+        }
+    }
+
+    // shells still to launch go through task_switch too
+    if (rq->need_resched || cur == NULL || cur->state != PROC_RUNNABLE ||
+        sched_launch_pending(cpu_id()) < MAX_TERMINALS)
+    {
+        if (this_cpu()->in_softirq)
+        {
+            // deferred work is running under us, softirq_run switches when it's done
+            rq->need_resched = 1;
+            return;
+        }
+        rq->need_resched = 0;
+        task_switch();
+        return;
+    }
+    sched_arm();
+}
+
+
+/** sched_tick
+ * DESCRIPTION: timer tick. With the local APIC timer every cpu gets its own, with the pit only
+ *              the boot processor does and passes it on to every AP with processes waiting or
+ *              shells to launch. Then it's charged to our own running process
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: may switch processes, every SCHED_BOOST_US moves everyone back up. sets up the
+ *               next tick, if one is needed
+*/
+void sched_tick(void)
+{
+    uint64_t now;
+    int i;
+
+    cli();
+    if (lapic_timer_on)
+    {
+        this_rq()->armed = 0;
+    }
+    else
+    {
+        armed = 0;
+    }
+    sched_stats.timer_irqs++;
+    if (!term_flag)
+    {
+        task_switch();
+        return;
+    }
+
+    now = rdtsc();
+    if (now >= boost_at)
+    {
+        boost_at = now + (uint64_t)SCHED_BOOST_US * tsc_per_us;
+        sched_boost();
+    }
+
+    for (i = 1; i < ncpus && cpu_id() == 0; i++)
+    {
+        if (lapic_timer_on)
+        {
+            // APs with their timer stopped don't know the scheduler was turned on
+            if (sched_launch_pending(i) < MAX_TERMINALS)
+            {
+                sched_arm_cpu(i);
+            }
+        }
+        else if (runqs[i].rq_levels != 0 || sched_launch_pending(i) < MAX_TERMINALS)
+        {
+            runqs[i].tick_pending = 1;
+            smp_resched(i);
+        }
+    }
+    sched_charge();
+}
+
+
+/** sched_ipi
+ * DESCRIPTION: another cpu interrupted us: take a forwarded tick, or switch to a process it
+ *              woke that outranks ours. With the local APIC timer, start ours if it was stopped
+ *              and something is waiting now
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: may switch processes
+*/
+void sched_ipi(void)
+{
+    runq_t* rq = this_rq();
+
+    cli();
+    if (rq->tick_pending)
+    {
+        rq->tick_pending = 0;
+        sched_charge();
+        return;
+    }
+    sched_preempt();
+    if (lapic_timer_on && !this_rq()->armed)
+    {
+        sched_arm();
+    }
+}
+
+
+/** kthread_create
+ * DESCRIPTION: start a kernel thread: a process that only runs fn in the kernel
+ * INPUTS: fn - what to run, the thread exits when it returns
+ *         arg - passed to fn
+ * OUTPUTS: the thread's pcb, NULL if there's no pid or memory left
+ * SIDE EFFECTS: the thread goes on this cpu's run queue and first runs on the next switch to it.
+ *               it isn't stolen unless the caller widens its affinity
+*/
+pcb_t* kthread_create(void (*fn)(void*), void* arg)
+{
+    pcb_t*   pcb = proc_alloc(ANY_PID);
+    uint32_t flags;
+
+    if (pcb == NULL)
+    {
+        return NULL;
+    }
+    pcb->parent_id = -1;
+    pcb->page_dir  = page_directory;
+    pcb->term      = (cur_term < 0) ? 0 : cur_term;
+    pcb->cpu       = cpu_id();
+    pcb->bkl_depth = 1;                 // kthread_start runs holding the kernel lock
+    pcb->kfn       = fn;
+    pcb->karg      = arg;
+    pcb->state     = PROC_RUNNABLE;
+    sched_new(pcb);
+    pcb->affinity  = 1 << pcb->cpu;     // they hold the kernel lock, not worth moving
+
+    spin_lock_irqsave(&sched_lock, flags);
+    rq_push(pcb);
+    sched_kick_idle();
+    spin_unlock(&sched_lock);
+    sched_arm_cpu(pcb->cpu);
+    restore_flags(flags);
+    return pcb;
+}
+
+
+/** kthread_start
+ * DESCRIPTION: first thing a kernel thread runs, on its own fresh stack
+ * INPUTS: none
+ * OUTPUTS: never returns
+*/
+void kthread_start(void)
+{
+    sti();
+    cur_pcb->kfn(cur_pcb->karg);
+    kthread_exit();
+}
+
+
+/** kthread_exit
+ * DESCRIPTION: end the running kernel thread
+ * INPUTS: none
+ * OUTPUTS: never returns
+ * SIDE EFFECTS: frees its pid, the stack goes once we've switched off it
+*/
+void kthread_exit(void)
+{
+    cli();
+    proc_free(cur_pid);
+    cur_pcb = NULL;
+    cur_pid = -1;
+    task_switch();
+
+    // only get here if the scheduler was turned off under us
+    for (;;)
+    {
+        idle_wait();
+    }
+}
+
+
+/** task_switch
+ * DESCRIPTION: put the running process at the back of this cpu's run queue and switch to the
+ *              one at the front. Terminals of this cpu without a shell get one launched first,
+ *              and if nothing is runnable we switch to the idle task
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: runs with interrupts off, the process switched to turns them back on. the
+ *               kernel lock depth is switched along with the stack
+*/
+void task_switch()
+{
+    runq_t* rq;
+    cpu_t*  c;
+    pcb_t * prev;
+    pcb_t * next;
+    uint32_t used;
+    int t, i;
+
+    cli();
+    idle_account();
+    rq = this_rq();
+    c  = this_cpu();
+
+    if (!term_flag)
+    {
+        terminals_initialized[0] = 0;
+        terminals_initialized[1] = 0;
+        terminals_initialized[2] = 0;
+        spin_lock(&sched_lock);
+        for (i = 0; i < ncpus; i++)
+        {
+            while (rq_pop(&runqs[i]) != NULL);
+        }
+        spin_unlock(&sched_lock);
+        sched_arm();
+        return;
+    }
+
+    // get current esp and ebp
+    register uint32_t sch_ebp asm("ebp");
+    register uint32_t sch_esp asm("esp");
+
+    // NULL when there's nothing to come back to (idle, a finished kernel thread, the gui)
+    prev = rq->in_idle ? NULL : cur_pcb;
+
+    // prev goes on the queue before its stack is saved below. that's only safe against it being
+    // stolen in between because the kernel lock keeps other cpus out until we've switched. every
+    // way in holds it: the interrupt linkages, and schedule for the system calls that don't
+    spin_lock(&sched_lock);
+    t = sched_launch_pending(c->id);
+    if (prev != NULL && prev->state == PROC_RUNNABLE)
+    {
+        rq_push(prev);
+    }
+    if (t < MAX_TERMINALS)
+    {
+        next = NULL;        // launch the shell, nothing to pick
+    }
+    else
+    {
+        next = rq_pop(rq);
+        if (next == NULL)
+        {
+            next = sched_steal(c->id);
+        }
+        if (next != NULL && next == prev)
+        {
+            spin_unlock(&sched_lock);
+            sched_arm();
+            return;         // nobody else wants the cpu
+        }
+    }
+
+    // more waiting here than we'll get to soon, get an idle cpu to take some
+    if (next != NULL && rq->rq_levels != 0)
+    {
+        sched_kick_idle();
+    }
+    spin_unlock(&sched_lock);
+
+    // save esp and ebp to resume next time
+    if (prev != NULL)
+    {
+        prev->sch_esp = sch_esp;
+        prev->sch_ebp = sch_ebp;
+        prev->bkl_depth = c->bkl_depth;
+        prev->last_ran = rdtsc();
+        if (prev->state == PROC_RUNNABLE && lapic_timer_on)
+        {
+            // preempted part way, it keeps the rest of its slice
+            used = sched_used(rq);
+            prev->slice = ((uint32_t)prev->slice > used) ? prev->slice - (int32_t)used : 1;
         }
-        flushTLB();
+    }
+    else if (rq->in_idle && (next != NULL || t < MAX_TERMINALS))
+    {
+        // leaving the idle task, it picks up from here next time
+        rq->idle_esp = sch_esp;
+        rq->idle_ebp = sch_ebp;
+        rq->idle_depth = c->bkl_depth;
+        rq->in_idle = 0;
+    }
 
-        // context switch
-        tss.esp0 = (EIGHT_MB - ((cur_pid) * EIGHT_KB) - sizeof(int));
+    // whatever runs next gets the timer armed for its own slice
+    rq->run_start = 0;
+    rq->armed = 0;
 
-        //update esp and ebp with new args
+    // launch shells at start
+    if (t < MAX_TERMINALS)
+    {
+        terminals_initialized[t] = 1;
+        cur_term = t;
+        sched_arm();
+        execute_kernel("shell");  
+    }
 
-        int newesp = cur_pcb->sch_esp;
-        int newebp = cur_pcb->sch_ebp;
+    if (next == NULL)
+    {
+        // everyone is asleep
+        if (rq->in_idle)
+        {
+            sched_arm();
+            return;
+        }
+        rq->in_idle = 1;
+
+        // on one cpu the last address space is as good as any. with more, the process it
+        // belongs to may be stolen and exit elsewhere, and pd_destroy can't free a directory
+        // we still have loaded
+        if (ncpus > 1)
+        {
+            pd_switch(page_directory);
+        }
+        sched_arm();
+        sched_stats.idle_switches++;
 
+        if (rq->idle_esp == 0)
+        {
+            // first time in, start the idle task on a fresh stack
+            c->bkl_depth = 1;
+            asm volatile("\
+                movl %0, %%esp; \
+                xorl %%ebp, %%ebp; \
+                call idle_task;"
+                :
+                : "r"((uint32_t)idle_stack + IDLE_STACK_SIZE)
+                : "memory"
+                );
+        }
+        c->bkl_depth = rq->idle_depth;
         asm volatile("\
             movl %0, %%esp; \
             movl %1, %%ebp;"
             :
-            : "r"(newesp), "r"(newebp)
-            : "%esp", "%ebp"
+            : "r"(rq->idle_esp), "r"(rq->idle_ebp)
+            : "%ebp"
             );
+        return;
     }
-    else
+
+    sched_stats.switches++;
+    cur_pcb  = next;
+    cur_pid  = next->pid;
+    cur_term = next->term;
+    c->bkl_depth = next->bkl_depth;
+    sched_arm();
+
+    // switch address space, the program page, heap and vidmap page all come with it
+    pd_switch(cur_pcb->page_dir);
+
+    // context switch
+    c->tss->esp0 = KSTACK_TOP(cur_pcb);
+
+    if (cur_pcb->kfn != NULL && cur_pcb->sch_esp == 0)
     {
-        idx = -1;
-        terminals_initialized[0] = 0;
-        terminals_initialized[1] = 0;
-        terminals_initialized[2] = 0;
+        // kernel thread that hasn't run yet
+        asm volatile("\
+            movl %0, %%esp; \
+            xorl %%ebp, %%ebp; \
+            call kthread_start;"
+            :
+            : "r"(KSTACK_TOP(cur_pcb))
+            : "memory"
+            );
+    }
+
+    //update esp and ebp with new args
+
+    int newesp = cur_pcb->sch_esp;
+    int newebp = cur_pcb->sch_ebp;
+
+    asm volatile("\
+        movl %0, %%esp; \
+        movl %1, %%ebp;"
+        :
+        : "r"(newesp), "r"(newebp)
+        : "%esp", "%ebp"
+        );
+}
+
+
+/** schedule
+ * DESCRIPTION: give up the cpu from inside a system call, e.g. to sleep on a wait queue
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: returns once the scheduler picks this process again. takes the kernel lock for
+ *               the switch if the system call runs without it, the depth goes with the process
+*/
+void schedule(void)
+{
+    uint32_t flags;
+
+    if (!term_flag)
+    {
+        return;
     }
+    kernel_enter();
+    cli_and_save(flags);
+    task_switch();
+    restore_flags(flags);
+    kernel_exit();
 }
@@ -1,14 +1,119 @@
 /** scheduler.h
- *  Schedule tasks in a round-robin fashion
+ *  Schedule processes off a multi-level feedback queue
 */
 
 #ifndef _SCHEDULER_H
 #define _SCHEDULER_H
 
 #include "lib.h"
+#include "x86_desc.h"
+#include "spinlock.h"
+#include "pit.h"
 
+struct pcb;
+
+/** BACKGROUND:
+ *  - Runnable processes wait on a FIFO run queue per level, independent of the terminals. A
+ *    switch puts the running process at the back of its level (if it is still runnable) and takes
+ *    the oldest process of the highest non empty level, found with one bit scan, so picking the
+ *    next process is O(1) however many there are. A terminal is only the process's I/O
+ *    attachment (pcb->term), which the scheduler loads into cur_term.
+ *  - Level 0 runs for SCHED_TICK_US, lower levels for longer. A process that uses up its whole
+ *    slice drops a level, one that sleeps before then keeps it. So cpu bound work sinks to the
+ *    bottom with long slices and anything that mostly waits stays near the top.
+ *  - Input gets a latency boost: a process woken by the keyboard goes to level 0 and, since it
+ *    outranks whatever is running, the keyboard handler switches to it straight away. Processes
+ *    of the terminal on screen are never queued below SCHED_FG_LEVEL.
+ *  - Every SCHED_BOOST_US everything is moved back up to SCHED_START_LEVEL, so a steady
+ *    stream of interactive work can't starve the bottom level.
+ *  - Ticks are one shot timer interrupts. In tickless mode (the default) the scheduler only arms
+ *    the next one when something is waiting for the cpu: a process running alone keeps the cpu
+ *    with no timer interrupts at all, and the idle task halts until the next device interrupt.
+ *    Slices are only charged while there is contention. With sched_tickless off it arms every
+ *    tick.
+ *  - The timer is each cpu's local APIC timer (apic.h), armed for exactly what's left of the
+ *    running process's slice, and the slice is charged the time measured with rdtsc. So a cpu
+ *    only takes an interrupt when a slice really runs out, and slices can be any number of
+ *    microseconds. Without a local APIC the pit is the timer: only the boot processor gets it,
+ *    every tick is SCHED_TICK_US and is charged as a whole.
+ *  - A process that sleeps on a wait queue simply isn't put back. wake_up puts it back through
+ *    sched_wake. A parent blocked in execute isn't on the queue either, its child runs in its
+ *    place until halt hands the cpu straight back.
+ *  - Kernel threads are processes with no user side. They share the kernel's page directory and
+ *    start running fn on their own kernel stack the first time they're picked.
+ *  - When the queue is empty the scheduler switches to the idle task instead of staying on a
+ *    sleeper. The idle task runs on its own small kernel stack and only halts the cpu, it isn't
+ *    a process and has no pid or address space of its own.
+ *  - Time spent halted, by the idle task or by anything else waiting on idle_wait, is added up in
+ *    sched_stats.idle_cycles so it can be told apart from time spent running processes.
+ *  - Every cpu has its own run queues and idle task (see smp.h). A process stays on the cpu it
+ *    was started on: its terminal's cpu, or the creating cpu for kernel threads, and waking it
+ *    queues it there, with an IPI if that cpu is idle or should preempt, or has its timer stopped
+ *    and now needs it. With the pit, sched_tick passes the boot processor's ticks on as IPIs to
+ *    the APs that have something waiting.
+ *  - That cpu is only where a process starts and is woken: a cpu with nothing to run steals from
+ *    the peer with the most processes waiting, and the process stays on the thief from then on.
+ *    It takes from the highest level with something it may run (pcb->affinity), and of those the
+ *    one that has been off a cpu longest (pcb->last_ran), since its cache footprint is the most
+ *    likely to be gone anyway. Queuing work on a busy cpu kicks an idle one with an IPI so it
+ *    comes and looks. All the queues are covered by sched_lock, stealing crosses between them.
+ *    Kernel threads run holding the kernel lock, so they're only stolen if their creator widens
+ *    their affinity.
+ */
+#define IDLE_STACK_SIZE     4096                // deferred work, and an interrupt on top of it, can run here
+
+#define SCHED_LEVELS        3
+#define SCHED_START_LEVEL   1                   // new processes, and everyone after a boost
+#define SCHED_FG_LEVEL      1                   // lowest level for vis_term's processes
+#define SCHED_TICK_US       PIT_TICK_US         // level 0's slice, and the pit's tick
+#define SCHED_SLACK_US      100                 // less left than this counts as used up
+#define SCHED_BOOST_US      1000000
+#define SCHED_ALL_CPUS      ((1 << SMP_MAX_CPUS) - 1)   // default affinity
+
+typedef struct {
+    uint64_t idle_cycles;                   /* halted waiting for an interrupt */
+    uint32_t idle_switches;                 /* times nothing was runnable */
+    uint32_t switches;                      /* switches to a process */
+    uint32_t rq_len;                        /* processes on the run queue right now */
+    uint32_t timer_irqs;                    /* timer interrupts taken, every cpu */
+    uint32_t steals;                        /* processes an idle cpu took from another */
+} sched_stats_t;
+
+extern sched_stats_t sched_stats;
+extern spinlock_t sched_lock;
+extern int terminals_initialized[3];
+extern int sched_tickless;
 
 void task_switch();
+void schedule(void);
+
+/* timer tick: preempt the running process once its slice is used up */
+void sched_tick(void);
+
+/* tickless (1) or periodic (0) pit interrupts */
+void sched_set_tickless(int on);
+
+/* switch right away if a woken process outranks the running one */
+void sched_preempt(void);
+
+/* resched IPI from another cpu: a forwarded tick, or a wake up to act on */
+void sched_ipi(void);
+
+/* an AP's boot stack turns into its idle task */
+void sched_ap_idle(void);
+
+/* starting level and slice for a new process, and the affinity to go with it */
+void sched_new(struct pcb* pcb);
+
+/* a sleeping process was woken, queue it again. boost is for input. safe from interrupt handlers */
+void sched_wake(struct pcb* pcb, int boost);
+
+/* start / end a kernel thread */
+struct pcb* kthread_create(void (*fn)(void*), void* arg);
+void kthread_exit(void);
+
+/* halt until the next interrupt, counted as idle time. returns with interrupts on */
+void idle_wait(void);
 
 int term_flag;
 
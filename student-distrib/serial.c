@@ -0,0 +1,50 @@
+/** serial.c
+ *  Polled output on the first serial port
+*/
+
+#include "serial.h"
+#include "lib.h"
+
+
+/** serial_init
+ * DESCRIPTION: set COM1 up for 115200 8N1 with its FIFOs on and its interrupts off
+ * INPUTS: none
+ * OUTPUTS: none
+*/
+void serial_init(void)
+{
+    outb(0, COM1 + SERIAL_IER);
+    outb(LCR_DLAB, COM1 + SERIAL_LCR);
+    outb(SERIAL_DIVISOR & 0xFF, COM1 + SERIAL_DATA);
+    outb(SERIAL_DIVISOR >> 8, COM1 + SERIAL_IER);
+    outb(LCR_8N1, COM1 + SERIAL_LCR);
+    outb(FCR_ENABLE_CLEAR, COM1 + SERIAL_FCR);
+    outb(MCR_DTR_RTS, COM1 + SERIAL_MCR);
+}
+
+
+/** serial_putc
+ * DESCRIPTION: send one byte
+ * INPUTS: c - the byte
+ * OUTPUTS: none
+ * SIDE EFFECTS: spins until the transmitter has room
+*/
+void serial_putc(uint8_t c)
+{
+    while (!(inb(COM1 + SERIAL_LSR) & LSR_THR_EMPTY));
+    outb(c, COM1 + SERIAL_DATA);
+}
+
+
+/** serial_puts
+ * DESCRIPTION: send a string
+ * INPUTS: s - nul terminated
+ * OUTPUTS: none
+*/
+void serial_puts(const int8_t* s)
+{
+    while (*s != '\0')
+    {
+        serial_putc((uint8_t)*s++);
+    }
+}
@@ -0,0 +1,40 @@
+/** serial.h
+ *  Polled output on the first serial port
+*/
+
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include "types.h"
+
+/** BACKGROUND:
+ *  - COM1 is a 16550 UART at I/O port 0x3F8. It's only used to get data out of the machine
+ *    (profiler dumps): QEMU run with -serial file:out.txt writes everything sent to it to a file
+ *    on the host. Nothing is read, and no interrupt is used, each byte waits for the transmit
+ *    register to empty.
+ *  - The divisor latch sets the baud rate as 115200 / divisor. QEMU doesn't care, real
+ *    hardware on the other end needs the same 115200 8N1.
+ */
+#define COM1                0x3F8
+#define SERIAL_DATA         0           // transmit holding register (divisor low while DLAB)
+#define SERIAL_IER          1           // interrupt enable (divisor high while DLAB)
+#define SERIAL_FCR          2           // FIFO control
+#define SERIAL_LCR          3           // line control
+#define SERIAL_MCR          4           // modem control
+#define SERIAL_LSR          5           // line status
+
+#define LCR_DLAB            0x80
+#define LCR_8N1             0x03
+#define FCR_ENABLE_CLEAR    0xC7        // FIFOs on and cleared, 14 byte threshold
+#define MCR_DTR_RTS         0x03
+#define LSR_THR_EMPTY       0x20
+#define SERIAL_DIVISOR      1           // 115200 baud
+
+/* program the port, 115200 8N1, interrupts off */
+void serial_init(void);
+
+/* send a byte / a string, waiting for room */
+void serial_putc(uint8_t c);
+void serial_puts(const int8_t* s);
+
+#endif /* _SERIAL_H */
@@ -0,0 +1,277 @@
+/** shm.c
+ *  Shared memory segments: the same frames mapped into several processes' address spaces
+*/
+
+#include "shm.h"
+#include "buddy.h"
+#include "lib.h"
+#include "spinlock.h"
+
+#define PAGE_UP(x)      (((x) + PAGESIZE - 1) & ~(PAGESIZE - 1))
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+static shm_seg_t  segs[SHM_MAX_SEGS];
+static spinlock_t shm_lock = SPINLOCK_INIT("shm");         // segs, and every process's attachments
+/*************************************************************************/
+
+
+/** seg_free
+ * DESCRIPTION: give a segment's frames and page table back
+ * INPUTS: seg - segment with nothing attached
+ * OUTPUTS: none
+ * SIDE EFFECTS: caller must hold shm_lock
+*/
+static void seg_free(shm_seg_t* seg)
+{
+    uint32_t i;
+
+    for (i = 0; i < seg->npages; i++)
+    {
+        if (seg->table[i].present)
+        {
+            page_free(seg->table[i].address_31_12 << ADDRSHIFT);
+        }
+    }
+    kpage_free(seg->table, 1);
+    seg->table = NULL;
+    seg->in_use = 0;
+}
+
+
+/** seg_put
+ * DESCRIPTION: drop one attachment, freeing the segment with the last one once its creator
+ *              has halted
+ * SIDE EFFECTS: caller must hold shm_lock
+*/
+static void seg_put(shm_seg_t* seg)
+{
+    if (--seg->attached == 0 && seg->creator == -1)
+    {
+        seg_free(seg);
+    }
+}
+
+
+/** shm_init
+ * DESCRIPTION: empty segment table
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: must run after paging_init
+*/
+void shm_init(void)
+{
+    memset(segs, 0, sizeof(segs));
+}
+
+
+/** shm_get
+ * DESCRIPTION: look up a segment by key, creating it if no segment has that key
+ * INPUTS: key - shared name for the segment, SHM_PRIVATE always creates a new one
+ *         size - bytes, rounded up to whole pages. ignored if the segment already exists
+ *         pid - process asking, it holds a segment it creates until it halts
+ * OUTPUTS: segment id, -1 if size is out of range, the table is full or out of memory
+ * SIDE EFFECTS: allocates the frames of a new segment
+*/
+int32_t shm_get(int32_t key, uint32_t size, int32_t pid)
+{
+    shm_seg_t* seg = NULL;
+    uint32_t   flags;
+    uint32_t   frame;
+    uint32_t   i;
+
+    spin_lock_irqsave(&shm_lock, flags);
+    if (key != SHM_PRIVATE)
+    {
+        for (i = 0; i < SHM_MAX_SEGS; i++)
+        {
+            if (segs[i].in_use && segs[i].key == key)
+            {
+                spin_unlock_irqrestore(&shm_lock, flags);
+                return i;
+            }
+        }
+    }
+
+    if (size == 0 || size > SHM_MAX_SIZE)
+    {
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return -1;
+    }
+
+    for (i = 0; i < SHM_MAX_SEGS; i++)
+    {
+        if (!segs[i].in_use)
+        {
+            seg = &segs[i];
+            break;
+        }
+    }
+    if (seg == NULL || (seg->table = (pte_t*)kpage_alloc(1)) == NULL)
+    {
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return -1;
+    }
+    memset(seg->table, 0, PAGESIZE);
+
+    seg->key      = key;
+    seg->npages   = PAGE_UP(size) / PAGESIZE;
+    seg->attached = 0;
+    seg->creator  = pid;
+    seg->zeroed   = 0;
+    seg->in_use   = 1;
+
+    for (i = 0; i < seg->npages; i++)
+    {
+        if ((frame = page_alloc()) == 0)
+        {
+            seg_free(seg);
+            spin_unlock_irqrestore(&shm_lock, flags);
+            return -1;
+        }
+        seg->table[i].address_31_12 = frame >> ADDRSHIFT;
+        seg->table[i].user_supervisor = 1;
+        seg->table[i].read_write = 1;
+        seg->table[i].present = 1;
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+
+    return seg - segs;
+}
+
+
+/** shm_attach
+ * DESCRIPTION: map a segment into a free slot of a process's shm window
+ * INPUTS: map - the process's attachments
+ *         pd - the process's page directory, must be in cr3
+ *         id - segment id from shm_get
+ * OUTPUTS: user address of the segment, 0 if the id is bad or every slot is taken
+ * SIDE EFFECTS: zeroes the segment on its first attach
+*/
+uint32_t shm_attach(shm_map_t* map, pde_t* pd, int32_t id)
+{
+    shm_seg_t* seg;
+    pde_t*     pde;
+    uint32_t   flags;
+    uint32_t   i;
+
+    if (id < 0 || id >= SHM_MAX_SEGS)
+    {
+        return 0;
+    }
+    seg = &segs[id];
+
+    spin_lock_irqsave(&shm_lock, flags);
+    if (!seg->in_use)
+    {
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return 0;
+    }
+    for (i = 0; i < SHM_SLOTS && map->slots[i] != NULL; i++);
+    if (i == SHM_SLOTS)
+    {
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return 0;
+    }
+
+    map->slots[i] = seg;
+    seg->attached++;
+
+    // not present -> present, no flush needed
+    pde = &pd[SHM_IDX + i];
+    pde->page_size = 0;
+    pde->address_31_12 = kheap_virt_to_phys(seg->table) >> ADDRSHIFT;
+    pde->user_supervisor = 1;
+    pde->read_write = 1;
+    pde->present = 1;
+
+    if (!seg->zeroed)
+    {
+        memset((void*)SHM_SLOT_ADDR(i), 0, seg->npages * PAGESIZE);
+        seg->zeroed = 1;
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+
+    return SHM_SLOT_ADDR(i);
+}
+
+
+/** shm_detach
+ * DESCRIPTION: unmap a segment from a process
+ * INPUTS: map - the process's attachments
+ *         pd - the process's page directory, must be in cr3
+ *         addr - address shm_attach returned
+ * OUTPUTS: 0 on success, -1 if nothing is attached there
+ * SIDE EFFECTS: frees the segment if this was its last attachment
+*/
+int32_t shm_detach(shm_map_t* map, pde_t* pd, uint32_t addr)
+{
+    shm_seg_t* seg;
+    uint32_t   flags;
+    uint32_t   i;
+
+    if (addr < SHM_BASE || (addr - SHM_BASE) % SHM_MAX_SIZE != 0)
+    {
+        return -1;
+    }
+    i = (addr - SHM_BASE) / SHM_MAX_SIZE;
+    if (i >= SHM_SLOTS)
+    {
+        return -1;
+    }
+
+    spin_lock_irqsave(&shm_lock, flags);
+    seg = map->slots[i];
+    if (seg == NULL)
+    {
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return -1;
+    }
+
+    pd[SHM_IDX + i].present = 0;
+    tlb_flush_range(addr, addr + seg->npages * PAGESIZE);
+    map->slots[i] = NULL;
+    seg_put(seg);
+    spin_unlock_irqrestore(&shm_lock, flags);
+
+    return 0;
+}
+
+
+/** shm_release
+ * DESCRIPTION: detach every segment when a process halts, and let go of the ones it created
+ * INPUTS: map - the process's attachments
+ *         pd - its page directory, which is about to be destroyed
+ *         pid - the process
+ * OUTPUTS: none
+ * SIDE EFFECTS: frees its segments nobody else has attached. stale TLB entries go with the
+ *               next cr3 load
+*/
+void shm_release(shm_map_t* map, pde_t* pd, int32_t pid)
+{
+    uint32_t flags;
+    uint32_t i;
+
+    spin_lock_irqsave(&shm_lock, flags);
+    for (i = 0; i < SHM_SLOTS; i++)
+    {
+        if (map->slots[i] != NULL)
+        {
+            pd[SHM_IDX + i].present = 0;
+            seg_put(map->slots[i]);
+            map->slots[i] = NULL;
+        }
+    }
+    for (i = 0; i < SHM_MAX_SEGS; i++)
+    {
+        if (segs[i].in_use && segs[i].creator == pid)
+        {
+            segs[i].creator = -1;
+            if (segs[i].attached == 0)
+            {
+                seg_free(&segs[i]);
+            }
+        }
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+}
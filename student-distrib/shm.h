@@ -0,0 +1,63 @@
+/* shm.h - shared memory segments between processes
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "types.h"
+#include "paging.h"
+
+/** BACKGROUND:
+ *  - A segment is up to 4MB of 4KB frames with one page table of its own. Attaching a segment
+ *    just points a free PDE in the shm window of the process's directory at that table, so
+ *    every process that attaches it sees the same frames, and attach costs the same no matter
+ *    how big the segment is.
+ *  - The shm window starts at SHM_BASE, right after the heap, one 4MB slot per attachment.
+ *  - Segments are found by key. Key SHM_PRIVATE always makes a new segment. The process that
+ *    created a segment holds it as well as every process attached to it, so a segment lives
+ *    until its creator has halted and the last process attached to it detaches (or halts). A
+ *    segment nobody attached goes when its creator halts.
+ *  - Frames are zeroed through the user mapping the first time the segment is attached.
+ */
+#define SHM_BASE            0xA800000
+#define SHM_IDX             42
+#define SHM_SLOTS           4                       // segments one process can have attached
+#define SHM_MAX_SEGS        16
+#define SHM_MAX_SIZE        0x400000                // one page table's worth
+#define SHM_PRIVATE         0
+#define SHM_SLOT_ADDR(i)    (SHM_BASE + (i) * SHM_MAX_SIZE)
+
+/* one shared segment */
+typedef struct {
+    int32_t  key;
+    uint32_t npages;
+    pte_t*   table;                             /* kernel heap address of the segment's page table */
+    uint32_t attached;                          /* number of attachments */
+    int32_t  creator;                           /* pid that created it, -1 once it has halted */
+    int32_t  zeroed;
+    int32_t  in_use;
+} shm_seg_t;
+
+/* attachments kept in the pcb, slot i is mapped at SHM_BASE + i * 4MB */
+typedef struct {
+    shm_seg_t* slots[SHM_SLOTS];
+} shm_map_t;
+
+/* empty segment table */
+void shm_init(void);
+
+/* find the segment with this key or create it for pid, returns its id or -1 */
+int32_t shm_get(int32_t key, uint32_t size, int32_t pid);
+
+/* map a segment into a process, pd must be in cr3. returns the user address, 0 on failure */
+uint32_t shm_attach(shm_map_t* map, pde_t* pd, int32_t id);
+
+/* unmap the segment attached at addr, pd must be in cr3 */
+int32_t shm_detach(shm_map_t* map, pde_t* pd, uint32_t addr);
+
+/* detach everything and drop the segments it created when process pid halts, pd doesn't have
+   to be in cr3 */
+void shm_release(shm_map_t* map, pde_t* pd, int32_t pid);
+
+#endif /* _SHM_H */
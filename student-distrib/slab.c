@@ -0,0 +1,418 @@
+/** slab.c
+ *  Object cache (slab) allocator for kernel objects, backed by pages from the kernel heap window
+*/
+
+#include "slab.h"
+#include "paging.h"
+#include "lib.h"
+
+#define SLAB_END            0xFFFF                      // end of a slab's free list
+#define ALIGN_UP(x, a)      (((x) + (a) - 1) & ~((a) - 1))
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+static kmem_cache_t  cache_pool[SLAB_MAX_CACHES];       // every cache lives here
+static kmem_cache_t* kmalloc_caches[KMALLOC_CLASSES];   // 32B, 64B ... 1KB
+static spinlock_t    slab_lock = SPINLOCK_INIT("slab");  // which of cache_pool are in use
+/*************************************************************************/
+
+
+/** list_push / list_remove
+ * DESCRIPTION: doubly linked slab list helpers. caller must hold the cache's lock.
+*/
+static void list_push(slab_t** head, slab_t* slab)
+{
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL)
+    {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void list_remove(slab_t** head, slab_t* slab)
+{
+    if (slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *head = slab->next;
+    }
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+
+/** slab_create
+ * DESCRIPTION: get a page for a cache, build its free list and construct every object in it
+ * INPUTS: cache - the cache to grow
+ * OUTPUTS: the new slab, NULL if out of memory
+ * SIDE EFFECTS: the slab is not put on any list
+*/
+static slab_t* slab_create(kmem_cache_t* cache)
+{
+    slab_t*  slab = (slab_t*)kpage_alloc(1);
+    uint32_t i;
+
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+
+    slab->next      = NULL;
+    slab->prev      = NULL;
+    slab->cache     = cache;
+    slab->inuse     = 0;
+    slab->free_head = 0;
+    slab->objs      = (uint8_t*)slab + cache->obj_offset;
+
+    for (i = 0; i < cache->per_slab; i++)
+    {
+        slab->free_next[i] = (i + 1 < cache->per_slab) ? i + 1 : SLAB_END;
+        if (cache->ctor != NULL)
+        {
+            cache->ctor(slab->objs + i * cache->obj_size);
+        }
+    }
+
+    cache->num_slabs++;
+    return slab;
+}
+
+
+/** slab_destroy
+ * DESCRIPTION: give an empty slab's page back
+ * INPUTS: slab - a slab that is on no list and has no objects in use
+*/
+static void slab_destroy(slab_t* slab)
+{
+    slab->cache->num_slabs--;
+    kpage_free(slab, 1);
+}
+
+
+/** cache_shrink
+ * DESCRIPTION: release every empty slab a cache is holding on to
+ * INPUTS: cache - the cache, its lock held
+ * OUTPUTS: none
+ * SIDE EFFECTS: frees pages
+*/
+static void cache_shrink(kmem_cache_t* cache)
+{
+    slab_t* slab;
+
+    while ((slab = cache->empty) != NULL)
+    {
+        list_remove(&cache->empty, slab);
+        slab_destroy(slab);
+    }
+    cache->num_empty = 0;
+}
+
+
+/** slab_init
+ * DESCRIPTION: clear the cache pool and create the kmalloc size classes
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: must run after paging_init, since slabs come from the kernel heap window
+*/
+void slab_init(void)
+{
+    static const int8_t* names[KMALLOC_CLASSES] = {
+        "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+    };
+    uint32_t i;
+
+    memset(cache_pool, 0, sizeof(cache_pool));
+    for (i = 0; i < KMALLOC_CLASSES; i++)
+    {
+        kmalloc_caches[i] = kmem_cache_create(names[i], 1 << (KMALLOC_MIN_SHIFT + i), 0, NULL);
+    }
+}
+
+
+/** kmem_cache_create
+ * DESCRIPTION: create a cache for objects of one size
+ * INPUTS: name - shows up in stats, truncated to SLAB_NAME_LEN - 1 chars
+ *         size - object size in bytes
+ *         align - power of two alignment. 0 picks the cache line size, or for objects smaller
+ *                 than half a line the next power of two so no object straddles a line
+ *         ctor - run once on every object when its slab is created, may be NULL
+ * OUTPUTS: the cache, NULL if the size/alignment doesn't fit in a page or the pool is full
+ * SIDE EFFECTS: no memory is allocated until the first kmem_cache_alloc
+*/
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size, uint32_t align, void (*ctor)(void* obj))
+{
+    kmem_cache_t* cache = NULL;
+    uint32_t      n, i;
+    uint32_t      flags;
+
+    if (size == 0 || (align & (align - 1)) != 0)
+    {
+        return NULL;
+    }
+
+    if (align == 0)
+    {
+        if (size >= CACHE_LINE_SIZE / 2)
+        {
+            align = CACHE_LINE_SIZE;
+        }
+        else
+        {
+            for (align = SLAB_MIN_ALIGN; align < size; align <<= 1);
+        }
+    }
+    if (align < SLAB_MIN_ALIGN)
+    {
+        align = SLAB_MIN_ALIGN;
+    }
+    size = ALIGN_UP(size, align);
+
+    /* most objects that fit after the header and its free list links */
+    n = (PAGESIZE - sizeof(slab_t)) / (size + sizeof(uint16_t));
+    while (n > 0 && ALIGN_UP(sizeof(slab_t) + n * sizeof(uint16_t), align) + n * size > PAGESIZE)
+    {
+        n--;
+    }
+    if (n == 0)
+    {
+        return NULL;
+    }
+
+    spin_lock_irqsave(&slab_lock, flags);
+    for (i = 0; i < SLAB_MAX_CACHES; i++)
+    {
+        if (!cache_pool[i].in_use)
+        {
+            cache = &cache_pool[i];
+            break;
+        }
+    }
+    if (cache == NULL)
+    {
+        spin_unlock_irqrestore(&slab_lock, flags);
+        return NULL;
+    }
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    strncpy(cache->name, name, SLAB_NAME_LEN - 1);
+    cache->obj_size   = size;
+    cache->align      = align;
+    cache->per_slab   = n;
+    cache->obj_offset = ALIGN_UP(sizeof(slab_t) + n * sizeof(uint16_t), align);
+    cache->ctor       = ctor;
+    cache->lock.owner = -1;
+    cache->lock.name  = cache->name;
+    cache->in_use     = 1;
+    spin_unlock_irqrestore(&slab_lock, flags);
+
+    return cache;
+}
+
+
+/** kmem_cache_destroy
+ * DESCRIPTION: free a cache and all of its slabs
+ * INPUTS: cache - cache from kmem_cache_create
+ * OUTPUTS: 0 on success, -1 if objects are still allocated
+ * SIDE EFFECTS: the cache pointer is invalid afterwards
+*/
+int32_t kmem_cache_destroy(kmem_cache_t* cache)
+{
+    uint32_t flags;
+
+    if (cache == NULL || !cache->in_use)
+    {
+        return -1;
+    }
+
+    spin_lock_irqsave(&cache->lock, flags);
+    if (cache->active != 0)
+    {
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return -1;
+    }
+    cache_shrink(cache);
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    // handing it back is the last thing, nobody can find it after that
+    spin_lock_irqsave(&slab_lock, flags);
+    cache->in_use = 0;
+    spin_unlock_irqrestore(&slab_lock, flags);
+
+    return 0;
+}
+
+
+/** kmem_cache_alloc
+ * DESCRIPTION: get an object from a cache. Partial slabs are used first so objects stay packed
+ *              into as few pages as possible, then the kept empty slab, then a new slab.
+ * INPUTS: cache - the cache
+ * OUTPUTS: pointer to the object, NULL if out of memory
+ * SIDE EFFECTS: the object is in whatever state it was freed in (or fresh from the constructor)
+*/
+void* kmem_cache_alloc(kmem_cache_t* cache)
+{
+    slab_t*  slab;
+    uint32_t idx;
+    uint32_t flags;
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    spin_lock_irqsave(&cache->lock, flags);
+    slab = cache->partial;
+    if (slab == NULL)
+    {
+        slab = cache->empty;
+        if (slab != NULL)
+        {
+            list_remove(&cache->empty, slab);
+            cache->num_empty--;
+        }
+        else
+        {
+            slab = slab_create(cache);
+            if (slab == NULL)
+            {
+                spin_unlock_irqrestore(&cache->lock, flags);
+                return NULL;
+            }
+        }
+        list_push(&cache->partial, slab);
+    }
+
+    idx = slab->free_head;
+    slab->free_head = slab->free_next[idx];
+    slab->inuse++;
+    cache->active++;
+
+    if (slab->free_head == SLAB_END)
+    {
+        list_remove(&cache->partial, slab);
+        list_push(&cache->full, slab);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    return slab->objs + idx * cache->obj_size;
+}
+
+
+/** kmem_cache_free
+ * DESCRIPTION: give an object back to its cache
+ * INPUTS: cache - the cache it came from
+ *         obj - the object
+ * OUTPUTS: none
+ * SIDE EFFECTS: may release the slab's page if it becomes empty
+*/
+void kmem_cache_free(kmem_cache_t* cache, void* obj)
+{
+    slab_t*  slab = (slab_t*)((uint32_t)obj & ~(PAGESIZE - 1));
+    uint32_t idx;
+    uint32_t flags;
+
+    if (obj == NULL || slab->cache != cache)
+    {
+        return;
+    }
+    idx = ((uint8_t*)obj - slab->objs) / cache->obj_size;
+
+    spin_lock_irqsave(&cache->lock, flags);
+    if (slab->free_head == SLAB_END)
+    {
+        list_remove(&cache->full, slab);
+        list_push(&cache->partial, slab);
+    }
+
+    slab->free_next[idx] = slab->free_head;
+    slab->free_head = idx;
+    slab->inuse--;
+    cache->active--;
+
+    if (slab->inuse == 0)
+    {
+        list_remove(&cache->partial, slab);
+        if (cache->num_empty < SLAB_KEEP_EMPTY)
+        {
+            list_push(&cache->empty, slab);
+            cache->num_empty++;
+        }
+        else
+        {
+            slab_destroy(slab);
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+
+/** kmem_cache_shrink
+ * DESCRIPTION: release every empty slab a cache is holding on to
+ * INPUTS: cache - the cache
+ * OUTPUTS: none
+ * SIDE EFFECTS: frees pages
+*/
+void kmem_cache_shrink(kmem_cache_t* cache)
+{
+    uint32_t flags;
+
+    spin_lock_irqsave(&cache->lock, flags);
+    cache_shrink(cache);
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+
+/** kmem_cache_footprint
+ * DESCRIPTION: bytes of pages held by a cache, compare with active * obj_size for utilization
+*/
+uint32_t kmem_cache_footprint(kmem_cache_t* cache)
+{
+    return cache->num_slabs * PAGESIZE;
+}
+
+
+/** kmalloc
+ * DESCRIPTION: allocate from the smallest power of two size class that fits
+ * INPUTS: size - bytes, at most KMALLOC_MAX_SIZE
+ * OUTPUTS: pointer to the memory, NULL if too big or out of memory
+ * SIDE EFFECTS: none
+*/
+void* kmalloc(uint32_t size)
+{
+    uint32_t cls;
+
+    if (size == 0 || size > KMALLOC_MAX_SIZE)
+    {
+        return NULL;
+    }
+    for (cls = 0; (1 << (KMALLOC_MIN_SHIFT + cls)) < size; cls++);
+
+    return kmem_cache_alloc(kmalloc_caches[cls]);
+}
+
+
+/** kfree
+ * DESCRIPTION: free memory from kmalloc. The owning cache is found through the slab header.
+ * INPUTS: ptr - pointer from kmalloc, NULL is ignored
+ * OUTPUTS: none
+ * SIDE EFFECTS: none
+*/
+void kfree(void* ptr)
+{
+    slab_t* slab = (slab_t*)((uint32_t)ptr & ~(PAGESIZE - 1));
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+    kmem_cache_free(slab->cache, ptr);
+}
@@ -0,0 +1,87 @@
+/* slab.h - object cache allocator for kernel objects
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include "types.h"
+#include "spinlock.h"
+
+/** BACKGROUND:
+ *  - Every object type (PCBs, fd tables, pipes, timers...) gets its own cache. A cache carves
+ *    single 4KB pages from kpage_alloc into equal sized objects. The slab header lives at the
+ *    start of its page, so finding an object's slab is just masking off the low 12 bits.
+ *  - The free list is an index array in the slab header rather than a pointer stored inside the
+ *    free objects. A freed object is left exactly as the caller left it, so the constructor only
+ *    runs once per object when its slab is created, not on every allocation.
+ *  - Slabs sit on one of three lists: partial (allocate from these first), full, and empty.
+ *    Only SLAB_KEEP_EMPTY empty slabs are kept around, the rest go back to the page allocator.
+ *  - Each cache has its own lock for its lists and counts, so different object types never
+ *    wait on each other. slab_lock only covers handing out the cache structs themselves.
+ */
+#define CACHE_LINE_SIZE     64
+#define SLAB_MIN_ALIGN      8
+#define SLAB_KEEP_EMPTY     1                           // empty slabs each cache holds on to
+#define SLAB_MAX_CACHES     32
+#define SLAB_NAME_LEN       16
+
+#define KMALLOC_MIN_SHIFT   5                           // smallest kmalloc size class is 32 bytes
+#define KMALLOC_MAX_SHIFT   10                          // largest is 1KB, anything bigger should use kpage_alloc
+#define KMALLOC_MAX_SIZE    (1 << KMALLOC_MAX_SHIFT)
+#define KMALLOC_CLASSES     (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+typedef struct kmem_cache kmem_cache_t;
+
+/* one page worth of objects */
+typedef struct slab {
+    struct slab*    next;
+    struct slab*    prev;
+    kmem_cache_t*   cache;
+    uint16_t        inuse;          /* objects handed out */
+    uint16_t        free_head;      /* first free object, SLAB_END if none */
+    uint8_t*        objs;           /* first object */
+    uint16_t        free_next[0];   /* free list links, one per object */
+} slab_t;
+
+struct kmem_cache {
+    int8_t          name[SLAB_NAME_LEN];
+    uint32_t        obj_size;       /* requested size rounded up to the alignment */
+    uint32_t        align;
+    uint32_t        per_slab;       /* objects per slab */
+    uint32_t        obj_offset;     /* offset of the first object from the page start */
+    void            (*ctor)(void* obj);
+    slab_t*         partial;
+    slab_t*         full;
+    slab_t*         empty;
+    uint32_t        num_slabs;
+    uint32_t        num_empty;
+    uint32_t        active;         /* objects currently allocated */
+    uint32_t        in_use;         /* nonzero while the cache exists */
+    spinlock_t      lock;           /* the lists and counts above */
+};
+
+/* set up the cache of caches and the kmalloc size classes */
+void slab_init(void);
+
+/* create a cache. align 0 means cache line aligned (or the next power of two for small objects) */
+kmem_cache_t* kmem_cache_create(const int8_t* name, uint32_t size, uint32_t align, void (*ctor)(void* obj));
+
+/* destroy a cache, fails if objects are still allocated */
+int32_t kmem_cache_destroy(kmem_cache_t* cache);
+
+/* get/put an object. returns NULL if out of memory */
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+/* general purpose allocation from power of two size classes, up to KMALLOC_MAX_SIZE */
+void* kmalloc(uint32_t size);
+void kfree(void* ptr);
+
+/* release empty slabs held by a cache */
+void kmem_cache_shrink(kmem_cache_t* cache);
+
+/* bytes of slab pages held by a cache, for fragmentation stats */
+uint32_t kmem_cache_footprint(kmem_cache_t* cache);
+
+#endif /* _SLAB_H */
@@ -0,0 +1,525 @@
+/** smp.c
+ *  Multiprocessor bring-up and per-cpu state
+*/
+
+#include "smp.h"
+#include "apic.h"
+#include "lib.h"
+#include "scheduler.h"
+#include "pit.h"
+
+#define MP_FLOAT_SIG        0x5F504D5F          // "_MP_"
+#define MP_CONFIG_SIG       0x504D4350          // "PCMP"
+#define MP_CONFIG_HDR_LEN   44
+#define MP_ENTRY_CPU        0
+#define MP_ENTRY_IOAPIC     2
+#define MP_CPU_ENTRY_LEN    20
+#define MP_ENTRY_LEN        8                   // every other entry type
+#define MP_CPU_ENABLED      0x01
+
+#define BDA_EBDA_SEG        0x40E               // BIOS data area: EBDA segment
+#define BDA_BASE_KB         0x413               // BIOS data area: KB of base memory
+#define BIOS_ROM_START      0xF0000
+#define BIOS_ROM_LEN        0x10000
+
+#define INIT_DELAY_US       10000
+#define STARTUP_DELAY_US    200
+#define ONLINE_TIMEOUT_US   100000
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+/* the boot processor's entry is good from the first instruction, before smp_init */
+cpu_t   cpus[SMP_MAX_CPUS] = {
+    { NULL, -1, -1, page_directory, &tss, 0, 0, 1, 0, 0 }
+};
+int32_t ncpus = 1;
+
+static uint32_t mp_apic_ids[SMP_MAX_CPUS];     // enabled cpus in the MP table, boot processor included
+static int32_t  mp_ncpus;
+static uint32_t lapic_base;
+static uint32_t ioapic_base;
+
+static tss_t    ap_tss[SMP_MAX_CPUS - 1];
+static uint8_t  ap_stacks[SMP_MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+
+spinlock_t      kernel_lock = SPINLOCK_INIT("kernel");     // held while some cpu is in the kernel
+
+/* for the trampoline: the AP being started and its stack */
+volatile int32_t ap_booting;
+uint32_t         ap_boot_stack;
+/*************************************************************************/
+
+/* the trampoline in ap_boot.S, copied to AP_BOOT_ADDR */
+extern uint8_t ap_boot_start[];
+extern uint8_t ap_boot_gdtr[];
+extern uint8_t ap_boot_end[];
+
+
+/** mp_checksum
+ * DESCRIPTION: MP structures sum to 0 mod 256
+ * INPUTS: p, len - the bytes
+ * OUTPUTS: 1 if the checksum is good
+*/
+static int mp_checksum(uint8_t* p, uint32_t len)
+{
+    uint8_t sum = 0;
+
+    while (len-- > 0)
+    {
+        sum += *p++;
+    }
+    return sum == 0;
+}
+
+
+/** mp_search
+ * DESCRIPTION: look for the MP floating pointer in one range, it's 16 byte aligned
+ * INPUTS: base, len - the range
+ * OUTPUTS: the floating pointer, NULL if it isn't there
+*/
+static uint8_t* mp_search(uint32_t base, uint32_t len)
+{
+    uint8_t* p;
+
+    for (p = (uint8_t*)base; p + 16 <= (uint8_t*)(base + len); p += 16)
+    {
+        if (*(uint32_t*)p == MP_FLOAT_SIG && mp_checksum(p, 16))
+        {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+
+/** bda_read16
+ * DESCRIPTION: read a word of the BIOS data area. through asm, since gcc flags any plain load
+ *              from an address this low as out of bounds
+ * INPUTS: addr - physical address, below 4KB
+ * OUTPUTS: the word there
+*/
+static inline uint32_t bda_read16(uint32_t addr)
+{
+    uint32_t v;
+
+    asm volatile ("movzwl (%1), %0" : "=r"(v) : "r"(addr) : "memory");
+    return v;
+}
+
+
+/** smp_detect
+ * DESCRIPTION: find the cpus and the APIC addresses in the MP table. the floating pointer is in
+ *              the first KB of the EBDA, the last KB of base memory, or the BIOS ROM
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: must run before paging_init, it reads physical memory below 1MB
+*/
+void smp_detect(void)
+{
+    uint8_t*  mpf;
+    uint8_t*  cfg;
+    uint8_t*  e;
+    uint32_t  ebda = bda_read16(BDA_EBDA_SEG) << 4;
+    uint32_t  base = bda_read16(BDA_BASE_KB) * 1024;
+    uint16_t  count, i;
+
+    mpf = (ebda != 0) ? mp_search(ebda, 1024) : NULL;
+    // a base memory word of 0 would put the last KB below address 0
+    if (mpf == NULL && base >= 1024)
+    {
+        mpf = mp_search(base - 1024, 1024);
+    }
+    if (mpf == NULL)
+    {
+        mpf = mp_search(BIOS_ROM_START, BIOS_ROM_LEN);
+    }
+    // a default configuration (no table) only ever has 2 cpus, not worth supporting
+    if (mpf == NULL || *(uint32_t*)(mpf + 4) == 0)
+    {
+        return;
+    }
+
+    cfg = (uint8_t*)*(uint32_t*)(mpf + 4);
+    if (*(uint32_t*)cfg != MP_CONFIG_SIG || !mp_checksum(cfg, *(uint16_t*)(cfg + 4)))
+    {
+        return;
+    }
+    lapic_base  = *(uint32_t*)(cfg + 36);
+    ioapic_base = 0;
+    count       = *(uint16_t*)(cfg + 34);
+
+    e = cfg + MP_CONFIG_HDR_LEN;
+    for (i = 0; i < count; i++)
+    {
+        if (*e == MP_ENTRY_CPU)
+        {
+            if ((e[3] & MP_CPU_ENABLED) && mp_ncpus < SMP_MAX_CPUS)
+            {
+                mp_apic_ids[mp_ncpus++] = e[1];
+            }
+            e += MP_CPU_ENTRY_LEN;
+            continue;
+        }
+        if (*e == MP_ENTRY_IOAPIC && ioapic_base == 0)
+        {
+            ioapic_base = *(uint32_t*)(e + 4);
+        }
+        e += MP_ENTRY_LEN;
+    }
+}
+
+
+/** udelay
+ * DESCRIPTION: spin for at least us microseconds
+ * INPUTS: us - microseconds
+ * OUTPUTS: none
+*/
+static void udelay(uint32_t us)
+{
+    uint64_t end = rdtsc() + (uint64_t)us * tsc_per_us;
+
+    while (rdtsc() < end)
+    {
+        asm volatile ("pause");
+    }
+}
+
+
+/** ap_tss_init
+ * DESCRIPTION: set up an AP's TSS and its descriptor in the GDT
+ * INPUTS: c - the AP
+ * OUTPUTS: none
+*/
+static void ap_tss_init(cpu_t* c)
+{
+    seg_desc_t desc;
+    tss_t*     t = &ap_tss[c->id - 1];
+
+    memset(t, 0, sizeof(tss_t));
+    t->ldt_segment_selector = KERNEL_LDT;
+    t->ss0  = KERNEL_DS;
+    t->esp0 = (uint32_t)ap_stacks[c->id] + AP_STACK_SIZE;
+    c->tss  = t;
+
+    // same as the boot processor's, see entry()
+    desc.granularity   = 0x0;
+    desc.opsize        = 0x0;
+    desc.reserved      = 0x0;
+    desc.avail         = 0x0;
+    desc.present       = 0x1;
+    desc.dpl           = 0x0;
+    desc.sys           = 0x0;
+    desc.type          = 0x9;
+    SET_TSS_PARAMS(desc, t, TSS_SIZE - 1);
+    ap_tss_desc_ptr[c->id - 1] = desc;
+}
+
+
+/** smp_init
+ * DESCRIPTION: enable the boot processor's local APIC and its timer, mask the I/O APIC and
+ *              start every other cpu in the MP table
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: each AP comes up in ap_main and waits for the kernel lock. a single cpu still
+ *               gets its local APIC timer, with the pit turned off. nothing happens without a
+ *               local APIC
+*/
+void smp_init(void)
+{
+    cpu_t*   c;
+    uint32_t bsp_id;
+    uint64_t end;
+    int32_t  i;
+
+    if (lapic_base == 0)
+    {
+        lapic_base = lapic_detect();        // no MP table
+    }
+    if (lapic_base == 0)
+    {
+        return;
+    }
+
+    paging_map_mmio(lapic_base);
+    if (ioapic_base != 0)
+    {
+        paging_map_mmio(ioapic_base);
+    }
+    apic_set_base(lapic_base, ioapic_base);
+    lapic_init(1);
+    ioapic_init();
+    bsp_id = lapic_id();
+    cpus[0].apic_id = bsp_id;
+
+    lapic_timer_init(1);
+    if (lapic_timer_on)
+    {
+        pit_stop();
+    }
+    if (mp_ncpus < 2)
+    {
+        return;
+    }
+
+    // the trampoline can't reach the kernel's GDT descriptor from real mode, it gets a copy
+    memcpy((void*)AP_BOOT_ADDR, ap_boot_start, ap_boot_end - ap_boot_start);
+    memcpy((void*)(AP_BOOT_ADDR + (ap_boot_gdtr - ap_boot_start)), (uint8_t*)&gdt_desc, 6);
+
+    for (i = 0; i < mp_ncpus && ncpus < SMP_MAX_CPUS; i++)
+    {
+        if (mp_apic_ids[i] == bsp_id)
+        {
+            continue;
+        }
+
+        c = &cpus[ncpus];
+        c->pcb     = NULL;
+        c->pid     = -1;
+        c->term    = -1;
+        c->pd      = page_directory;
+        c->id      = ncpus;
+        c->apic_id = mp_apic_ids[i];
+        c->online  = 0;
+        ap_tss_init(c);
+
+        ap_booting    = c->id;
+        ap_boot_stack = (uint32_t)ap_stacks[c->id] + AP_STACK_SIZE;
+
+        lapic_send_ipi(c->apic_id, ICR_INIT);
+        udelay(INIT_DELAY_US);
+        lapic_send_ipi(c->apic_id, ICR_STARTUP | (AP_BOOT_ADDR >> ADDRSHIFT));
+        udelay(STARTUP_DELAY_US);
+        if (!c->online)
+        {
+            lapic_send_ipi(c->apic_id, ICR_STARTUP | (AP_BOOT_ADDR >> ADDRSHIFT));
+        }
+
+        end = rdtsc() + (uint64_t)ONLINE_TIMEOUT_US * tsc_per_us;
+        while (!c->online && rdtsc() < end);
+        if (c->online)
+        {
+            ncpus++;
+        }
+    }
+}
+
+
+/** ap_main
+ * DESCRIPTION: first C code an AP runs, from the trampoline with paging on and its stack set
+ * INPUTS: none
+ * OUTPUTS: never returns
+ * SIDE EFFECTS: becomes the AP's idle task once it has the kernel lock
+*/
+void ap_main(void)
+{
+    cpu_t* c = &cpus[ap_booting];
+
+    lldt(KERNEL_LDT);
+    ltr(AP_TSS + (c->id - 1) * sizeof(seg_desc_t));
+    lidt(&idt_desc_ptr);
+    lapic_init(0);
+    lapic_timer_init(0);
+    c->online = 1;
+
+    kernel_enter();
+    sched_ap_idle();
+}
+
+
+/** smp_term_cpu
+ * DESCRIPTION: which cpu runs a terminal's processes. the boot processor only gets them if it's
+ *              the only cpu
+ * INPUTS: term - the terminal
+ * OUTPUTS: cpu index
+*/
+int32_t smp_term_cpu(int32_t term)
+{
+    return (ncpus > 1) ? 1 + term % (ncpus - 1) : 0;
+}
+
+
+/** bkl_lock
+ * DESCRIPTION: spin until the kernel lock is ours, with interrupts as the caller had them. an
+ *              interrupt while we wait takes and drops the lock itself, and may switch us away
+ *              to carry on waiting later, maybe on another cpu
+ * INPUTS: flags - the caller's eflags, interrupts are off now
+ * OUTPUTS: none
+ * SIDE EFFECTS: returns with interrupts off. flushes the TLB if a shootdown came in while we
+ *               were out of the kernel
+*/
+static void bkl_lock(uint32_t flags)
+{
+    cpu_t* c;
+
+    spin_lock_irqwait(&kernel_lock, flags);
+    c = this_cpu();
+    if (c->tlb_stale)
+    {
+        c->tlb_stale = 0;
+        flushTLBGlobal();
+    }
+}
+
+
+/** bkl_unlock
+ * DESCRIPTION: let go of the kernel lock
+*/
+static void bkl_unlock(void)
+{
+    spin_unlock(&kernel_lock);
+}
+
+
+/** kernel_enter
+ * DESCRIPTION: take the kernel lock, or nest one deeper if this cpu has it
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: may spin while another cpu is in the kernel, taking interrupts meanwhile if
+ *               the caller had them on (a system call does)
+*/
+void kernel_enter(void)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (this_cpu()->bkl_depth == 0)
+    {
+        bkl_lock(flags);
+    }
+    // only counted once it's ours, an interrupt while waiting mustn't think it has the lock
+    this_cpu()->bkl_depth++;
+    restore_flags(flags);
+}
+
+
+/** kernel_exit
+ * DESCRIPTION: undo one kernel_enter, the lock goes with the outermost one
+ * INPUTS: none
+ * OUTPUTS: none
+*/
+void kernel_exit(void)
+{
+    uint32_t flags;
+    cpu_t*   c;
+
+    cli_and_save(flags);
+    c = this_cpu();
+    if (c->bkl_depth > 0 && --c->bkl_depth == 0)
+    {
+        bkl_unlock();
+    }
+    restore_flags(flags);
+}
+
+
+/** kernel_release
+ * DESCRIPTION: let go of the kernel lock however deep we are in it, before halting or going
+ *              to user mode without passing through a linkage
+ * INPUTS: none
+ * OUTPUTS: the depth, for kernel_reacquire
+*/
+int32_t kernel_release(void)
+{
+    uint32_t flags;
+    cpu_t*   c;
+    int32_t  depth;
+
+    cli_and_save(flags);
+    c = this_cpu();
+    depth = c->bkl_depth;
+    c->bkl_depth = 0;
+    if (depth > 0)
+    {
+        bkl_unlock();
+    }
+    restore_flags(flags);
+    return depth;
+}
+
+
+/** kernel_reacquire
+ * DESCRIPTION: take the kernel lock back after kernel_release
+ * INPUTS: depth - what kernel_release returned
+ * OUTPUTS: none
+*/
+void kernel_reacquire(int32_t depth)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (depth > 0)
+    {
+        bkl_lock(flags);
+        this_cpu()->bkl_depth = depth;
+    }
+    restore_flags(flags);
+}
+
+
+/** smp_resched
+ * DESCRIPTION: make another cpu look at its run queue
+ * INPUTS: cpu - the cpu, nothing is sent to ourselves
+ * OUTPUTS: none
+*/
+void smp_resched(int32_t cpu)
+{
+    if (cpu != cpu_id() && cpus[cpu].online)
+    {
+        lapic_send_ipi(cpus[cpu].apic_id, ICR_FIXED | SMP_RESCHED_VECTOR);
+    }
+}
+
+
+/** smp_tlb_shootdown
+ * DESCRIPTION: drop every other cpu's TLB after a shared mapping changed. Cpus out of the
+ *              kernel flush on the IPI, any that are waiting for the kernel lock flush when
+ *              they get it too
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: doesn't wait for the flushes
+*/
+void smp_tlb_shootdown(void)
+{
+    int32_t i;
+    int32_t me;
+
+    if (ncpus == 1)
+    {
+        return;
+    }
+    me = cpu_id();
+    for (i = 0; i < ncpus; i++)
+    {
+        if (i != me && cpus[i].online)
+        {
+            cpus[i].tlb_stale = 1;
+            lapic_send_ipi(cpus[i].apic_id, ICR_FIXED | SMP_TLB_VECTOR);
+        }
+    }
+}
+
+
+/** smp_resched_ipi
+ * DESCRIPTION: another cpu queued something for us, or forwarded a pit tick
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: may switch processes
+*/
+void smp_resched_ipi(void)
+{
+    lapic_eoi();
+    sched_ipi();
+}
+
+
+/** smp_tlb_ipi
+ * DESCRIPTION: flush the TLB for a shootdown. runs without the kernel lock
+ * INPUTS: none
+ * OUTPUTS: none
+*/
+void smp_tlb_ipi(void)
+{
+    this_cpu()->tlb_stale = 0;
+    flushTLBGlobal();
+    lapic_eoi();
+}
@@ -0,0 +1,121 @@
+/** smp.h
+ *  Multiprocessor bring-up and per-cpu state
+*/
+
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "types.h"
+#include "x86_desc.h"
+
+/** BACKGROUND:
+ *  - The cpus are found in the BIOS's MP table (Intel MultiProcessor spec 1.4), which also has the
+ *    local APIC and I/O APIC addresses. Without one (or on a single cpu) ncpus stays 1, but the
+ *    boot processor's local APIC is still turned on for its timer, found through its MSR.
+ *  - smp_init copies a real mode trampoline to AP_BOOT_ADDR and starts each AP with INIT and two
+ *    STARTUP IPIs. The trampoline loads the kernel GDT, goes to protected mode and jumps into the
+ *    kernel, which turns on paging with the kernel page directory, loads the AP's own TSS and
+ *    drops into the AP's idle task.
+ *  - Everything that used to be "the" current process is per cpu: cur_pcb, cur_pid and cur_term
+ *    are fields of this cpu's cpu_t, and so are the TSS (so esp0) and the page directory in cr3.
+ *    The cpu is identified by its task register, every cpu loads a different TSS selector.
+ *  - The kernel was written for one cpu and protects its data by turning interrupts off. That
+ *    doesn't keep other cpus out, so what isn't covered by a subsystem lock (spinlock.h) is
+ *    covered by one big kernel lock: every interrupt and exception takes it on entry and drops it
+ *    on the way out (kernel_enter / kernel_exit in the linkages), and halting in idle_wait lets
+ *    go of it. It is recursive per cpu, a context switch carries each context's depth with it.
+ *    A cpu waiting for it keeps interrupts on if it had them (system calls), they only go off
+ *    once the lock is taken.
+ *  - System calls only take it if lock_table in syscall_handler.S says so. read and write on
+ *    the terminal, rtc and files, brk/sbrk, shm*, sleep, clock_gettime, getargs and irqstat
+ *    run on their subsystem locks alone, so several cpus can be in them at once. read and write
+ *    take it themselves for drivers without fot_t.nolock (pipes). halt, execute, open, close,
+ *    pipe, dup, dup2 and the profiler calls still hold it throughout.
+ *  - A task switch always happens under it: the interrupt linkages hold it, and schedule takes
+ *    it for the system calls that don't. So does waking a sleeper (waitq.h).
+ *  - Each terminal's processes run on one cpu, smp_term_cpu. The boot processor keeps the GUI and
+ *    the device interrupts, so with 4 cpus the three terminals get an AP each.
+ *  - Kernel page tables are shared, so unmapping a kernel page or repointing a vidmap page leaves
+ *    stale TLB entries on the other cpus. smp_tlb_shootdown IPIs them to flush, and flags them
+ *    to flush again when they next take the kernel lock.
+ */
+#define AP_BOOT_ADDR        0x8000              // trampoline page, below 1MB and page aligned
+#define AP_STACK_SIZE       4096                // each AP's boot / idle stack
+
+#define SMP_RESCHED_VECTOR  0xF0                // look at the run queue: tick, wake up, shell launch
+#define SMP_TLB_VECTOR      0xF1                // flush the TLB, global pages too
+
+#ifndef ASM
+
+#include "paging.h"
+#include "spinlock.h"
+
+struct pcb;
+
+typedef struct {
+    struct pcb*  pcb;                   /* running process, cur_pcb */
+    int32_t      pid;                   /* cur_pid */
+    int32_t      term;                  /* terminal of the running process, cur_term */
+    pde_t*       pd;                    /* directory in cr3 */
+    tss_t*       tss;
+    int32_t      id;                    /* index into cpus[], 0 is the boot processor */
+    uint32_t     apic_id;
+    volatile int32_t online;            /* AP has started and is in its idle task */
+    int32_t      bkl_depth;             /* kernel lock nesting of the running context */
+    volatile int32_t tlb_stale;         /* flush the TLB on the next kernel lock */
+    int32_t      in_softirq;            /* running deferred work (softirq.h), don't switch away */
+} cpu_t;
+
+extern cpu_t   cpus[SMP_MAX_CPUS];
+extern int32_t ncpus;
+extern spinlock_t kernel_lock;
+
+/** this_cpu
+ * DESCRIPTION: the cpu we're running on, from the TSS selector in the task register
+ * INPUTS: none
+ * OUTPUTS: its cpu_t, the boot processor's before any TSS is loaded
+*/
+static inline cpu_t* this_cpu(void)
+{
+    uint16_t sel;
+
+    asm volatile ("str %0" : "=r"(sel));
+    if (sel < AP_TSS)
+    {
+        return &cpus[0];
+    }
+    return &cpus[1 + (sel - AP_TSS) / sizeof(seg_desc_t)];
+}
+
+#define cpu_id()        (this_cpu()->id)
+
+/* find the cpus and APICs in the MP table. runs before paging is on */
+void smp_detect(void);
+
+/* map the APICs and start every AP */
+void smp_init(void);
+
+/* cpu a terminal's processes run on */
+int32_t smp_term_cpu(int32_t term);
+
+/* take / drop the kernel lock. recursive, called by the interrupt and syscall linkages */
+void kernel_enter(void);
+void kernel_exit(void);
+
+/* drop the lock completely before halting or going to user mode, and take it back after */
+int32_t kernel_release(void);
+void kernel_reacquire(int32_t depth);
+
+/* interrupt another cpu to look at its run queue */
+void smp_resched(int32_t cpu);
+
+/* make the other cpus drop their TLBs, after changing a shared mapping */
+void smp_tlb_shootdown(void);
+
+/* IPI handlers */
+void smp_resched_ipi(void);
+void smp_tlb_ipi(void);
+
+#endif /* ASM */
+
+#endif /* _SMP_H */
@@ -0,0 +1,132 @@
+/** softirq.c
+ *  Deferred work, run on the way out of an interrupt with interrupts back on
+*/
+
+#include "softirq.h"
+#include "lib.h"
+#include "smp.h"
+#include "scheduler.h"
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+softirq_stats_t softirq_stats;
+spinlock_t      work_lock = SPINLOCK_INIT("work");          // the work queue
+
+static work_t*  work_head;                                  // oldest first
+static work_t*  work_tail;
+/*************************************************************************/
+
+
+/** work_setup
+ * DESCRIPTION: set a work item's function
+ * INPUTS: w - the work item, not queued
+ *         fn - what to run
+ *         arg - passed to fn
+ * OUTPUTS: none
+*/
+void work_setup(work_t* w, void (*fn)(void*), void* arg)
+{
+    w->next    = NULL;
+    w->pending = 0;
+    w->fn      = fn;
+    w->arg     = arg;
+}
+
+
+/** work_queue
+ * DESCRIPTION: queue a work item to run at the end of the interrupt. safe from handlers
+ * INPUTS: w - the work item
+ * OUTPUTS: 1 if it was queued, 0 if it was already waiting to run
+*/
+int32_t work_queue(work_t* w)
+{
+    uint32_t flags;
+    int32_t  queued = 0;
+
+    spin_lock_irqsave(&work_lock, flags);
+    if (!w->pending)
+    {
+        w->pending = 1;
+        w->next    = NULL;
+        if (work_tail != NULL)
+        {
+            work_tail->next = w;
+        }
+        else
+        {
+            work_head = w;
+        }
+        work_tail = w;
+        queued    = 1;
+    }
+    spin_unlock_irqrestore(&work_lock, flags);
+    return queued;
+}
+
+
+/** work_dequeue
+ * DESCRIPTION: take the oldest work item off the queue
+ * INPUTS: none
+ * OUTPUTS: the item, NULL if there's none
+*/
+static work_t* work_dequeue(void)
+{
+    work_t*  w;
+    uint32_t flags;
+
+    spin_lock_irqsave(&work_lock, flags);
+    if ((w = work_head) != NULL)
+    {
+        work_head = w->next;
+        if (work_head == NULL)
+        {
+            work_tail = NULL;
+        }
+        w->pending = 0;
+    }
+    spin_unlock_irqrestore(&work_lock, flags);
+    return w;
+}
+
+
+/** softirq_run
+ * DESCRIPTION: run the queued work, after an interrupt handler. Does nothing if this cpu is
+ *              already running work further down the stack
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: turns interrupts on while the work runs, returns with them off. may switch
+ *               processes afterwards, if that was put off while the work ran
+*/
+void softirq_run(void)
+{
+    cpu_t*   c = this_cpu();
+    work_t*  w;
+    uint32_t cycles;
+    uint64_t start;
+
+    if (work_head == NULL || c->in_softirq)
+    {
+        return;
+    }
+    c->in_softirq = 1;
+    softirq_stats.runs++;
+
+    while ((w = work_dequeue()) != NULL)
+    {
+        sti();
+        start = rdtsc();
+        w->fn(w->arg);
+        cycles = (uint32_t)(rdtsc() - start);
+        cli();
+
+        softirq_stats.works++;
+        softirq_stats.cycles += cycles;
+        if (cycles > softirq_stats.max)
+        {
+            softirq_stats.max = cycles;
+        }
+    }
+
+    c->in_softirq = 0;
+    sched_preempt();
+}
@@ -0,0 +1,57 @@
+/** softirq.h
+ *  Deferred work, run on the way out of an interrupt with interrupts back on
+*/
+
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include "types.h"
+#include "spinlock.h"
+
+/** BACKGROUND:
+ *  - Interrupt handlers run with interrupts off, so everything they do delays every other
+ *    device on that cpu. Anything slow (drawing, CMOS port I/O) they hand off as a work item
+ *    instead: work_queue from the handler, and the item's function runs later.
+ *  - Later is the end of the same interrupt: the interrupt linkage calls softirq_run once the
+ *    handler has returned and sent its EOI, still holding the kernel lock but with interrupts on.
+ *    This doesn't depend on the scheduler, which only runs while a terminal is open, so work
+ *    queued on the desktop or lock screen runs just as soon.
+ *  - Interrupts that come in while work is running are handled normally but don't run work
+ *    themselves, anything they queue is picked up by the loop already running. For the same
+ *    reason a cpu doesn't switch processes part way through its work: a switch asked for meanwhile
+ *    happens once the work is done.
+ *  - A work item is queued at most once: queueing one that's already waiting does nothing. It's
+ *    taken off the queue before its function runs, so the function may queue it again.
+ *  - Work functions mustn't sleep. Anything they share with interrupt handlers still has to be
+ *    locked with interrupts off.
+ *  - softirq_stats counts the work run and the cycles spent in it, to set against the time the
+ *    handlers themselves take.
+ */
+
+typedef struct work {
+    struct work*    next;
+    volatile int32_t pending;           /* 1 while queued */
+    void            (*fn)(void* arg);
+    void*           arg;
+} work_t;
+
+typedef struct {
+    uint32_t runs;                      /* interrupts that found work to do */
+    uint32_t works;                     /* work items run */
+    uint64_t cycles;                    /* spent running them */
+    uint32_t max;                       /* longest single item */
+} softirq_stats_t;
+
+extern softirq_stats_t softirq_stats;
+extern spinlock_t      work_lock;
+
+/* set what a work item runs */
+void work_setup(work_t* w, void (*fn)(void*), void* arg);
+
+/* queue it to run at the end of the interrupt: 1 if queued, 0 if it was already waiting */
+int32_t work_queue(work_t* w);
+
+/* interrupt linkage: run everything queued, with interrupts on */
+void softirq_run(void);
+
+#endif /* _SOFTIRQ_H */
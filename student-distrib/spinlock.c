@@ -0,0 +1,192 @@
+/** spinlock.c
+ *  Spinlocks, with hold time statistics
+*/
+
+#include "spinlock.h"
+#include "smp.h"
+
+
+/** spin_xchg
+ * DESCRIPTION: try to take the lock word
+ * INPUTS: lock - the lock
+ * OUTPUTS: 1 if it was free and is ours now
+*/
+static inline int32_t spin_xchg(spinlock_t* lock)
+{
+    uint32_t old = 1;
+
+    asm volatile ("xchgl %0, %1" : "+r"(old), "+m"(lock->locked) : : "memory");
+    return old == 0;
+}
+
+
+/** spin_wait
+ * DESCRIPTION: spin until the lock is ours
+ * INPUTS: lock - the lock
+ *         irq - 1 if interrupts are off and flags has them as the caller had them
+ *         flags - the caller's eflags, for irq
+ * OUTPUTS: none
+ * SIDE EFFECTS: records the wait, if there was one, and when the hold started. with irq the
+ *               wait runs with the caller's interrupts, only the xchg with them off
+*/
+static inline void spin_wait(spinlock_t* lock, int32_t irq, uint32_t flags)
+{
+    uint64_t start;
+
+    if (spin_xchg(lock))
+    {
+        lock->acquired = rdtsc();
+    }
+    else
+    {
+        start = rdtsc();
+        do
+        {
+            if (irq)
+            {
+                restore_flags(flags);
+            }
+            while (lock->locked)
+            {
+                asm volatile ("pause");
+            }
+            if (irq)
+            {
+                cli();
+            }
+        } while (!spin_xchg(lock));
+        lock->acquired = rdtsc();
+        lock->contended++;
+        lock->spin_cycles += lock->acquired - start;
+    }
+    lock->owner = cpu_id();
+    lock->acquisitions++;
+}
+
+
+/** spin_lock
+ * DESCRIPTION: spin until the lock is ours
+ * INPUTS: lock - the lock
+ * OUTPUTS: none
+ * SIDE EFFECTS: records the wait, if there was one, and when the hold started
+*/
+void spin_lock(spinlock_t* lock)
+{
+    spin_wait(lock, 0, 0);
+}
+
+
+/** spin_lock_irqwait
+ * DESCRIPTION: take a lock with interrupts off, but wait for it with them the way the caller
+ *              had them, so a contended lock doesn't hold this cpu's interrupts off too
+ * INPUTS: lock - the lock
+ *         flags - the caller's eflags from cli_and_save, interrupts are off now
+ * OUTPUTS: none
+ * SIDE EFFECTS: returns with interrupts off. an interrupt that comes in while waiting runs,
+ *               and may switch this context away, it holds nothing yet
+*/
+void spin_lock_irqwait(spinlock_t* lock, uint32_t flags)
+{
+    spin_wait(lock, 1, flags);
+}
+
+
+/** spin_trylock
+ * DESCRIPTION: take the lock only if nobody has it
+ * INPUTS: lock - the lock
+ * OUTPUTS: 1 if it's ours, 0 if it was taken
+*/
+int32_t spin_trylock(spinlock_t* lock)
+{
+    if (lock->locked || !spin_xchg(lock))
+    {
+        return 0;
+    }
+    lock->acquired = rdtsc();
+    lock->owner = cpu_id();
+    lock->acquisitions++;
+    return 1;
+}
+
+
+/** spin_unlock
+ * DESCRIPTION: let go of the lock
+ * INPUTS: lock - a lock this cpu holds
+ * OUTPUTS: none
+ * SIDE EFFECTS: adds the hold to its statistics
+*/
+void spin_unlock(spinlock_t* lock)
+{
+    uint32_t held = (uint32_t)(rdtsc() - lock->acquired);
+
+    lock->hold_cycles += held;
+    if (held > lock->hold_max)
+    {
+        lock->hold_max = held;
+    }
+    lock->owner = -1;
+    // a plain store releases on x86, the compiler just mustn't move the section past it
+    asm volatile ("" : : : "memory");
+    lock->locked = 0;
+}
+
+
+/** spin_stats_reset
+ * DESCRIPTION: start a lock's statistics over
+ * INPUTS: lock - the lock
+ * OUTPUTS: none
+*/
+void spin_stats_reset(spinlock_t* lock)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    lock->acquisitions = 0;
+    lock->contended    = 0;
+    lock->spin_cycles  = 0;
+    lock->hold_cycles  = 0;
+    lock->hold_max     = 0;
+    restore_flags(flags);
+}
+
+
+/** spin_avg
+ * DESCRIPTION: a 64 bit cycle total over a 32 bit count, without pulling in libgcc's division
+ * INPUTS: sum - the total
+ *         n - how many it's over
+ * OUTPUTS: the average, 0 if n is 0, 0xFFFFFFFF if it doesn't fit
+*/
+static uint32_t spin_avg(uint64_t sum, uint32_t n)
+{
+    uint32_t hi = (uint32_t)(sum >> 32);
+    uint32_t lo = (uint32_t)sum;
+    uint32_t q;
+
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (hi >= n)
+    {
+        return 0xFFFFFFFF;
+    }
+    asm ("divl %2" : "=a"(q), "+d"(hi) : "rm"(n), "a"(lo));
+    return q;
+}
+
+
+/** spin_stats_print
+ * DESCRIPTION: print how often a lock was taken, how often it had to be waited for, and how
+ *              long it was held
+ * INPUTS: lock - the lock
+ * OUTPUTS: none
+*/
+void spin_stats_print(spinlock_t* lock)
+{
+    uint32_t n = lock->acquisitions;
+
+    printf("%s: %d taken, %d waited (avg %d cycles), held avg %d max %d cycles\n",
+           lock->name, n, lock->contended,
+           spin_avg(lock->spin_cycles, lock->contended), spin_avg(lock->hold_cycles, n),
+           lock->hold_max);
+}
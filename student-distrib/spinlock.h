@@ -0,0 +1,98 @@
+/** spinlock.h
+ *  Spinlocks, with hold time statistics
+*/
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+#include "lib.h"
+
+/** BACKGROUND:
+ *  - A spinlock is one word, taken with xchg. A cpu that finds it taken spins reading it (with
+ *    pause) and only retries the xchg once it reads free, so waiters don't keep pulling the cache
+ *    line away from the holder.
+ *  - cli only keeps this cpu's interrupts out, and for as long as the whole section runs. A lock
+ *    keeps out every cpu but only from the data it covers, so each subsystem has its own:
+ *      term_lock   keyboard buffer, terminal state, which terminal is visible   (terminal.c)
+ *      gfx_lock    the screen and the console cursor positions                 (bga.c)
+ *      sched_lock  the run queues                                              (scheduler.c)
+ *      proc_lock   the process table and kernel stack cache                    (proc.c)
+ *      rtc_lock    the virtual rtc heap, each open rtc file's rate and count   (rtc.c)
+ *      cmos_lock   the CMOS index register, between select and read            (rtc.c)
+ *      timer_lock  the timer wheel                                             (timer.c)
+ *      work_lock   the deferred work queue                                     (softirq.c)
+ *      wq_lock     every wait queue's list                                     (waitq.c)
+ *      pipe_lock   each pipe's reader and writer counts                        (pipe.c)
+ *      shm_lock    the shared memory segments and attachments                  (shm.c)
+ *      slab_lock   the cache structs, each cache has its own lock too          (slab.c)
+ *      kheap_lock  the kernel heap window's page tables                        (paging.c)
+ *      buddy_lock  the physical frame bitmaps                                  (buddy.c)
+ *      irqstat_lock  resetting the interrupt stats against reading them       (irqstat.c)
+ *  - What's left of cli is per cpu: a cpu's own run queue timer and idle halt, its local APIC,
+ *    its softirq flag. Nothing another cpu touches is protected by cli alone.
+ *  - Locks aren't recursive. A lock an interrupt handler also takes has to be taken with this
+ *    cpu's interrupts off (spin_lock_irqsave), or the handler could interrupt the holder and spin
+ *    on it forever. spin_lock_irqsave only turns them off once it has the lock, a cpu waiting
+ *    for it takes interrupts the way it did before. A lock no handler takes can use plain
+ *    spin_lock and leave interrupts on.
+ *  - Nothing may sleep or switch tasks while holding one. A holder with interrupts on can still be
+ *    preempted by a tick, and anyone after the lock spins until the holder gets a cpu back, so
+ *    with plain spin_lock keep the section short.
+ *  - Order: term_lock before gfx_lock before cmos_lock. term_lock and rtc_lock wake sleepers,
+ *    so come before wq_lock, which comes before sched_lock. shm_lock, proc_lock and a cache's
+ *    lock allocate, so come before kheap_lock, which comes before buddy_lock. pipe_lock,
+ *    timer_lock, work_lock and irqstat_lock are taken last. Timer callbacks run without
+ *    timer_lock, work without work_lock.
+ *  - The kernel lock (smp.h) is outside all of them, and is a spinlock_t too so its contention
+ *    shows up the same way. Interrupts, exceptions and task switches take it, system calls only
+ *    where lock_table in syscall_handler.S says so. The rest (terminal, rtc and file reads and
+ *    writes, the heap, shm, sleep, the clock) run on these locks alone, and contend with each
+ *    other across cpus.
+ *  - Every lock counts acquisitions, how many had to wait for it, the cycles spent waiting and
+ *    the cycles it was held (total and longest), all with rdtsc. The counters are only written
+ *    by the holder so they need nothing extra.
+ */
+typedef struct {
+    volatile uint32_t locked;
+    int32_t     owner;                  /* cpu holding it, -1 if free */
+    const char* name;
+    uint64_t    acquired;               /* rdtsc when the holder got it */
+
+    uint32_t    acquisitions;
+    uint32_t    contended;              /* acquisitions that had to wait */
+    uint64_t    spin_cycles;            /* waiting, summed over every cpu */
+    uint64_t    hold_cycles;
+    uint32_t    hold_max;
+} spinlock_t;
+
+#define SPINLOCK_INIT(n)    { 0, -1, (n), 0, 0, 0, 0, 0, 0 }
+
+/* take / drop a lock, leaving interrupts alone */
+void spin_lock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+
+/* take it only if it's free: 1 if we got it */
+int32_t spin_trylock(spinlock_t* lock);
+
+/* zero / print a lock's statistics */
+void spin_stats_reset(spinlock_t* lock);
+void spin_stats_print(spinlock_t* lock);
+
+/* take a lock with interrupts off, waiting for it with them as flags has them */
+void spin_lock_irqwait(spinlock_t* lock, uint32_t flags);
+
+/* for locks interrupt handlers take too: interrupts off on this cpu first, back as they were after */
+#define spin_lock_irqsave(lock, flags)          \
+do {                                            \
+    cli_and_save(flags);                        \
+    spin_lock_irqwait(lock, flags);             \
+} while (0)
+
+#define spin_unlock_irqrestore(lock, flags)     \
+do {                                            \
+    spin_unlock(lock);                          \
+    restore_flags(flags);                       \
+} while (0)
+
+#endif /* _SPINLOCK_H */
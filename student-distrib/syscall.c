@@ -3,12 +3,19 @@
 #include "fs_driver.h"
 #include "paging.h"
 #include "terminal.h"
+#include "buddy.h"
+#include "proc.h"
+#include "uaccess.h"
+#include "pipe.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "timer.h"
+#include "irqstat.h"
+#include "prof.h"
 
 extern pde_t page_directory[DIRSIZE] __attribute__((aligned (PAGESIZE)));
 extern pte_t page_table[TABLESIZE] __attribute__((aligned (PAGESIZE)));
 
-int pid[MAX_PID] = {0, 0, 0, 0, 0, 0};
-
 
 
 static fot_t rtc_fot;
@@ -17,6 +24,28 @@ static fot_t file_fot;
 static fot_t stdin_fot;
 static fot_t stdout_fot;
 
+static int32_t exec_command (const int8_t* command, int32_t user);
+
+
+/** fd_release
+ * DESCRIPTION: close an fd through its driver and clear the entry
+ * INPUTS: pcb - process that owns the fd, must be cur_pcb (drivers look the fd up there)
+ *         fd - an fd in use
+ * OUTPUTS: whatever the driver's close returned
+*/
+static int32_t fd_release(pcb_t* pcb, int32_t fd)
+{
+    int32_t ret = (* pcb->fdt[fd].fot_ptr->close)(fd);
+
+    pcb->fdt[fd].fot_ptr  = 0;
+    pcb->fdt[fd].inode    = 0;
+    pcb->fdt[fd].file_pos = 0;
+    pcb->fdt[fd].data     = NULL;
+    pcb->fdt[fd].cloexec  = 0;
+    pcb->fdt[fd].flag     = 0;
+    return ret;
+}
+
 
 /**
  * halt
@@ -28,6 +57,8 @@ static fot_t stdout_fot;
 */
 int32_t halt (uint8_t status)
 {
+    // exception handlers call halt without going through a linkage that takes the lock
+    kernel_enter();
     cli();
     uint32_t retval = (uint32_t) status;
 
@@ -37,51 +68,60 @@ int32_t halt (uint8_t status)
         retval = EXC_ERR_CODE;
     }
 
+    // program page goes back to the allocator, we're running on the kernel stack
+    frame_free(cur_pcb->user_page, FOUR_MB_ORDER);
+    cur_pcb->user_page = 0;
+    heap_release(&cur_pcb->heap);
+    shm_release(&cur_pcb->shm, cur_pcb->page_dir, cur_pid);
+    pde_t * old_pd = cur_pcb->page_dir;
+
+    //close fds, stdin and stdout too since they may have been redirected
+    int j;
+    for (j = 0; j < MAX_FD; j++)
+    {
+        if (cur_pcb->fdt[j].flag == 1)
+        {
+            fd_release(cur_pcb, j);
+        }
+    }
+
     // if base shell then relaunch
-    if (cur_pid == 0 || cur_pid == 1 || cur_pid == 2)
+    if (cur_pid < MAX_TERMINALS)
     {
         // cur_pid = -1;
-        pid[cur_pid] = 0;
+        pd_switch(page_directory);  // get off the directory before freeing it
+        pd_destroy(old_pd);
+        proc_free(cur_pid);
         sti();
-        execute("shell");
+        execute_kernel("shell");
     }
 
-    pid[cur_pid] = 0;
-
     // get parent process
     int parent = cur_pcb->parent_id;
-    terminalState[cur_term].cur_pid = parent;
-    pcb_t * parent_ptr = (pcb_t *)(EIGHT_MB - ((parent+1) * EIGHT_KB));
+    terminalState[cur_term].fg_pid = parent;
+    pcb_t * parent_ptr = proc_get(parent);
 
 
     // set tss for parent
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = (EIGHT_MB - ((parent) * EIGHT_KB) - ESP0_OFFSET);
+    this_cpu()->tss->ss0 = KERNEL_DS;
+    this_cpu()->tss->esp0 = KSTACK_TOP(parent_ptr);
 
     // Paging
-    page_directory[USERIDX].address_31_12 = (EIGHT_MB + (parent * FOUR_MB)) >> ADDRSHIFT;
-    flushTLB();
+    pd_switch(parent_ptr->page_dir);
+    pd_destroy(old_pd);
 
-    //close fds
-    int j;
-    for (j = 0; j<MAX_FD; j++)
-    {
-        if ((j >= 2) && (cur_pcb->fdt[j].flag == 1))    //exlucde stdin and stdout
-        {
-          (* cur_pcb->fdt[j].fot_ptr->close)(j);
-        }
-        cur_pcb->fdt[j].fot_ptr = 0;
-        cur_pcb->fdt[j].inode = 0;
-        cur_pcb->fdt[j].file_pos = 0;
-        cur_pcb->fdt[j].flag = 0;
-    }
     cur_pcb->active = 0;
 
-    // set parent as active
+    // set parent as active. the pcb and stack we're on are released once we've left them
     uint32_t saved_esp = cur_pcb->saved_esp;
     uint32_t saved_ebp = cur_pcb->saved_ebp;
+    proc_free(cur_pid);
     cur_pid = parent;
     cur_pcb = parent_ptr;
+    cur_pcb->cpu = cpu_id();        // the child may have been stolen, the parent comes along
+
+    // the parent is inside its execute system call, one level into the kernel lock
+    this_cpu()->bkl_depth = 1;
 
     asm volatile("\
     movl %0, %%esp; \
@@ -102,12 +142,22 @@ int32_t halt (uint8_t status)
 int32_t haltall (uint8_t status)
 {
     int i;
-    for (i = 5; i >= 0; i--)
+    pd_switch(page_directory);
+    for (i = MAX_PID - 1; i >= 0; i--)
     {
-        pid[i] = 0;
+        pcb_t * pcb = proc_get(i);
+        if (pcb != NULL)
+        {
+            frame_free(pcb->user_page, FOUR_MB_ORDER);
+            pcb->user_page = 0;
+            heap_release(&pcb->heap);
+            shm_release(&pcb->shm, pcb->page_dir, i);
+            pd_destroy(pcb->page_dir);
+            proc_free(i);
+        }
     }
     terminal_init();
-    tss.esp0 = 0x800000;
+    this_cpu()->tss->esp0 = 0x800000;
     
     return 0;
 }
@@ -130,38 +180,74 @@ void syscall_init(void)
     rtc_fot.write  = &rtc_write;
     rtc_fot.open   = &rtc_open;
     rtc_fot.close  = &rtc_close;
+    rtc_fot.dup    = &rtc_dup;
+    rtc_fot.nolock = 1;     // rtc_lock, readers are woken from the rtc interrupt
 
     dir_fot.read   = &dir_read;
     dir_fot.write  = &dir_write;
     dir_fot.open   = &dir_open;
     dir_fot.close  = &dir_close;
+    dir_fot.nolock = 1;     // the filesystem image is read only
 
     file_fot.read  = &file_read;
     file_fot.write = &file_write;
     file_fot.open  = &file_open;
     file_fot.close = &file_close;
+    file_fot.nolock = 1;
 
     stdin_fot.read  = &terminal_read;
     stdin_fot.write = &std_write;
     stdin_fot.open  = &terminal_open;
-    stdin_fot.close = &terminal_close;
+    stdin_fot.close = &std_close;
+    stdin_fot.nolock = 1;   // term_lock, readers are woken from the keyboard interrupt
 
     stdout_fot.read  = &std_read;
     stdout_fot.write = &terminal_write;
     stdout_fot.open  = &terminal_open;
-    stdout_fot.close = &terminal_close;
+    stdout_fot.close = &std_close;
+    stdout_fot.nolock = 1;  // gfx_lock, term_lock for the cursor
 }
 
 /**
  * execute
  * 
  * DESCRIPTION: system call to execute a user level program
- * INPUTS: command - the program to execute and its arguments all as a string
- * OUTPUTS: none
+ * INPUTS: command - the program to execute and its arguments all as a string, in user memory
+ * OUTPUTS: -1 if the command isn't a valid string of under MAX_CMD_LEN bytes or can't be run,
+ *          otherwise the program's status once it halts
  * SIDE EFFECTS: a new process will be created for the passed in program
 */
 
 int32_t execute (const int8_t* command)
+{
+    return exec_command(command, 1);
+}
+
+/**
+ * execute_kernel
+ * 
+ * DESCRIPTION: execute for a command in kernel memory, e.g. the base shells
+ * INPUTS: command - the program to execute and its arguments all as a string
+ * OUTPUTS: same as execute
+ * SIDE EFFECTS: a new process will be created for the passed in program
+*/
+
+int32_t execute_kernel (const int8_t* command)
+{
+    return exec_command(command, 0);
+}
+
+/**
+ * exec_command
+ * 
+ * DESCRIPTION: start a program. the halt of the new process returns out of this frame
+ * INPUTS: command - the program to execute and its arguments all as a string
+ *         user - nonzero if command is a user pointer, which is copied in with safe_strncpy
+ * OUTPUTS: same as execute
+ * SIDE EFFECTS: a new process will be created for the passed in program
+*/
+
+static int32_t exec_command (const int8_t* command, int32_t user)
 {   
     cli();
     dentry_t d;
@@ -171,14 +257,23 @@ int32_t execute (const int8_t* command)
     int8_t   file[MAX_FILE_NAME] = "\0";
     int8_t   arg[MAX_ARG_LEN]    = "\0";
     int8_t   arg_len             =   0;
-    int i;
 
     /* Parse args*/
     ///////////////////////////////////////////////////////////////////////////////////////////////
     int8_t *cmd_ptr_l, *cmd_ptr_r;
 
-    int cmd_len = strlen(command);
-    memcpy(cmd, command, cmd_len * sizeof(int8_t));
+    // bounded copy, the rest of cmd stays zero for the arg scan below
+    if (user)
+    {
+        if (safe_strncpy(cmd, command, MAX_CMD_LEN) == -1)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        strncpy(cmd, command, MAX_CMD_LEN - 1);
+    }
 
     // find the file name within the command, and copy it to the file string
     for(cmd_ptr_l = cmd; *cmd_ptr_l == ' '; cmd_ptr_l++);
@@ -240,28 +335,33 @@ int32_t execute (const int8_t* command)
     /*Setup Paging*/
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
-    // get pid
-
-    for (i = 0; i < MAX_PID; i++)
+    // get pid, pcb and kernel stack. a terminal without a shell gets its base shell pid
+    pcb_t * new_pcb = proc_alloc(proc_in_use(cur_term) ? ANY_PID : cur_term);
+    if (new_pcb == NULL)
     {
-        if (pid[i] == 0)
-        {
-            pid[i] = 1;
-            break;
-        }
+        return -1;
     }
 
-    if (i == MAX_PID)
+    // program page from the frame allocator
+    uint32_t user_page = frame_alloc(FOUR_MB_ORDER);
+    if (user_page == 0)
     {
+        proc_free(new_pcb->pid);
         return -1;
     }
 
-    cur_pid = i;
-    
+    // own address space, sharing the kernel's page tables
+    pde_t * pd = pd_create(user_page, cur_term);
+    if (pd == NULL)
+    {
+        frame_free(user_page, FOUR_MB_ORDER);
+        proc_free(new_pcb->pid);
+        return -1;
+    }
 
+    cur_pid = new_pcb->pid;
     
-    page_directory[USERIDX].address_31_12 = (EIGHT_MB + (cur_pid * FOUR_MB)) >> ADDRSHIFT;
-    flushTLB();
+    pd_switch(pd);
 
     /*Load file into mem*/
     ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -273,42 +373,33 @@ int32_t execute (const int8_t* command)
     /*Create PCB/Open FD*/
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
-    cur_pcb = (pcb_t *)(EIGHT_MB - ((cur_pid+1) * EIGHT_KB));
+    cur_pcb = new_pcb;
 
     // Possible that parent need not be cur - 1??
-    cur_pcb->pid = cur_pid;
+    cur_pcb->user_page = user_page;
+    cur_pcb->page_dir = pd;
+
+    // empty heap
+    heap_init(&cur_pcb->heap, pd);
 
-    if (cur_pid == 0 || cur_pid == 1 || cur_pid == 2)
+    // the child takes the caller's terminal, and its place on the cpu until it halts
+    cur_pcb->term = cur_term;
+    cur_pcb->cpu  = cpu_id();
+    sched_new(cur_pcb);
+    if (cur_pid < MAX_TERMINALS)
     {
         cur_pcb->parent_id = -1;
     }
 
     else
     {
-        cur_pcb->parent_id = terminalState[vis_term].cur_pid;
-        terminalState[vis_term].cur_pid = cur_pid;
+        cur_pcb->parent_id = terminalState[cur_term].fg_pid;
+        terminalState[cur_term].fg_pid = cur_pid;
     }
     
 
-    // TODO stdin
-    cur_pcb->fdt[0].fot_ptr = &stdin_fot;
-    cur_pcb->fdt[0].inode = 0;
-    cur_pcb->fdt[0].file_pos = 0;
-    cur_pcb->fdt[0].flag = 1;
-
-    // TODO stdout
-    cur_pcb->fdt[1].fot_ptr = &stdout_fot;
-    cur_pcb->fdt[1].inode = 0;
-    cur_pcb->fdt[1].file_pos = 0;
-    cur_pcb->fdt[1].flag = 1;
-
-    for (i = 2; i < MAX_FD; i++)    // initialize fd 2-7
-    {
-        cur_pcb->fdt[i].fot_ptr = 0;
-        cur_pcb->fdt[i].inode = 0;
-        cur_pcb->fdt[i].file_pos = 0;
-        cur_pcb->fdt[i].flag = 0;
-    }
+    // stdin/stdout (possibly redirected) and any non close-on-exec fds come from the parent
+    fdt_inherit(cur_pcb, proc_get(cur_pcb->parent_id));
     register uint32_t saved_ebp asm("ebp");
     register uint32_t saved_esp asm("esp");
 
@@ -325,9 +416,9 @@ int32_t execute (const int8_t* command)
     /*Prepare for context switch*/
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
-    tss.ss0 = KERNEL_DS;
-    // 8MB-8KB (pid )-1 byte,
-    tss.esp0 = (EIGHT_MB - ((cur_pid) * EIGHT_KB) - sizeof(int));
+    this_cpu()->tss->ss0 = KERNEL_DS;
+    // top of the new process's kernel stack
+    this_cpu()->tss->esp0 = KSTACK_TOP(cur_pcb);
 
 
     // user level stack
@@ -336,6 +427,8 @@ int32_t execute (const int8_t* command)
     int ds = USER_DS;
     int cs = USER_CS;
 
+    // straight to user mode, not back out through the syscall linkage
+    kernel_release();
     sti();
 
     /*Push IRET context to stack*/
@@ -363,7 +456,7 @@ int32_t execute (const int8_t* command)
  * DESCRIPTION: system call to read data
  * INPUTS: fd: fd index to read, buf: stores data read, nbytes: bytes to be read
  * OUTPUT: buf: gets populated with data read, ret: returns bytes read
- * SIDE EFFECTS: updates buffer
+ * SIDE EFFECTS: updates buffer. takes the kernel lock unless the driver's fot is nolock
 */
 int32_t read (int32_t fd, void* buf, int32_t nbytes)
 {
@@ -371,7 +464,7 @@ int32_t read (int32_t fd, void* buf, int32_t nbytes)
     {
         return -1;
     }
-    if (buf == NULL || nbytes < 0)
+    if (bad_userspace_addr(buf, nbytes))
     {
         return -1;
     }
@@ -381,7 +474,16 @@ int32_t read (int32_t fd, void* buf, int32_t nbytes)
     {
         return -1;
     }
-    int ret = (* cur_pcb->fdt[fd].fot_ptr->read)(fd, buf, nbytes);
+
+    // the system call linkage leaves the kernel lock to the driver
+    fot_t* fot = cur_pcb->fdt[fd].fot_ptr;
+    if (fot->nolock)
+    {
+        return (* fot->read)(fd, buf, nbytes);
+    }
+    kernel_enter();
+    int ret = (* fot->read)(fd, buf, nbytes);
+    kernel_exit();
     return ret;
 }
 
@@ -391,7 +493,7 @@ int32_t read (int32_t fd, void* buf, int32_t nbytes)
  * DESCRIPTION: system call to write data
  * INPUTS: fd: fd index to write, buf: stores data to write, nbytes: bytes to be written
  * OUTPUT: ret: returns bytes read
- * SIDE EFFECTS: file gets written to
+ * SIDE EFFECTS: file gets written to. takes the kernel lock unless the driver's fot is nolock
 */
 int32_t write (int32_t fd, const void* buf, int32_t nbytes)
 {
@@ -399,7 +501,7 @@ int32_t write (int32_t fd, const void* buf, int32_t nbytes)
     {
         return -1;
     }
-    if (buf == NULL || nbytes < 0)
+    if (bad_userspace_addr(buf, nbytes))
     {
         return -1;
     }
@@ -407,7 +509,16 @@ int32_t write (int32_t fd, const void* buf, int32_t nbytes)
     {
         return -1;
     }
-    return (* cur_pcb->fdt[fd].fot_ptr->write)(fd, buf, nbytes);
+
+    fot_t* fot = cur_pcb->fdt[fd].fot_ptr;
+    if (fot->nolock)
+    {
+        return (* fot->write)(fd, buf, nbytes);
+    }
+    kernel_enter();
+    int ret = (* fot->write)(fd, buf, nbytes);
+    kernel_exit();
+    return ret;
 }
 
 /**
@@ -422,9 +533,16 @@ int32_t open (const uint8_t* filename)
 {
     dentry_t file_dentry; // pointer to the dentry corresponding to the file name
     uint8_t  fd;          // first open entry in fdt
+    int8_t   name[MAX_FILE_NAME_LEN + 1];   // kernel copy of the user's file name
+
+    // copy the name in so the lookup can't run off the end of user memory
+    if (safe_strncpy(name, (int8_t*)filename, sizeof(name)) == -1)
+    {
+        return -1;
+    }
 
     // find the file, check for errors
-    if (read_dentry_by_name((char *)filename, &file_dentry) == -1)
+    if (read_dentry_by_name(name, &file_dentry) == -1)
     {
         return -1;
     }
@@ -444,6 +562,8 @@ int32_t open (const uint8_t* filename)
     cur_pcb->fdt[fd].flag     = 1;
     cur_pcb->fdt[fd].file_pos = 0;
     cur_pcb->fdt[fd].inode    = file_dentry.inode_num;
+    cur_pcb->fdt[fd].data     = NULL;
+    cur_pcb->fdt[fd].cloexec  = 1;
     switch(file_dentry.filetype)
     {
         case RTC_FILETYPE:
@@ -458,7 +578,7 @@ int32_t open (const uint8_t* filename)
     }
 
     // if the open function on the file failed, return error
-    if((* cur_pcb->fdt[fd].fot_ptr->open)((char *)filename) == -1)
+    if((* cur_pcb->fdt[fd].fot_ptr->open)(name) == -1)
     {
         return -1;
     }
@@ -486,10 +606,7 @@ int32_t close (int32_t fd)
         return -1;
     }
 
-    cur_pcb->fdt[fd].flag = 0;
-    cur_pcb->fdt[fd].file_pos = 0;
-    cur_pcb->fdt[fd].inode = 0;
-    return (* cur_pcb->fdt[fd].fot_ptr->close)(fd);
+    return fd_release(cur_pcb, fd);
 }
 
 /*reads the program's command line arguments into a user-level buffer*/
@@ -512,7 +629,7 @@ int32_t getargs (uint8_t* buf, int32_t nbytes)
     if(cur_pcb->arg[0] == '\0')       return -1;
     if(strlen(cur_pcb->arg) > nbytes) return -1;
 
-    memcpy(buf, cur_pcb->arg, nbytes);
+    if (copy_to_user(buf, cur_pcb->arg, nbytes) != 0) return -1;
     return 0;
 }
 
@@ -526,12 +643,12 @@ int32_t getargs (uint8_t* buf, int32_t nbytes)
 */
 int32_t vidmap (uint8_t** screen_start)
 {
-    if (((int)(screen_start) < USERMEM) ||((int)(screen_start) >= USERMEM + FOUR_MB))
+    uint8_t* addr = SCREEN_START;
+
+    if (copy_to_user(screen_start, &addr, sizeof(addr)) != 0)
     {
         return -1;
     }
-
-    *screen_start = SCREEN_START;
     return 0;
 }
 
@@ -558,6 +675,349 @@ int32_t sigreturn (void)
 }
 
 
+/** brk
+ * DESCRIPTION: set the end of the process's heap
+ * INPUTS: addr - new break, between USER_HEAP and USER_HEAP_END
+ * OUTPUTS: 0 on success, -1 if out of range or out of memory
+ * SIDE EFFECTS: maps or unmaps heap pages
+*/
+int32_t brk (void* addr)
+{
+    return heap_set_brk(&cur_pcb->heap, (uint32_t)addr);
+}
+
+
+/** sbrk
+ * DESCRIPTION: grow or shrink the process's heap by increment bytes
+ * INPUTS: increment - bytes to add (or remove if negative), 0 just reads the break
+ * OUTPUTS: the old break, -1 on failure
+ * SIDE EFFECTS: maps or unmaps heap pages
+*/
+int32_t sbrk (int32_t increment)
+{
+    uint32_t old_brk = cur_pcb->heap.brk;
+
+    if (heap_set_brk(&cur_pcb->heap, old_brk + increment) == -1)
+    {
+        return -1;
+    }
+    return old_brk;
+}
+
+
+/** shmget
+ * DESCRIPTION: find or create a shared memory segment
+ * INPUTS: key - name shared by the cooperating programs, SHM_PRIVATE for a new unnamed segment
+ *         size - bytes, at most 4MB. only used when the segment is created
+ * OUTPUTS: segment id, -1 on failure
+ * SIDE EFFECTS: allocates the segment's frames, held by this process until it halts
+*/
+int32_t shmget (int32_t key, uint32_t size)
+{
+    return shm_get(key, size, cur_pid);
+}
+
+
+/** shmat
+ * DESCRIPTION: map a segment into the process
+ * INPUTS: id - segment id from shmget
+ * OUTPUTS: user address of the segment, -1 on failure
+ * SIDE EFFECTS: uses one of the process's SHM_SLOTS slots
+*/
+int32_t shmat (int32_t id)
+{
+    uint32_t addr = shm_attach(&cur_pcb->shm, cur_pcb->page_dir, id);
+
+    return (addr == 0) ? -1 : (int32_t)addr;
+}
+
+
+/** shmdt
+ * DESCRIPTION: unmap a segment from the process
+ * INPUTS: addr - address shmat returned
+ * OUTPUTS: 0 on success, -1 if no segment is attached there
+ * SIDE EFFECTS: the segment is freed once no process has it attached
+*/
+int32_t shmdt (void* addr)
+{
+    return shm_detach(&cur_pcb->shm, cur_pcb->page_dir, (uint32_t)addr);
+}
+
+
+/** pipe
+ * DESCRIPTION: make a pipe and give the process both ends
+ * INPUTS: fds - user array of two ints, gets the read end in fds[0] and the write end in fds[1]
+ * OUTPUTS: 0 on success, -1 if fds is bad, there aren't two free fds or out of memory
+ * SIDE EFFECTS: uses two fds
+*/
+int32_t pipe (int32_t* fds)
+{
+    int32_t ends[2];
+    int32_t fd, n = 0;
+
+    if (!access_ok(fds, sizeof(ends)))
+    {
+        return -1;
+    }
+
+    for (fd = 2; fd < MAX_FD && n < 2; fd++)
+    {
+        if (cur_pcb->fdt[fd].flag == 0)
+        {
+            ends[n++] = fd;
+        }
+    }
+    if (n < 2)
+    {
+        return -1;
+    }
+
+    if (pipe_create(&cur_pcb->fdt[ends[0]], &cur_pcb->fdt[ends[1]]) == -1)
+    {
+        return -1;
+    }
+    if (copy_to_user(fds, ends, sizeof(ends)) != 0)
+    {
+        // the caller never learns the fds, nobody else could close them
+        fd_release(cur_pcb, ends[0]);
+        fd_release(cur_pcb, ends[1]);
+        return -1;
+    }
+    return 0;
+}
+
+
+/** fd_copy
+ * DESCRIPTION: make one fd entry a copy of another, letting the driver count the extra reference
+ * INPUTS: to - an unused entry
+ *         from - an entry in use
+ * OUTPUTS: none
+ * SIDE EFFECTS: the copy is passed on to children (close-on-exec cleared)
+*/
+static void fd_copy(fde_t* to, fde_t* from)
+{
+    *to = *from;
+    to->cloexec = 0;
+    if (to->fot_ptr->dup != NULL)
+    {
+        to->fot_ptr->dup(to);
+    }
+}
+
+
+/** fdt_inherit
+ * DESCRIPTION: set up a new process's fd table. fd 0 and 1 are always copied from the parent,
+ *              so a shell can redirect a child by dup2'ing over its own stdin/stdout first.
+ *              Other fds are copied unless they're close-on-exec. Without a parent (base
+ *              shells) the process just gets the terminal.
+ * INPUTS: child - the new process's pcb, fd table empty
+ *         parent - the parent's pcb, or NULL
+ * OUTPUTS: none
+ * SIDE EFFECTS: takes a reference on every inherited pipe end
+*/
+void fdt_inherit(pcb_t* child, pcb_t* parent)
+{
+    int32_t fd;
+
+    memset(child->fdt, 0, sizeof(child->fdt));
+    if (parent == NULL)
+    {
+        child->fdt[0].fot_ptr = &stdin_fot;
+        child->fdt[0].flag    = 1;
+        child->fdt[1].fot_ptr = &stdout_fot;
+        child->fdt[1].flag    = 1;
+        return;
+    }
+
+    for (fd = 0; fd < MAX_FD; fd++)
+    {
+        if (parent->fdt[fd].flag == 1 && (fd <= 1 || !parent->fdt[fd].cloexec))
+        {
+            fd_copy(&child->fdt[fd], &parent->fdt[fd]);
+        }
+    }
+}
+
+
+/** dup
+ * DESCRIPTION: copy an fd to the lowest free fd
+ * INPUTS: fd - an open fd
+ * OUTPUTS: the new fd, -1 if fd isn't open or there's no free fd
+ * SIDE EFFECTS: both fds refer to the same pipe/file/terminal. file offsets are per fd
+*/
+int32_t dup (int32_t fd)
+{
+    int32_t new_fd;
+
+    if (fd < 0 || fd >= MAX_FD || cur_pcb->fdt[fd].flag == 0)
+    {
+        return -1;
+    }
+    for (new_fd = 0; new_fd < MAX_FD && cur_pcb->fdt[new_fd].flag == 1; new_fd++);
+    if (new_fd == MAX_FD)
+    {
+        return -1;
+    }
+
+    fd_copy(&cur_pcb->fdt[new_fd], &cur_pcb->fdt[fd]);
+    return new_fd;
+}
+
+
+/** dup2
+ * DESCRIPTION: copy an fd onto a given fd, closing whatever was there. stdin and stdout
+ *              can be replaced this way
+ * INPUTS: old_fd - an open fd
+ *         new_fd - fd to copy it to
+ * OUTPUTS: new_fd, -1 if either fd is out of range or old_fd isn't open
+ * SIDE EFFECTS: closes new_fd first if it was open
+*/
+int32_t dup2 (int32_t old_fd, int32_t new_fd)
+{
+    if (old_fd < 0 || old_fd >= MAX_FD || new_fd < 0 || new_fd >= MAX_FD ||
+        cur_pcb->fdt[old_fd].flag == 0)
+    {
+        return -1;
+    }
+    if (old_fd == new_fd)
+    {
+        return new_fd;
+    }
+    if (cur_pcb->fdt[new_fd].flag == 1)
+    {
+        fd_release(cur_pcb, new_fd);
+    }
+
+    fd_copy(&cur_pcb->fdt[new_fd], &cur_pcb->fdt[old_fd]);
+    return new_fd;
+}
+
+
+/** clock_gettime
+ * DESCRIPTION: read a clock. programs can also read the clock page at CLOCKPAGE themselves,
+ *              without the system call
+ * INPUTS: clock - which clock, only CLOCK_MONOTONIC
+ *         ns - user pointer, gets nanoseconds since boot
+ * OUTPUTS: 0 on success, -1 for an unknown clock or a bad pointer
+ * SIDE EFFECTS: none
+*/
+int32_t clock_gettime (int32_t clock, uint64_t* ns)
+{
+    uint64_t now;
+
+    if (clock != CLOCK_MONOTONIC)
+    {
+        return -1;
+    }
+    now = clock_ns();
+    if (copy_to_user(ns, &now, sizeof(now)) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+
+/** sleep
+ * DESCRIPTION: sleep the process for a while
+ * INPUTS: ms - milliseconds, rounded up to whole rtc ticks
+ * OUTPUTS: 0
+ * SIDE EFFECTS: gives up the cpu until a timer wakes it
+*/
+int32_t sleep (uint32_t ms)
+{
+    timer_sleep(timer_ms_to_ticks(ms));
+    return 0;
+}
+
+
+/** irqstat
+ * DESCRIPTION: copy out the interrupt stats (irqstat.h), one entry per vector that has fired,
+ *              lowest vector first and the shared linkages last
+ * INPUTS: buf - user array of n entries
+ *         n - how many fit, 0 to zero the stats instead
+ * OUTPUTS: entries written, -1 for a bad buffer or a negative n
+ * SIDE EFFECTS: n = 0 starts every count again
+*/
+int32_t irqstat (irqstat_entry_t* buf, int32_t n)
+{
+    irqstat_entry_t e;
+    uint32_t        vec;
+    int32_t         done = 0;
+
+    if (n < 0)
+    {
+        return -1;
+    }
+    if (n == 0)
+    {
+        irqstat_reset();
+        return 0;
+    }
+    for (vec = 0; vec < IRQSTAT_VECTORS && done < n; vec++)
+    {
+        if (irqstat_get(vec, &e) && copy_to_user(&buf[done++], &e, sizeof(e)) != 0)
+        {
+            return -1;
+        }
+    }
+    return done;
+}
+
+
+/** prof_start
+ * DESCRIPTION: start the sampling profiler (prof.h) with empty rings
+ * INPUTS: none
+ * OUTPUTS: 0, -1 if it's already running or there's no memory for the rings
+*/
+int32_t prof_start (void)
+{
+    return prof_enable();
+}
+
+
+/** prof_stop
+ * DESCRIPTION: stop the sampling profiler, the samples stay until read
+ * INPUTS: none
+ * OUTPUTS: samples waiting to be read
+*/
+int32_t prof_stop (void)
+{
+    return prof_disable();
+}
+
+
+/** prof_dump
+ * DESCRIPTION: read the profiler's samples, either into a user buffer or out the serial port
+ * INPUTS: buf - user array of n samples, NULL to write every sample to COM1 as text instead
+ *         n - how many fit
+ * OUTPUTS: samples read, -1 for a bad buffer or a negative n
+ * SIDE EFFECTS: the samples read are gone from the rings
+*/
+int32_t prof_dump (prof_sample_t* buf, int32_t n)
+{
+    prof_sample_t s;
+    int32_t       done;
+
+    if (buf == NULL)
+    {
+        return prof_serial_dump();
+    }
+    if (n < 0)
+    {
+        return -1;
+    }
+    for (done = 0; done < n && prof_read(&s, 1) == 1; done++)
+    {
+        if (copy_to_user(&buf[done], &s, sizeof(s)) != 0)
+        {
+            return -1;
+        }
+    }
+    return done;
+}
+
+
 /** std_read
  * DESCRIPTION: dummy function
  * INPUTS: neglect
@@ -578,3 +1038,15 @@ int std_write(int32_t fd, const char* buf, int32_t nbytes)
 {
     return -1;
 }
+
+
+/** std_close
+ * DESCRIPTION: stdin/stdout are shared with every process on the terminal, so closing one
+ *              (or a dup of one) leaves the terminal alone
+ * INPUTS: neglect
+ * OUTPUTS: 0
+*/
+int std_close(int32_t fd)
+{
+    return 0;
+}
@@ -1,14 +1,20 @@
 
+#ifndef _SYSCALL_H
+#define _SYSCALL_H
+
 #include "lib.h"
 #include "rtc.h"
 #include "terminal.h"
 #include "types.h"
+#include "heap.h"
+#include "shm.h"
+#include "smp.h"
+#include "irqstat.h"
+#include "prof.h"
 
-#define MAX_PID     6
+#define MAX_PID     256                 // size of the process table, multiple of 32
 #define USER_CODE   0x8048000
-#define EIGHT_MB    0x800000
 #define FOUR_MB     0x400000  
-#define EIGHT_KB    0x2000
 #define ELF0        0x7F
 #define ELF1        0x45
 #define ELF2        0x4C
@@ -30,24 +36,33 @@
 
 
 
+struct fde;
+
 /* File Operation Table */
 typedef struct {    /* Function pointers for each file type to its driver */
     int (*read)  (int32_t fd, int8_t* buf, int32_t nbytes);
     int (*write) (int32_t fd, const int8_t* buf, int32_t nbytes);
     int (*open)  (const int8_t* filename);
     int (*close) (int32_t fd);
+    void (*dup)  (struct fde* f);   /* optional, called when an entry is copied (dup, dup2, execute) */
+    int32_t nolock;                 /* read and write run without the kernel lock (smp.h) */
  } fot_t;
 
  /* File Descriptor Entry */
-typedef struct {
+typedef struct fde {
     fot_t*  fot_ptr;    /* function table for the file                                          */
     int32_t inode;      /* inode of the file                                                    */
     int32_t file_pos;   /* keeps track of where the user is currently reading from in the file  */
     int32_t flag;       /* flag whether file descriptor is in use or not */
+    void*   data;       /* driver private state (the pipe for pipe ends)                        */
+    int32_t cloexec;    /* not passed on to children. set by open/pipe, cleared on dup copies   */
 } fde_t;
 
+#define PROC_RUNNABLE   0
+#define PROC_SLEEPING   1
+
 /* Process Control Block */
-typedef struct {
+typedef struct pcb {
     int32_t pid;
     int32_t parent_id;
     fde_t   fdt[MAX_FD];
@@ -56,17 +71,35 @@ typedef struct {
     int32_t sch_esp; // for switching tasks
     int32_t sch_ebp;
     int32_t active;
+    int32_t state;            /* PROC_RUNNABLE or PROC_SLEEPING (on a wait queue) */
+    uint32_t user_page;       /* physical address of the 4MB program page */
+    uheap_t heap;             /* brk/sbrk heap */
+    shm_map_t shm;            /* attached shared memory segments */
+    pde_t*  page_dir;         /* this process's page directory */
+    int32_t term;             /* terminal its I/O goes to */
+    int32_t level;            /* scheduler level, 0 is picked first */
+    int32_t slice;            /* microseconds left before it is preempted */
+    struct pcb* rq_next;      /* next on the run queue */
+    int32_t on_rq;            /* 1 while waiting on the run queue */
+    void  (*kfn)(void*);      /* kernel threads: what they run, NULL for user processes */
+    void*   karg;
+    int32_t cpu;              /* cpu it runs on, the one its run queue belongs to */
+    uint32_t affinity;        /* cpus an idle cpu may steal it onto, bit per cpu */
+    uint64_t last_ran;        /* rdtsc when it last left a cpu, the coldest is stolen first */
+    int32_t bkl_depth;        /* kernel lock nesting while it's switched out */
     int8_t  arg[MAX_ARG_LEN]; /* arguments to pass into file */
 } pcb_t;
 
-int cur_pid;
-pcb_t *  cur_pcb;
+/* the process running on this cpu */
+#define cur_pid     (this_cpu()->pid)
+#define cur_pcb     (this_cpu()->pcb)
 
 
 
 void syscall_init(void);
 int32_t halt (uint8_t status);
 int32_t execute (const int8_t* command);
+int32_t execute_kernel (const int8_t* command);
 int32_t read (int32_t fd, void* buf, int32_t nbytes);
 int32_t write (int32_t fd, const void* buf, int32_t nbytes);
 int32_t open (const uint8_t* filename);
@@ -75,6 +108,21 @@ int32_t getargs (uint8_t* buf, int32_t nbytes);
 int32_t vidmap (uint8_t** screen_start);
 int32_t set_handler (int32_t signum, void* handler_address);
 int32_t sigreturn (void);
+int32_t brk (void* addr);
+int32_t sbrk (int32_t increment);
+int32_t shmget (int32_t key, uint32_t size);
+int32_t shmat (int32_t id);
+int32_t shmdt (void* addr);
+int32_t pipe (int32_t* fds);
+int32_t dup (int32_t fd);
+int32_t dup2 (int32_t old_fd, int32_t new_fd);
+int32_t clock_gettime (int32_t clock, uint64_t* ns);
+int32_t sleep (uint32_t ms);
+int32_t irqstat (irqstat_entry_t* buf, int32_t n);
+int32_t prof_start (void);
+int32_t prof_stop (void);
+int32_t prof_dump (prof_sample_t* buf, int32_t n);
+void fdt_inherit(pcb_t* child, pcb_t* parent);
 int32_t haltall (uint8_t status);
 
 extern void flushTLB(void);
@@ -82,5 +130,8 @@ extern void flushTLB(void);
 /* these are dummy functions*/
 int std_read(int32_t fd, char* buf, int32_t nbytes);
 int std_write(int32_t fd, const char* buf, int32_t nbytes);
+int std_close(int32_t fd);
 
 #endif
+
+#endif /* _SYSCALL_H */
@@ -7,8 +7,8 @@
 #include "paging.h"
 #include "lib.h"
 #include "bga.h"
+#include "waitq.h"
 
-int cur_term = -1;
 
 // pointer to the keyboard's buffer
 volatile static char* kbdbuf;
@@ -16,6 +16,13 @@ volatile static char* kbdbuf;
 volatile static  int kbdbufsize;
 // pointer to the current index of the keyboard buffer
 volatile static int* kbdbufidx;
+
+// processes waiting in terminal_read for enter, one queue per terminal
+static wait_queue_t read_wq[MAX_TERMINALS];
+
+// keyboard buffer, terminalState, vis_term and the cursor. kb_handler takes it, so always with
+// interrupts off
+spinlock_t term_lock = SPINLOCK_INIT("term");
 // pointer to boolean that determines whether terminal_read shoudl read buffer
 // acts like a rudimentary spinlock, for now
 // static int* bufready;
@@ -79,20 +86,27 @@ int terminal_close(int32_t fd){
 int terminal_read(int32_t fd, int8_t* buf, int32_t nbytes){
     int copy_bytes;
     int last_idx;
+    uint32_t flags;
+    int8_t line[TERM_BUF_SIZE];
     if((buf == 0)|(nbytes <= 0))
     {
         printf("terminal_read error: invalid buffer input or read size\n");
         return -1;
     }
 
+    spin_lock_irqsave(&term_lock, flags);
     update_cursor();
     memset((void*)kbdbuf, 0x00, kbdbufsize);
  
     (*kbdbufidx) =0;  // start from beginning since we just cleared
     last_idx = *kbdbufidx;
+    spin_unlock_irqrestore(&term_lock, flags);
 
-    while(terminalState[cur_term].enter_pressed == 0){}   // while the user hasn't hit enter...
+    // sleep until the user hits enter, kb_handler wakes us
+    int term = cur_term;
+    wait_event(&read_wq[term], terminalState[term].enter_pressed != 0);
 
+    spin_lock_irqsave(&term_lock, flags);
     kb_putc('\n');
     kbdbuf[((*kbdbufidx))++] = '\n';
     terminalState[cur_term].enter_pressed = 0;
@@ -102,11 +116,13 @@ int terminal_read(int32_t fd, int8_t* buf, int32_t nbytes){
         copy_bytes = nbytes;
     }
 
-    // if we exited then it's time to copy from kbdbuf to the external buf
-    memcpy(buf, (void*)kbdbuf, copy_bytes);
+    // take the line out under the lock, the copy to the caller may fault
+    memcpy(line, (void*)kbdbuf, copy_bytes);
     memset((void*)kbdbuf, 0x00, kbdbufsize);
     (*kbdbufidx) =0;
+    spin_unlock_irqrestore(&term_lock, flags);
 
+    memcpy(buf, line, copy_bytes);
     return (copy_bytes);  // return number of chars copied to buf
 }
 
@@ -122,6 +138,7 @@ int terminal_read(int32_t fd, int8_t* buf, int32_t nbytes){
 */
 int terminal_write(int32_t fd, const int8_t* buf, int32_t nbytes){
     int retval;
+    uint32_t flags;
     if((buf == 0) | (nbytes < 0)){
         printf("terminal_write error: invalid buffer input or write size\n");
         return -1;
@@ -134,10 +151,13 @@ int terminal_write(int32_t fd, const int8_t* buf, int32_t nbytes){
         }
         buf++;
     }
+    // the cursor registers are shared with kb_handler, which has term_lock
+    spin_lock_irqsave(&term_lock, flags);
     if (cur_term == vis_term)
     {
         update_cursor();
     }
+    spin_unlock_irqrestore(&term_lock, flags);
     return retval;
 }
 
@@ -154,19 +174,24 @@ void terminal_init() {
         terminalState[i].buf_idx  = 0;
         terminalState[i].screen_x = 0;
         terminalState[i].screen_y = 0;
-        terminalState[i].cur_pid  = i;
+        terminalState[i].fg_pid   = i;
         terminalState[i].enter_pressed = 0;
     }
+    vidmap_update(vis_term);
 }
 
 /* void switch_terminal(uint8_t new_term);
  * Inputs: uint8_t new_term - Terminal to switch to
  * Return Value: none
  * Function: Switches to the requested terminal. Restores previous state from TerminalState array.
+ *           Caller holds term_lock, the screen swap takes gfx_lock.
  */
 void switch_terminal(int new_term) 
 {
+    uint32_t flags;
+
     if (new_term == vis_term) return;
+    spin_lock_irqsave(&gfx_lock, flags);
     
     // save terminal keyboard buffer and idx
     strncpy(terminalState[vis_term].keyboard_buf, (const int8_t *)kbdbuf, TERM_BUF_SIZE);
@@ -193,4 +218,18 @@ void switch_terminal(int new_term)
     update_cursor();
 
     vis_term = new_term;
+    spin_unlock_irqrestore(&gfx_lock, flags);
+    vidmap_update(vis_term);
+}
+
+
+/** terminal_wake_reader
+ * DESCRIPTION: wake whatever is sleeping in terminal_read on a terminal, with the input boost
+ * INPUTS: term - the terminal enter was pressed on
+ * OUTPUTS: none
+ * SIDE EFFECTS: called from kb_handler
+*/
+void terminal_wake_reader(int term)
+{
+    wake_up_input(&read_wq[term]);
 }
@@ -8,6 +8,8 @@
 
 
 #include "keyboard.h"
+#include "smp.h"
+#include "spinlock.h"
 
 #define MAX_TERMINALS   3
 #define TERM_BUF_SIZE   128
@@ -20,7 +22,7 @@ typedef struct __attribute__((packed)) terminal {
     int buf_idx;
     int screen_x;
     int screen_y;
-    int cur_pid;
+    int fg_pid;                 // the process its input goes to
     unsigned int esp0;
     unsigned int ss0;
     volatile int enter_pressed;
@@ -30,7 +32,9 @@ terminal_t terminalState[3]; // 3 terminals
 
 
 int vis_term;
-extern int cur_term;
+extern spinlock_t term_lock;
+/* terminal of the process running on this cpu */
+#define cur_term    (this_cpu()->term)
 
 extern int terminal_open();
 extern int terminal_close(int32_t fd);
@@ -38,5 +42,6 @@ extern int terminal_read(int32_t fd, int8_t* buf, int32_t nbytes);
 extern int terminal_write(int32_t fd, const int8_t* buf, int32_t nbytes);
 void terminal_init();
 void switch_terminal(int new_term);
+void terminal_wake_reader(int term);
 
 #endif
@@ -4,6 +4,26 @@
 #include "rtc.h"
 #include "terminal.h"
 #include "fs_driver.h"
+#include "buddy.h"
+#include "slab.h"
+#include "heap.h"
+#include "proc.h"
+#include "paging.h"
+#include "uaccess.h"
+#include "shm.h"
+#include "pipe.h"
+#include "waitq.h"
+#include "scheduler.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "bga.h"
+#include "apic.h"
+#include "pit.h"
+#include "clock.h"
+#include "timer.h"
+#include "softirq.h"
+#include "irqstat.h"
+#include "prof.h"
 
 #define PASS 1
 #define FAIL 0
@@ -423,6 +443,2168 @@ int divide_by_zero_test(){
 /* Checkpoint 4 tests */
 /* Checkpoint 5 tests */
 
+/* Memory management tests */
+
+/* Buddy Allocator Test
+ * 
+ * Allocates single pages and a 4MB block, checks alignment and uniqueness,
+ * frees them and checks the free frame count is back where it started
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: frame_alloc, frame_free, page_alloc, page_free
+ * Files: buddy.h/c
+ */
+int buddy_test(){
+	TEST_HEADER;
+	uint32_t pages[16];
+	uint32_t big;
+	uint32_t before = buddy_free_frames();
+	int i, j;
+
+	for (i = 0; i < 16; i++) {
+		pages[i] = page_alloc();
+		if (pages[i] == 0 || (pages[i] & (FRAME_SIZE - 1)) || pages[i] < BUDDY_BASE)
+			return FAIL;
+		for (j = 0; j < i; j++) {
+			if (pages[j] == pages[i])
+				return FAIL;	// handed out twice
+		}
+	}
+
+	big = frame_alloc(FOUR_MB_ORDER);
+	if (big == 0 || (big & ((FRAME_SIZE << FOUR_MB_ORDER) - 1)))
+		return FAIL;
+	if (buddy_free_frames() != before - 16 - (1 << FOUR_MB_ORDER))
+		return FAIL;
+
+	frame_free(big, FOUR_MB_ORDER);
+	for (i = 0; i < 16; i++) {
+		page_free(pages[i]);
+	}
+	if (buddy_free_frames() != before)
+		return FAIL;
+
+	printf("%d of %d frames free\n", buddy_free_frames(), buddy_total_frames());
+	return PASS;
+}
+
+/* objects for the slab tests. ctor_calls counts how often the constructor ran */
+typedef struct {
+	uint32_t magic;
+	uint32_t state;
+	uint8_t pad[40];
+} slab_test_obj_t;
+
+#define SLAB_TEST_MAGIC	0x51AB51AB
+#define SLAB_BENCH_N	256
+static uint32_t ctor_calls;
+
+static void slab_test_ctor(void* obj){
+	((slab_test_obj_t*)obj)->magic = SLAB_TEST_MAGIC;
+	((slab_test_obj_t*)obj)->state = 0;
+	ctor_calls++;
+}
+
+/* Slab Allocator Test
+ * 
+ * Checks objects are cache line aligned and constructed, that a freed
+ * object comes back with its state intact and without another constructor
+ * call, and that kmalloc/kfree round trip through the size classes
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: kmem_cache_create/alloc/free/destroy, kmalloc, kfree
+ * Files: slab.h/c, paging.c
+ */
+int slab_test(){
+	TEST_HEADER;
+	kmem_cache_t* cache;
+	slab_test_obj_t* a;
+	slab_test_obj_t* b;
+	uint32_t calls;
+	void* p;
+
+	ctor_calls = 0;
+	cache = kmem_cache_create("slab_test", sizeof(slab_test_obj_t), 0, slab_test_ctor);
+	if (cache == NULL)
+		return FAIL;
+
+	a = kmem_cache_alloc(cache);
+	if (a == NULL || ((uint32_t)a & (CACHE_LINE_SIZE - 1)) || a->magic != SLAB_TEST_MAGIC)
+		return FAIL;
+	if (ctor_calls != cache->per_slab)
+		return FAIL;	// whole slab constructed up front
+	a->state = 42;
+
+	/* LIFO free list, so the same object comes straight back */
+	calls = ctor_calls;
+	kmem_cache_free(cache, a);
+	b = kmem_cache_alloc(cache);
+	if (b != a || b->state != 42 || ctor_calls != calls)
+		return FAIL;
+	kmem_cache_free(cache, b);
+	if (kmem_cache_destroy(cache) != 0)
+		return FAIL;
+
+	p = kmalloc(100);
+	if (p == NULL || kmalloc(KMALLOC_MAX_SIZE + 1) != NULL)
+		return FAIL;
+	memset(p, 0xAB, 100);
+	kfree(p);
+	if (kmalloc(128) != p)
+		return FAIL;	// 100 bytes comes from the 128 byte class
+	kfree(p);
+
+	return PASS;
+}
+
+/* Slab Latency Benchmark
+ * 
+ * Times SLAB_BENCH_N allocations and frees with rdtsc, once from a
+ * cold cache and once warm, and compares with 4KB pages from the
+ * buddy allocator. The warm round must not take a single frame
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints average cycles per operation
+ * Side Effects: None
+ * Coverage: kmem_cache_alloc/free, page_alloc/free
+ * Files: slab.h/c, buddy.h/c
+ */
+int slab_latency_test(){
+	TEST_HEADER;
+	static void* objs[SLAB_BENCH_N];
+	kmem_cache_t* cache;
+	uint64_t start;
+	uint32_t cold, warm, release, page, frames;
+	int result = PASS;
+	int i;
+
+	cache = kmem_cache_create("slab_bench", sizeof(slab_test_obj_t), 0, slab_test_ctor);
+	if (cache == NULL)
+		return FAIL;
+
+	start = rdtsc();
+	for (i = 0; i < SLAB_BENCH_N; i++) {
+		if ((objs[i] = kmem_cache_alloc(cache)) == NULL)
+			return FAIL;
+	}
+	cold = (uint32_t)(rdtsc() - start) / SLAB_BENCH_N;
+
+	start = rdtsc();
+	for (i = 0; i < SLAB_BENCH_N; i++)
+		kmem_cache_free(cache, objs[i]);
+	release = (uint32_t)(rdtsc() - start) / SLAB_BENCH_N;
+
+	/* the kept empty slab plus partial slabs serve these without new pages */
+	frames = buddy_free_frames();
+	start = rdtsc();
+	for (i = 0; i < SLAB_BENCH_N; i++) {
+		objs[i] = kmem_cache_alloc(cache);
+		kmem_cache_free(cache, objs[i]);
+	}
+	warm = (uint32_t)(rdtsc() - start) / SLAB_BENCH_N;
+	if (buddy_free_frames() != frames)
+		result = FAIL;
+
+	start = rdtsc();
+	for (i = 0; i < SLAB_BENCH_N; i++) {
+		objs[i] = (void*)page_alloc();
+		page_free((uint32_t)objs[i]);
+	}
+	page = (uint32_t)(rdtsc() - start) / SLAB_BENCH_N;
+
+	kmem_cache_destroy(cache);
+
+	printf("slab alloc cold %d, free %d, alloc+free warm %d cycles/op\n", cold, release, warm);
+	printf("buddy page alloc+free %d cycles/op\n", page);
+	return result;
+}
+
+/* Slab Fragmentation Benchmark
+ * 
+ * Fills every kmalloc size class, frees every other object and reports
+ * how much of the slab memory is still in use, then frees the rest and
+ * checks that the pages went back to the buddy allocator
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints utilization before and after
+ * Side Effects: None
+ * Coverage: kmalloc, kfree, kmem_cache_shrink
+ * Files: slab.h/c, buddy.h/c
+ */
+int slab_frag_test(){
+	TEST_HEADER;
+	static void* objs[SLAB_BENCH_N];
+	uint32_t sizes[SLAB_BENCH_N];
+	uint32_t frames = buddy_free_frames();
+	uint32_t requested, held, before;
+	uint32_t held_pages;
+	int i;
+
+	requested = 0;
+	for (i = 0; i < SLAB_BENCH_N; i++) {
+		sizes[i] = 24 + (i * 37) % (KMALLOC_MAX_SIZE - 24);	// spread over all classes
+		if ((objs[i] = kmalloc(sizes[i])) == NULL)
+			return FAIL;
+		requested += sizes[i];
+	}
+	held_pages = frames - buddy_free_frames();
+	held = held_pages * FRAME_SIZE;
+	printf("full: %d bytes requested in %d bytes of slabs (%d%%)\n", requested, held, requested * 100 / held);
+
+	before = requested;
+	for (i = 0; i < SLAB_BENCH_N; i += 2) {
+		kfree(objs[i]);
+		requested -= sizes[i];
+	}
+	held = (frames - buddy_free_frames()) * FRAME_SIZE;
+	printf("half freed: %d bytes requested in %d bytes of slabs (%d%%)\n", requested, held, requested * 100 / held);
+	if (requested >= before)
+		return FAIL;
+
+	for (i = 1; i < SLAB_BENCH_N; i += 2)
+		kfree(objs[i]);
+
+	/* each size class may keep one empty slab, beyond that every page must be back */
+	if (frames - buddy_free_frames() > KMALLOC_CLASSES * SLAB_KEEP_EMPTY)
+		return FAIL;
+	return PASS;
+}
+
+/* User Heap Test
+ * 
+ * Grows a heap with heap_set_brk, checks the new pages are mapped and
+ * zeroed, that out of range breaks are refused, and that shrinking
+ * and releasing give every frame back
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: Uses the heap PDEs of page_directory, leaves them unmapped
+ * Coverage: heap_init, heap_set_brk, heap_release
+ * Files: heap.h/c
+ */
+int heap_test(){
+	TEST_HEADER;
+	static uheap_t heap;
+	uint32_t frames = buddy_free_frames();
+	uint32_t* p = (uint32_t*)USER_HEAP;
+	int result = PASS;
+
+	heap_init(&heap, page_directory);
+
+	if (heap_set_brk(&heap, USER_HEAP + 3 * PAGESIZE + 100) != 0)
+		return FAIL;
+	if (p[0] != 0 || p[(4 * PAGESIZE) / sizeof(uint32_t) - 1] != 0)
+		result = FAIL;	// fresh pages must be zeroed
+	p[0] = 0xCAFEBABE;
+
+	if (heap_set_brk(&heap, USER_HEAP_END + 1) != -1 || heap_set_brk(&heap, USER_HEAP - 1) != -1)
+		result = FAIL;
+
+	if (heap_set_brk(&heap, USER_HEAP + PAGESIZE) != 0 || p[0] != 0xCAFEBABE)
+		result = FAIL;
+
+	heap_release(&heap);
+	if (buddy_free_frames() != frames)
+		result = FAIL;
+
+	return result;
+}
+
+/* Process Table Test
+ * 
+ * Creates PROC_TEST_N processes, checks pids are unique, skip the base
+ * shell pids and map back to their pcbs, then frees them all. Prints
+ * the average cycles per create and teardown
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: None
+ * Coverage: proc_alloc, proc_free, proc_get, proc_in_use
+ * Files: proc.h/c
+ */
+#define PROC_TEST_N	200
+int proc_test(){
+	TEST_HEADER;
+	static pcb_t* pcbs[PROC_TEST_N];
+	uint32_t count = proc_count();
+	uint32_t create, teardown;
+	uint64_t start;
+	pcb_t* base;
+	int32_t first;
+	int i;
+
+	start = rdtsc();
+	for (i = 0; i < PROC_TEST_N; i++) {
+		pcbs[i] = proc_alloc(ANY_PID);
+		if (pcbs[i] == NULL)
+			return FAIL;
+	}
+	create = (uint32_t)(rdtsc() - start) / PROC_TEST_N;
+
+	for (i = 0; i < PROC_TEST_N; i++) {
+		if (pcbs[i]->pid < MAX_TERMINALS || proc_get(pcbs[i]->pid) != pcbs[i])
+			return FAIL;
+		if (i > 0 && pcbs[i]->pid == pcbs[i - 1]->pid)
+			return FAIL;
+	}
+	if (proc_count() != count + PROC_TEST_N)
+		return FAIL;
+
+	/* base shell pids only come out when asked for by number */
+	if (!proc_in_use(1)) {
+		if ((base = proc_alloc(1)) == NULL || base->pid != 1 || proc_alloc(1) != NULL)
+			return FAIL;
+		proc_free(1);
+	}
+
+	first = pcbs[0]->pid;
+	start = rdtsc();
+	for (i = 0; i < PROC_TEST_N; i++)
+		proc_free(pcbs[i]->pid);
+	teardown = (uint32_t)(rdtsc() - start) / PROC_TEST_N;
+
+	if (proc_count() != count || proc_in_use(first))
+		return FAIL;
+
+	printf("%d processes: create %d, teardown %d cycles each\n", PROC_TEST_N, create, teardown);
+	return PASS;
+}
+
+/* TLB Benchmark
+ * 
+ * Warms the TLB with TLB_BENCH_PAGES kernel heap pages, then times
+ * touching them again after what a context switch used to do (drop
+ * everything), after a cr3 reload now that kernel pages are global,
+ * and after invlpg of just the two per process entries. Checks global
+ * pages are on, that the kernel's mappings are global and that a
+ * process's program page isn't
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints cycles per switch + refill
+ * Side Effects: None
+ * Coverage: flushTLB, flushTLBGlobal, invlpg, global pages
+ * Files: paging.h/c, enablepaging.S
+ */
+#define TLB_BENCH_PAGES		64
+#define TLB_BENCH_ROUNDS	100
+#define TLB_BENCH_CR4_PGE	0x80
+static uint32_t tlb_touch(volatile uint8_t* pages){
+	uint32_t sum = 0;
+	int i;
+	for (i = 0; i < TLB_BENCH_PAGES; i++)
+		sum += pages[i * PAGESIZE];
+	return sum;
+}
+
+int tlb_bench_test(){
+	TEST_HEADER;
+	volatile uint8_t* pages = kpage_alloc(TLB_BENCH_PAGES);
+	uint32_t full = 0, reload = 0, targeted = 0;
+	uint32_t cr4;
+	uint64_t start;
+	int result = PASS;
+	int r;
+
+	if (pages == NULL)
+		return FAIL;
+	tlb_touch(pages);
+
+	asm volatile ("movl %%cr4, %0" : "=r"(cr4));
+	if (!(cr4 & TLB_BENCH_CR4_PGE) || !page_directory[KERNEL / FOUR_MB].global ||
+		page_directory[USERIDX].global)
+		result = FAIL;
+
+	for (r = 0; r < TLB_BENCH_ROUNDS; r++) {
+		start = rdtsc();
+		flushTLBGlobal();
+		tlb_touch(pages);
+		full += (uint32_t)(rdtsc() - start);
+
+		start = rdtsc();
+		flushTLB();
+		tlb_touch(pages);
+		reload += (uint32_t)(rdtsc() - start);
+
+		start = rdtsc();
+		invlpg(USER);
+		invlpg(VIRVIDMEM + (VIDMEMIDX << ADDRSHIFT));
+		tlb_touch(pages);
+		targeted += (uint32_t)(rdtsc() - start);
+	}
+
+	kpage_free((void*)pages, TLB_BENCH_PAGES);
+
+	printf("switch + %d page touches: full flush %d, cr3 reload %d, invlpg %d cycles\n",
+		TLB_BENCH_PAGES, full / TLB_BENCH_ROUNDS, reload / TLB_BENCH_ROUNDS, targeted / TLB_BENCH_ROUNDS);
+	return result;
+}
+
+/* Address Space Ping-Pong Benchmark
+ * 
+ * Builds two process page directories with their own program pages and
+ * bounces between them, touching each one's program page after every
+ * switch. Checks the two address spaces really are separate, and
+ * compares a cr3 load against the old way (patching PD[USERIDX] in the
+ * shared directory and reloading cr3)
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints cycles per round trip
+ * Side Effects: Ends back on page_directory
+ * Coverage: pd_create, pd_switch, pd_destroy
+ * Files: paging.h/c
+ */
+#define PINGPONG_ROUNDS	1000
+int pingpong_test(){
+	TEST_HEADER;
+	volatile uint32_t* user = (volatile uint32_t*)USER;
+	uint32_t page_a, page_b, saved_user;
+	uint32_t pd_cycles, patch_cycles;
+	pde_t* pd_a;
+	pde_t* pd_b;
+	uint64_t start;
+	int result = PASS;
+	int r;
+
+	page_a = frame_alloc(FOUR_MB_ORDER);
+	page_b = frame_alloc(FOUR_MB_ORDER);
+	pd_a = pd_create(page_a, 0);
+	pd_b = pd_create(page_b, 1);
+	if (!page_a || !page_b || pd_a == NULL || pd_b == NULL)
+		return FAIL;
+
+	pd_switch(pd_a);
+	*user = 0xAAAA;
+	pd_switch(pd_b);
+	*user = 0xBBBB;
+	pd_switch(pd_a);
+	if (*user != 0xAAAA)
+		result = FAIL;
+
+	start = rdtsc();
+	for (r = 0; r < PINGPONG_ROUNDS; r++) {
+		pd_switch(pd_b);
+		(void)*user;
+		pd_switch(pd_a);
+		(void)*user;
+	}
+	pd_cycles = (uint32_t)(rdtsc() - start) / PINGPONG_ROUNDS;
+
+	/* old scheme: one shared directory, patch the entry and reload cr3 */
+	pd_switch(page_directory);
+	saved_user = page_directory[USERIDX].address_31_12;
+	start = rdtsc();
+	for (r = 0; r < PINGPONG_ROUNDS; r++) {
+		page_directory[USERIDX].address_31_12 = page_b >> ADDRSHIFT;
+		flushTLB();
+		(void)*user;
+		page_directory[USERIDX].address_31_12 = page_a >> ADDRSHIFT;
+		flushTLB();
+		(void)*user;
+	}
+	patch_cycles = (uint32_t)(rdtsc() - start) / PINGPONG_ROUNDS;
+	page_directory[USERIDX].address_31_12 = saved_user;
+	flushTLB();
+
+	pd_destroy(pd_a);
+	pd_destroy(pd_b);
+	frame_free(page_a, FOUR_MB_ORDER);
+	frame_free(page_b, FOUR_MB_ORDER);
+
+	printf("ping-pong round trip: cr3 load %d, patch + flush %d cycles\n", pd_cycles, patch_cycles);
+	return result;
+}
+
+/* User Copy Test
+ * 
+ * Sets up a fake process with its own directory and a UACCESS_BYTES
+ * heap, then times copy_to_user/copy_from_user against a checked byte
+ * loop. Checks kernel and out of range pointers are refused and that a
+ * copy running into an unmapped page stops there instead of killing
+ * the kernel, and that execute won't take a command it can't copy in
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints cycles per KB
+ * Side Effects: Borrows cur_pcb, ends back on page_directory
+ * Coverage: access_ok, copy_to_user, copy_from_user, __copy_user fixups,
+ *           execute's command copy
+ * Files: uaccess.h/c, copy_user.S, inthandlers.c
+ */
+#define UACCESS_BYTES	(16 * PAGESIZE)
+#define UACCESS_ROUNDS	50
+int uaccess_test(){
+	TEST_HEADER;
+	static pcb_t fake;
+	pcb_t* saved_pcb = cur_pcb;
+	uint8_t* kbuf = kpage_alloc(UACCESS_BYTES / PAGESIZE);
+	uint8_t* ubuf = (uint8_t*)USER_HEAP;
+	uint32_t page = frame_alloc(FOUR_MB_ORDER);
+	uint32_t to_cycles = 0, from_cycles = 0, loop_cycles = 0;
+	uint64_t start;
+	uint32_t flags;
+	pde_t* pd;
+	int result = PASS;
+	int r, i;
+
+	pd = pd_create(page, 0);
+	if (kbuf == NULL || !page || pd == NULL)
+		return FAIL;
+	pd_switch(pd);
+
+	memset(&fake, 0, sizeof(fake));
+	heap_init(&fake.heap, pd);
+	cur_pcb = &fake;
+	if (heap_set_brk(&fake.heap, USER_HEAP + UACCESS_BYTES) != 0)
+		result = FAIL;
+
+	for (i = 0; i < UACCESS_BYTES; i++)
+		kbuf[i] = (uint8_t)i;
+
+	for (r = 0; r < UACCESS_ROUNDS; r++) {
+		start = rdtsc();
+		if (copy_to_user(ubuf, kbuf, UACCESS_BYTES) != 0)
+			result = FAIL;
+		to_cycles += (uint32_t)(rdtsc() - start);
+
+		start = rdtsc();
+		if (copy_from_user(kbuf, ubuf, UACCESS_BYTES) != 0)
+			result = FAIL;
+		from_cycles += (uint32_t)(rdtsc() - start);
+
+		/* what a driver did before: check the pointer, copy a byte at a time */
+		start = rdtsc();
+		if (!bad_userspace_addr(ubuf, UACCESS_BYTES))
+			for (i = 0; i < UACCESS_BYTES; i++)
+				ubuf[i] = kbuf[i];
+		loop_cycles += (uint32_t)(rdtsc() - start);
+	}
+	if (ubuf[UACCESS_BYTES - 1] != (uint8_t)(UACCESS_BYTES - 1))
+		result = FAIL;
+
+	/* kernel memory, past the break and wrapping ranges are refused */
+	if (access_ok((void*)KERNEL, 4) || access_ok(ubuf, UACCESS_BYTES + 1) ||
+		access_ok((void*)(USER + FOUR_MB - 2), 4) || access_ok(ubuf + 4, 0xFFFFFFFF))
+		result = FAIL;
+	if (copy_to_user((void*)KERNEL, kbuf, 16) != 16)
+		result = FAIL;
+
+	/* execute copies its command in, a kernel pointer or one with no end in MAX_CMD_LEN is refused */
+	cli_and_save(flags);
+	memset(ubuf, 'a', MAX_CMD_LEN);
+	if (execute((int8_t*)"shell") != -1 || execute((int8_t*)ubuf) != -1)
+		result = FAIL;
+	restore_flags(flags);
+
+	/* bypass access_ok and run into the unmapped page after the break */
+	if (__copy_user(ubuf + UACCESS_BYTES - 8, kbuf, 16) != 8)
+		result = FAIL;
+	if (__copy_user(kbuf, ubuf + UACCESS_BYTES, 5) != 5)
+		result = FAIL;
+
+	cur_pcb = saved_pcb;
+	heap_release(&fake.heap);
+	pd_switch(page_directory);
+	pd_destroy(pd);
+	frame_free(page, FOUR_MB_ORDER);
+	kpage_free(kbuf, UACCESS_BYTES / PAGESIZE);
+
+	printf("%dKB user copy: to %d, from %d, checked byte loop %d cycles per KB\n", UACCESS_BYTES / 1024,
+		to_cycles / UACCESS_ROUNDS / (UACCESS_BYTES / 1024), from_cycles / UACCESS_ROUNDS / (UACCESS_BYTES / 1024),
+		loop_cycles / UACCESS_ROUNDS / (UACCESS_BYTES / 1024));
+	return result;
+}
+
+
+/* Shared Memory Bandwidth Test
+ * 
+ * Two processes on terminals 0 and 1 attach the same keyed segment.
+ * The writer fills it, the reader sums it straight out of its own
+ * mapping. Compares against relaying the same data through a kernel
+ * buffer (copy_from_user in the writer, copy_to_user in the reader),
+ * which is what any message based IPC would cost. Also checks detach
+ * and halt give every frame back, the creator's halt included, and
+ * that a segment nobody attached goes when its creator halts
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints cycles per KB both ways
+ * Side Effects: Borrows cur_pcb, ends back on page_directory
+ * Coverage: shm_get, shm_attach, shm_detach, shm_release
+ * Files: shm.h/c
+ */
+#define SHM_TEST_KEY	391
+#define SHM_TEST_BYTES	(16 * PAGESIZE)
+#define SHM_TEST_ROUNDS	50
+static uint32_t shm_sum(volatile uint32_t* p){
+	uint32_t sum = 0;
+	int i;
+	for (i = 0; i < SHM_TEST_BYTES / 4; i++)
+		sum += p[i];
+	return sum;
+}
+
+static void shm_fill(volatile uint32_t* p, uint32_t r){
+	int i;
+	for (i = 0; i < SHM_TEST_BYTES / 4; i++)
+		p[i] = i + r;
+}
+
+int shm_test(){
+	TEST_HEADER;
+	static pcb_t writer, reader;
+	pcb_t* saved_pcb = cur_pcb;
+	uint32_t frames = buddy_free_frames();
+	uint32_t page_w = frame_alloc(FOUR_MB_ORDER);
+	uint32_t page_r = frame_alloc(FOUR_MB_ORDER);
+	uint8_t* kbuf = kpage_alloc(SHM_TEST_BYTES / PAGESIZE);
+	uint32_t* relay_buf = (uint32_t*)(USER + FOUR_MB / 2);	/* somewhere in the program page */
+	uint32_t shm_cycles = 0, relay_cycles = 0, expect = 0;
+	uint32_t addr_w, addr_r;
+	uint64_t start;
+	int32_t id, unused;
+	int result = PASS;
+	int r;
+
+	memset(&writer, 0, sizeof(writer));
+	memset(&reader, 0, sizeof(reader));
+	writer.pid = MAX_PID - 1;
+	reader.pid = MAX_PID - 2;
+	writer.page_dir = pd_create(page_w, 0);
+	reader.page_dir = pd_create(page_r, 1);
+	if (!page_w || !page_r || kbuf == NULL || writer.page_dir == NULL || reader.page_dir == NULL)
+		return FAIL;
+
+	id = shm_get(SHM_TEST_KEY, SHM_TEST_BYTES, writer.pid);
+	unused = shm_get(SHM_PRIVATE, PAGESIZE, writer.pid);
+	if (id == -1 || unused == -1 || shm_get(SHM_TEST_KEY, 0, reader.pid) != id ||
+		shm_get(SHM_PRIVATE, SHM_MAX_SIZE + 1, reader.pid) != -1)
+		return FAIL;
+
+	pd_switch(writer.page_dir);
+	addr_w = shm_attach(&writer.shm, writer.page_dir, id);
+	pd_switch(reader.page_dir);
+	addr_r = shm_attach(&reader.shm, reader.page_dir, id);
+	if (addr_w == 0 || addr_r == 0 || shm_sum((uint32_t*)addr_r) != 0)
+		return FAIL;
+
+	for (r = 0; r < SHM_TEST_ROUNDS; r++) {
+		start = rdtsc();
+		pd_switch(writer.page_dir);
+		shm_fill((uint32_t*)addr_w, r);
+		pd_switch(reader.page_dir);
+		expect = shm_sum((uint32_t*)addr_r);
+		shm_cycles += (uint32_t)(rdtsc() - start);
+
+		start = rdtsc();
+		pd_switch(writer.page_dir);
+		cur_pcb = &writer;
+		shm_fill(relay_buf, r);
+		copy_from_user(kbuf, relay_buf, SHM_TEST_BYTES);
+		pd_switch(reader.page_dir);
+		cur_pcb = &reader;
+		copy_to_user(relay_buf, kbuf, SHM_TEST_BYTES);
+		if (shm_sum(relay_buf) != expect)
+			result = FAIL;
+		relay_cycles += (uint32_t)(rdtsc() - start);
+	}
+	cur_pcb = saved_pcb;
+
+	/* the writer detaches, the reader still sees the data until it halts */
+	pd_switch(writer.page_dir);
+	if (shm_detach(&writer.shm, writer.page_dir, addr_w) != 0 ||
+		shm_detach(&writer.shm, writer.page_dir, addr_w) != -1)
+		result = FAIL;
+	pd_switch(reader.page_dir);
+	if (shm_sum((uint32_t*)addr_r) != expect)
+		result = FAIL;
+
+	pd_switch(page_directory);
+	shm_release(&reader.shm, reader.page_dir, reader.pid);
+	if (shm_get(SHM_TEST_KEY, 0, reader.pid) != id)
+		result = FAIL;		/* the writer created it and hasn't halted */
+	shm_release(&writer.shm, writer.page_dir, writer.pid);
+	if (shm_attach(&writer.shm, writer.page_dir, id) != 0 ||
+		shm_attach(&writer.shm, writer.page_dir, unused) != 0)
+		result = FAIL;		/* last one out freed it, and the one never attached */
+	pd_destroy(writer.page_dir);
+	pd_destroy(reader.page_dir);
+	frame_free(page_w, FOUR_MB_ORDER);
+	frame_free(page_r, FOUR_MB_ORDER);
+	kpage_free(kbuf, SHM_TEST_BYTES / PAGESIZE);
+	if (buddy_free_frames() != frames)
+		result = FAIL;
+
+	printf("%dKB between two terminals: shared segment %d, kernel relay %d cycles per KB\n",
+		SHM_TEST_BYTES / 1024, shm_cycles / SHM_TEST_ROUNDS / (SHM_TEST_BYTES / 1024),
+		relay_cycles / SHM_TEST_ROUNDS / (SHM_TEST_BYTES / 1024));
+	return result;
+}
+
+
+/* Pipe Throughput Test
+ * 
+ * Opens a pipe in a fake process and pushes PIPE_TEST_BYTES through it
+ * in several chunk sizes with the read/write system calls, checking
+ * the data. Then checks end of file once the write end is closed and
+ * that the pipe's memory is freed with its last end. Pipes aren't nolock,
+ * so read and write take the kernel lock themselves, and must leave its
+ * depth as they found it
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints cycles per KB for each chunk size
+ * Side Effects: Borrows cur_pcb, ends back on page_directory
+ * Coverage: pipe, pipe_read, pipe_write, pipe_close
+ * Files: pipe.h/c
+ */
+#define PIPE_TEST_BYTES	(1024 * 1024)
+#define PIPE_TEST_SIZES	4
+int pipe_test(){
+	TEST_HEADER;
+	static pcb_t fake;
+	static const int32_t chunks[PIPE_TEST_SIZES] = {64, 512, 4096, PIPE_SIZE};
+	pcb_t* saved_pcb = cur_pcb;
+	uint32_t frames = buddy_free_frames();
+	uint32_t page = frame_alloc(FOUR_MB_ORDER);
+	int32_t depth = this_cpu()->bkl_depth;
+	int32_t* fds = (int32_t*)USER;
+	int8_t* wbuf = (int8_t*)(USER + PIPE_SIZE);
+	int8_t* rbuf = (int8_t*)(USER + 2 * PIPE_SIZE);
+	uint32_t cycles;
+	uint64_t start;
+	int result = PASS;
+	int c, i, moved;
+
+	memset(&fake, 0, sizeof(fake));
+	fake.page_dir = pd_create(page, 0);
+	if (!page || fake.page_dir == NULL)
+		return FAIL;
+	pd_switch(fake.page_dir);
+	cur_pcb = &fake;
+	fake.fdt[0].flag = 1;
+	fake.fdt[1].flag = 1;
+
+	if (pipe(fds) != 0 || fds[0] != 2 || fds[1] != 3 || pipe((int32_t*)KERNEL) != -1)
+		result = FAIL;
+	for (i = 0; i < PIPE_SIZE; i++)
+		wbuf[i] = (int8_t)(i * 7);
+
+	for (c = 0; c < PIPE_TEST_SIZES && result == PASS; c++) {
+		start = rdtsc();
+		for (moved = 0; moved < PIPE_TEST_BYTES; moved += chunks[c]) {
+			if (write(fds[1], wbuf, chunks[c]) != chunks[c] ||
+				read(fds[0], rbuf, chunks[c]) != chunks[c]) {
+				result = FAIL;
+				break;
+			}
+		}
+		cycles = (uint32_t)(rdtsc() - start);
+
+		/* one more round into a cleared buffer, every byte must come through */
+		memset(rbuf, 0, chunks[c]);
+		if (write(fds[1], wbuf, chunks[c]) != chunks[c] || read(fds[0], rbuf, chunks[c]) != chunks[c])
+			result = FAIL;
+		for (i = 0; i < chunks[c]; i++) {
+			if (rbuf[i] != wbuf[i])
+				result = FAIL;
+		}
+		printf("pipe, %d byte chunks: %d cycles per KB\n", chunks[c], cycles / (PIPE_TEST_BYTES / 1024));
+	}
+
+	/* wrong direction, then end of file once the writer is gone */
+	if (read(fds[1], rbuf, 1) != -1 || write(fds[0], wbuf, 1) != -1)
+		result = FAIL;
+	write(fds[1], wbuf, 10);
+	close(fds[1]);
+	if (read(fds[0], rbuf, 64) != 10 || read(fds[0], rbuf, 64) != 0)
+		result = FAIL;
+	close(fds[0]);
+	if (this_cpu()->bkl_depth != depth)
+		result = FAIL;
+
+	cur_pcb = saved_pcb;
+	pd_switch(page_directory);
+	pd_destroy(fake.page_dir);
+	frame_free(page, FOUR_MB_ORDER);
+	/* the pipe cache may keep its empty slab */
+	if (frames - buddy_free_frames() > SLAB_KEEP_EMPTY)
+		result = FAIL;
+	return result;
+}
+
+
+/* Redirection Test
+ * 
+ * A fake parent points its stdout at a pipe with dup2 and a fake child
+ * inherits it, the way a shell would run "prog > pipe". Checks only
+ * stdin/stdout and dup'd fds are inherited, that the child's output
+ * lands in the pipe, and that the pipe only reports end of file once
+ * every copy of the write end is closed
+ * Inputs: None
+ * Outputs: PASS/FAIL
+ * Side Effects: Borrows cur_pcb, ends back on page_directory
+ * Coverage: dup, dup2, fdt_inherit, pipe_dup
+ * Files: syscall.c, pipe.c
+ */
+int dup_test(){
+	TEST_HEADER;
+	static pcb_t parent, child;
+	pcb_t* saved_pcb = cur_pcb;
+	uint32_t page = frame_alloc(FOUR_MB_ORDER);
+	int32_t* fds = (int32_t*)USER;
+	int8_t* buf = (int8_t*)(USER + PAGESIZE);
+	int32_t saved;
+	int result = PASS;
+
+	memset(&parent, 0, sizeof(parent));
+	memset(&child, 0, sizeof(child));
+	parent.page_dir = pd_create(page, 0);
+	if (!page || parent.page_dir == NULL)
+		return FAIL;
+	pd_switch(parent.page_dir);
+
+	cur_pcb = &parent;
+	fdt_inherit(&parent, NULL);
+	if (pipe(fds) != 0)
+		result = FAIL;
+	saved = dup(1);
+	if (saved != 4 || dup2(fds[1], 1) != 1 || dup2(fds[1], MAX_FD) != -1 || dup(MAX_FD - 1) != -1)
+		result = FAIL;
+
+	fdt_inherit(&child, &parent);
+	if (child.fdt[1].data != parent.fdt[fds[1]].data || child.fdt[fds[0]].flag || child.fdt[fds[1]].flag ||
+		!child.fdt[saved].flag)
+		result = FAIL;
+
+	/* child writes to "stdout", then exits */
+	cur_pcb = &child;
+	strcpy(buf, "redirected");
+	if (write(1, buf, 10) != 10)
+		result = FAIL;
+	dup2(saved, 1);
+	close(saved);
+
+	/* parent puts its stdout back and drains the pipe */
+	cur_pcb = &parent;
+	dup2(saved, 1);
+	close(saved);
+	close(fds[1]);
+	if (read(fds[0], buf, 64) != 10 || strncmp(buf, "redirected", 10) != 0 || read(fds[0], buf, 64) != 0)
+		result = FAIL;
+	close(fds[0]);
+
+	cur_pcb = saved_pcb;
+	pd_switch(page_directory);
+	pd_destroy(parent.page_dir);
+	frame_free(page, FOUR_MB_ORDER);
+	return result;
+}
+
+
+/* rtc_write takes its frequency from user memory, so a test running as
+ * cur_pcb maps a program page of its own for the call, the same way
+ * rtc_virt_test's writes come in. Returns what rtc_write did
+ */
+static int32_t test_rtc_rate(int32_t fd, int32_t hz){
+	pde_t* saved_pd = cur_pcb->page_dir ? cur_pcb->page_dir : page_directory;
+	uint32_t page = frame_alloc(FOUR_MB_ORDER);
+	pde_t* pd = page ? pd_create(page, 0) : NULL;
+	uint32_t flags;
+	int32_t ret;
+
+	if (pd == NULL) {
+		if (page)
+			frame_free(page, FOUR_MB_ORDER);
+		return -1;
+	}
+	cli_and_save(flags);
+	pd_switch(pd);
+	*(int32_t*)USER = hz;
+	ret = rtc_write(fd, (int8_t*)USER, sizeof(int32_t));
+	pd_switch(saved_pd);
+	restore_flags(flags);
+	pd_destroy(pd);
+	frame_free(page, FOUR_MB_ORDER);
+	return ret;
+}
+
+
+/* Wait Queue Test
+ * 
+ * Checks a satisfied wait_event returns straight away and leaves the
+ * process runnable and off the queue. Then does WAITQ_TEST_READS
+ * rtc_reads at 32Hz as a fake process, checks they took as long as
+ * 32Hz should, and reports how much of that time the cpu was actually
+ * busy (it used to spin the whole time) and how long a woken process
+ * took to run
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints busy % and wake up latency
+ * Side Effects: Borrows cur_pcb, runs a 32Hz virtual rtc on fd 2
+ * Coverage: wait_event, wq_sleep, wake_up, rtc_read
+ * Files: waitq.h/c, rtc.c
+ */
+#define WAITQ_TEST_READS	10
+#define WAITQ_TEST_HZ		32
+int waitq_test(){
+	TEST_HEADER;
+	static pcb_t fake;
+	static wait_queue_t wq = WAIT_QUEUE_INIT;
+	pcb_t* saved_pcb = cur_pcb;
+	uint64_t idle_before, latency_before, start;
+	uint32_t total, idle, latency, wakeups, ticks;
+	int result = PASS;
+	int i;
+
+	memset(&fake, 0, sizeof(fake));
+	cur_pcb = &fake;
+
+	wait_event(&wq, 1);
+	if (fake.state != PROC_RUNNABLE || wq.head != NULL)
+		result = FAIL;
+
+	if (test_rtc_rate(2, WAITQ_TEST_HZ) != 0)
+		result = FAIL;
+	idle_before = sched_stats.idle_cycles;
+	latency_before = wq_stats.latency_total;
+	wakeups = wq_stats.wakeups;
+	ticks = timer_ticks;
+	start = rdtsc();
+	for (i = 0; i < WAITQ_TEST_READS; i++)
+		rtc_read(2, NULL, 0);
+	total = (uint32_t)(rdtsc() - start);
+	ticks = timer_ticks - ticks;
+	idle = (uint32_t)(sched_stats.idle_cycles - idle_before);
+	latency = (uint32_t)(wq_stats.latency_total - latency_before);
+	rtc_close(2);
+
+	if (fake.state != PROC_RUNNABLE || wq_stats.wakeups == wakeups)
+		result = FAIL;
+	/* every read slept out its own period at the rate that was set */
+	if (ticks < WAITQ_TEST_READS * (VIRT_SECOND / WAITQ_TEST_HZ) - 1 ||
+		ticks > WAITQ_TEST_READS * (VIRT_SECOND / WAITQ_TEST_HZ) + 1)
+		result = FAIL;
+	cur_pcb = saved_pcb;
+
+	printf("%d rtc_reads: %d cycles, cpu busy %d%%, wake up latency avg %d max %d cycles\n",
+		WAITQ_TEST_READS, total, (total - idle) / (total / 100), latency / WAITQ_TEST_READS,
+		wq_stats.latency_max);
+	return result;
+}
+
+
+/* Idle Test
+ * 
+ * Halts IDLE_TEST_HALTS times through idle_wait and checks the time
+ * shows up as idle, that interrupts come back on and that halting
+ * actually waits for an interrupt rather than falling straight through
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the average cycles per halt
+ * Side Effects: None
+ * Coverage: idle_wait, idle accounting
+ * Files: scheduler.h/c
+ */
+#define IDLE_TEST_HALTS		8
+int idle_test(){
+	TEST_HEADER;
+	uint64_t idle_before = sched_stats.idle_cycles;
+	uint32_t idle, flags;
+	int result = PASS;
+	int i;
+
+	for (i = 0; i < IDLE_TEST_HALTS; i++)
+		idle_wait();
+	idle = (uint32_t)(sched_stats.idle_cycles - idle_before);
+
+	asm volatile ("pushfl; popl %0" : "=r"(flags));
+	if (!(flags & 0x200))		// IF
+		result = FAIL;
+	if (idle < IDLE_TEST_HALTS * 1000)	// an interrupt is a lot further away than that
+		result = FAIL;
+
+	printf("%d halts, %d idle cycles each\n", IDLE_TEST_HALTS, idle / IDLE_TEST_HALTS);
+	return result;
+}
+
+
+/* Scheduler Test
+ * 
+ * Runs SCHED_TEST_THREADS cpu bound kernel threads off the run queue
+ * for about two seconds while the test itself sleeps on the rtc, then
+ * compares how far each one got. With round robin they should all get
+ * a fair share, within SCHED_TEST_SPREAD of each other, and the
+ * switching shouldn't eat much of the throughput one thread gets on
+ * its own
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the spread, switch count and throughput
+ * Side Effects: Turns the scheduler on with the shells marked launched,
+ *				 borrows cur_pcb, runs a 4Hz virtual rtc on fd 2
+ * Coverage: run queue, task_switch, kthread_create/exit, sched_wake
+ * Files: scheduler.h/c, waitq.c
+ */
+#define SCHED_TEST_THREADS	12
+#define SCHED_TEST_READS	8
+#define SCHED_TEST_BASE		1000000
+#define SCHED_TEST_SPREAD	4			// most max / min iterations allowed
+static volatile uint32_t sched_counts[SCHED_TEST_THREADS];
+static volatile int sched_stop;
+static volatile int sched_done;
+static wait_queue_t sched_done_wq = WAIT_QUEUE_INIT;
+
+static void sched_spin(void* arg){
+	volatile uint32_t* count = arg;
+	while (!sched_stop)
+		(*count)++;
+	cli();
+	sched_done++;
+	wake_up(&sched_done_wq);
+	sti();
+}
+
+int sched_test(){
+	TEST_HEADER;
+	pcb_t* saved_pcb = cur_pcb;
+	int saved_pid = cur_pid;
+	int saved_term = cur_term;
+	pcb_t* self;
+	volatile uint32_t base_count = 0;
+	uint64_t start;
+	uint32_t base_cycles, total_k, switches, sum, min, max, thr_cpi, base_cpi;
+	int result = PASS;
+	int i;
+
+	// one thread alone, for comparison
+	start = rdtsc();
+	for (i = 0; i < SCHED_TEST_BASE; i++)
+		base_count++;
+	base_cycles = (uint32_t)(rdtsc() - start);
+
+	// the test runs as a process too, so it has something to sleep on the rtc with
+	self = proc_alloc(ANY_PID);
+	if (self == NULL)
+		return FAIL;
+	self->page_dir = page_directory;
+	cur_pcb = self;
+	cur_pid = self->pid;
+	cur_term = 0;
+	terminals_initialized[0] = 1;
+	terminals_initialized[1] = 1;
+	terminals_initialized[2] = 1;
+
+	sched_stop = 0;
+	sched_done = 0;
+	for (i = 0; i < SCHED_TEST_THREADS; i++) {
+		sched_counts[i] = 0;
+		if (kthread_create(sched_spin, (void*)&sched_counts[i]) == NULL)
+			result = FAIL;
+	}
+
+	if (test_rtc_rate(2, 4) != 0)
+		result = FAIL;
+	switches = sched_stats.switches;
+	start = rdtsc();
+	term_flag = 1;
+	for (i = 0; i < SCHED_TEST_READS; i++)
+		rtc_read(2, NULL, 0);
+	sched_stop = 1;
+	total_k = (uint32_t)((rdtsc() - start) >> 10);
+	wait_event(&sched_done_wq, sched_done == SCHED_TEST_THREADS);
+	term_flag = 0;
+	switches = sched_stats.switches - switches;
+	rtc_close(2);
+
+	cur_pcb = saved_pcb;
+	cur_pid = saved_pid;
+	cur_term = saved_term;
+	proc_free(self->pid);
+
+	sum = 0;
+	min = max = sched_counts[0];
+	for (i = 0; i < SCHED_TEST_THREADS; i++) {
+		sum += sched_counts[i];
+		if (sched_counts[i] < min)
+			min = sched_counts[i];
+		if (sched_counts[i] > max)
+			max = sched_counts[i];
+	}
+	if (min == 0 || sched_stats.rq_len != 0)
+		return FAIL;
+	// a fair share: nobody far behind (threads spread unevenly over the cpus can be 2x apart)
+	if (min < max / SCHED_TEST_SPREAD)
+		result = FAIL;
+
+	// cycles per 100 iterations, threaded vs alone
+	thr_cpi = (total_k * 100) / ((sum >> 10) + 1);
+	base_cpi = base_cycles / (SCHED_TEST_BASE / 100);
+	printf("%d threads: iterations min %d max %d (%d%%), %d switches, throughput %d%% of one thread\n",
+		SCHED_TEST_THREADS, min, max, min / (max / 100 + 1), switches, base_cpi * 100 / (thr_cpi + 1));
+	return result;
+}
+
+
+/* Priority Test
+ * 
+ * Runs PRIO_TEST_BATCH cpu bound kernel threads on a background
+ * terminal and one "echo" thread on the visible terminal. The test
+ * plays the keyboard: PRIO_TEST_KEYS times it waits on the rtc, stamps
+ * the time and wakes the echo thread the way kb_handler does. Checks
+ * the echo thread gets the cpu back well within one batch slice and
+ * the batch threads still all make progress
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the echo latency in microseconds
+ * Side Effects: Turns the scheduler on with the shells marked launched,
+ *				 borrows cur_pcb, runs a 16Hz virtual rtc on fd 2
+ * Coverage: sched_wake boost, sched_preempt, levels and slices
+ * Files: scheduler.h/c, waitq.c
+ */
+#define PRIO_TEST_BATCH		6
+#define PRIO_TEST_KEYS		16
+#define PRIO_TEST_RATE_US	62500		// 16Hz
+#define PRIO_TEST_SLICE_US	25000		// one pit tick
+static volatile uint32_t prio_counts[PRIO_TEST_BATCH];
+static volatile uint32_t prio_key;
+static volatile uint64_t prio_key_at;
+static volatile uint32_t prio_latency_total;
+static volatile uint32_t prio_latency_max;
+static wait_queue_t prio_key_wq = WAIT_QUEUE_INIT;
+
+static void prio_echo(void* arg){
+	uint32_t seen = 0;
+	uint32_t latency;
+	while (seen < PRIO_TEST_KEYS) {
+		wait_event(&prio_key_wq, prio_key != seen);
+		latency = (uint32_t)(rdtsc() - prio_key_at);
+		seen = prio_key;
+		prio_latency_total += latency;
+		if (latency > prio_latency_max)
+			prio_latency_max = latency;
+	}
+	cli();
+	sched_done++;
+	wake_up(&sched_done_wq);
+	sti();
+}
+
+int prio_test(){
+	TEST_HEADER;
+	pcb_t* saved_pcb = cur_pcb;
+	int saved_pid = cur_pid;
+	int saved_term = cur_term;
+	pcb_t* self;
+	pcb_t* pcb;
+	uint64_t start;
+	uint32_t period, avg_us, max_us;
+	int result = PASS;
+	int i;
+
+	self = proc_alloc(ANY_PID);
+	if (self == NULL)
+		return FAIL;
+	self->page_dir = page_directory;
+	sched_new(self);
+	self->affinity = 1;		// it borrows the boot processor's cur_pcb
+	cur_pcb = self;
+	cur_pid = self->pid;
+	cur_term = 0;
+	vis_term = 0;
+	terminals_initialized[0] = 1;
+	terminals_initialized[1] = 1;
+	terminals_initialized[2] = 1;
+
+	sched_stop = 0;
+	sched_done = 0;
+	prio_key = 0;
+	prio_latency_total = 0;
+	prio_latency_max = 0;
+	for (i = 0; i < PRIO_TEST_BATCH; i++) {
+		prio_counts[i] = 0;
+		if ((pcb = kthread_create(sched_spin, (void*)&prio_counts[i])) == NULL)
+			result = FAIL;
+		else
+			pcb->term = 1;		// background
+	}
+	if (kthread_create(prio_echo, NULL) == NULL)
+		result = FAIL;
+
+	if (test_rtc_rate(2, 16) != 0)
+		result = FAIL;
+	term_flag = 1;
+	rtc_read(2, NULL, 0);		// line up with the rtc
+	start = rdtsc();
+	for (i = 0; i < PRIO_TEST_KEYS; i++) {
+		rtc_read(2, NULL, 0);
+		cli();
+		prio_key_at = rdtsc();
+		prio_key++;
+		wake_up_input(&prio_key_wq);
+		sched_preempt();
+		sti();
+	}
+	period = (uint32_t)(rdtsc() - start) / PRIO_TEST_KEYS;
+	sched_stop = 1;
+	wait_event(&sched_done_wq, sched_done == PRIO_TEST_BATCH + 1);
+	term_flag = 0;
+	rtc_close(2);
+
+	cur_pcb = saved_pcb;
+	cur_pid = saved_pid;
+	cur_term = saved_term;
+	proc_free(self->pid);
+
+	for (i = 0; i < PRIO_TEST_BATCH; i++)
+		if (prio_counts[i] == 0)
+			result = FAIL;
+
+	// the rtc period is a known 62.5ms, use it to turn cycles into microseconds
+	avg_us = (prio_latency_total / PRIO_TEST_KEYS) / (period / PRIO_TEST_RATE_US + 1);
+	max_us = prio_latency_max / (period / PRIO_TEST_RATE_US + 1);
+	if (max_us >= PRIO_TEST_SLICE_US)
+		result = FAIL;
+
+	printf("echo under %d cpu bound threads: latency avg %d us, max %d us\n",
+		PRIO_TEST_BATCH, avg_us, max_us);
+	return result;
+}
+
+
+/* Tickless Test
+ * 
+ * Runs half a second with one cpu bound thread and half a second with
+ * nothing runnable, first with a pit interrupt every tick and then
+ * tickless, and reports timer interrupts per second and how much of
+ * the time the cpu sat in hlt. Tickless should take fewer interrupts
+ * in both cases, ideally none besides the test's own wake ups
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints interrupts/s and hlt residency
+ * Side Effects: Turns the scheduler on with the shells marked launched,
+ *				 borrows cur_pcb, runs a 16Hz virtual rtc on fd 2
+ * Coverage: sched_arm, pit_arm/pit_stop, sched_set_tickless
+ * Files: scheduler.h/c, pit.h/c
+ */
+#define TICK_TEST_READS		8			// at 16Hz, half a second
+static void tick_run(int spin, uint32_t* irqs, uint32_t* hlt_pct){
+	uint64_t start, idle_before;
+	uint32_t irq_before, total, idle;
+	int i;
+
+	sched_stop = 0;
+	sched_done = 0;
+	if (spin && kthread_create(sched_spin, (void*)&sched_counts[0]) == NULL)
+		spin = 0;
+	rtc_read(2, NULL, 0);		// line up with the rtc
+
+	irq_before = sched_stats.timer_irqs;
+	idle_before = sched_stats.idle_cycles;
+	start = rdtsc();
+	for (i = 0; i < TICK_TEST_READS; i++)
+		rtc_read(2, NULL, 0);
+	total = (uint32_t)(rdtsc() - start);
+	idle = (uint32_t)(sched_stats.idle_cycles - idle_before);
+	*irqs = (sched_stats.timer_irqs - irq_before) * 2;		// per second
+	*hlt_pct = idle / (total / 100);
+
+	sched_stop = 1;
+	wait_event(&sched_done_wq, sched_done == spin);
+}
+
+int tickless_test(){
+	TEST_HEADER;
+	pcb_t* saved_pcb = cur_pcb;
+	int saved_pid = cur_pid;
+	int saved_term = cur_term;
+	int saved_mode = sched_tickless;
+	pcb_t* self;
+	uint32_t irqs[2][2], hlt[2][2];
+	int result = PASS;
+	int mode;
+
+	self = proc_alloc(ANY_PID);
+	if (self == NULL)
+		return FAIL;
+	self->page_dir = page_directory;
+	sched_new(self);
+	self->affinity = 1;		// it borrows the boot processor's cur_pcb
+	cur_pcb = self;
+	cur_pid = self->pid;
+	cur_term = 0;
+	terminals_initialized[0] = 1;
+	terminals_initialized[1] = 1;
+	terminals_initialized[2] = 1;
+
+	if (test_rtc_rate(2, 16) != 0)
+		result = FAIL;
+	term_flag = 1;
+	for (mode = 0; mode < 2; mode++) {
+		sched_set_tickless(mode);
+		tick_run(1, &irqs[mode][1], &hlt[mode][1]);
+		tick_run(0, &irqs[mode][0], &hlt[mode][0]);
+	}
+	term_flag = 0;
+	sched_set_tickless(saved_mode);
+	rtc_close(2);
+
+	cur_pcb = saved_pcb;
+	cur_pid = saved_pid;
+	cur_term = saved_term;
+	proc_free(self->pid);
+
+	if (irqs[1][0] >= irqs[0][0] || irqs[1][1] >= irqs[0][1])
+		result = FAIL;
+
+	printf("periodic: 1 busy %d irq/s, idle %d irq/s %d%% hlt\n", irqs[0][1], irqs[0][0], hlt[0][0]);
+	printf("tickless: 1 busy %d irq/s, idle %d irq/s %d%% hlt\n", irqs[1][1], irqs[1][0], hlt[1][0]);
+	return result;
+}
+
+
+/* Timer Test
+ * 
+ * Checks the boot time calibration: the tsc rate measured against the
+ * pit, and with the local APIC timer, that one shot interrupts armed
+ * for 500us, 5ms and a tick come when they should. Without a local
+ * APIC it times a pit tick instead
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the tsc rate and each measured delay
+ * Side Effects: Arms this cpu's timer directly. with the scheduler off
+ *				 the tick it causes only arms the next one
+ * Coverage: pit_calibrate_tsc, lapic_timer_init, lapic_timer_arm
+ * Files: pit.h/c, apic.h/c
+ */
+#define TIMER_TEST_SHOTS	3
+#define TIMER_TEST_SLACK_US	100		// interrupt entry, the kernel lock
+static const uint32_t timer_test_us[TIMER_TEST_SHOTS] = {500, 5000, SCHED_TICK_US};
+
+static uint32_t timer_shot(uint32_t us){
+	uint32_t before;
+	uint64_t start, timeout;
+
+	cli();
+	before = sched_stats.timer_irqs;
+	start = rdtsc();
+	timeout = start + (uint64_t)2 * us * tsc_per_us;
+	if (lapic_timer_on)
+		lapic_timer_arm(us);
+	else
+		pit_arm();
+	sti();
+	while (sched_stats.timer_irqs == before && rdtsc() < timeout)
+		asm volatile ("pause");
+	return (uint32_t)(rdtsc() - start) / tsc_per_us;
+}
+
+int timer_test(){
+	TEST_HEADER;
+	uint32_t us, got;
+	int result = PASS;
+	int i;
+
+	printf("tsc %d MHz, scheduler clock: %s\n", tsc_per_us,
+		!lapic_timer_on ? "pit" : (lapic_tsc_deadline ? "TSC-deadline" : "local APIC one shot"));
+	if (tsc_per_us <= 1)
+		result = FAIL;
+
+	for (i = 0; i < TIMER_TEST_SHOTS; i++) {
+		us = timer_test_us[i];
+		if (!lapic_timer_on && us != SCHED_TICK_US)
+			continue;			// the pit only counts whole ticks
+		got = timer_shot(us);
+		if (got < us - us / 50 || got > us + us / 20 + TIMER_TEST_SLACK_US)
+			result = FAIL;
+		printf("armed %d us, interrupt after %d us\n", us, got);
+	}
+	return result;
+}
+
+
+/* Clock Test
+ * 
+ * Reads the nanosecond clock across a pit timed delay, checks it never
+ * goes backwards, and that a fake process sees the same clock on its
+ * read only clock page as through clock_gettime. Compares the cost of
+ * a read with reading the time out of the CMOS
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the measured delay and the cost of each read
+ * Side Effects: Borrows cur_pcb, ends back on page_directory
+ * Coverage: clock_init, clock_ns, clock_gettime, the clock page mapping
+ * Files: clock.h/c, paging.c, syscall.c
+ */
+#define CLOCK_TEST_DELAY_US		20000
+#define CLOCK_TEST_READS		1000
+int clock_test(){
+	TEST_HEADER;
+	static pcb_t fake;
+	pcb_t* saved_pcb = cur_pcb;
+	uint32_t page = frame_alloc(FOUR_MB_ORDER);
+	uint64_t* user_ns = (uint64_t*)USER;
+	volatile clock_page_t* cp = (volatile clock_page_t*)CLOCKPAGE;
+	uint64_t start, end, prev, now, cycles;
+	uint32_t us, clock_cycles, cmos_cycles;
+	int result = PASS;
+	int i;
+
+	start = clock_ns();
+	pit_delay_us(CLOCK_TEST_DELAY_US);
+	end = clock_ns();
+	us = (uint32_t)(end - start) / 1000;
+	if (us < CLOCK_TEST_DELAY_US - CLOCK_TEST_DELAY_US / 100 ||
+		us > CLOCK_TEST_DELAY_US + CLOCK_TEST_DELAY_US / 100)
+		result = FAIL;
+
+	prev = clock_ns();
+	start = rdtsc();
+	for (i = 0; i < CLOCK_TEST_READS; i++) {
+		now = clock_ns();
+		if (now < prev)
+			result = FAIL;
+		prev = now;
+	}
+	clock_cycles = (uint32_t)(rdtsc() - start) / CLOCK_TEST_READS;
+	start = rdtsc();
+	rtc_get_time();
+	cmos_cycles = (uint32_t)(rdtsc() - start);
+
+	/* the same clock from a process's point of view */
+	memset(&fake, 0, sizeof(fake));
+	fake.page_dir = pd_create(page, 0);
+	if (!page || fake.page_dir == NULL)
+		return FAIL;
+	pd_switch(fake.page_dir);
+	cur_pcb = &fake;
+
+	if (cp->version != CLOCK_VERSION || cp->shift != CLOCK_SHIFT || cp->tsc_khz != tsc_khz)
+		result = FAIL;
+	start = clock_ns();
+	cycles = rdtsc() - cp->tsc_base;
+	now = clock_cycles_to_ns(cycles);
+	if (clock_gettime(CLOCK_MONOTONIC, user_ns) != 0 || now < start || *user_ns < now)
+		result = FAIL;
+	if (clock_gettime(CLOCK_MONOTONIC + 1, user_ns) != -1 ||
+		clock_gettime(CLOCK_MONOTONIC, (uint64_t*)CLOCKPAGE) != -1)
+		result = FAIL;
+
+	cur_pcb = saved_pcb;
+	pd_switch(page_directory);
+	pd_destroy(fake.page_dir);
+	frame_free(page, FOUR_MB_ORDER);
+
+	printf("pit delay of %d us measured as %d us, tsc %d kHz\n", CLOCK_TEST_DELAY_US, us, tsc_khz);
+	printf("clock read %d cycles, CMOS read %d cycles\n", clock_cycles, cmos_cycles);
+	return result;
+}
+
+
+/* Timer Wheel Test
+ * 
+ * Adds one shot timers due across the first level and past it (so
+ * they cascade), checks each runs exactly on its tick, and that
+ * cancelled ones, short and hours out, never run. Counts a periodic
+ * timer's runs over a known number of ticks, times timer_sleep against
+ * the nanosecond clock and measures what an add + cancel costs
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the sleep accuracy and the add/cancel cost
+ * Side Effects: Sleeps about half a second on the rtc
+ * Coverage: timer_add, timer_add_periodic, timer_cancel, timer_tick, timer_sleep
+ * Files: timer.h/c
+ */
+#define WHEEL_TEST_TIMERS	8
+#define WHEEL_TEST_PERIOD	16
+#define WHEEL_TEST_SLEEP	100			// ticks
+#define WHEEL_TEST_OPS		1000
+static const uint32_t wheel_test_delay[WHEEL_TEST_TIMERS] = {1, 2, 100, 255, 256, 257, 300, 400};
+static volatile uint32_t wheel_fired_at[WHEEL_TEST_TIMERS];
+static volatile uint32_t wheel_periodic_runs;
+static volatile uint32_t wheel_cancelled_runs;
+
+static void wheel_fire(void* arg){
+	wheel_fired_at[(uint32_t)arg] = timer_ticks;
+}
+
+static void wheel_count(void* arg){
+	(*(volatile uint32_t*)arg)++;
+}
+
+int wheel_test(){
+	TEST_HEADER;
+	ktimer_t timers[WHEEL_TEST_TIMERS];
+	ktimer_t periodic, near, far;
+	uint32_t start, flags, us, cycles;
+	uint64_t ns;
+	int result = PASS;
+	int i;
+
+	wheel_periodic_runs = 0;
+	wheel_cancelled_runs = 0;
+	for (i = 0; i < WHEEL_TEST_TIMERS; i++) {
+		wheel_fired_at[i] = 0;
+		timer_setup(&timers[i], wheel_fire, (void*)i);
+	}
+	timer_setup(&periodic, wheel_count, (void*)&wheel_periodic_runs);
+	timer_setup(&near, wheel_count, (void*)&wheel_cancelled_runs);
+	timer_setup(&far, wheel_count, (void*)&wheel_cancelled_runs);
+
+	cli_and_save(flags);
+	start = timer_ticks;
+	for (i = 0; i < WHEEL_TEST_TIMERS; i++)
+		timer_add(&timers[i], wheel_test_delay[i]);
+	timer_add_periodic(&periodic, WHEEL_TEST_PERIOD);
+	timer_add(&near, 50);
+	timer_add(&far, 3600 * TIMER_HZ);
+	restore_flags(flags);
+
+	if (timer_cancel(&near) != 1 || timer_cancel(&near) != 0)
+		result = FAIL;
+	timer_sleep(wheel_test_delay[WHEEL_TEST_TIMERS - 1] + 1);
+	timer_cancel(&periodic);
+	if (timer_cancel(&far) != 1 || wheel_cancelled_runs != 0)
+		result = FAIL;
+	for (i = 0; i < WHEEL_TEST_TIMERS; i++) {
+		if (wheel_fired_at[i] != start + wheel_test_delay[i])
+			result = FAIL;
+	}
+	// one more if the wake up was slow
+	i = (wheel_test_delay[WHEEL_TEST_TIMERS - 1] + 1) / WHEEL_TEST_PERIOD;
+	if (wheel_periodic_runs < i || wheel_periodic_runs > i + 1)
+		result = FAIL;
+
+	ns = clock_ns();
+	timer_sleep(WHEEL_TEST_SLEEP);
+	us = (uint32_t)(clock_ns() - ns) / 1000;
+	// the first tick comes anywhere up to one tick after the call
+	if (us < (WHEEL_TEST_SLEEP - 1) * 1000000 / TIMER_HZ || us > (WHEEL_TEST_SLEEP + 2) * 1000000 / TIMER_HZ)
+		result = FAIL;
+
+	cycles = (uint32_t)rdtsc();
+	for (i = 0; i < WHEEL_TEST_OPS; i++) {
+		timer_add(&timers[i % WHEEL_TEST_TIMERS], 1 + (i * 65537) % TIMER_MAX_TICKS);
+		timer_cancel(&timers[i % WHEEL_TEST_TIMERS]);
+	}
+	cycles = ((uint32_t)rdtsc() - cycles) / WHEEL_TEST_OPS;
+
+	printf("sleep of %d ticks took %d us, periodic ran %d times\n", WHEEL_TEST_SLEEP, us, wheel_periodic_runs);
+	printf("add + cancel: %d cycles\n", cycles);
+	return result;
+}
+
+
+/* Virtual RTC Test
+ * 
+ * Opens several rtc fds in one process at independent rates and checks
+ * each one's virtual interrupts come at its own rate: a 64Hz fd every
+ * 4 ticks, a 3Hz fd (not a whole number of ticks) at exactly 3 per
+ * virtual second, with the other fds still running underneath. Bad
+ * rates and sizes are refused, and a dup'd fd keeps the rtc alive
+ * after the original is closed
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the ticks each run of reads took
+ * Side Effects: Borrows cur_pcb, sleeps about a third of a second
+ * Coverage: rtc_read, rtc_write, rtc_close, rtc_dup, the deadline heap
+ * Files: rtc.h/c, syscall.c
+ */
+#define RTC_TEST_FDS		4
+#define RTC_TEST_FAST		64
+#define RTC_TEST_FAST_READS	16
+#define RTC_TEST_ODD		3
+int rtc_virt_test(){
+	TEST_HEADER;
+	static pcb_t fake;
+	pcb_t* saved_pcb = cur_pcb;
+	uint32_t frames = buddy_free_frames();
+	uint32_t page = frame_alloc(FOUR_MB_ORDER);
+	int8_t* name = (int8_t*)USER;
+	int32_t* rate = (int32_t*)(USER + 16);
+	int32_t fds[RTC_TEST_FDS];
+	rtc_file_t* fast;
+	uint32_t start, fast_ticks, odd_ticks, fired;
+	int result = PASS;
+	int i, copy;
+
+	memset(&fake, 0, sizeof(fake));
+	fake.page_dir = pd_create(page, 0);
+	if (!page || fake.page_dir == NULL)
+		return FAIL;
+	pd_switch(fake.page_dir);
+	cur_pcb = &fake;
+	fake.fdt[0].flag = 1;
+	fake.fdt[1].flag = 1;
+	strcpy(name, "rtc");
+
+	for (i = 0; i < RTC_TEST_FDS; i++) {
+		fds[i] = open((uint8_t*)name);
+		*rate = 2 << i;
+		if (fds[i] < 0 || write(fds[i], rate, sizeof(int32_t)) != 0)
+			result = FAIL;
+	}
+	*rate = 1;
+	if (write(fds[0], rate, sizeof(int32_t)) != -1)
+		result = FAIL;
+	*rate = 4;
+	if (write(fds[0], rate, 1) != -1 || write(fds[0], (int32_t*)KERNEL, sizeof(int32_t)) != -1)
+		result = FAIL;
+
+	*rate = RTC_TEST_FAST;
+	write(fds[1], rate, sizeof(int32_t));
+	start = timer_ticks;
+	for (i = 0; i < RTC_TEST_FAST_READS; i++)
+		read(fds[1], NULL, 0);
+	fast_ticks = timer_ticks - start;
+	if (fast_ticks < RTC_TEST_FAST_READS * (VIRT_SECOND / RTC_TEST_FAST) - 1 ||
+		fast_ticks > RTC_TEST_FAST_READS * (VIRT_SECOND / RTC_TEST_FAST) + 1)
+		result = FAIL;
+
+	/* a third of a virtual second isn't a whole number of ticks, three of them are */
+	fast = fake.fdt[fds[1]].data;
+	fired = fast->fired;
+	*rate = RTC_TEST_ODD;
+	write(fds[2], rate, sizeof(int32_t));
+	start = timer_ticks;
+	for (i = 0; i < RTC_TEST_ODD; i++)
+		read(fds[2], NULL, 0);
+	odd_ticks = timer_ticks - start;
+	if (odd_ticks < VIRT_SECOND - 1 || odd_ticks > VIRT_SECOND + 1)
+		result = FAIL;
+	/* the fast one kept going with nobody reading it */
+	fired = fast->fired - fired;
+	if (fired < odd_ticks / (VIRT_SECOND / RTC_TEST_FAST) - 1 ||
+		fired > odd_ticks / (VIRT_SECOND / RTC_TEST_FAST) + 1)
+		result = FAIL;
+
+	copy = dup(fds[1]);
+	close(fds[1]);
+	if (copy < 0 || read(copy, NULL, 0) != 0)
+		result = FAIL;
+	close(copy);
+	for (i = 0; i < RTC_TEST_FDS; i++) {
+		if (i != 1)
+			close(fds[i]);
+	}
+
+	cur_pcb = saved_pcb;
+	pd_switch(page_directory);
+	pd_destroy(fake.page_dir);
+	frame_free(page, FOUR_MB_ORDER);
+	/* the rtc cache may keep its empty slab */
+	if (frames - buddy_free_frames() > SLAB_KEEP_EMPTY)
+		result = FAIL;
+
+	printf("%d reads at %dHz took %d ticks, %d at %dHz took %d\n", RTC_TEST_FAST_READS, RTC_TEST_FAST,
+		fast_ticks, RTC_TEST_ODD, RTC_TEST_ODD, odd_ticks);
+	return result;
+}
+
+
+/* Deferred Work Test
+ * 
+ * A timer callback (in the rtc interrupt) queues a work item that
+ * spins for a few milliseconds. Checks that the work runs with
+ * interrupts on and this cpu marked as in deferred work, that rtc
+ * interrupts keep being taken while it spins, that queueing an item
+ * that's already waiting does nothing, and that the work's time isn't
+ * counted in rtc_handler's
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the rtc handler's average and longest run
+ *          against the work's
+ * Side Effects: Spins for SOFTIRQ_TEST_US with interrupts on
+ * Coverage: work_queue, softirq_run, the linkage hook
+ * Files: softirq.h/c, handler_link.S, rtc.c
+ */
+#define SOFTIRQ_TEST_US		5000
+#define SOFTIRQ_TEST_EFLAGS_IF	0x200
+static work_t softirq_work;
+static volatile int32_t softirq_ran;
+static volatile uint32_t softirq_eflags;
+static volatile int32_t softirq_flagged;
+static volatile uint32_t softirq_ticks;
+
+static void softirq_spin(void* arg){
+	uint32_t start = timer_ticks;
+	uint64_t end = rdtsc() + (uint64_t)SOFTIRQ_TEST_US * tsc_per_us;
+	uint32_t flags;
+
+	cli_and_save(flags);
+	restore_flags(flags);
+	softirq_eflags = flags;
+	softirq_flagged = this_cpu()->in_softirq;
+	while (rdtsc() < end);
+	softirq_ticks = timer_ticks - start;
+	softirq_ran++;
+}
+
+static void softirq_queue_twice(void* arg){
+	if (work_queue(&softirq_work) != 1 || work_queue(&softirq_work) != 0)
+		softirq_ran = -1;
+}
+
+int softirq_test(){
+	TEST_HEADER;
+	ktimer_t timer;
+	uint32_t works = softirq_stats.works;
+	uint32_t avg;
+	int result = PASS;
+
+	softirq_ran = 0;
+	softirq_ticks = 0;
+	work_setup(&softirq_work, softirq_spin, NULL);
+	timer_setup(&timer, softirq_queue_twice, NULL);
+	memset(&rtc_stats, 0, sizeof(rtc_stats));
+	softirq_stats.max = 0;
+
+	timer_add(&timer, 1);
+	timer_sleep(2 + SOFTIRQ_TEST_US * TIMER_HZ / 1000000 + 2);
+
+	if (softirq_ran != 1 || softirq_stats.works - works != 1)
+		result = FAIL;
+	if (!(softirq_eflags & SOFTIRQ_TEST_EFLAGS_IF) || !softirq_flagged || this_cpu()->in_softirq)
+		result = FAIL;
+	/* the rtc kept interrupting the work */
+	if (softirq_ticks < SOFTIRQ_TEST_US * TIMER_HZ / 1000000 - 1)
+		result = FAIL;
+	if (rtc_stats.irqs == 0 || rtc_stats.max >= softirq_stats.max)
+		result = FAIL;
+
+	avg = (rtc_stats.irqs != 0) ? (uint32_t)rtc_stats.cycles / rtc_stats.irqs : 0;
+	printf("rtc handler avg %d max %d cycles over %d irqs, deferred work %d cycles\n", avg,
+		rtc_stats.max, rtc_stats.irqs, softirq_stats.max);
+	return result;
+}
+
+
+/* Interrupt Stats Test
+ * 
+ * Times what the entry, lock and exit stamps cost, zeroes the stats,
+ * sleeps on the rtc and reads them back through the irqstat system
+ * call. The rtc's vector must have fired about once a tick, with min <=
+ * avg <= max and every timed run in one histogram bucket, and its
+ * linkage must have recorded a kernel lock wait for every timed
+ * run, kept out of those times. Also a short buffer, a negative count
+ * and a kernel pointer
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the rtc's numbers and the stamping cost
+ * Side Effects: Borrows cur_pcb, zeroes the interrupt stats
+ * Coverage: irq_enter_stamp, irq_lock_stamp, irq_exit_stamp, irqstat_get, irqstat
+ * Files: irqstat.h/c, handler_link.S, syscall.c
+ */
+#define IRQSTAT_TEST_TICKS	64
+#define IRQSTAT_TEST_STAMPS	1000
+#define IRQSTAT_TEST_RTC	0x28
+int irqstat_test(){
+	TEST_HEADER;
+	static pcb_t fake;
+	pcb_t* saved_pcb = cur_pcb;
+	uint32_t page = frame_alloc(FOUR_MB_ORDER);
+	irqstat_entry_t* buf = (irqstat_entry_t*)USER;
+	irqstat_entry_t* rtc = NULL;
+	uint32_t flags, cycles, sum;
+	int result = PASS;
+	int i, n, b;
+
+	cli_and_save(flags);
+	cycles = (uint32_t)rdtsc();
+	for (i = 0; i < IRQSTAT_TEST_STAMPS; i++) {
+		irq_enter_stamp(IRQSTAT_OTHER, NULL);
+		irq_lock_stamp();
+		irq_exit_stamp();
+	}
+	cycles = ((uint32_t)rdtsc() - cycles) / IRQSTAT_TEST_STAMPS;
+	restore_flags(flags);
+
+	memset(&fake, 0, sizeof(fake));
+	fake.page_dir = pd_create(page, 0);
+	if (!page || fake.page_dir == NULL)
+		return FAIL;
+	pd_switch(fake.page_dir);
+	cur_pcb = &fake;
+
+	if (irqstat(buf, 0) != 0)
+		result = FAIL;
+	timer_sleep(IRQSTAT_TEST_TICKS);
+	n = irqstat(buf, IRQSTAT_VECTORS);
+	for (i = 0; i < n; i++) {
+		if (buf[i].vector == IRQSTAT_TEST_RTC)
+			rtc = &buf[i];
+	}
+	if (rtc == NULL || rtc->count < IRQSTAT_TEST_TICKS - 1 || rtc->count > IRQSTAT_TEST_TICKS + 2 ||
+		rtc->timed > rtc->count || rtc->min > rtc->avg || rtc->avg > rtc->max) {
+		result = FAIL;
+	} else {
+		for (sum = 0, b = 0; b < IRQSTAT_BUCKETS; b++)
+			sum += rtc->hist[b];
+		if (sum != rtc->timed || rtc->hist[find_last_set(rtc->max)] == 0)
+			result = FAIL;
+		/* a run can only be timed if its wait was counted first */
+		if (rtc->waits > rtc->count || rtc->waits < rtc->timed || rtc->wait_avg > rtc->wait_max)
+			result = FAIL;
+	}
+	if (irqstat(buf, 1) != 1 || irqstat(buf, -1) != -1 || irqstat((irqstat_entry_t*)KERNEL, 1) != -1)
+		result = FAIL;
+
+	if (rtc != NULL)
+		printf("rtc: %d irqs, min %d avg %d max %d cycles, lock wait avg %d max %d\n", rtc->count,
+			rtc->min, rtc->avg, rtc->max, rtc->wait_avg, rtc->wait_max);
+	printf("enter + lock + exit stamp: %d cycles\n", cycles);
+
+	cur_pcb = saved_pcb;
+	pd_switch(page_directory);
+	pd_destroy(fake.page_dir);
+	frame_free(page, FOUR_MB_ORDER);
+	return result;
+}
+
+
+/* Profiler Test
+ * 
+ * Profiles a sleep on the rtc and reads the samples back through the
+ * prof_dump system call. Sleeping cpus halt in the kernel, so every
+ * sample must be a kernel eip with its callers in the kernel too, and
+ * some must have callers. With the local APIC timer the pit ticks at
+ * PROF_HZ for the profiler alone, so the boot processor must have
+ * about one sample per millisecond. Also starting twice and a
+ * negative count
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the samples per cpu
+ * Side Effects: Borrows cur_pcb, uses the pit for the sleep
+ * Coverage: prof_enable, prof_disable, prof_tick, prof_ipi, prof_read, prof_dump, pit_periodic
+ * Files: prof.h/c, pit.c, handler_link.S, syscall.c
+ */
+#define PROF_TEST_TICKS		256
+#define PROF_TEST_EXPECT	(PROF_TEST_TICKS * PROF_HZ / TIMER_HZ)
+int prof_test(){
+	TEST_HEADER;
+	static pcb_t fake;
+	pcb_t* saved_pcb = cur_pcb;
+	uint32_t page = frame_alloc(FOUR_MB_ORDER);
+	prof_sample_t* buf = (prof_sample_t*)USER;
+	int32_t per_cpu[SMP_MAX_CPUS] = {0};
+	int result = PASS;
+	int i, n, waiting, chained = 0;
+	uint32_t d;
+
+	memset(&fake, 0, sizeof(fake));
+	fake.page_dir = pd_create(page, 0);
+	if (!page || fake.page_dir == NULL)
+		return FAIL;
+	pd_switch(fake.page_dir);
+	cur_pcb = &fake;
+
+	if (prof_start() != 0 || prof_start() != -1)
+		result = FAIL;
+	timer_sleep(PROF_TEST_TICKS);
+	waiting = prof_stop();
+
+	n = prof_dump(buf, ncpus * PROF_SAMPLES);
+	if (n != waiting || prof_dump(buf, 1) != 0 || prof_dump(buf, -1) != -1)
+		result = FAIL;
+	for (i = 0; i < n; i++) {
+		if (buf[i].user || buf[i].cpu >= ncpus || buf[i].depth > PROF_DEPTH ||
+			buf[i].eip < KERNEL || buf[i].eip >= KHEAP) {
+			result = FAIL;
+			break;
+		}
+		for (d = 0; d < buf[i].depth; d++) {
+			if (buf[i].stack[d] < KERNEL || buf[i].stack[d] >= KHEAP)
+				result = FAIL;
+		}
+		chained += buf[i].depth != 0;
+		per_cpu[buf[i].cpu]++;
+	}
+	if (n > 0 && chained == 0)
+		result = FAIL;
+	if (lapic_timer_on && (per_cpu[0] < PROF_TEST_EXPECT * 3 / 4 || per_cpu[0] > PROF_TEST_EXPECT * 5 / 4))
+		result = FAIL;
+
+	for (i = 0; i < ncpus; i++)
+		printf("cpu %d: %d samples ", i, per_cpu[i]);
+	printf("(%d with callers, %d lost)\n", chained, prof_lost());
+
+	cur_pcb = saved_pcb;
+	pd_switch(page_directory);
+	pd_destroy(fake.page_dir);
+	frame_free(page, FOUR_MB_ORDER);
+	return result;
+}
+
+
+/* SMP Test
+ * 
+ * Checks that every cpu smp_init counted is online with its own APIC
+ * id, that the kernel lock nests, and that a TLB shootdown reaches
+ * every AP (each one clears its flag in the IPI handler). With 4 cpus
+ * the three terminals must land on three different APs
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints the cpus and the shootdown round trip
+ * Side Effects: Flushes every AP's TLB
+ * Coverage: smp_init, kernel_enter/kernel_exit, smp_tlb_shootdown, smp_term_cpu
+ * Files: smp.h/c, apic.h/c, ap_boot.S
+ */
+#define SMP_TEST_TIMEOUT	100000000	// cycles to wait for the APs' flushes
+int smp_test(){
+	TEST_HEADER;
+
+	int result = PASS;
+	int32_t depth = this_cpu()->bkl_depth;
+	uint64_t start;
+	uint32_t cycles;
+	int i, stale;
+
+	if (this_cpu() != &cpus[0])
+		result = FAIL;
+	for (i = 0; i < ncpus; i++){
+		printf("cpu %d: apic id %d%s\n", i, cpus[i].apic_id, cpus[i].online ? "" : " OFFLINE");
+		if (!cpus[i].online || (i > 0 && cpus[i].apic_id == cpus[0].apic_id))
+			result = FAIL;
+	}
+
+	kernel_enter();
+	kernel_enter();
+	if (this_cpu()->bkl_depth != depth + 2)
+		result = FAIL;
+	kernel_exit();
+	kernel_exit();
+	if (this_cpu()->bkl_depth != depth)
+		result = FAIL;
+
+	if (ncpus >= 4 && (smp_term_cpu(0) == smp_term_cpu(1) || smp_term_cpu(1) == smp_term_cpu(2) ||
+		smp_term_cpu(0) == smp_term_cpu(2) || smp_term_cpu(0) == 0))
+		result = FAIL;
+
+	if (ncpus > 1){
+		start = rdtsc();
+		smp_tlb_shootdown();
+		do {
+			stale = 0;
+			for (i = 1; i < ncpus; i++)
+				stale |= cpus[i].tlb_stale;
+		} while (stale && rdtsc() - start < SMP_TEST_TIMEOUT);
+		cycles = (uint32_t)(rdtsc() - start);
+		if (stale)
+			result = FAIL;
+		printf("%d cpus, shootdown acked by all APs in %d cycles\n", ncpus, cycles);
+	}
+	return result;
+}
+
+
+/* Work Stealing Test
+ * 
+ * Throughput of STEAL_TEST_THREADS cpu bound threads with 1 up to
+ * ncpus cpus allowed to run them. They're all created on the boot
+ * processor, so anything past the first cpu only gets work by stealing
+ * it. The threads let go of the kernel lock while they count, the way
+ * a user program runs, otherwise they would only ever take turns.
+ * Each counter has a cache line to itself. Checks every thread made
+ * progress, and with more than one cpu that the threads were stolen
+ * and the throughput went up
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints iterations per round and the speedup
+ * Side Effects: Turns the scheduler on with the shells marked launched,
+ *				 borrows cur_pcb, runs a 8Hz virtual rtc on fd 2
+ * Coverage: sched_steal, sched_kick_idle, affinity
+ * Files: scheduler.h/c, smp.c
+ */
+#define STEAL_TEST_THREADS	8
+#define STEAL_TEST_READS	4			// at 8Hz, half a second per round
+typedef struct {
+	volatile uint32_t count;
+	uint8_t pad[60];
+} __attribute__((aligned(64))) steal_count_t;
+static steal_count_t steal_counts[STEAL_TEST_THREADS];
+
+static void steal_spin(void* arg){
+	volatile uint32_t* count = arg;
+	int32_t depth = kernel_release();
+	while (!sched_stop)
+		(*count)++;
+	kernel_reacquire(depth);
+	cli();
+	sched_done++;
+	wake_up(&sched_done_wq);
+	sti();
+}
+
+int steal_test(){
+	TEST_HEADER;
+	pcb_t* saved_pcb = cur_pcb;
+	int saved_pid = cur_pid;
+	int saved_term = cur_term;
+	pcb_t* self;
+	pcb_t* pcb;
+	uint32_t sum[SMP_MAX_CPUS];
+	uint32_t steals, min;
+	int result = PASS;
+	int n, i;
+
+	self = proc_alloc(ANY_PID);
+	if (self == NULL)
+		return FAIL;
+	self->page_dir = page_directory;
+	sched_new(self);
+	self->affinity = 1;		// it borrows the boot processor's cur_pcb
+	cur_pcb = self;
+	cur_pid = self->pid;
+	cur_term = 0;
+	terminals_initialized[0] = 1;
+	terminals_initialized[1] = 1;
+	terminals_initialized[2] = 1;
+
+	if (test_rtc_rate(2, 8) != 0)
+		result = FAIL;
+	steals = sched_stats.steals;
+	term_flag = 1;
+	for (n = 1; n <= ncpus; n++) {
+		sched_stop = 0;
+		sched_done = 0;
+		for (i = 0; i < STEAL_TEST_THREADS; i++) {
+			steal_counts[i].count = 0;
+			cli();
+			if ((pcb = kthread_create(steal_spin, (void*)&steal_counts[i].count)) == NULL)
+				result = FAIL;
+			else
+				pcb->affinity = (1 << n) - 1;
+			sti();
+		}
+		rtc_read(2, NULL, 0);		// line up with the rtc
+		for (i = 0; i < STEAL_TEST_THREADS; i++)
+			steal_counts[i].count = 0;
+		for (i = 0; i < STEAL_TEST_READS; i++)
+			rtc_read(2, NULL, 0);
+		sum[n - 1] = 0;
+		min = steal_counts[0].count;
+		for (i = 0; i < STEAL_TEST_THREADS; i++) {
+			sum[n - 1] += steal_counts[i].count >> 10;
+			if (steal_counts[i].count < min)
+				min = steal_counts[i].count;
+		}
+		sched_stop = 1;
+		wait_event(&sched_done_wq, sched_done == STEAL_TEST_THREADS);
+		if (min == 0)
+			result = FAIL;
+		printf("%d cpus: %dK iterations, %d%% of one cpu\n", n, sum[n - 1],
+			sum[n - 1] * 100 / (sum[0] + 1));
+	}
+	term_flag = 0;
+	steals = sched_stats.steals - steals;
+	rtc_close(2);
+
+	cur_pcb = saved_pcb;
+	cur_pid = saved_pid;
+	cur_term = saved_term;
+	proc_free(self->pid);
+
+	if (ncpus > 1 && (steals == 0 || sum[ncpus - 1] <= sum[0]))
+		result = FAIL;
+	printf("%d steals\n", steals);
+	return result;
+}
+
+
+/* Spinlock Test
+ * 
+ * SPIN_TEST_THREADS threads, free to run on every cpu, each add
+ * SPIN_TEST_ITERS to one counter with a read, a delay and a write
+ * back, under a lock. Any overlap between two holders loses an add.
+ * Also checks trylock on a held lock fails and the irqsave variant
+ * holds the lock with interrupts off and gives the interrupt flag back
+ * as it was. The threads wait for the lock (and the kernel lock, in
+ * kernel_reacquire) with interrupts on. Prints the test lock's
+ * statistics and the kernel's own locks
+ * Inputs: None
+ * Outputs: PASS/FAIL, prints lock statistics
+ * Side Effects: Turns the scheduler on with the shells marked launched,
+ *				 borrows cur_pcb
+ * Coverage: spin_lock/unlock/trylock, spin_lock_irqsave, spin_lock_irqwait, kernel_reacquire,
+ *			 statistics
+ * Files: spinlock.h/c
+ */
+#define SPIN_TEST_THREADS	4
+#define SPIN_TEST_ITERS		20000
+static spinlock_t spin_test_lock = SPINLOCK_INIT("test");
+static volatile uint32_t spin_test_count;
+
+static void spin_adder(void* arg){
+	int32_t depth = kernel_release();
+	uint32_t v, flags;
+	int i, j;
+	for (i = 0; i < SPIN_TEST_ITERS; i++) {
+		spin_lock_irqsave(&spin_test_lock, flags);
+		v = spin_test_count;
+		for (j = 0; j < 10; j++)
+			asm volatile ("pause");
+		spin_test_count = v + 1;
+		spin_unlock_irqrestore(&spin_test_lock, flags);
+	}
+	kernel_reacquire(depth);
+	cli();
+	sched_done++;
+	wake_up(&sched_done_wq);
+	sti();
+}
+
+int spinlock_test(){
+	TEST_HEADER;
+	pcb_t* saved_pcb = cur_pcb;
+	int saved_pid = cur_pid;
+	int saved_term = cur_term;
+	pcb_t* self;
+	pcb_t* pcb;
+	uint32_t flags, held, after;
+	int result = PASS;
+	int i;
+
+	// single cpu behaviour first
+	spin_lock(&spin_test_lock);
+	if (spin_trylock(&spin_test_lock) || spin_test_lock.owner != cpu_id())
+		result = FAIL;
+	spin_unlock(&spin_test_lock);
+	if (!spin_trylock(&spin_test_lock))
+		result = FAIL;
+	spin_unlock(&spin_test_lock);
+	sti();
+	spin_lock_irqsave(&spin_test_lock, flags);
+	asm volatile ("pushfl; popl %0" : "=r"(held));
+	spin_unlock_irqrestore(&spin_test_lock, flags);
+	asm volatile ("pushfl; popl %0" : "=r"(after));
+	if ((held & 0x200) || !(after & 0x200))
+		result = FAIL;
+
+	self = proc_alloc(ANY_PID);
+	if (self == NULL)
+		return FAIL;
+	self->page_dir = page_directory;
+	sched_new(self);
+	self->affinity = 1;		// it borrows the boot processor's cur_pcb
+	cur_pcb = self;
+	cur_pid = self->pid;
+	cur_term = 0;
+	terminals_initialized[0] = 1;
+	terminals_initialized[1] = 1;
+	terminals_initialized[2] = 1;
+
+	spin_stats_reset(&spin_test_lock);
+	spin_stats_reset(&kernel_lock);
+	spin_stats_reset(&sched_lock);
+	spin_stats_reset(&proc_lock);
+	spin_test_count = 0;
+	sched_done = 0;
+	term_flag = 1;
+	for (i = 0; i < SPIN_TEST_THREADS; i++) {
+		cli();
+		if ((pcb = kthread_create(spin_adder, NULL)) == NULL)
+			result = FAIL;
+		else
+			pcb->affinity = SCHED_ALL_CPUS;
+		sti();
+	}
+	wait_event(&sched_done_wq, sched_done == SPIN_TEST_THREADS);
+	term_flag = 0;
+
+	cur_pcb = saved_pcb;
+	cur_pid = saved_pid;
+	cur_term = saved_term;
+	proc_free(self->pid);
+
+	if (spin_test_count != SPIN_TEST_THREADS * SPIN_TEST_ITERS ||
+		spin_test_lock.acquisitions != SPIN_TEST_THREADS * SPIN_TEST_ITERS)
+		result = FAIL;
+
+	printf("%d adds on %d cpus, counted %d\n", SPIN_TEST_THREADS * SPIN_TEST_ITERS, ncpus,
+		spin_test_count);
+	spin_stats_print(&spin_test_lock);
+	spin_stats_print(&kernel_lock);
+	spin_stats_print(&sched_lock);
+	spin_stats_print(&proc_lock);
+	spin_stats_print(&term_lock);
+	spin_stats_print(&gfx_lock);
+	return result;
+}
+
 
 /* Test suite entry point */
 void launch_tests(){
@@ -451,5 +2633,35 @@ void launch_tests(){
 	// TEST_OUTPUT("fs_exec_open_test", fs_exec_open_test());
 	// TEST_OUTPUT("fs_file_open_test", fs_file_open_test());
 
+	/* Memory management */
+	TEST_OUTPUT("buddy_test", buddy_test());
+	TEST_OUTPUT("slab_test", slab_test());
+	TEST_OUTPUT("slab_latency_test", slab_latency_test());
+	TEST_OUTPUT("slab_frag_test", slab_frag_test());
+	TEST_OUTPUT("heap_test", heap_test());
+	TEST_OUTPUT("tlb_bench_test", tlb_bench_test());
+	TEST_OUTPUT("pingpong_test", pingpong_test());
+
+	/* Processes */
+	TEST_OUTPUT("proc_test", proc_test());
+	TEST_OUTPUT("uaccess_test", uaccess_test());
+	TEST_OUTPUT("shm_test", shm_test());
+	TEST_OUTPUT("pipe_test", pipe_test());
+	TEST_OUTPUT("dup_test", dup_test());
+	TEST_OUTPUT("waitq_test", waitq_test());
+	TEST_OUTPUT("idle_test", idle_test());
+	TEST_OUTPUT("sched_test", sched_test());
+	TEST_OUTPUT("prio_test", prio_test());
+	TEST_OUTPUT("tickless_test", tickless_test());
+	TEST_OUTPUT("timer_test", timer_test());
+	TEST_OUTPUT("clock_test", clock_test());
+	TEST_OUTPUT("wheel_test", wheel_test());
+	TEST_OUTPUT("rtc_virt_test", rtc_virt_test());
+	TEST_OUTPUT("softirq_test", softirq_test());
+	TEST_OUTPUT("irqstat_test", irqstat_test());
+	TEST_OUTPUT("prof_test", prof_test());
+	TEST_OUTPUT("smp_test", smp_test());
+	TEST_OUTPUT("steal_test", steal_test());
+	TEST_OUTPUT("spinlock_test", spinlock_test());
 
 }
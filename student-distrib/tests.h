@@ -3,6 +3,9 @@
 
 /************************* TESTING MACROS ********************************/
 #define RUN_TESTS       1 // enable/disable the testing suite 
+#ifndef LAUNCH_TESTS
+#define LAUNCH_TESTS    0 // run launch_tests() at boot before the GUI, or build with CPPFLAGS+=-DLAUNCH_TESTS=1
+#endif
 
 #if RUN_TESTS
 #define RTC_WRITE_TEST  0 // sweep the rtc with different frequencies, and display output to the screen
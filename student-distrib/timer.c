@@ -0,0 +1,328 @@
+/** timer.c
+ *  Kernel timers on a hierarchical timer wheel
+*/
+
+#include "timer.h"
+#include "lib.h"
+#include "waitq.h"
+
+
+/* a process in timer_sleep, on its own stack */
+typedef struct {
+    ktimer_t     timer;
+    wait_queue_t wq;
+    volatile int done;
+} timer_sleeper_t;
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+volatile uint32_t timer_ticks;
+spinlock_t        timer_lock = SPINLOCK_INIT("timer");      // the wheel
+
+static ktimer_t*  tv_root[TVR_SIZE];                        // one bucket per tick
+static ktimer_t*  tvn[TVN_LEVELS][TVN_SIZE];
+static uint32_t   wheel_time;                               // next tick the wheel has to run
+static ktimer_t*  work_list;                                // the bucket being run
+/*************************************************************************/
+
+
+/** timer_init
+ * DESCRIPTION: empty the wheel, at tick 0
+ * INPUTS: none
+ * OUTPUTS: none
+*/
+void timer_init(void)
+{
+    memset(tv_root, 0, sizeof(tv_root));
+    memset(tvn, 0, sizeof(tvn));
+    timer_ticks = 0;
+    wheel_time  = 1;
+    work_list   = NULL;
+}
+
+
+/** timer_setup
+ * DESCRIPTION: set a timer's callback
+ * INPUTS: t - the timer, not pending
+ *         fn - what to call when it's due
+ *         arg - passed to fn
+ * OUTPUTS: none
+*/
+void timer_setup(ktimer_t* t, void (*fn)(void*), void* arg)
+{
+    t->next   = NULL;
+    t->pprev  = NULL;
+    t->period = 0;
+    t->fn     = fn;
+    t->arg    = arg;
+}
+
+
+/** bucket_add
+ * DESCRIPTION: link a timer into a bucket
+ * INPUTS: head - the bucket
+ *         t - a timer that isn't pending
+ * OUTPUTS: none
+*/
+static void bucket_add(ktimer_t** head, ktimer_t* t)
+{
+    t->next = *head;
+    if (t->next != NULL)
+    {
+        t->next->pprev = &t->next;
+    }
+    *head = t;
+    t->pprev = head;
+}
+
+
+/** bucket_del
+ * DESCRIPTION: unlink a timer from whichever bucket it's in
+ * INPUTS: t - a pending timer
+ * OUTPUTS: none
+*/
+static void bucket_del(ktimer_t* t)
+{
+    *t->pprev = t->next;
+    if (t->next != NULL)
+    {
+        t->next->pprev = t->pprev;
+    }
+    t->next  = NULL;
+    t->pprev = NULL;
+}
+
+
+/** wheel_add
+ * DESCRIPTION: put a timer in the bucket for its expiry: the first level if it's due within
+ *              TVR_SIZE ticks, otherwise the lowest level that reaches that far
+ * INPUTS: t - a timer that isn't pending, with expires set
+ * OUTPUTS: none
+ * SIDE EFFECTS: caller must hold timer_lock
+*/
+static void wheel_add(ktimer_t* t)
+{
+    uint32_t delta = t->expires - wheel_time;
+    uint32_t shift = TVR_BITS;
+    int32_t  level;
+
+    if ((int32_t)delta < 0)
+    {
+        // already due, run it on the next tick
+        bucket_add(&tv_root[wheel_time & TVR_MASK], t);
+        return;
+    }
+    if (delta < TVR_SIZE)
+    {
+        bucket_add(&tv_root[t->expires & TVR_MASK], t);
+        return;
+    }
+    if (delta > TIMER_MAX_TICKS)
+    {
+        t->expires = wheel_time + TIMER_MAX_TICKS;
+    }
+    for (level = 0; level < TVN_LEVELS - 1; level++)
+    {
+        if (delta < (1U << (shift + TVN_BITS)))
+        {
+            break;
+        }
+        shift += TVN_BITS;
+    }
+    bucket_add(&tvn[level][(t->expires >> shift) & TVN_MASK], t);
+}
+
+
+/** cascade
+ * DESCRIPTION: re-spread one bucket of a level over the levels below it, now that they've
+ *              come round to its range
+ * INPUTS: level - index into tvn
+ *         idx - the bucket
+ * OUTPUTS: the bucket index, so the caller knows if this level wrapped too
+ * SIDE EFFECTS: caller must hold timer_lock
+*/
+static uint32_t cascade(int32_t level, uint32_t idx)
+{
+    ktimer_t* t;
+    ktimer_t* list = tvn[level][idx];
+
+    tvn[level][idx] = NULL;
+    while (list != NULL)
+    {
+        t = list;
+        list = t->next;
+        t->next  = NULL;
+        t->pprev = NULL;
+        wheel_add(t);
+    }
+    return idx;
+}
+
+
+/** timer_add
+ * DESCRIPTION: have a timer run once, ticks from now. re-adding a pending timer moves it
+ * INPUTS: t - the timer
+ *         ticks - how far ahead, at least 1
+ * OUTPUTS: none
+ * SIDE EFFECTS: safe from interrupt handlers, timer callbacks included
+*/
+void timer_add(ktimer_t* t, uint32_t ticks)
+{
+    uint32_t flags;
+
+    spin_lock_irqsave(&timer_lock, flags);
+    if (t->pprev != NULL)
+    {
+        bucket_del(t);
+    }
+    t->period  = 0;
+    t->expires = timer_ticks + ((ticks == 0) ? 1 : ticks);
+    wheel_add(t);
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+
+/** timer_add_periodic
+ * DESCRIPTION: have a timer run every period ticks, the first time period from now
+ * INPUTS: t - the timer
+ *         period - ticks between runs, at least 1
+ * OUTPUTS: none
+*/
+void timer_add_periodic(ktimer_t* t, uint32_t period)
+{
+    uint32_t flags;
+
+    if (period == 0)
+    {
+        period = 1;
+    }
+    spin_lock_irqsave(&timer_lock, flags);
+    if (t->pprev != NULL)
+    {
+        bucket_del(t);
+    }
+    t->period  = period;
+    t->expires = timer_ticks + period;
+    wheel_add(t);
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+
+/** timer_cancel
+ * DESCRIPTION: take a timer off the wheel, a periodic one stops for good
+ * INPUTS: t - the timer
+ * OUTPUTS: 1 if it was pending, 0 if not
+ * SIDE EFFECTS: doesn't wait for its callback if that's running right now
+*/
+int32_t timer_cancel(ktimer_t* t)
+{
+    uint32_t flags;
+    int32_t  pending;
+
+    spin_lock_irqsave(&timer_lock, flags);
+    pending = (t->pprev != NULL);
+    if (pending)
+    {
+        bucket_del(t);
+    }
+    t->period = 0;
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return pending;
+}
+
+
+/** timer_tick
+ * DESCRIPTION: one rtc tick: cascade any levels that came round, then run the bucket for
+ *              this tick
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: calls the timers' callbacks, without timer_lock
+*/
+void timer_tick(void)
+{
+    ktimer_t* t;
+    uint32_t  flags;
+    uint32_t  idx;
+    int32_t   level;
+
+    spin_lock_irqsave(&timer_lock, flags);
+    timer_ticks++;
+    while ((int32_t)(timer_ticks - wheel_time) >= 0)
+    {
+        idx = wheel_time & TVR_MASK;
+        for (level = 0; idx == 0 && level < TVN_LEVELS; level++)
+        {
+            idx = cascade(level, (wheel_time >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK);
+        }
+
+        // move the bucket to work_list, so callbacks can still cancel what's in it
+        work_list = tv_root[wheel_time & TVR_MASK];
+        tv_root[wheel_time & TVR_MASK] = NULL;
+        if (work_list != NULL)
+        {
+            work_list->pprev = &work_list;
+        }
+        wheel_time++;
+
+        while ((t = work_list) != NULL)
+        {
+            bucket_del(t);
+            if (t->period != 0)
+            {
+                t->expires += t->period;
+                wheel_add(t);
+            }
+            spin_unlock(&timer_lock);
+            t->fn(t->arg);
+            spin_lock(&timer_lock);
+        }
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+
+/** timer_wake
+ * DESCRIPTION: timer_sleep's callback
+ * INPUTS: arg - the sleeper
+ * OUTPUTS: none
+*/
+static void timer_wake(void* arg)
+{
+    timer_sleeper_t* s = (timer_sleeper_t*)arg;
+
+    s->done = 1;
+    wake_up(&s->wq);
+}
+
+
+/** timer_sleep
+ * DESCRIPTION: sleep for at least ticks, on a one shot timer
+ * INPUTS: ticks - how long
+ * OUTPUTS: none
+ * SIDE EFFECTS: gives up the cpu. outside a process it halts until the timer has run
+*/
+void timer_sleep(uint32_t ticks)
+{
+    timer_sleeper_t s;
+
+    wq_init(&s.wq);
+    s.done = 0;
+    timer_setup(&s.timer, timer_wake, &s);
+    timer_add(&s.timer, ticks);
+    wait_event(&s.wq, s.done);
+}
+
+
+/** timer_ms_to_ticks
+ * DESCRIPTION: convert milliseconds to rtc ticks, TIMER_HZ is 1.024 ticks per ms
+ * INPUTS: ms - milliseconds
+ * OUTPUTS: ticks, rounded up and at most TIMER_MAX_TICKS
+*/
+uint32_t timer_ms_to_ticks(uint32_t ms)
+{
+    if (ms >= TIMER_MAX_TICKS)
+    {
+        return TIMER_MAX_TICKS;
+    }
+    return ms + (ms * 3 + 124) / 125;
+}
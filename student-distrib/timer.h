@@ -0,0 +1,74 @@
+/** timer.h
+ *  Kernel timers on a hierarchical timer wheel
+*/
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "types.h"
+#include "spinlock.h"
+
+/** BACKGROUND:
+ *  - Time is counted in ticks of the rtc's periodic interrupt, TIMER_HZ a second. It runs all
+ *    the time on the boot processor, so it's the clock every timer is on. TIMER_HZ has to match
+ *    the rate rtc_init programs.
+ *  - Pending timers hang off a wheel of buckets hashed by expiry tick, so adding and cancelling
+ *    are a list insert and unlink, whatever else is pending. The first level has a bucket per
+ *    tick for the next TVR_SIZE ticks. Each further level covers TVN_SIZE times as far at
+ *    1/TVN_SIZE the resolution, and whenever the level below wraps one of its buckets is
+ *    re-spread a level down (cascaded). A timer is only ever touched again when its bucket
+ *    cascades, at most once per level.
+ *  - Each tick takes the bucket for that tick and runs its callbacks, with timer_lock dropped
+ *    so a callback can add or cancel timers, itself included. A periodic timer is re-added for
+ *    its next period before its callback runs.
+ *  - Callbacks run in the rtc interrupt, with interrupts off and the kernel lock held. They must
+ *    not sleep, and should be short: everything else in that interrupt waits for them. Anything
+ *    slow should queue a work item (softirq.h) and do it there.
+ *  - timer_sleep parks the calling process on a one shot timer, rather than spinning until
+ *    some counter runs out.
+ */
+#define TIMER_HZ            1024
+#define TVR_BITS            8
+#define TVN_BITS            6
+#define TVR_SIZE            (1 << TVR_BITS)
+#define TVN_SIZE            (1 << TVN_BITS)
+#define TVR_MASK            (TVR_SIZE - 1)
+#define TVN_MASK            (TVN_SIZE - 1)
+#define TVN_LEVELS          3                                       // above the first
+#define TIMER_MAX_TICKS     ((1 << (TVR_BITS + TVN_LEVELS * TVN_BITS)) - 1)     // about 18 hours
+
+typedef struct ktimer {
+    struct ktimer*  next;
+    struct ktimer** pprev;              /* the link pointing at us, NULL if not pending */
+    uint32_t        expires;            /* tick it's due at */
+    uint32_t        period;             /* ticks between runs, 0 for one shot */
+    void            (*fn)(void* arg);
+    void*           arg;
+} ktimer_t;
+
+extern volatile uint32_t timer_ticks;   /* rtc ticks since boot */
+extern spinlock_t        timer_lock;
+
+/* empty wheel */
+void timer_init(void);
+
+/* set what a timer calls, before it's first added */
+void timer_setup(ktimer_t* t, void (*fn)(void*), void* arg);
+
+/* run once, ticks from now / every period ticks from now on. re-adds a pending timer */
+void timer_add(ktimer_t* t, uint32_t ticks);
+void timer_add_periodic(ktimer_t* t, uint32_t period);
+
+/* take a timer off the wheel: 1 if it was pending */
+int32_t timer_cancel(ktimer_t* t);
+
+/* rtc interrupt: run everything that's due */
+void timer_tick(void);
+
+/* sleep the calling process for at least ticks */
+void timer_sleep(uint32_t ticks);
+
+/* milliseconds to ticks, rounded up */
+uint32_t timer_ms_to_ticks(uint32_t ms);
+
+#endif /* _TIMER_H */
@@ -0,0 +1,174 @@
+/** uaccess.c
+ *  Validation of user pointers and checked copies between kernel and user memory
+*/
+
+#include "uaccess.h"
+#include "syscall.h"
+#include "paging.h"
+#include "heap.h"
+#include "shm.h"
+#include "lib.h"
+
+#define VIDMAP_PAGE     ((uint32_t)SCREEN_START)
+
+extern ex_entry_t ex_table[];
+extern ex_entry_t ex_table_end[];
+
+
+/** region_end
+ * DESCRIPTION: find the user region an address is in
+ * INPUTS: addr - user address
+ * OUTPUTS: end of the region containing addr, 0 if it isn't in any
+*/
+static uint32_t region_end(uint32_t addr)
+{
+    shm_seg_t* seg;
+    uint32_t   i;
+
+    if (cur_pcb == NULL)
+    {
+        return 0;
+    }
+    if (addr >= USER && addr < USER + FOUR_MB)
+    {
+        return USER + FOUR_MB;
+    }
+    if (addr >= USER_HEAP && addr < cur_pcb->heap.brk)
+    {
+        return cur_pcb->heap.brk;
+    }
+    if (addr >= VIDMAP_PAGE && addr < VIDMAP_PAGE + PAGESIZE)
+    {
+        return VIDMAP_PAGE + PAGESIZE;
+    }
+    if (addr >= SHM_BASE && addr < SHM_SLOT_ADDR(SHM_SLOTS))
+    {
+        i = (addr - SHM_BASE) / SHM_MAX_SIZE;
+        seg = cur_pcb->shm.slots[i];
+        if (seg != NULL && addr < SHM_SLOT_ADDR(i) + seg->npages * PAGESIZE)
+        {
+            return SHM_SLOT_ADDR(i) + seg->npages * PAGESIZE;
+        }
+    }
+    return 0;
+}
+
+
+/** access_ok
+ * DESCRIPTION: checks a user buffer lies entirely in memory the current process has mapped
+ * INPUTS: addr - start of the buffer
+ *         len - length in bytes
+ * OUTPUTS: 1 if the buffer is valid, 0 if not
+ * SIDE EFFECTS: none
+*/
+int32_t access_ok(const void* addr, uint32_t len)
+{
+    uint32_t start = (uint32_t)addr;
+    uint32_t end   = region_end(start);
+
+    if (end == 0 || start + len < start)
+    {
+        return 0;
+    }
+    return (start + len <= end);
+}
+
+
+/** copy_from_user
+ * DESCRIPTION: copy a buffer from user memory into the kernel
+ * INPUTS: to - kernel destination
+ *         from - user source
+ *         n - bytes to copy
+ * OUTPUTS: number of bytes that could not be copied, 0 on success
+ * SIDE EFFECTS: nothing is copied if the user range is invalid
+*/
+uint32_t copy_from_user(void* to, const void* from, uint32_t n)
+{
+    if (!access_ok(from, n))
+    {
+        return n;
+    }
+    return __copy_user(to, from, n);
+}
+
+
+/** copy_to_user
+ * DESCRIPTION: copy a kernel buffer out to user memory
+ * INPUTS: to - user destination
+ *         from - kernel source
+ *         n - bytes to copy
+ * OUTPUTS: number of bytes that could not be copied, 0 on success
+ * SIDE EFFECTS: nothing is copied if the user range is invalid
+*/
+uint32_t copy_to_user(void* to, const void* from, uint32_t n)
+{
+    if (!access_ok(to, n))
+    {
+        return n;
+    }
+    return __copy_user(to, from, n);
+}
+
+
+/** search_exception_table
+ * DESCRIPTION: look up the fixup for an instruction that faulted in the kernel
+ * INPUTS: eip - address of the faulting instruction
+ * OUTPUTS: address to resume at, 0 if the fault wasn't expected
+*/
+uint32_t search_exception_table(uint32_t eip)
+{
+    ex_entry_t* e;
+
+    for (e = ex_table; e < ex_table_end; e++)
+    {
+        if (e->insn == eip)
+        {
+            return e->fixup;
+        }
+    }
+    return 0;
+}
+
+
+/** bad_userspace_addr
+ * DESCRIPTION: opposite of access_ok, for callers that want an error flag
+ * INPUTS: addr, len - the user buffer
+ * OUTPUTS: nonzero if the buffer is invalid
+*/
+int32_t bad_userspace_addr(const void* addr, int32_t len)
+{
+    return (len < 0 || !access_ok(addr, len));
+}
+
+
+/** safe_strncpy
+ * DESCRIPTION: copy a string from user memory, at most n bytes including the terminator.
+ *              Only the region the string starts in is read, so this never faults.
+ * INPUTS: dest - kernel buffer of n bytes
+ *         src - user string
+ *         n - size of dest
+ * OUTPUTS: length of the string copied, -1 if src is invalid or not terminated within n bytes
+ * SIDE EFFECTS: dest is always terminated on success
+*/
+int32_t safe_strncpy(int8_t* dest, const int8_t* src, int32_t n)
+{
+    uint32_t end = region_end((uint32_t)src);
+    uint32_t limit;
+    int32_t  i;
+
+    if (end == 0 || n <= 0)
+    {
+        return -1;
+    }
+
+    limit = end - (uint32_t)src;
+    for (i = 0; i < n && (uint32_t)i < limit; i++)
+    {
+        dest[i] = src[i];
+        if (src[i] == '\0')
+        {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,52 @@
+/* uaccess.h - checked copies between kernel and user memory
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _UACCESS_H
+#define _UACCESS_H
+
+#include "types.h"
+
+/** BACKGROUND:
+ *  - A user pointer is valid if the whole [addr, addr + len) range falls inside one region the
+ *    process has mapped: its 4MB program page, its heap up to the break, the vidmap page
+ *    or an attached shared memory segment.
+ *    That's one range compare per region, no per byte or per page checks.
+ *  - The copies themselves are rep movsl/movsb in copy_user.S. If one of them faults anyway, the
+ *    page fault handler finds the faulting instruction in the exception table and resumes at its
+ *    fixup, which returns how many bytes were left instead of killing the process.
+ */
+
+#ifndef ASM
+
+/* one exception table entry: where a fault may happen and where to continue */
+typedef struct {
+    uint32_t insn;
+    uint32_t fixup;
+} ex_entry_t;
+
+/* frame the page fault linkage hands to page_fault */
+typedef struct {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;    /* pushal */
+    uint32_t error_code;
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+} fault_frame_t;
+
+/* nonzero if [addr, addr + len) is entirely inside one of the current process's regions */
+int32_t access_ok(const void* addr, uint32_t len);
+
+/* copy n bytes, returns the number of bytes NOT copied (0 on success) */
+uint32_t copy_from_user(void* to, const void* from, uint32_t n);
+uint32_t copy_to_user(void* to, const void* from, uint32_t n);
+
+/* fixup address for a faulting kernel eip, 0 if there is none */
+uint32_t search_exception_table(uint32_t eip);
+
+/* unchecked copy with fault recovery, in copy_user.S */
+extern uint32_t __copy_user(void* to, const void* from, uint32_t n);
+
+#endif /* ASM */
+
+#endif /* _UACCESS_H */
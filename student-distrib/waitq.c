@@ -0,0 +1,185 @@
+/** waitq.c
+ *  Wait queues: put a process to sleep until an interrupt handler wakes it
+*/
+
+#include "waitq.h"
+#include "syscall.h"
+#include "scheduler.h"
+#include "lib.h"
+#include "spinlock.h"
+
+
+/*********************** GLOBAL VARIABLES ********************************/
+wq_stats_t        wq_stats;
+static spinlock_t wq_lock = SPINLOCK_INIT("waitq");       // every wait queue's list, and wq_stats
+/*************************************************************************/
+
+
+/** wq_init
+ * DESCRIPTION: empty a wait queue
+ * INPUTS: wq - the queue
+ * OUTPUTS: none
+*/
+void wq_init(wait_queue_t* wq)
+{
+    wq->head = NULL;
+}
+
+
+/** wq_add
+ * DESCRIPTION: put the current process on a queue
+ * INPUTS: wq - the queue
+ *         e - entry on the caller's stack, stays on the queue until wq_remove
+ * OUTPUTS: none
+ * SIDE EFFECTS: none, the process is still runnable until wq_prepare
+*/
+void wq_add(wait_queue_t* wq, wait_entry_t* e)
+{
+    uint32_t flags;
+
+    e->pcb      = cur_pcb;
+    e->woken_at = 0;
+
+    spin_lock_irqsave(&wq_lock, flags);
+    e->next  = wq->head;
+    wq->head = e;
+    spin_unlock_irqrestore(&wq_lock, flags);
+}
+
+
+/** wq_remove
+ * DESCRIPTION: take the current process off a queue once its condition is true
+ * INPUTS: wq - the queue
+ *         e - the entry from wq_add
+ * OUTPUTS: none
+ * SIDE EFFECTS: marks the process runnable, records the wake up latency
+*/
+void wq_remove(wait_queue_t* wq, wait_entry_t* e)
+{
+    wait_entry_t** link;
+    uint32_t       flags;
+    uint32_t       latency;
+
+    spin_lock_irqsave(&wq_lock, flags);
+    for (link = &wq->head; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == e)
+        {
+            *link = e->next;
+            break;
+        }
+    }
+    if (e->pcb != NULL)
+    {
+        e->pcb->state = PROC_RUNNABLE;
+    }
+
+    if (e->woken_at != 0)
+    {
+        latency = (uint32_t)(rdtsc() - e->woken_at);
+        wq_stats.latency_total += latency;
+        wq_stats.wakeups++;
+        if (latency > wq_stats.latency_max)
+        {
+            wq_stats.latency_max = latency;
+        }
+    }
+    spin_unlock_irqrestore(&wq_lock, flags);
+}
+
+
+/** wq_prepare
+ * DESCRIPTION: mark the current process asleep before its last condition check
+ * INPUTS: e - the entry from wq_add
+ * OUTPUTS: none
+*/
+void wq_prepare(wait_entry_t* e)
+{
+    uint32_t flags;
+
+    // under the lock wake_sleepers reads the state with, so either it sees us asleep or we see
+    // the condition it set before taking the lock. the sleeper may not hold the kernel lock
+    spin_lock_irqsave(&wq_lock, flags);
+    if (e->pcb != NULL)
+    {
+        e->pcb->state = PROC_SLEEPING;
+    }
+    spin_unlock_irqrestore(&wq_lock, flags);
+}
+
+
+/** wq_sleep
+ * DESCRIPTION: let other processes run until a wake_up. If the scheduler isn't running, halt
+ *              until the next interrupt instead
+ * INPUTS: none
+ * OUTPUTS: none
+ * SIDE EFFECTS: returns with interrupts on. the caller re-checks its condition afterwards
+*/
+void wq_sleep(void)
+{
+    cli();
+    if (cur_pcb != NULL && cur_pcb->state == PROC_SLEEPING)
+    {
+        schedule();
+    }
+
+    if (cur_pcb == NULL || cur_pcb->state == PROC_SLEEPING)
+    {
+        idle_wait();
+    }
+    else
+    {
+        sti();
+    }
+}
+
+
+/** wake_sleepers
+ * DESCRIPTION: make every sleeper on a queue runnable
+ * INPUTS: wq - the queue
+ *         boost - passed on to sched_wake
+ * OUTPUTS: none
+ * SIDE EFFECTS: the sleepers run on the scheduler's next pick, they stay on the queue until
+ *               they've checked their condition
+*/
+static void wake_sleepers(wait_queue_t* wq, int boost)
+{
+    wait_entry_t* e;
+    uint32_t      flags;
+
+    spin_lock_irqsave(&wq_lock, flags);
+    for (e = wq->head; e != NULL; e = e->next)
+    {
+        if (e->pcb == NULL || e->pcb->state == PROC_SLEEPING)
+        {
+            if (e->pcb != NULL)
+            {
+                sched_wake(e->pcb, boost);
+            }
+            e->woken_at = rdtsc();
+        }
+    }
+    spin_unlock_irqrestore(&wq_lock, flags);
+}
+
+
+/** wake_up
+ * DESCRIPTION: make every sleeper on a queue runnable. needs the kernel lock, see waitq.h
+ * INPUTS: wq - the queue
+ * OUTPUTS: none
+*/
+void wake_up(wait_queue_t* wq)
+{
+    wake_sleepers(wq, 0);
+}
+
+
+/** wake_up_input
+ * DESCRIPTION: wake_up for keyboard and mouse input, the sleepers get the interactive boost
+ * INPUTS: wq - the queue
+ * OUTPUTS: none
+*/
+void wake_up_input(wait_queue_t* wq)
+{
+    wake_sleepers(wq, 1);
+}
@@ -0,0 +1,85 @@
+/* waitq.h - wait queues for processes blocked on an event
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef _WAITQ_H
+#define _WAITQ_H
+
+#include "types.h"
+
+struct pcb;
+
+/** BACKGROUND:
+ *  - A wait queue is a list of sleeping processes. The list entries live on each sleeper's
+ *    kernel stack, so waiting never allocates.
+ *  - A sleeper marks itself PROC_SLEEPING, checks its condition one last time and gives the cpu
+ *    away. The scheduler doesn't put sleeping processes back on the run queue. An interrupt
+ *    handler that makes the condition true calls wake_up, which queues the sleepers again. Since the state is set before
+ *    the condition is checked, a wake_up that lands in between is never lost.
+ *  - Sleeping doesn't need the kernel lock (smp.h), the terminal and rtc reads wait without it.
+ *    Waking does: sched_wake decides whether the sleeper is still running on its cpu, and only
+ *    the kernel lock keeps that cpu from switching in the meantime. The wakers are interrupt
+ *    handlers and the system calls that still take it (pipes).
+ *  - With nothing else runnable the scheduler switches to its idle task, which halts the cpu
+ *    until the next interrupt. wq_stats counts how long woken processes took to actually get
+ *    the cpu back.
+ */
+
+/* one sleeper, on its own stack */
+typedef struct wait_entry {
+    struct pcb*         pcb;
+    struct wait_entry*  next;
+    uint64_t            woken_at;           /* rdtsc at wake_up, 0 if not woken yet */
+} wait_entry_t;
+
+typedef struct {
+    wait_entry_t* head;
+} wait_queue_t;
+
+typedef struct {
+    uint64_t latency_total;                 /* wake_up -> running again, summed */
+    uint32_t latency_max;
+    uint32_t wakeups;
+} wq_stats_t;
+
+#define WAIT_QUEUE_INIT     { NULL }
+
+extern wq_stats_t wq_stats;
+
+/* empty queue */
+void wq_init(wait_queue_t* wq);
+
+/* put the current process on a queue / take it off again */
+void wq_add(wait_queue_t* wq, wait_entry_t* e);
+void wq_remove(wait_queue_t* wq, wait_entry_t* e);
+
+/* mark the current process asleep, to be followed by a condition check and wq_sleep */
+void wq_prepare(wait_entry_t* e);
+
+/* give up the cpu until woken, or until the next interrupt if the scheduler isn't running */
+void wq_sleep(void);
+
+/* make every process on the queue runnable. safe from interrupt handlers */
+void wake_up(wait_queue_t* wq);
+
+/* same, for input: the sleepers jump to the scheduler's top level */
+void wake_up_input(wait_queue_t* wq);
+
+/* sleep on wq until cond is true. cond is re-checked after every wake up */
+#define wait_event(wq, cond)                \
+do {                                        \
+    wait_entry_t __we;                      \
+    wq_add((wq), &__we);                    \
+    for (;;)                                \
+    {                                       \
+        wq_prepare(&__we);                  \
+        if (cond)                           \
+        {                                   \
+            break;                          \
+        }                                   \
+        wq_sleep();                         \
+    }                                       \
+    wq_remove((wq), &__we);                 \
+} while (0)
+
+#endif /* _WAITQ_H */
@@ -0,0 +1,33 @@
+/* ece391clock.h - monotonic nanosecond clock, with or without a system call, and sleep
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391CLOCK_H
+#define ECE391CLOCK_H
+
+/* the only clock there is: nanoseconds since boot */
+#define CLOCK_MONOTONIC     0
+
+/* the kernel's read only clock page, mapped in every program */
+#define CLOCK_PAGE          0xB800000
+#define CLOCK_VERSION       1
+
+/* layout of the clock page, the same as the kernel's clock_page_t */
+typedef struct {
+    unsigned int version;
+    unsigned int mult;                  /* nanoseconds per tsc cycle << shift */
+    unsigned int shift;
+    unsigned int tsc_khz;
+    unsigned long long tsc_base;        /* tsc at time 0 */
+} ece391_clock_page_t;
+
+/* clock syscall (SYS_CLOCK_GETTIME = 19) */
+extern int ece391_clock_gettime (int clock, unsigned long long* ns);
+
+/* the same clock read straight off the clock page, no system call */
+extern unsigned long long ece391_clock_ns (void);
+
+/* sleep syscall (SYS_SLEEP = 20): give up the cpu for at least ms milliseconds */
+extern int ece391_sleep (unsigned int ms);
+
+#endif /* ECE391CLOCK_H */
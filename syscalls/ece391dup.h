@@ -0,0 +1,20 @@
+/* ece391dup.h - fd duplication and redirection
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391DUP_H
+#define ECE391DUP_H
+
+/* dup syscalls (SYS_DUP = 17, SYS_DUP2 = 18).
+   A child started with ece391_execute gets the caller's fd 0 and 1 plus every fd made by
+   dup/dup2, so to run "prog > pipe":
+       saved = ece391_dup (1);
+       ece391_dup2 (fds[1], 1);
+       ece391_execute ("prog");
+       ece391_dup2 (saved, 1);
+       ece391_close (saved);
+   Fds from open and pipe are not passed on. */
+extern int ece391_dup (int fd);
+extern int ece391_dup2 (int old_fd, int new_fd);
+
+#endif /* ECE391DUP_H */
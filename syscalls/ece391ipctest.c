@@ -0,0 +1,175 @@
+/* ece391ipctest.c - exercise pipe, dup/dup2 and shared memory
+ * vim:ts=4 noexpandtab
+ *
+ * Prints "ipctest: PASS", or which check failed, and halts with 0 or 1. If memtest is in the
+ * filesystem it is also run with its stdout sent down a pipe.
+ */
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+#include "ece391pipe.h"
+#include "ece391dup.h"
+#include "ece391shm.h"
+
+#define BUF_SIZE        256
+#define SHM_SIZE        (2 * 4096)
+#define SHMAT_FAILED    ((void*)-1)
+#define BAD_SHM_ID      1000
+
+static char wbuf[BUF_SIZE];
+static char rbuf[BUF_SIZE];
+
+
+static int
+fail (const char* what)
+{
+    ece391_fdputs (1, "ipctest: FAIL, ");
+    ece391_fdputs (1, what);
+    ece391_fdputs (1, "\n");
+    return 1;
+}
+
+
+/* read_all
+ *   DESCRIPTION: read until n bytes arrived or the pipe hit end of file
+ *   RETURN VALUE: bytes read, -1 on error
+ */
+static int
+read_all (int fd, char* buf, int n)
+{
+    int got = 0;
+    int cnt;
+
+    while (got < n) {
+        if ((cnt = ece391_read (fd, buf + got, n - got)) < 0)
+            return -1;
+        if (cnt == 0)
+            break;
+        got += cnt;
+    }
+    return got;
+}
+
+
+/* pipe_check
+ *   DESCRIPTION: bytes come out in order, and read sees end of file once the write end is closed
+ */
+static int
+pipe_check ()
+{
+    int fds[2];
+    int i;
+
+    for (i = 0; i < BUF_SIZE; i++)
+        wbuf[i] = (char)(i * 7 + 1);
+
+    if (ece391_pipe (fds) != 0)
+        return fail ("pipe");
+    if (ece391_write (fds[1], wbuf, BUF_SIZE) != BUF_SIZE)
+        return fail ("pipe write");
+    if (ece391_close (fds[1]) != 0)
+        return fail ("close write end");
+    if (read_all (fds[0], rbuf, BUF_SIZE) != BUF_SIZE)
+        return fail ("pipe read");
+    for (i = 0; i < BUF_SIZE; i++) {
+        if (rbuf[i] != wbuf[i])
+            return fail ("pipe data");
+    }
+    if (ece391_read (fds[0], rbuf, 1) != 0)
+        return fail ("no end of file after the write end closed");
+    ece391_close (fds[0]);
+    return 0;
+}
+
+
+/* dup_check
+ *   DESCRIPTION: send stdout down a pipe with dup2, write to fd 1, put stdout back and read the
+ *                pipe. then do the same around execute ("memtest"), if memtest is there
+ */
+static int
+dup_check ()
+{
+    static const char msg[] = "through fd 1\n";
+    static const char pass[] = "memtest: PASS\n";
+    int fds[2];
+    int saved;
+    int ran;
+    int len;
+
+    if (ece391_pipe (fds) != 0)
+        return fail ("pipe for dup");
+    if ((saved = ece391_dup (1)) < 0)
+        return fail ("dup");
+    if (ece391_dup2 (fds[1], 1) != 1)
+        return fail ("dup2 onto stdout");
+    len = ece391_fdputs (1, msg);
+    ran = ece391_execute ("memtest");
+    if (ece391_dup2 (saved, 1) != 1)
+        return fail ("dup2 back to the terminal");
+    ece391_close (saved);
+    ece391_close (fds[1]);
+
+    if (len != (int)ece391_strlen (msg))
+        return fail ("write through the dup'd fd");
+    len = read_all (fds[0], rbuf, BUF_SIZE - 1);
+    ece391_close (fds[0]);
+    if (len < 0)
+        return fail ("read from the dup'd pipe");
+    rbuf[len] = '\0';
+    if (ece391_strncmp (rbuf, msg, ece391_strlen (msg)) != 0)
+        return fail ("dup'd write went somewhere else");
+
+    if (ran == -1) {
+        ece391_fdputs (1, "ipctest: no memtest, skipped execute through a pipe\n");
+    } else if (ran != 0 || ece391_strcmp (rbuf + ece391_strlen (msg), pass) != 0) {
+        return fail ("memtest through a pipe");
+    }
+    return 0;
+}
+
+
+/* shm_check
+ *   DESCRIPTION: two mappings of one segment see each other's writes, and bad ids are refused
+ */
+static int
+shm_check ()
+{
+    unsigned int* a;
+    unsigned int* b;
+    int id;
+    int i;
+
+    if ((id = ece391_shmget (SHM_PRIVATE, SHM_SIZE)) < 0)
+        return fail ("shmget");
+    if ((a = ece391_shmat (id)) == SHMAT_FAILED || (b = ece391_shmat (id)) == SHMAT_FAILED)
+        return fail ("shmat");
+    if (a == b)
+        return fail ("two attaches got one address");
+    for (i = 0; i < SHM_SIZE / (int)sizeof (*a); i++) {
+        if (a[i] != 0)
+            return fail ("new segment not zeroed");
+        a[i] = i ^ 0x5A5A5A5A;
+    }
+    for (i = 0; i < SHM_SIZE / (int)sizeof (*b); i++) {
+        if (b[i] != (unsigned int)(i ^ 0x5A5A5A5A))
+            return fail ("write not seen through the other mapping");
+    }
+    if (ece391_shmdt (a) != 0 || ece391_shmdt (b) != 0)
+        return fail ("shmdt");
+    if (ece391_shmdt (a) != -1)
+        return fail ("shmdt twice");
+    if (ece391_shmat (BAD_SHM_ID) != SHMAT_FAILED || ece391_shmat (-1) != SHMAT_FAILED)
+        return fail ("shmat of a bad id");
+    return 0;
+}
+
+
+int
+main ()
+{
+    if (pipe_check () != 0 || dup_check () != 0 || shm_check () != 0)
+        return 1;
+
+    ece391_fdputs (1, "ipctest: PASS\n");
+    return 0;
+}
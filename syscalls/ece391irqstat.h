@@ -0,0 +1,32 @@
+/* ece391irqstat.h - how often each interrupt fires and how long its handler takes
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391IRQSTAT_H
+#define ECE391IRQSTAT_H
+
+#define IRQSTAT_VECTORS     257         /* most entries there can be */
+#define IRQSTAT_BUCKETS     32
+
+/* one interrupt vector, the same as the kernel's irqstat_entry_t. times are in tsc cycles,
+   tsc_khz on the clock page (ece391clock.h) turns them into time */
+typedef struct {
+    int vector;                         /* -1 for the shared fault / do nothing handlers */
+    unsigned int count;                 /* times it fired */
+    unsigned int timed;                 /* of those, the ones with a duration */
+    unsigned int min;
+    unsigned int avg;
+    unsigned int max;
+    unsigned long long cycles;          /* total */
+    unsigned int hist[IRQSTAT_BUCKETS]; /* hist[b]: took 2^b to 2^(b+1) - 1 cycles */
+    unsigned int waits;                 /* times it waited for the kernel lock first. that */
+    unsigned int wait_avg;              /* wait isn't part of the times above */
+    unsigned int wait_max;
+    unsigned long long wait_cycles;
+} ece391_irqstat_t;
+
+/* irqstat syscall (SYS_IRQSTAT = 21): fill buf with up to n entries, one per vector that has
+   fired, and return how many. n = 0 zeroes the counts instead */
+extern int ece391_irqstat (ece391_irqstat_t* buf, int n);
+
+#endif /* ECE391IRQSTAT_H */
@@ -0,0 +1,201 @@
+/* ece391malloc.c - user level malloc on top of the brk/sbrk system calls
+ * vim:ts=4 noexpandtab
+ */
+
+#include "ece391malloc.h"
+
+/** BACKGROUND:
+ *  - Requests up to 2KB (including the 8 byte header) are rounded up to a power of two size
+ *    class. Each class has its own singly linked free list, so malloc and free of small blocks
+ *    are a push/pop with no searching and no coalescing.
+ *  - New blocks are carved off a bump region at the end of the heap, which grows with sbrk in
+ *    ARENA_GROW steps, so most mallocs never make a system call.
+ *  - Bigger requests are rounded up to whole pages and kept on one first fit free list.
+ */
+#define MIN_SHIFT       4                               /* 16 byte blocks */
+#define MAX_SHIFT       11                              /* 2KB blocks */
+#define NUM_CLASSES     (MAX_SHIFT - MIN_SHIFT + 1)
+#define LARGE_CLASS     NUM_CLASSES
+#define PAGE_SIZE       4096
+#define ARENA_GROW      (16 * PAGE_SIZE)
+#define HDR_SIZE        sizeof(header_t)
+#define SBRK_FAILED     ((void*)-1)
+
+/* sits in front of every block. 8 bytes keeps payloads 8 byte aligned */
+typedef struct header {
+    unsigned int size;          /* block size including the header */
+    unsigned int cls;           /* size class, or LARGE_CLASS */
+} header_t;
+
+/* free blocks reuse their payload for the list link */
+typedef struct free_block {
+    struct free_block* next;
+} free_block_t;
+
+static free_block_t* free_lists[NUM_CLASSES];
+static free_block_t* large_list;
+static char* arena_cur;                                 /* next unused byte of the bump region */
+static char* arena_end;                                 /* current break */
+
+
+/* carve_block
+ *   DESCRIPTION: take size bytes off the bump region, growing the heap if needed
+ *   INPUTS: size - block size including the header, multiple of 8
+ *   OUTPUTS: start of the block, NULL if the heap can't grow
+ */
+static header_t*
+carve_block (unsigned int size)
+{
+    char* blk;
+    char* more;
+    unsigned int grow;
+
+    if (arena_cur == 0 || (unsigned int)(arena_end - arena_cur) < size) {
+        grow = (size + ARENA_GROW - 1) & ~(ARENA_GROW - 1);
+        more = ece391_sbrk (grow);
+        if (more == SBRK_FAILED)
+            return 0;
+        /* someone else moved the break, start a new region and drop the old tail */
+        if (more != arena_end)
+            arena_cur = more;
+        arena_end = more + grow;
+    }
+
+    blk = arena_cur;
+    arena_cur += size;
+    return (header_t*)blk;
+}
+
+
+/* ece391_malloc
+ *   DESCRIPTION: allocate size bytes, 8 byte aligned
+ *   INPUTS: size - bytes wanted
+ *   OUTPUTS: pointer to the memory, NULL on failure or size 0
+ *   SIDE EFFECTS: may grow the heap
+ */
+void*
+ece391_malloc (unsigned int size)
+{
+    unsigned int total, cls;
+    free_block_t** link;
+    free_block_t* fb;
+    header_t* hdr;
+
+    if (size == 0 || size > 0x7FFFFFFF - PAGE_SIZE)
+        return 0;
+    total = size + HDR_SIZE;
+
+    if (total <= (1 << MAX_SHIFT)) {
+        for (cls = 0; (1U << (MIN_SHIFT + cls)) < total; cls++);
+
+        if ((fb = free_lists[cls]) != 0) {
+            free_lists[cls] = fb->next;
+            return fb;
+        }
+        hdr = carve_block (1 << (MIN_SHIFT + cls));
+        if (hdr == 0)
+            return 0;
+        hdr->size = 1 << (MIN_SHIFT + cls);
+        hdr->cls = cls;
+        return hdr + 1;
+    }
+
+    /* large: first fit on whole pages */
+    total = (total + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    for (link = &large_list; *link != 0; link = &(*link)->next) {
+        hdr = (header_t*)*link - 1;
+        if (hdr->size >= total) {
+            fb = *link;
+            *link = fb->next;
+            return fb;
+        }
+    }
+    hdr = carve_block (total);
+    if (hdr == 0)
+        return 0;
+    hdr->size = total;
+    hdr->cls = LARGE_CLASS;
+    return hdr + 1;
+}
+
+
+/* ece391_free
+ *   DESCRIPTION: give a block back to its free list
+ *   INPUTS: ptr - pointer from ece391_malloc, NULL is ignored
+ *   OUTPUTS: none
+ *   SIDE EFFECTS: memory is kept for reuse, the heap never shrinks
+ */
+void
+ece391_free (void* ptr)
+{
+    header_t* hdr;
+    free_block_t* fb = ptr;
+
+    if (ptr == 0)
+        return;
+    hdr = (header_t*)ptr - 1;
+
+    if (hdr->cls < NUM_CLASSES) {
+        fb->next = free_lists[hdr->cls];
+        free_lists[hdr->cls] = fb;
+    } else {
+        fb->next = large_list;
+        large_list = fb;
+    }
+}
+
+
+/* ece391_calloc
+ *   DESCRIPTION: allocate nmemb * size zeroed bytes
+ *   INPUTS: nmemb, size - element count and size
+ *   OUTPUTS: pointer to the memory, NULL on failure or overflow
+ */
+void*
+ece391_calloc (unsigned int nmemb, unsigned int size)
+{
+    unsigned int total = nmemb * size;
+    unsigned int i;
+    char* p;
+
+    if (size != 0 && total / size != nmemb)
+        return 0;
+    if ((p = ece391_malloc (total)) == 0)
+        return 0;
+    for (i = 0; i < total; i++)
+        p[i] = 0;
+    return p;
+}
+
+
+/* ece391_realloc
+ *   DESCRIPTION: resize a block, in place if it already fits
+ *   INPUTS: ptr - block to resize (NULL acts like malloc)
+ *           size - new size (0 acts like free)
+ *   OUTPUTS: pointer to the resized block, NULL on failure (ptr is still valid then)
+ */
+void*
+ece391_realloc (void* ptr, unsigned int size)
+{
+    header_t* hdr;
+    unsigned int old_size, i;
+    char* p;
+
+    if (ptr == 0)
+        return ece391_malloc (size);
+    if (size == 0) {
+        ece391_free (ptr);
+        return 0;
+    }
+
+    hdr = (header_t*)ptr - 1;
+    old_size = hdr->size - HDR_SIZE;
+    if (size <= old_size)
+        return ptr;
+
+    if ((p = ece391_malloc (size)) == 0)
+        return 0;
+    for (i = 0; i < old_size; i++)
+        p[i] = ((char*)ptr)[i];
+    ece391_free (ptr);
+    return p;
+}
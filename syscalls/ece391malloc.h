@@ -0,0 +1,18 @@
+/* ece391malloc.h - user level malloc on top of the brk/sbrk system calls
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391MALLOC_H
+#define ECE391MALLOC_H
+
+/* heap syscalls (SYS_BRK = 11, SYS_SBRK = 12) */
+extern int ece391_brk (void* addr);
+extern void* ece391_sbrk (int increment);
+
+/* allocator, power of two size classes up to 2KB with a free list each */
+extern void* ece391_malloc (unsigned int size);
+extern void ece391_free (void* ptr);
+extern void* ece391_calloc (unsigned int nmemb, unsigned int size);
+extern void* ece391_realloc (void* ptr, unsigned int size);
+
+#endif /* ECE391MALLOC_H */
@@ -0,0 +1,131 @@
+/* ece391memtest.c - exercise brk/sbrk and the malloc built on them
+ * vim:ts=4 noexpandtab
+ *
+ * Prints "memtest: PASS", or which check failed, and halts with 0 or 1.
+ */
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+#include "ece391malloc.h"
+
+#define PAGE_SIZE       4096
+#define NUM_BLOCKS      200
+#define SBRK_FAILED     ((void*)-1)
+
+static void* blocks[NUM_BLOCKS];
+
+
+/* block_size
+ *   DESCRIPTION: sizes spread over every small class and a few large blocks
+ */
+static unsigned int
+block_size (int i)
+{
+    return 1 + (i * 37) % 3000;
+}
+
+
+/* fill / check
+ *   DESCRIPTION: a pattern that differs per block, so overlapping blocks show up
+ */
+static void
+fill (int i)
+{
+    unsigned char* p = blocks[i];
+    unsigned int j;
+
+    for (j = 0; j < block_size (i); j++)
+        p[j] = (unsigned char)(i + j);
+}
+
+static int
+check (int i)
+{
+    unsigned char* p = blocks[i];
+    unsigned int j;
+
+    for (j = 0; j < block_size (i); j++) {
+        if (p[j] != (unsigned char)(i + j))
+            return -1;
+    }
+    return 0;
+}
+
+
+static int
+fail (const char* what)
+{
+    ece391_fdputs (1, "memtest: FAIL, ");
+    ece391_fdputs (1, what);
+    ece391_fdputs (1, "\n");
+    return 1;
+}
+
+
+int
+main ()
+{
+    char* start;
+    char* p;
+    unsigned int* z;
+    int i;
+
+    /* the raw break */
+    start = ece391_sbrk (0);
+    if (start == SBRK_FAILED)
+        return fail ("sbrk(0)");
+    if (ece391_sbrk (PAGE_SIZE) != start || ece391_sbrk (0) != start + PAGE_SIZE)
+        return fail ("sbrk grow");
+    for (i = 0; i < PAGE_SIZE; i++)
+        start[i] = (char)i;
+    if (start[PAGE_SIZE - 1] != (char)(PAGE_SIZE - 1))
+        return fail ("new heap page");
+    if (ece391_brk (start) != 0 || ece391_sbrk (0) != start)
+        return fail ("brk shrink");
+    if (ece391_brk ((void*)0) != -1 || ece391_sbrk (0x7FFFFFFF) != SBRK_FAILED)
+        return fail ("bad break accepted");
+
+    /* malloc on top of it */
+    for (i = 0; i < NUM_BLOCKS; i++) {
+        if ((blocks[i] = ece391_malloc (block_size (i))) == 0 || ((unsigned int)blocks[i] & 7))
+            return fail ("malloc");
+        fill (i);
+    }
+    for (i = 0; i < NUM_BLOCKS; i++) {
+        if (check (i) != 0)
+            return fail ("blocks overlap");
+    }
+    for (i = 0; i < NUM_BLOCKS; i += 2)
+        ece391_free (blocks[i]);
+    for (i = 0; i < NUM_BLOCKS; i += 2) {
+        if ((blocks[i] = ece391_malloc (block_size (i))) == 0)
+            return fail ("malloc after free");
+        fill (i);
+    }
+    for (i = 1; i < NUM_BLOCKS; i += 2) {
+        if (check (i) != 0)
+            return fail ("reused block overlaps a live one");
+    }
+
+    /* calloc zeroes, realloc keeps the contents */
+    if ((z = ece391_calloc (PAGE_SIZE, sizeof (*z))) == 0)
+        return fail ("calloc");
+    for (i = 0; i < PAGE_SIZE; i++) {
+        if (z[i] != 0)
+            return fail ("calloc not zeroed");
+    }
+    if ((p = ece391_realloc (blocks[1], 2 * PAGE_SIZE)) == 0)
+        return fail ("realloc");
+    blocks[1] = p;
+    for (i = 0; i < (int)block_size (1); i++) {
+        if ((unsigned char)p[i] != (unsigned char)(1 + i))
+            return fail ("realloc lost data");
+    }
+
+    for (i = 0; i < NUM_BLOCKS; i++)
+        ece391_free (blocks[i]);
+    ece391_free (z);
+
+    ece391_fdputs (1, "memtest: PASS\n");
+    return 0;
+}
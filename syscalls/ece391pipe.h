@@ -0,0 +1,12 @@
+/* ece391pipe.h - pipes between programs
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391PIPE_H
+#define ECE391PIPE_H
+
+/* pipe syscall (SYS_PIPE = 16). read() of an empty pipe waits, and returns 0 once every
+   write end is closed. write() waits for room, and returns -1 once every read end is closed */
+extern int ece391_pipe (int fds[2]);
+
+#endif /* ECE391PIPE_H */
@@ -0,0 +1,28 @@
+/* ece391prof.h - sampling profiler: where the cpus spend their time
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391PROF_H
+#define ECE391PROF_H
+
+#define PROF_HZ             1000        /* samples a second, per cpu */
+#define PROF_DEPTH          8
+
+/* one sample, the same as the kernel's prof_sample_t */
+typedef struct {
+    unsigned int eip;                   /* where the cpu was */
+    short pid;                          /* -1 for none: idle, the gui */
+    unsigned char cpu;
+    unsigned char user;                 /* 1 if it was in user mode */
+    unsigned int depth;                 /* callers in stack[], kernel samples only */
+    unsigned int stack[PROF_DEPTH];     /* return addresses, nearest caller first */
+} ece391_prof_sample_t;
+
+/* profiler syscalls (SYS_PROF_START = 22, SYS_PROF_STOP = 23, SYS_PROF_DUMP = 24). start
+   empties the buffers, stop returns how many samples are waiting. dump reads up to n of them
+   into buf, or with buf NULL writes them all out the serial port for profsym.py */
+extern int ece391_prof_start (void);
+extern int ece391_prof_stop (void);
+extern int ece391_prof_dump (ece391_prof_sample_t* buf, int n);
+
+#endif /* ECE391PROF_H */
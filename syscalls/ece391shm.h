@@ -0,0 +1,16 @@
+/* ece391shm.h - shared memory segments between programs
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391SHM_H
+#define ECE391SHM_H
+
+/* key that always creates a new, unnamed segment */
+#define SHM_PRIVATE 0
+
+/* shared memory syscalls (SYS_SHMGET = 13, SYS_SHMAT = 14, SYS_SHMDT = 15) */
+extern int ece391_shmget (int key, unsigned int size);
+extern void* ece391_shmat (int id);
+extern int ece391_shmdt (void* addr);
+
+#endif /* ECE391SHM_H */
@@ -0,0 +1,70 @@
+/* ece391support.c - string helpers for user programs, there's no libc
+ * vim:ts=4 noexpandtab
+ */
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+unsigned int
+ece391_strlen (const char* s)
+{
+    unsigned int len;
+
+    for (len = 0; s[len] != '\0'; len++);
+    return len;
+}
+
+
+int
+ece391_strcmp (const char* s1, const char* s2)
+{
+    while (*s1 != '\0' && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+    return (unsigned char)*s1 - (unsigned char)*s2;
+}
+
+
+int
+ece391_strncmp (const char* s1, const char* s2, unsigned int n)
+{
+    for (; n > 0; n--, s1++, s2++) {
+        if (*s1 != *s2 || *s1 == '\0')
+            return (unsigned char)*s1 - (unsigned char)*s2;
+    }
+    return 0;
+}
+
+
+void
+ece391_strcpy (char* dst, const char* src)
+{
+    while ((*dst++ = *src++) != '\0');
+}
+
+
+char*
+ece391_itoa (unsigned int value, char* buf, int radix)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    char tmp[33];
+    char* out = buf;
+    int n = 0;
+
+    do {
+        tmp[n++] = digits[value % radix];
+        value /= radix;
+    } while (value != 0);
+    while (n > 0)
+        *out++ = tmp[--n];
+    *out = '\0';
+    return buf;
+}
+
+
+int
+ece391_fdputs (int fd, const char* s)
+{
+    return ece391_write (fd, s, ece391_strlen (s));
+}
@@ -0,0 +1,19 @@
+/* ece391support.h - string helpers for user programs, there's no libc
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391SUPPORT_H
+#define ECE391SUPPORT_H
+
+extern unsigned int ece391_strlen (const char* s);
+extern int ece391_strcmp (const char* s1, const char* s2);
+extern int ece391_strncmp (const char* s1, const char* s2, unsigned int n);
+extern void ece391_strcpy (char* dst, const char* src);
+
+/* value in radix (2 to 16) into buf, which needs room for 33 bytes. returns buf */
+extern char* ece391_itoa (unsigned int value, char* buf, int radix);
+
+/* write a string to an fd, returns what write did */
+extern int ece391_fdputs (int fd, const char* s);
+
+#endif /* ECE391SUPPORT_H */
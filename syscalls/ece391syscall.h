@@ -0,0 +1,20 @@
+/* ece391syscall.h - the original system calls. the later ones are declared in the header for
+ * their subsystem (ece391malloc.h, ece391shm.h, ece391pipe.h, ...)
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391SYSCALL_H
+#define ECE391SYSCALL_H
+
+extern int ece391_halt (unsigned char status);
+extern int ece391_execute (const char* command);
+extern int ece391_read (int fd, void* buf, int nbytes);
+extern int ece391_write (int fd, const void* buf, int nbytes);
+extern int ece391_open (const char* filename);
+extern int ece391_close (int fd);
+extern int ece391_getargs (char* buf, int nbytes);
+extern int ece391_vidmap (unsigned char** screen_start);
+extern int ece391_set_handler (int signum, void* handler);
+extern int ece391_sigreturn (void);
+
+#endif /* ECE391SYSCALL_H */
@@ -0,0 +1,35 @@
+/* ece391sysnum.h - system call numbers
+ * vim:ts=4 noexpandtab
+ */
+
+#ifndef ECE391SYSNUM_H
+#define ECE391SYSNUM_H
+
+/* the number goes in EAX. these must match the order of jump_table in the kernel's
+   syscall_handler.S */
+#define SYS_HALT            1
+#define SYS_EXECUTE         2
+#define SYS_READ            3
+#define SYS_WRITE           4
+#define SYS_OPEN            5
+#define SYS_CLOSE           6
+#define SYS_GETARGS         7
+#define SYS_VIDMAP          8
+#define SYS_SET_HANDLER     9
+#define SYS_SIGRETURN       10
+#define SYS_BRK             11
+#define SYS_SBRK            12
+#define SYS_SHMGET          13
+#define SYS_SHMAT           14
+#define SYS_SHMDT           15
+#define SYS_PIPE            16
+#define SYS_DUP             17
+#define SYS_DUP2            18
+#define SYS_CLOCK_GETTIME   19
+#define SYS_SLEEP           20
+#define SYS_IRQSTAT         21
+#define SYS_PROF_START      22
+#define SYS_PROF_STOP       23
+#define SYS_PROF_DUMP       24
+
+#endif /* ECE391SYSNUM_H */